@@ -0,0 +1,148 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <new>
+
+#include "Benchmark.h"
+#include "MockHost.h"
+
+std::atomic<uint64_t> Benchmark::heap_allocations{0};
+std::atomic<uint64_t> Benchmark::heap_bytes{0};
+
+void *operator new(std::size_t size) {
+    Benchmark::heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    Benchmark::heap_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// Time and counters at a point, differences give what a run spent
+struct Sample {
+    clock::duration time;
+    uint64_t heap_a, heap_b, host_a, host_b;
+
+    static Sample now() {
+        return {clock::now().time_since_epoch(), Benchmark::heap_allocations.load(), Benchmark::heap_bytes.load(),
+                MockMemoryManager::allocations.load(), MockMemoryManager::allocated_bytes.load()};
+    }
+
+    Sample operator-(const Sample &other) const {
+        return {time - other.time, heap_a - other.heap_a, heap_b - other.heap_b,
+                host_a - other.host_a, host_b - other.host_b};
+    }
+
+    Sample operator+(const Sample &other) const {
+        return {time + other.time, heap_a + other.heap_a, heap_b + other.heap_b,
+                host_a + other.host_a, host_b + other.host_b};
+    }
+};
+
+// Spent between pause and resume during the current run
+Sample excluded{};
+Sample paused_at{};
+bool paused = false;
+
+}
+
+void Benchmark::pause() {
+    if (!paused) {
+        paused_at = Sample::now();
+        paused = true;
+    }
+}
+
+void Benchmark::resume() {
+    if (paused) {
+        excluded = excluded + (Sample::now() - paused_at);
+        paused = false;
+    }
+}
+
+Benchmark::Registrar::Registrar(const std::string &name, Body body) {
+    cases().push_back({name, std::move(body)});
+}
+
+std::vector<Benchmark::Case> &Benchmark::cases() {
+    static std::vector<Case> result;
+    return result;
+}
+
+int Benchmark::run(const std::string &filter) {
+    constexpr auto min_time = std::chrono::milliseconds(200);
+
+    std::printf("%-40s %14s %12s %12s %12s %12s\n",
+                "benchmark", "ns/op", "allocs/op", "bytes/op", "host allocs", "host bytes");
+
+    int failed = 0;
+    for (auto &c : cases()) {
+        if (c.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        try {
+            // Warm up and calibrate until a run takes long enough to be measurable
+            size_t iterations = 1;
+            Sample spent{};
+            while (true) {
+                excluded = {};
+                paused = false;
+                auto start = Sample::now();
+
+                c.body(iterations);
+
+                resume();
+                spent = Sample::now() - start - excluded;
+
+                if (spent.time >= min_time || iterations >= (size_t(1) << 30)) {
+                    break;
+                }
+                iterations *= spent.time * 10 < min_time ? 10 : 2;
+            }
+
+            auto n = static_cast<double>(iterations);
+            std::printf("%-40s %14.1f %12.2f %12.1f %12.2f %12.1f\n", c.name.c_str(),
+                        std::chrono::duration<double, std::nano>(spent.time).count() / n,
+                        spent.heap_a / n, spent.heap_b / n, spent.host_a / n, spent.host_b / n);
+        } catch (const std::exception &e) {
+            std::printf("%-40s failed: %s\n", c.name.c_str(), e.what());
+            ++failed;
+        }
+        std::fflush(stdout);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
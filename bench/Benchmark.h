@@ -0,0 +1,66 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Minimal benchmark runner. Each case runs its body for the requested
+// number of iterations, the runner calibrates the count and reports
+// time, heap and host memory manager traffic per iteration.
+class Benchmark {
+public:
+    using Body = std::function<void(size_t iterations)>;
+
+    struct Registrar {
+        Registrar(const std::string &name, Body body);
+    };
+
+    static int run(const std::string &filter);
+
+    // Leave setup inside a body, e.g. building inputs, out of the measurement
+    static void pause();
+    static void resume();
+
+    // Counted by replaced global operator new
+    static std::atomic<uint64_t> heap_allocations;
+    static std::atomic<uint64_t> heap_bytes;
+
+private:
+    struct Case {
+        std::string name;
+        Body body;
+    };
+
+    static std::vector<Case> &cases();
+};
+
+#define BENCHMARK_CONCAT_IMPL(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_IMPL(a, b)
+
+// BENCHMARK("Group/name", [](size_t n) { for (size_t i = 0; i < n; ++i) {...} });
+#define BENCHMARK(name, ...) \
+    static Benchmark::Registrar BENCHMARK_CONCAT(benchmark_registrar_, __LINE__)(name, __VA_ARGS__)
+
+#endif //BENCHMARK_H
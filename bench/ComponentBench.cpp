@@ -0,0 +1,477 @@
+﻿/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Benchmark.h"
+#include "MockHost.h"
+
+// Cases drive the Sample class through the same interface the platform uses
+
+namespace {
+
+MockHost &host() {
+    static MockHost instance;
+    return instance;
+}
+
+const size_t payload_sizes[] = {16, 256, 4096, 65536, 1048576};
+
+void check(bool success) {
+    if (!success) {
+        throw std::runtime_error("call failed");
+    }
+}
+
+void findMethod(size_t n, const std::u16string &name) {
+    auto &c = host().component();
+    for (size_t i = 0; i < n; ++i) {
+        c.FindMethod(reinterpret_cast<const WCHAR_T *>(name.c_str()));
+    }
+}
+
+// Instance lifetime as the platform drives it, without Init
+void createObject(size_t n, const std::u16string &name) {
+    for (size_t i = 0; i < n; ++i) {
+        IComponentBase *instance = nullptr;
+        if (GetClassObject(reinterpret_cast<const WCHAR_T *>(name.c_str()), &instance)) {
+            DestroyObject(&instance);
+        }
+    }
+}
+
+BENCHMARK("GetClassObject/Sample", [](size_t n) { createObject(n, u"Sample"); });
+BENCHMARK("GetClassObject/missing", [](size_t n) { createObject(n, u"NoSuchClass"); });
+
+// Path of a new segment of the component
+std::u16string createSegment(size_t size) {
+    tVariant result = makeVariant();
+    tVariant params[] = {makeVariant(static_cast<int64_t>(size))};
+    check(host().component().CallAsFunc(host().method(u"CreateSegment"), &result, params, 1));
+    std::u16string path(reinterpret_cast<const char16_t *>(result.pwstrVal), result.wstrLen);
+    host().clear(result);
+    return path;
+}
+
+void releaseSegment(const std::u16string &path) {
+    tVariant params[] = {makeVariant(path)};
+    check(host().component().CallAsProc(host().method(u"ReleaseSegment"), params, 1));
+}
+
+// CSV-like rows, compressible as typical payloads are
+std::vector<char> tabularPayload(size_t size) {
+    std::string rows;
+    for (size_t i = 0; rows.size() < size; ++i) {
+        rows += std::to_string(i) + ";Товар " + std::to_string(i * 7919 % 977) + ";" + std::to_string(i * 31 % 10000)
+                + ".00;Склад " + std::to_string(i % 13) + "\n";
+    }
+    return std::vector<char>(rows.begin(), rows.begin() + static_cast<std::ptrdiff_t>(size));
+}
+
+std::vector<char> compressed(const std::vector<char> &data) {
+    tVariant result = makeVariant();
+    tVariant params[] = {makeVariant(data), makeVariant(false)};
+    check(host().component().CallAsFunc(host().method(u"Compress"), &result, params, 2));
+    std::vector<char> frame(result.pstrVal, result.pstrVal + result.strLen);
+    host().clear(result);
+    return frame;
+}
+
+BENCHMARK("FindMethod/first", [](size_t n) { findMethod(n, u"ResetStatistics"); });
+BENCHMARK("FindMethod/Add", [](size_t n) { findMethod(n, u"Add"); });
+BENCHMARK("FindMethod/Сложить", [](size_t n) { findMethod(n, u"Сложить"); });
+BENCHMARK("FindMethod/missing", [](size_t n) { findMethod(n, u"NoSuchMethod"); });
+
+BENCHMARK("CallAsFunc/Add/int", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"Add");
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(int32_t(1)), makeVariant(int32_t(2))};
+        tVariant result = makeVariant();
+        check(c.CallAsFunc(method, &result, params, 2));
+        host().clear(result);
+    }
+});
+
+// 64-bit integers stay I8 on the way in and out
+BENCHMARK("CallAsFunc/Add/int64", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"Add");
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(int64_t(1) << 40), makeVariant(int64_t(2))};
+        tVariant result = makeVariant();
+        check(c.CallAsFunc(method, &result, params, 2));
+        host().clear(result);
+    }
+});
+
+// Failing calls: unsupported types returned as an error and a parameter
+// that does not match the typed handler signature
+BENCHMARK("CallAsFunc/Add/error", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"Add");
+    std::u16string text = u"text";
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(int32_t(1)), makeVariant(text)};
+        tVariant result = makeVariant();
+        if (c.CallAsFunc(method, &result, params, 2)) {
+            throw std::runtime_error("call succeeded");
+        }
+        host().clear(result);
+    }
+});
+
+BENCHMARK("CallAsProc/Sleep/mismatch", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"Sleep");
+    std::u16string text = u"text";
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(text)};
+        if (c.CallAsProc(method, params, 1)) {
+            throw std::runtime_error("call succeeded");
+        }
+    }
+});
+
+// Typed parameter given as a number and as a string to be parsed, Sleep(0) returns at once
+BENCHMARK("CallAsProc/Sleep/int", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"Sleep");
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(int32_t(0))};
+        check(c.CallAsProc(method, params, 1));
+    }
+});
+
+BENCHMARK("CallAsProc/Sleep/string", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"Sleep");
+    std::u16string text = u"0";
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(text)};
+        check(c.CallAsProc(method, params, 1));
+    }
+});
+
+BENCHMARK("GetPropVal/Version", [](size_t n) {
+    auto &c = host().component();
+    auto prop = host().property(u"Version");
+    for (size_t i = 0; i < n; ++i) {
+        tVariant result = makeVariant();
+        check(c.GetPropVal(prop, &result));
+        host().clear(result);
+    }
+});
+
+BENCHMARK("GetPropVal/SampleProperty/int", [](size_t n) {
+    auto &c = host().component();
+    auto prop = host().property(u"SampleProperty");
+    tVariant value = makeVariant(int32_t{42});
+    check(c.SetPropVal(prop, &value));
+    for (size_t i = 0; i < n; ++i) {
+        tVariant result = makeVariant();
+        check(c.GetPropVal(prop, &result));
+        host().clear(result);
+    }
+});
+
+// Reads while another thread keeps publishing new values.
+// Allocation counters include the writer.
+BENCHMARK("GetPropVal/SampleProperty/contended", [](size_t n) {
+    auto &c = host().component();
+    auto prop = host().property(u"SampleProperty");
+    std::atomic<bool> done{false};
+    std::thread writer([&]() {
+        for (int32_t i = 0; !done.load(std::memory_order_relaxed); ++i) {
+            tVariant value = makeVariant(i);
+            check(c.SetPropVal(prop, &value));
+        }
+    });
+    for (size_t i = 0; i < n; ++i) {
+        tVariant result = makeVariant();
+        check(c.GetPropVal(prop, &result));
+        host().clear(result);
+    }
+    done = true;
+    writer.join();
+});
+
+BENCHMARK("PropVal/date", [](size_t n) {
+    auto &c = host().component();
+    auto prop = host().property(u"SampleProperty");
+    std::tm date{};
+    date.tm_year = 120;
+    date.tm_mday = 1;
+    for (size_t i = 0; i < n; ++i) {
+        tVariant value = makeVariant(date);
+        check(c.SetPropVal(prop, &value));
+        tVariant result = makeVariant();
+        check(c.GetPropVal(prop, &result));
+        host().clear(result);
+    }
+});
+
+BENCHMARK("PropVal/uint64", [](size_t n) {
+    auto &c = host().component();
+    auto prop = host().property(u"SampleProperty");
+    for (size_t i = 0; i < n; ++i) {
+        tVariant value = makeVariant(std::numeric_limits<uint64_t>::max());
+        check(c.SetPropVal(prop, &value));
+        tVariant result = makeVariant();
+        check(c.GetPropVal(prop, &result));
+        host().clear(result);
+    }
+});
+
+BENCHMARK("CallAsFunc/CurrentDate", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"CurrentDate");
+    for (size_t i = 0; i < n; ++i) {
+        tVariant result = makeVariant();
+        check(c.CallAsFunc(method, &result, nullptr, 0));
+        host().clear(result);
+    }
+});
+
+BENCHMARK("CallAsProc/Message/date", [](size_t n) {
+    auto &c = host().component();
+    auto method = host().method(u"Message");
+    std::tm date{};
+    date.tm_year = 124;
+    date.tm_mon = 1;
+    date.tm_mday = 29;
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(date)};
+        check(c.CallAsProc(method, params, 1));
+    }
+});
+
+const bool sized_cases = []() {
+    for (auto size : payload_sizes) {
+        auto suffix = "/" + std::to_string(size);
+
+        Benchmark::Registrar("CallAsFunc/Add/string" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto method = host().method(u"Add");
+            Benchmark::pause();
+            std::u16string payload(size / 2, u'ж');
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(payload), makeVariant(payload)};
+                tVariant result = makeVariant();
+                check(c.CallAsFunc(method, &result, params, 2));
+                host().clear(result);
+            }
+        });
+
+        Benchmark::Registrar("PropVal/blob" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto prop = host().property(u"SampleProperty");
+            Benchmark::pause();
+            std::vector<char> payload(size, '\x5a');
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant value = makeVariant(payload);
+                check(c.SetPropVal(prop, &value));
+                tVariant result = makeVariant();
+                check(c.GetPropVal(prop, &result));
+                host().clear(result);
+            }
+        });
+
+        // Compare with PropVal/blob and Segment/memcpy: only paths cross the boundary
+        Benchmark::Registrar("Segment/CopySegment" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            Benchmark::pause();
+            auto source = createSegment(size);
+            auto target = createSegment(size);
+            Benchmark::resume();
+            auto method = host().method(u"CopySegment");
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(source), makeVariant(int64_t{0}), makeVariant(target),
+                                     makeVariant(int64_t{0}), makeVariant(static_cast<int64_t>(size))};
+                check(c.CallAsProc(method, params, 5));
+            }
+            Benchmark::pause();
+            releaseSegment(source);
+            releaseSegment(target);
+            Benchmark::resume();
+        });
+
+        Benchmark::Registrar("Segment/memcpy" + suffix, [size](size_t n) {
+            Benchmark::pause();
+            std::vector<char> source(size, '\x5a'), target(size);
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                memcpy(target.data(), source.data(), size);
+            }
+        });
+
+        // Size is of the binary data, text crosses the boundary as UTF-16
+        Benchmark::Registrar("Codec/Base64Encode" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto method = host().method(u"Base64Encode");
+            Benchmark::pause();
+            std::vector<char> payload(size, '\x5a');
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(payload), makeVariant(false)};
+                tVariant result = makeVariant();
+                check(c.CallAsFunc(method, &result, params, 2));
+                host().clear(result);
+            }
+        });
+
+        Benchmark::Registrar("Codec/Base64Decode" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto method = host().method(u"Base64Decode");
+            Benchmark::pause();
+            std::u16string text(size / 3 * 4, u'W');
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(text), makeVariant(false)};
+                tVariant result = makeVariant();
+                check(c.CallAsFunc(method, &result, params, 2));
+                host().clear(result);
+            }
+        });
+
+        Benchmark::Registrar("Codec/HexEncode" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto method = host().method(u"HexEncode");
+            Benchmark::pause();
+            std::vector<char> payload(size, '\x5a');
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(payload)};
+                tVariant result = makeVariant();
+                check(c.CallAsFunc(method, &result, params, 1));
+                host().clear(result);
+            }
+        });
+
+        Benchmark::Registrar("Codec/HexDecode" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto method = host().method(u"HexDecode");
+            Benchmark::pause();
+            std::u16string text(size * 2, u'A');
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(text)};
+                tVariant result = makeVariant();
+                check(c.CallAsFunc(method, &result, params, 1));
+                host().clear(result);
+            }
+        });
+
+        for (std::u16string algorithm : {u"CRC32C", u"XXH3", u"XXH128", u"SHA256"}) {
+            std::string name(algorithm.begin(), algorithm.end());
+            Benchmark::Registrar("Hash/" + name + suffix, [size, algorithm](size_t n) {
+                auto &c = host().component();
+                auto method = host().method(u"Hash");
+                Benchmark::pause();
+                std::vector<char> payload(size, '\x5a');
+                Benchmark::resume();
+                for (size_t i = 0; i < n; ++i) {
+                    tVariant params[] = {makeVariant(payload), makeVariant(algorithm)};
+                    tVariant result = makeVariant();
+                    check(c.CallAsFunc(method, &result, params, 2));
+                    host().clear(result);
+                }
+            });
+        }
+
+        for (auto high_ratio : {false, true}) {
+            Benchmark::Registrar(std::string("Compress/") + (high_ratio ? "high" : "fast") + suffix,
+                                 [size, high_ratio](size_t n) {
+                auto &c = host().component();
+                auto method = host().method(u"Compress");
+                Benchmark::pause();
+                auto payload = tabularPayload(size);
+                Benchmark::resume();
+                for (size_t i = 0; i < n; ++i) {
+                    tVariant params[] = {makeVariant(payload), makeVariant(high_ratio)};
+                    tVariant result = makeVariant();
+                    check(c.CallAsFunc(method, &result, params, 2));
+                    host().clear(result);
+                }
+            });
+        }
+
+        Benchmark::Registrar("Decompress" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto method = host().method(u"Decompress");
+            Benchmark::pause();
+            auto frame = compressed(tabularPayload(size));
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(frame)};
+                tVariant result = makeVariant();
+                check(c.CallAsFunc(method, &result, params, 1));
+                host().clear(result);
+            }
+        });
+
+        // Compare with PropVal/blob: an unchanged value is not copied to the host
+        Benchmark::Registrar("GetIfChanged/blob/unchanged" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto prop = host().property(u"SampleProperty");
+            Benchmark::pause();
+            std::vector<char> payload(size, '\x5a');
+            tVariant value = makeVariant(payload);
+            check(c.SetPropVal(prop, &value));
+
+            std::u16string name = u"SampleProperty";
+            tVariant version = makeVariant();
+            tVariant version_params[] = {makeVariant(name)};
+            check(c.CallAsFunc(host().method(u"PropertyVersion"), &version, version_params, 1));
+            Benchmark::resume();
+
+            auto method = host().method(u"GetIfChanged");
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(name), makeVariant(version.dblVal)};
+                tVariant result = makeVariant();
+                check(c.CallAsFunc(method, &result, params, 2));
+                host().clear(result);
+            }
+        });
+
+        Benchmark::Registrar("ExternalEvent" + suffix, [size](size_t n) {
+            auto &c = host().component();
+            auto method = host().method(u"Notify");
+            std::u16string message = u"message";
+            Benchmark::pause();
+            std::u16string data(size, u'd');
+            Benchmark::resume();
+            for (size_t i = 0; i < n; ++i) {
+                tVariant params[] = {makeVariant(message), makeVariant(data)};
+                check(c.CallAsProc(method, params, 2));
+            }
+        });
+    }
+    return true;
+}();
+
+}
@@ -0,0 +1,111 @@
+﻿/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <ctime>
+#include <iomanip>
+#include <locale>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "Benchmark.h"
+#include "DateTime.h"
+
+// DateFormat compared with what SampleAddIn::message used to do per call:
+// a named locale, a string stream and put_time. The C.UTF-8 locale stands in
+// for ru_RU.utf8, which is often not installed.
+
+namespace {
+
+const Timestamp sample_date(CivilDate{2024, 2, 29}, 13, 5, 9);
+
+void check(bool success) {
+    if (!success) {
+        throw std::runtime_error("unexpected result");
+    }
+}
+
+BENCHMARK("DateTime/format/DateFormat", [](size_t n) {
+    static const DateFormat format(u8"%a %d %b %Y %H:%M:%S");
+    std::string out;
+    for (size_t i = 0; i < n; ++i) {
+        out.clear();
+        format.format(Timestamp(sample_date.seconds() + static_cast<int64_t>(i)), out);
+    }
+    check(!out.empty());
+});
+
+BENCHMARK("DateTime/format/put_time", [](size_t n) {
+    std::string out;
+    for (size_t i = 0; i < n; ++i) {
+        std::tm tm = Timestamp(sample_date.seconds() + static_cast<int64_t>(i));
+        std::ostringstream oss;
+        oss.imbue(std::locale("C.UTF-8"));
+        oss << std::put_time(&tm, "%c");
+        out = oss.str();
+    }
+    check(!out.empty());
+});
+
+BENCHMARK("DateTime/parse/DateFormat", [](size_t n) {
+    static const DateFormat format("%Y-%m-%d %H:%M:%S");
+    Timestamp value;
+    for (size_t i = 0; i < n; ++i) {
+        check(format.parse("2024-02-29 13:05:09", value));
+    }
+    check(value == sample_date);
+});
+
+BENCHMARK("DateTime/parse/get_time", [](size_t n) {
+    std::tm tm{};
+    for (size_t i = 0; i < n; ++i) {
+        std::istringstream iss("2024-02-29 13:05:09");
+        iss.imbue(std::locale("C.UTF-8"));
+        iss >> std::get_time(&tm, "%Y-%m-%d %H:%M:%S");
+        check(!iss.fail());
+    }
+    check(Timestamp(tm) == sample_date);
+});
+
+BENCHMARK("DateTime/tm/roundtrip", [](size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        std::tm tm = Timestamp(sample_date.seconds() + static_cast<int64_t>(i) * Timestamp::SECONDS_PER_DAY);
+        sum += Timestamp(tm).seconds();
+    }
+    check(sum != 0);
+});
+
+BENCHMARK("DateTime/tm/timegm", [](size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        time_t t = static_cast<time_t>(sample_date.seconds() + static_cast<int64_t>(i) * Timestamp::SECONDS_PER_DAY);
+        std::tm tm{};
+#ifdef _WINDOWS
+        gmtime_s(&tm, &t);
+        sum += _mkgmtime(&tm);
+#else
+        gmtime_r(&t, &tm);
+        sum += timegm(&tm);
+#endif
+    }
+    check(sum != 0);
+});
+
+}
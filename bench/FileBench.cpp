@@ -0,0 +1,263 @@
+﻿/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+#include "MockHost.h"
+
+// File methods of the component against standard streams. Lines are
+// 100 bytes of mixed Latin and Cyrillic text, CSV rows have 6 columns
+// with one quoted field. Files are reopened at their end.
+// They are kept in the temporary directory and removed at exit.
+
+namespace {
+
+// TMPDIR or /tmp, GetTempPath on Windows, as for shared memory segments
+struct TempFile {
+    explicit TempFile(const char *name) : path(std::filesystem::temp_directory_path() / name) {}
+
+    ~TempFile() {
+        std::error_code ignored;
+        std::filesystem::remove(path, ignored);
+    }
+
+    std::u16string name() const { return path.u16string(); }
+
+    const std::filesystem::path path;
+};
+
+const TempFile LINES_FILE("addin-bench-lines.txt");
+const TempFile OUTPUT_FILE("addin-bench-output.txt");
+const TempFile CSV_FILE("addin-bench-rows.csv");
+const size_t LINES_COUNT = 100000;
+const size_t CSV_COLUMNS = 6;
+
+MockHost &host() {
+    static MockHost instance;
+    return instance;
+}
+
+void check(bool success) {
+    if (!success) {
+        throw std::runtime_error("call failed");
+    }
+}
+
+// 5 x 18 bytes plus 6 digits
+const std::string &sampleLine() {
+    static const std::string line = [] {
+        std::string result;
+        for (int i = 0; i < 5; ++i) {
+            result += u8"line строка ";
+        }
+        return result + "012345";
+    }();
+    return line;
+}
+
+void writeLines() {
+    static bool written = false;
+    if (!written) {
+        std::ofstream out(LINES_FILE.path, std::ios::binary);
+        for (size_t i = 0; i < LINES_COUNT; ++i) {
+            out << sampleLine() << '\n';
+        }
+        written = true;
+    }
+}
+
+void writeCsv() {
+    static bool written = false;
+    if (!written) {
+        std::ofstream out(CSV_FILE.path, std::ios::binary);
+        for (size_t i = 0; i < LINES_COUNT; ++i) {
+            out << i << u8",\"Иванов, Иван\",2024-01-01,1234.56,warehouse " << i % 10 << ",true\r\n";
+        }
+        written = true;
+    }
+}
+
+int32_t openCsv() {
+    static const std::u16string path = CSV_FILE.name(), delimiter = u",", quote = u"\"";
+    tVariant result = makeVariant();
+    tVariant params[] = {makeVariant(path), makeVariant(delimiter), makeVariant(quote), makeVariant(false)};
+    check(host().component().CallAsFunc(host().method(u"OpenCsv"), &result, params, 4));
+    return result.lVal;
+}
+
+int32_t openReader(const std::u16string &path) {
+    tVariant result = makeVariant();
+    tVariant params[] = {makeVariant(path)};
+    check(host().component().CallAsFunc(host().method(u"OpenFileReader"), &result, params, 1));
+    return result.lVal;
+}
+
+int32_t openWriter(const std::u16string &path) {
+    tVariant result = makeVariant();
+    tVariant params[] = {makeVariant(path), makeVariant(false)};
+    check(host().component().CallAsFunc(host().method(u"OpenFileWriter"), &result, params, 2));
+    return result.lVal;
+}
+
+void closeFile(int32_t handle) {
+    tVariant params[] = {makeVariant(handle)};
+    check(host().component().CallAsProc(host().method(u"CloseFile"), params, 1));
+}
+
+BENCHMARK("File/ReadLine/component", [](size_t n) {
+    Benchmark::pause();
+    writeLines();
+    Benchmark::resume();
+    auto &c = host().component();
+    auto read = host().method(u"ReadLine");
+    auto handle = openReader(LINES_FILE.name());
+    for (size_t i = 0; i < n; ++i) {
+        tVariant result = makeVariant();
+        tVariant params[] = {makeVariant(handle)};
+        check(c.CallAsFunc(read, &result, params, 1));
+        if (result.vt != VTYPE_PWSTR) {
+            closeFile(handle);
+            handle = openReader(LINES_FILE.name());
+        }
+        host().clear(result);
+    }
+    closeFile(handle);
+});
+
+BENCHMARK("File/ReadLine/ifstream", [](size_t n) {
+    Benchmark::pause();
+    writeLines();
+    Benchmark::resume();
+    std::ifstream in(LINES_FILE.path, std::ios::binary);
+    std::string line;
+    for (size_t i = 0; i < n; ++i) {
+        if (!std::getline(in, line)) {
+            in.clear();
+            in.seekg(0);
+        }
+    }
+});
+
+BENCHMARK("File/WriteText/component", [](size_t n) {
+    auto &c = host().component();
+    auto write = host().method(u"WriteText");
+    std::u16string text = u"line строка line строка line строка line строка line строка line строка\n";
+    auto handle = openWriter(OUTPUT_FILE.name());
+    for (size_t i = 0; i < n; ++i) {
+        tVariant params[] = {makeVariant(handle), makeVariant(text)};
+        check(c.CallAsProc(write, params, 2));
+    }
+    closeFile(handle);
+    std::filesystem::remove(OUTPUT_FILE.path);
+});
+
+BENCHMARK("File/WriteText/ofstream", [](size_t n) {
+    std::ofstream out(OUTPUT_FILE.path, std::ios::binary);
+    std::string text = u8"line строка line строка line строка line строка line строка line строка\n";
+    for (size_t i = 0; i < n; ++i) {
+        out << text;
+    }
+    out.close();
+    std::filesystem::remove(OUTPUT_FILE.path);
+});
+
+BENCHMARK("File/CsvRow/component", [](size_t n) {
+    Benchmark::pause();
+    writeCsv();
+    Benchmark::resume();
+    auto &c = host().component();
+    auto next = host().method(u"NextCsvRow");
+    auto field = host().method(u"CsvField");
+    auto handle = openCsv();
+    for (size_t i = 0; i < n; ++i) {
+        tVariant result = makeVariant();
+        tVariant params[] = {makeVariant(handle), makeVariant(int32_t(0))};
+        check(c.CallAsFunc(next, &result, params, 1));
+        if (!result.bVal) {
+            closeFile(handle);
+            handle = openCsv();
+            continue;
+        }
+        for (int32_t column = 0; column < static_cast<int32_t>(CSV_COLUMNS); ++column) {
+            params[1] = makeVariant(column);
+            check(c.CallAsFunc(field, &result, params, 2));
+            host().clear(result);
+        }
+    }
+    closeFile(handle);
+});
+
+BENCHMARK("File/CsvRow/getline", [](size_t n) {
+    Benchmark::pause();
+    writeCsv();
+    Benchmark::resume();
+    std::ifstream in(CSV_FILE.path, std::ios::binary);
+    std::string line;
+    std::vector<std::string> fields;
+    for (size_t i = 0; i < n; ++i) {
+        if (!std::getline(in, line)) {
+            in.clear();
+            in.seekg(0);
+            continue;
+        }
+        // Naive split aware of quotes, as script code usually does it
+        fields.clear();
+        std::string current;
+        bool quoted = false;
+        for (auto ch : line) {
+            if (ch == '"') {
+                quoted = !quoted;
+            } else if (ch == ',' && !quoted) {
+                fields.push_back(std::move(current));
+                current.clear();
+            } else if (ch != '\r') {
+                current += ch;
+            }
+        }
+        fields.push_back(std::move(current));
+    }
+});
+
+// One op is a batch of about 1 MB
+BENCHMARK("File/CsvBatch/component", [](size_t n) {
+    Benchmark::pause();
+    writeCsv();
+    Benchmark::resume();
+    auto &c = host().component();
+    auto read = host().method(u"ReadCsvBatch");
+    auto handle = openCsv();
+    for (size_t i = 0; i < n; ++i) {
+        tVariant result = makeVariant();
+        tVariant params[] = {makeVariant(handle)};
+        check(c.CallAsFunc(read, &result, params, 1));
+        if (result.vt != VTYPE_BLOB) {
+            closeFile(handle);
+            handle = openCsv();
+        }
+        host().clear(result);
+    }
+    closeFile(handle);
+});
+
+}
@@ -0,0 +1,519 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Server-like load generator. Worker threads own a share of component
+// instances and call them according to a weighted call mix.
+//
+// Usage: AddInLoad [--threads N] [--instances N] [--duration S] [--rate N]
+//                  [--churn N] [--alloc-delay NS] [--mix FILE]
+//
+// Mix file lines: <target> <weight> [argument ...]
+//   target   - method name, get:<property> or set:<property>
+//   argument - i (int), r (double), t (bool), d (date),
+//              s:<chars> (string), b:<bytes> (BLOB)
+// '#' starts a comment.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <codecvt>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <locale>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "MockHost.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+const char default_mix[] = R"(
+Add                 40  i i
+Add                 20  s:64 s:64
+get:Version         20
+set:SampleProperty   5  b:65536
+get:SampleProperty   5
+CurrentDate          5
+Notify               5  s:16 s:256
+)";
+
+struct Options {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned instances = 0;
+    double duration = 10;
+    double rate = 0;
+    uint64_t churn = 0;
+    std::chrono::nanoseconds alloc_delay{0};
+    std::string mix;
+};
+
+struct Argument {
+    char type;
+    size_t size;
+};
+
+struct CallSpec {
+    enum Kind {
+        METHOD,
+        GET,
+        SET
+    } kind;
+    std::u16string name;
+    unsigned weight;
+    std::vector<Argument> args;
+};
+
+// Log-linear latency histogram, 16 sub-buckets per power of two
+class Histogram {
+public:
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    void record(uint64_t value) {
+        buckets[index(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void addTo(std::vector<uint64_t> &dst) const {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            dst[i] += buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static double percentile(const std::vector<uint64_t> &counts, double q) {
+        uint64_t total = 0;
+        for (auto c : counts) {
+            total += c;
+        }
+        if (total == 0) {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return static_cast<double>(upper(i));
+            }
+        }
+        return 0;
+    }
+
+private:
+    static size_t index(uint64_t value) {
+        if (value < (1u << SUB_BITS)) {
+            return static_cast<size_t>(value);
+        }
+        unsigned m = 63;
+        while (!(value >> m)) {
+            --m;
+        }
+        return ((m - SUB_BITS + 1) << SUB_BITS) | ((value >> (m - SUB_BITS)) & ((1u << SUB_BITS) - 1));
+    }
+
+    static uint64_t upper(size_t index) {
+        if (index < (1u << SUB_BITS)) {
+            return index;
+        }
+        auto m = (index >> SUB_BITS) + SUB_BITS - 1;
+        auto sub = index & ((1u << SUB_BITS) - 1);
+        return ((((1ull << SUB_BITS) | sub) + 1) << (m - SUB_BITS)) - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+};
+
+struct WorkerStats {
+    Histogram latency;
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> errors{0};
+};
+
+std::u16string toUTF16(const std::string &src) {
+    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> conv;
+    return conv.from_bytes(src);
+}
+
+std::vector<CallSpec> parseMix(std::istream &input) {
+    std::vector<CallSpec> result;
+    std::string line;
+    while (std::getline(input, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream iss(line);
+        std::string target;
+        if (!(iss >> target)) {
+            continue;
+        }
+
+        CallSpec spec{CallSpec::METHOD, {}, 1, {}};
+        if (target.rfind("get:", 0) == 0) {
+            spec.kind = CallSpec::GET;
+            target = target.substr(4);
+        } else if (target.rfind("set:", 0) == 0) {
+            spec.kind = CallSpec::SET;
+            target = target.substr(4);
+        }
+        spec.name = toUTF16(target);
+
+        if (!(iss >> spec.weight)) {
+            throw std::runtime_error("Missing weight for " + target);
+        }
+
+        std::string arg;
+        while (iss >> arg) {
+            auto size = arg.size() > 2 && arg[1] == ':' ? std::stoul(arg.substr(2)) : 0;
+            if (std::string("irtdsb").find(arg[0]) == std::string::npos) {
+                throw std::runtime_error("Unknown argument type " + arg);
+            }
+            spec.args.push_back({arg[0], size});
+        }
+
+        if (spec.kind == CallSpec::SET && spec.args.size() != 1) {
+            throw std::runtime_error("Property setter needs exactly one argument: " + target);
+        }
+
+        result.push_back(std::move(spec));
+    }
+
+    if (result.empty()) {
+        throw std::runtime_error("Call mix is empty");
+    }
+    return result;
+}
+
+double residentMegabytes() {
+#ifdef _WINDOWS
+    PROCESS_MEMORY_COUNTERS counters{};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize / 1048576.0;
+#elif defined(__linux__)
+    long pages = 0, resident = 0;
+    if (auto f = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(f);
+    }
+    return resident * static_cast<double>(sysconf(_SC_PAGESIZE)) / 1048576.0;
+#else
+    // Peak value only
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1048576.0;
+#endif
+}
+
+// Argument payloads are built once per worker and referenced by every call
+class PreparedCall {
+public:
+    explicit PreparedCall(const CallSpec &spec) {
+        for (auto &arg : spec.args) {
+            switch (arg.type) {
+                case 's':
+                    strings.emplace_back(arg.size, u'x');
+                    break;
+                case 'b':
+                    blobs.emplace_back(arg.size, '\x5a');
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        size_t s = 0, b = 0;
+        for (auto &arg : spec.args) {
+            switch (arg.type) {
+                case 'i':
+                    params.push_back(makeVariant(int32_t(42)));
+                    break;
+                case 'r':
+                    params.push_back(makeVariant(3.14));
+                    break;
+                case 't':
+                    params.push_back(makeVariant(true));
+                    break;
+                case 'd': {
+                    std::tm date{};
+                    date.tm_year = 120;
+                    date.tm_mday = 1;
+                    params.push_back(makeVariant(date));
+                    break;
+                }
+                case 's':
+                    params.push_back(makeVariant(strings[s++]));
+                    break;
+                case 'b':
+                    params.push_back(makeVariant(blobs[b++]));
+                    break;
+            }
+        }
+    }
+
+    // Handlers may not modify input parameters, still give them a fresh copy
+    std::vector<tVariant> &arguments() {
+        scratch = params;
+        return scratch;
+    }
+
+private:
+    std::vector<std::u16string> strings;
+    std::vector<std::vector<char>> blobs;
+    std::vector<tVariant> params;
+    std::vector<tVariant> scratch;
+};
+
+struct Instance {
+    std::unique_ptr<MockHost> host;
+    std::vector<long> ids;
+    uint64_t calls = 0;
+};
+
+void open(Instance &instance, const std::vector<CallSpec> &mix, const Options &options) {
+    instance.host.reset();
+    instance.host = std::make_unique<MockHost>(u"Sample", options.alloc_delay);
+    instance.ids.clear();
+    for (auto &spec : mix) {
+        instance.ids.push_back(spec.kind == CallSpec::METHOD
+                               ? instance.host->method(spec.name)
+                               : instance.host->property(spec.name));
+    }
+    instance.calls = 0;
+}
+
+void worker(unsigned index, const Options &options, const std::vector<CallSpec> &mix,
+            WorkerStats &stats, const std::atomic<bool> &stop) {
+
+    std::vector<Instance> instances((options.instances + options.threads - 1 - index) / options.threads);
+    if (instances.empty()) {
+        return;
+    }
+    for (auto &instance : instances) {
+        open(instance, mix, options);
+    }
+
+    std::vector<PreparedCall> prepared;
+    std::vector<unsigned> thresholds;
+    unsigned total_weight = 0;
+    for (auto &spec : mix) {
+        prepared.emplace_back(spec);
+        total_weight += spec.weight;
+        thresholds.push_back(total_weight);
+    }
+
+    std::mt19937 random(index);
+    std::uniform_int_distribution<unsigned> pick(0, total_weight - 1);
+    auto period = options.rate > 0
+                  ? std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(1.0 / options.rate))
+                  : clock_type::duration::zero();
+    auto next = clock_type::now();
+    size_t current = 0;
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        auto roll = pick(random);
+        size_t n = 0;
+        while (thresholds[n] <= roll) {
+            ++n;
+        }
+
+        auto &instance = instances[current];
+        current = (current + 1) % instances.size();
+        auto &component = instance.host->component();
+        auto &args = prepared[n].arguments();
+        auto id = instance.ids[n];
+
+        auto start = clock_type::now();
+        bool success;
+        switch (mix[n].kind) {
+            case CallSpec::GET: {
+                tVariant result = makeVariant();
+                success = component.GetPropVal(id, &result);
+                instance.host->clear(result);
+                break;
+            }
+            case CallSpec::SET:
+                success = component.SetPropVal(id, args.data());
+                break;
+            default:
+                if (component.HasRetVal(id)) {
+                    tVariant result = makeVariant();
+                    success = component.CallAsFunc(id, &result, args.data(), static_cast<long>(args.size()));
+                    instance.host->clear(result);
+                } else {
+                    success = component.CallAsProc(id, args.data(), static_cast<long>(args.size()));
+                }
+        }
+        auto elapsed = clock_type::now() - start;
+
+        stats.latency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        stats.calls.fetch_add(1, std::memory_order_relaxed);
+        if (!success) {
+            stats.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (options.churn && ++instance.calls >= options.churn) {
+            open(instance, mix, options);
+        }
+
+        if (period.count() > 0) {
+            next += period;
+            std::this_thread::sleep_until(next);
+        }
+    }
+}
+
+Options parseOptions(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for " + key);
+        }
+        std::string value = argv[++i];
+        if (key == "--threads") {
+            options.threads = std::max(1u, static_cast<unsigned>(std::stoul(value)));
+        } else if (key == "--instances") {
+            options.instances = static_cast<unsigned>(std::stoul(value));
+        } else if (key == "--duration") {
+            options.duration = std::stod(value);
+        } else if (key == "--rate") {
+            options.rate = std::stod(value);
+        } else if (key == "--churn") {
+            options.churn = std::stoull(value);
+        } else if (key == "--alloc-delay") {
+            options.alloc_delay = std::chrono::nanoseconds(std::stoll(value));
+        } else if (key == "--mix") {
+            options.mix = value;
+        } else {
+            throw std::runtime_error("Unknown option " + key);
+        }
+    }
+    options.instances = std::max(options.instances, options.threads);
+    return options;
+}
+
+void printRow(double time, double throughput, const std::vector<uint64_t> &counts) {
+    std::printf("%8.1f %12.0f %10.2f %10.2f %10.2f %10.1f\n", time, throughput,
+                Histogram::percentile(counts, 0.5) / 1000,
+                Histogram::percentile(counts, 0.99) / 1000,
+                Histogram::percentile(counts, 0.999) / 1000,
+                residentMegabytes());
+    std::fflush(stdout);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        auto options = parseOptions(argc, argv);
+
+        std::vector<CallSpec> mix;
+        if (options.mix.empty()) {
+            std::istringstream input(default_mix);
+            mix = parseMix(input);
+        } else {
+            std::ifstream input(options.mix);
+            if (!input) {
+                throw std::runtime_error("Can't open " + options.mix);
+            }
+            mix = parseMix(input);
+        }
+
+        std::printf("threads %u, instances %u, rate %s, churn %llu, alloc delay %lld ns\n",
+                    options.threads, options.instances,
+                    options.rate > 0 ? std::to_string(options.rate).c_str() : "unlimited",
+                    static_cast<unsigned long long>(options.churn),
+                    static_cast<long long>(options.alloc_delay.count()));
+        std::printf("%8s %12s %10s %10s %10s %10s\n", "time s", "calls/s", "p50 us", "p99 us", "p999 us", "RSS MB");
+
+        std::atomic<bool> stop{false};
+        std::vector<std::unique_ptr<WorkerStats>> stats;
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < options.threads; ++i) {
+            stats.push_back(std::make_unique<WorkerStats>());
+            threads.emplace_back(worker, i, std::cref(options), std::cref(mix), std::ref(*stats.back()),
+                                 std::cref(stop));
+        }
+
+        auto start = clock_type::now();
+        auto deadline = start + std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double>(options.duration));
+        std::vector<uint64_t> previous(Histogram::BUCKETS);
+        uint64_t previous_calls = 0;
+        auto previous_time = start;
+
+        while (clock_type::now() < deadline) {
+            std::this_thread::sleep_until(std::min(deadline, previous_time + std::chrono::seconds(1)));
+
+            std::vector<uint64_t> counts(Histogram::BUCKETS);
+            uint64_t calls = 0;
+            for (auto &s : stats) {
+                s->latency.addTo(counts);
+                calls += s->calls.load(std::memory_order_relaxed);
+            }
+
+            auto now = clock_type::now();
+            std::vector<uint64_t> interval(Histogram::BUCKETS);
+            for (size_t i = 0; i < Histogram::BUCKETS; ++i) {
+                interval[i] = counts[i] - previous[i];
+            }
+            auto seconds = std::chrono::duration<double>(now - previous_time).count();
+            printRow(std::chrono::duration<double>(now - start).count(), (calls - previous_calls) / seconds, interval);
+
+            previous = std::move(counts);
+            previous_calls = calls;
+            previous_time = now;
+        }
+
+        stop = true;
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        uint64_t errors = 0;
+        for (auto &s : stats) {
+            errors += s->errors.load();
+        }
+        auto total = std::chrono::duration<double>(previous_time - start).count();
+        std::printf("total %llu calls, %llu errors\n", static_cast<unsigned long long>(previous_calls),
+                    static_cast<unsigned long long>(errors));
+        printRow(total, previous_calls / total, previous);
+
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
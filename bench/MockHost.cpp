@@ -0,0 +1,199 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdlib>
+#include <stdexcept>
+
+#include "MockHost.h"
+
+std::atomic<uint64_t> MockMemoryManager::allocations{0};
+std::atomic<uint64_t> MockMemoryManager::allocated_bytes{0};
+
+bool MockMemoryManager::AllocMemory(void **memory, unsigned long size) {
+    if (delay.count() > 0) {
+        auto until = std::chrono::steady_clock::now() + delay;
+        while (std::chrono::steady_clock::now() < until) {}
+    }
+
+    *memory = std::malloc(size);
+    if (!*memory) {
+        return false;
+    }
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    return true;
+}
+
+void MockMemoryManager::FreeMemory(void **memory) {
+    std::free(*memory);
+    *memory = nullptr;
+}
+
+bool MockConnection::AddError(unsigned short /*code*/, const WCHAR_T * /*source*/, const WCHAR_T * /*descr*/,
+                              long /*scode*/) {
+    errors.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool MockConnection::Read(WCHAR_T * /*prop_name*/, tVariant * /*value*/, long * /*error_code*/,
+                          WCHAR_T ** /*error_descr*/) {
+    return false;
+}
+
+bool MockConnection::Write(WCHAR_T * /*prop_name*/, tVariant * /*value*/) {
+    return false;
+}
+
+bool MockConnection::RegisterProfileAs(WCHAR_T * /*profile_name*/) {
+    return false;
+}
+
+bool MockConnection::SetEventBufferDepth(long depth) {
+    event_buffer_depth = depth;
+    return true;
+}
+
+long MockConnection::GetEventBufferDepth() {
+    return event_buffer_depth;
+}
+
+bool MockConnection::ExternalEvent(WCHAR_T * /*source*/, WCHAR_T * /*message*/, WCHAR_T * /*data*/) {
+    events.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void MockConnection::CleanEventBuffer() {}
+
+bool MockConnection::SetStatusLine(WCHAR_T * /*status_line*/) {
+    return true;
+}
+
+void MockConnection::ResetStatusLine() {}
+
+MockHost::MockHost(const std::u16string &class_name, std::chrono::nanoseconds alloc_delay) {
+    memory_manager.delay = alloc_delay;
+
+    if (!GetClassObject(reinterpret_cast<const WCHAR_T *>(class_name.c_str()), &instance)) {
+        throw std::runtime_error("GetClassObject failed");
+    }
+
+    instance->setMemManager(&memory_manager);
+    instance->Init(&connection);
+}
+
+MockHost::~MockHost() {
+    instance->Done();
+    DestroyObject(&instance);
+}
+
+long MockHost::method(const std::u16string &name) {
+    auto result = instance->FindMethod(reinterpret_cast<const WCHAR_T *>(name.c_str()));
+    if (result < 0) {
+        throw std::runtime_error("Method not found");
+    }
+    return result;
+}
+
+long MockHost::property(const std::u16string &name) {
+    auto result = instance->FindProp(reinterpret_cast<const WCHAR_T *>(name.c_str()));
+    if (result < 0) {
+        throw std::runtime_error("Property not found");
+    }
+    return result;
+}
+
+void MockHost::clear(tVariant &value) {
+    if (value.vt == VTYPE_PWSTR && value.pwstrVal) {
+        memory_manager.FreeMemory(reinterpret_cast<void **>(&value.pwstrVal));
+    } else if ((value.vt == VTYPE_PSTR || value.vt == VTYPE_BLOB) && value.pstrVal) {
+        memory_manager.FreeMemory(reinterpret_cast<void **>(&value.pstrVal));
+    }
+    tVarInit(&value);
+}
+
+tVariant makeVariant() {
+    tVariant result;
+    tVarInit(&result);
+    return result;
+}
+
+tVariant makeVariant(int32_t value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_I4;
+    result.lVal = value;
+    return result;
+}
+
+tVariant makeVariant(int64_t value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_I8;
+    result.llVal = value;
+    return result;
+}
+
+tVariant makeVariant(uint64_t value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_UI8;
+    result.ullVal = value;
+    return result;
+}
+
+tVariant makeVariant(float value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_R4;
+    result.fltVal = value;
+    return result;
+}
+
+tVariant makeVariant(double value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_R8;
+    result.dblVal = value;
+    return result;
+}
+
+tVariant makeVariant(bool value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_BOOL;
+    result.bVal = value;
+    return result;
+}
+
+tVariant makeVariant(const std::tm &value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_TM;
+    result.tmVal = value;
+    return result;
+}
+
+tVariant makeVariant(const std::u16string &value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_PWSTR;
+    result.pwstrVal = reinterpret_cast<WCHAR_T *>(const_cast<char16_t *>(value.data()));
+    result.wstrLen = static_cast<uint32_t>(value.size());
+    return result;
+}
+
+tVariant makeVariant(const std::vector<char> &value) {
+    tVariant result = makeVariant();
+    result.vt = VTYPE_BLOB;
+    result.pstrVal = const_cast<char *>(value.data());
+    result.strLen = static_cast<uint32_t>(value.size());
+    return result;
+}
@@ -0,0 +1,128 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MOCKHOST_H
+#define MOCKHOST_H
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <AddInDefBase.h>
+#include <ComponentBase.h>
+#include <IMemoryManager.h>
+#include <types.h>
+
+// In-process stand-in for the 1C platform side of the add-in boundary
+
+class MockMemoryManager : public IMemoryManager {
+public:
+    bool ADDIN_API AllocMemory(void **memory, unsigned long size) override;
+
+    void ADDIN_API FreeMemory(void **memory) override;
+
+    // Busy waits on every allocation to simulate a slow host allocator
+    std::chrono::nanoseconds delay{0};
+
+    // Process wide, shared by all instances
+    static std::atomic<uint64_t> allocations;
+    static std::atomic<uint64_t> allocated_bytes;
+};
+
+class MockConnection : public IAddInDefBase {
+public:
+    bool ADDIN_API AddError(unsigned short code, const WCHAR_T *source, const WCHAR_T *descr, long scode) override;
+
+    bool ADDIN_API Read(WCHAR_T *prop_name, tVariant *value, long *error_code, WCHAR_T **error_descr) override;
+
+    bool ADDIN_API Write(WCHAR_T *prop_name, tVariant *value) override;
+
+    bool ADDIN_API RegisterProfileAs(WCHAR_T *profile_name) override;
+
+    bool ADDIN_API SetEventBufferDepth(long depth) override;
+
+    long ADDIN_API GetEventBufferDepth() override;
+
+    bool ADDIN_API ExternalEvent(WCHAR_T *source, WCHAR_T *message, WCHAR_T *data) override;
+
+    void ADDIN_API CleanEventBuffer() override;
+
+    bool ADDIN_API SetStatusLine(WCHAR_T *status_line) override;
+
+    void ADDIN_API ResetStatusLine() override;
+
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> events{0};
+    long event_buffer_depth = 1;
+};
+
+// Component instance created through exported GetClassObject and
+// initialized the same way the platform does it
+class MockHost {
+public:
+    explicit MockHost(const std::u16string &class_name = u"Sample",
+                      std::chrono::nanoseconds alloc_delay = std::chrono::nanoseconds::zero());
+
+    MockHost(const MockHost &) = delete;
+
+    MockHost &operator=(const MockHost &) = delete;
+
+    ~MockHost();
+
+    IComponentBase &component() { return *instance; }
+
+    long method(const std::u16string &name);
+
+    long property(const std::u16string &name);
+
+    // Releases host memory owned by the variant, as the platform does after a call
+    void clear(tVariant &value);
+
+    MockMemoryManager memory_manager;
+    MockConnection connection;
+
+private:
+    IComponentBase *instance = nullptr;
+};
+
+// Parameter constructors. Returned variants reference the given storage.
+
+tVariant makeVariant();
+
+tVariant makeVariant(int32_t value);
+
+tVariant makeVariant(int64_t value);
+
+tVariant makeVariant(uint64_t value);
+
+tVariant makeVariant(float value);
+
+tVariant makeVariant(double value);
+
+tVariant makeVariant(bool value);
+
+tVariant makeVariant(const std::tm &value);
+
+tVariant makeVariant(const std::u16string &value);
+
+tVariant makeVariant(const std::vector<char> &value);
+
+#endif //MOCKHOST_H
@@ -0,0 +1,86 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdexcept>
+#include <string>
+
+#include "Benchmark.h"
+#include "Numbers.h"
+
+// Numbers to and from UTF-16 host strings compared with the std::to_string
+// and std::stod route through an intermediate UTF-8 std::string
+
+namespace {
+
+const double values[] = {0.1, 1234.5, -2.5e-7, 3.141592653589793, 1e21, 42, -1, 65536.125};
+const size_t VALUES_COUNT = sizeof(values) / sizeof(values[0]);
+
+void check(bool success) {
+    if (!success) {
+        throw std::runtime_error("unexpected result");
+    }
+}
+
+std::u16string widen(const std::string &src) {
+    return std::u16string(src.begin(), src.end());
+}
+
+std::string narrow(const std::u16string &src) {
+    return std::string(src.begin(), src.end());
+}
+
+BENCHMARK("Numbers/format/formatNumber", [](size_t n) {
+    char16_t buffer[NUMBER_SIZE];
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        total += formatNumber(values[i % VALUES_COUNT], buffer);
+    }
+    check(total > 0);
+});
+
+BENCHMARK("Numbers/format/to_string", [](size_t n) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+        total += widen(std::to_string(values[i % VALUES_COUNT])).size();
+    }
+    check(total > 0);
+});
+
+const std::u16string texts[] = {u"0.1", u"1234.5", u"-2.5e-7", u"3.141592653589793", u"1e21", u"42", u"-1",
+                                u"65536.125"};
+
+BENCHMARK("Numbers/parse/parseNumber", [](size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        double value = 0;
+        check(parseNumber(std::u16string_view(texts[i % VALUES_COUNT]), value));
+        sum += value;
+    }
+    check(sum != 0);
+});
+
+BENCHMARK("Numbers/parse/stod", [](size_t n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += std::stod(narrow(texts[i % VALUES_COUNT]));
+    }
+    check(sum != 0);
+});
+
+}
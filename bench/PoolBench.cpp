@@ -0,0 +1,79 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Benchmark.h"
+#include "ClassRegistry.h"
+#include "InstancePool.h"
+#include "MockHost.h"
+#include "SampleAddIn.h"
+
+// Instance lifecycle as the platform drives it on a busy server:
+// create, set memory manager, Init, Done and destroy.
+// Same class with pooling off and on.
+
+namespace {
+
+template<typename Policy>
+void lifecycle(size_t n) {
+    static MockMemoryManager memory_manager;
+    static MockConnection connection;
+
+    for (size_t i = 0; i < n; ++i) {
+        auto instance = Policy::template create<SampleAddIn>();
+        instance->setMemManager(&memory_manager);
+        if (!instance->Init(&connection)) {
+            throw std::runtime_error("Init failed");
+        }
+        instance->Done();
+        Policy::destroy(instance);
+    }
+}
+
+// Lifecycle with other threads doing the same, counters include them
+template<typename Policy>
+void lifecycleContended(size_t n) {
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; ++t) {
+        threads.emplace_back([&]() {
+            while (!done.load(std::memory_order_relaxed)) {
+                lifecycle<Policy>(16);
+            }
+        });
+    }
+    lifecycle<Policy>(n);
+    done = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+using Pooled = PoolPolicy<64>;
+
+BENCHMARK("Lifecycle/HeapPolicy", [](size_t n) { lifecycle<HeapPolicy>(n); });
+BENCHMARK("Lifecycle/PoolPolicy", [](size_t n) { lifecycle<Pooled>(n); });
+BENCHMARK("Lifecycle/HeapPolicy/contended", [](size_t n) { lifecycleContended<HeapPolicy>(n); });
+BENCHMARK("Lifecycle/PoolPolicy/contended", [](size_t n) { lifecycleContended<Pooled>(n); });
+
+}
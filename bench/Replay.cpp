@@ -0,0 +1,170 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Replays a call recording made through the RecordFile property against
+// a mock host and compares recorded and replayed timings per target.
+//
+// Usage: AddInReplay FILE [--max-speed] [--repeat N]
+
+#include <chrono>
+#include <codecvt>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <locale>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "CallRecorder.h"
+#include "MockHost.h"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Totals {
+    uint64_t calls = 0;
+    uint64_t mismatches = 0;
+    double recorded_us = 0;
+    double replayed_us = 0;
+};
+
+std::u16string toUTF16(const std::string &src) {
+    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> conv;
+    return conv.from_bytes(src);
+}
+
+std::string toUTF8(const WCHAR_T *src, uint32_t size) {
+    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> conv;
+    auto begin = reinterpret_cast<const char16_t *>(src);
+    return conv.to_bytes(begin, begin + size);
+}
+
+bool replay(MockHost &host, std::map<std::pair<bool, std::string>, long> &ids, CallRecorder::Record &record) {
+    auto &component = host.component();
+    auto is_method = record.kind == CallRecorder::PROC || record.kind == CallRecorder::FUNC;
+
+    auto it = ids.find({is_method, record.name});
+    if (it == ids.end()) {
+        auto name = toUTF16(record.name);
+        it = ids.emplace(std::make_pair(is_method, record.name),
+                         is_method ? host.method(name) : host.property(name)).first;
+    }
+
+    auto count = static_cast<long>(record.params.size());
+    switch (record.kind) {
+        case CallRecorder::PROC:
+            return component.CallAsProc(it->second, record.params.data(), count);
+        case CallRecorder::FUNC: {
+            tVariant result = makeVariant();
+            auto success = component.CallAsFunc(it->second, &result, record.params.data(), count);
+            host.clear(result);
+            return success;
+        }
+        case CallRecorder::GET_PROP: {
+            tVariant result = makeVariant();
+            auto success = component.GetPropVal(it->second, &result);
+            host.clear(result);
+            return success;
+        }
+        case CallRecorder::SET_PROP:
+            return component.SetPropVal(it->second, record.params.data());
+    }
+
+    return false;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: AddInReplay FILE [--max-speed] [--repeat N]\n");
+        return EXIT_FAILURE;
+    }
+
+    std::string path = argv[1];
+    bool max_speed = false;
+    unsigned repeat = 1;
+    for (int i = 2; i < argc; ++i) {
+        std::string key = argv[i];
+        if (key == "--max-speed") {
+            max_speed = true;
+        } else if (key == "--repeat" && i + 1 < argc) {
+            repeat = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else {
+            std::fprintf(stderr, "Unknown option %s\n", key.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        MockHost host;
+        std::map<std::pair<bool, std::string>, long> ids;
+        std::map<std::string, Totals> totals;
+        CallRecorder::Record record;
+        auto started = clock_type::now();
+
+        for (unsigned pass = 0; pass < repeat; ++pass) {
+            std::ifstream input(path, std::ios::binary);
+            if (!input || !CallRecorder::readHeader(input)) {
+                throw std::runtime_error("Not a call recording: " + path);
+            }
+
+            auto origin = clock_type::now();
+            while (CallRecorder::read(input, record)) {
+                if (!max_speed) {
+                    std::this_thread::sleep_until(origin + std::chrono::nanoseconds(record.timestamp));
+                }
+
+                auto start = clock_type::now();
+                auto success = replay(host, ids, record);
+                auto elapsed = clock_type::now() - start;
+
+                auto &t = totals[record.name];
+                ++t.calls;
+                t.mismatches += success != record.success;
+                t.recorded_us += record.duration / 1000.0;
+                t.replayed_us += std::chrono::duration<double, std::micro>(elapsed).count();
+            }
+        }
+
+        std::printf("%-32s %10s %10s %14s %14s\n", "target", "calls", "mismatch", "recorded us", "replayed us");
+        for (auto &item : totals) {
+            auto &t = item.second;
+            std::printf("%-32s %10llu %10llu %14.2f %14.2f\n", item.first.c_str(),
+                        static_cast<unsigned long long>(t.calls), static_cast<unsigned long long>(t.mismatches),
+                        t.recorded_us / t.calls, t.replayed_us / t.calls);
+        }
+        std::printf("wall time %.3f s\n", std::chrono::duration<double>(clock_type::now() - started).count());
+
+        tVariant statistics = makeVariant();
+        if (host.component().GetPropVal(host.property(u"Statistics"), &statistics)) {
+            std::printf("%s\n", toUTF8(statistics.pwstrVal, statistics.wstrLen).c_str());
+        }
+        host.clear(statistics);
+
+    } catch (const std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
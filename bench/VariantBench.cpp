@@ -0,0 +1,115 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "Benchmark.h"
+#include "Variant.h"
+
+// Compares variant_t with the layout it replaced: std::tm for dates and
+// std::vector<char> for blobs. Case names carry sizeof of each type.
+
+namespace {
+
+typedef std::variant<
+        std::monostate,
+        int32_t,
+        double,
+        bool,
+        std::string,
+        std::tm,
+        std::vector<char>
+> legacy_variant_t;
+
+const size_t PARAMS_COUNT = 8;
+
+std::tm sampleDate() {
+    std::tm date{};
+    date.tm_year = 120;
+    date.tm_mday = 1;
+    return date;
+}
+
+template<typename V, typename Date, typename Bytes>
+std::vector<V> makeParams() {
+    const char bytes[16] = {};
+    return {int32_t{1}, 2.5, true, std::string("short"), Date(sampleDate()),
+            Bytes(bytes, bytes + sizeof(bytes)), int32_t{3}, V()};
+}
+
+// What a call does with its params: copy them in and visit every one
+template<typename V, typename Date, typename Bytes>
+void callParams(size_t n) {
+    Benchmark::pause();
+    auto source = makeParams<V, Date, Bytes>();
+    Benchmark::resume();
+    size_t sink = 0;
+    for (size_t i = 0; i < n; ++i) {
+        std::vector<V> params;
+        params.reserve(PARAMS_COUNT);
+        for (auto &param : source) {
+            params.emplace_back(param);
+        }
+        for (auto &param : params) {
+            sink += std::visit([](const auto &v) { return sizeof(v); }, param);
+        }
+    }
+    if (sink == 0) {
+        throw std::runtime_error("unexpected");
+    }
+}
+
+// Returning native memory, e.g. a Java direct buffer, through variant_t to the host.
+// Owned blobs copy the bytes twice, borrowed ones once.
+template<bool Borrowed>
+void returnBlob(size_t n, size_t size) {
+    Benchmark::pause();
+    std::vector<char> source(size, 1), host(size);
+    Benchmark::resume();
+    for (size_t i = 0; i < n; ++i) {
+        variant_t result = Borrowed ? Blob::borrow(source.data(), size) : Blob(source.data(), size);
+        auto &blob = std::get<Blob>(result);
+        memcpy(host.data(), blob.data(), blob.size());
+    }
+}
+
+template<typename V>
+std::string name(const char *type, const char *workload) {
+    return std::string("Variant/") + type + "[" + std::to_string(sizeof(V)) + "B]/" + workload;
+}
+
+const bool cases = []() {
+    Benchmark::Registrar(name<legacy_variant_t>("legacy", "params"),
+                         callParams<legacy_variant_t, std::tm, std::vector<char>>);
+    Benchmark::Registrar(name<variant_t>("compact", "params"), callParams<variant_t, Timestamp, Blob>);
+    for (size_t size : {4096, 1048576}) {
+        Benchmark::Registrar("Blob/return/owned/" + std::to_string(size),
+                             [size](size_t n) { returnBlob<false>(n, size); });
+        Benchmark::Registrar("Blob/return/borrowed/" + std::to_string(size),
+                             [size](size_t n) { returnBlob<true>(n, size); });
+    }
+    return true;
+}();
+
+}
@@ -0,0 +1,93 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef ATOMICVALUE_H
+#define ATOMICVALUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "Epoch.h"
+
+// Value shared between threads with RCU semantics.
+// Every write publishes a new immutable version, readers take the current
+// one without locks and it stays valid until their Epoch::Guard ends.
+// Replaced versions are reclaimed by Epoch. Every write increments
+// version(), which lets readers skip values they have already seen.
+template<typename T>
+class AtomicValue {
+public:
+    explicit AtomicValue(T initial = T()) : current(new T(std::move(initial))) {};
+
+    AtomicValue(const AtomicValue &) = delete;
+
+    AtomicValue &operator=(const AtomicValue &) = delete;
+
+    ~AtomicValue() { Epoch::retire(current.load(std::memory_order_relaxed)); }
+
+    // Reference stays valid while the calling thread holds an Epoch::Guard
+    const T &get() const { return *current.load(std::memory_order_acquire); }
+
+    // Read before the value, a concurrent write may only make it look older
+    uint64_t version() const { return versions.load(std::memory_order_acquire); }
+
+    T load() const {
+        Epoch::Guard guard;
+        return get();
+    }
+
+    template<typename F>
+    decltype(auto) read(F &&reader) const {
+        Epoch::Guard guard;
+        return reader(get());
+    }
+
+    void store(T value) {
+        auto fresh = new T(std::move(value));
+        Epoch::retire(current.exchange(fresh, std::memory_order_acq_rel));
+        versions.fetch_add(1, std::memory_order_release);
+    }
+
+    // Applies updater to a copy of the current version and publishes it,
+    // retrying if another writer got ahead
+    template<typename F>
+    void update(F &&updater) {
+        Epoch::Guard guard;
+        auto old = current.load(std::memory_order_acquire);
+        while (true) {
+            auto fresh = std::make_unique<T>(*old);
+            updater(*fresh);
+            if (current.compare_exchange_weak(old, fresh.get(), std::memory_order_acq_rel,
+                                              std::memory_order_acquire)) {
+                fresh.release();
+                Epoch::retire(old);
+                versions.fetch_add(1, std::memory_order_release);
+                return;
+            }
+        }
+    }
+
+private:
+    std::atomic<T *> current;
+    std::atomic<uint64_t> versions{0};
+};
+
+#endif //ATOMICVALUE_H
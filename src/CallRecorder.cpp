@@ -0,0 +1,325 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "CallRecorder.h"
+#include "Trace.h"
+
+// All supported targets are little endian, so values are copied as is
+
+namespace {
+
+constexpr size_t SUCCESS_OFFSET = 1;
+constexpr size_t DURATION_OFFSET = 10;
+
+template<typename T>
+void append(std::string &dst, T value) {
+    dst.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+bool extract(std::istream &src, T &value) {
+    return static_cast<bool>(src.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+// Size of numbers stored as raw bytes of the variant union, 0 for other types
+size_t numberSize(uint16_t vt) {
+    switch (vt) {
+        case VTYPE_I1:
+        case VTYPE_UI1:
+            return sizeof(int8_t);
+        case VTYPE_I2:
+        case VTYPE_UI2:
+            return sizeof(int16_t);
+        case VTYPE_I4:
+        case VTYPE_UI4:
+        case VTYPE_R4:
+            return sizeof(int32_t);
+        case VTYPE_INT:
+        case VTYPE_UINT:
+            return sizeof(int);
+        case VTYPE_I8:
+        case VTYPE_UI8:
+        case VTYPE_R8:
+        case VTYPE_DATE:
+            return sizeof(int64_t);
+        default:
+            return 0;
+    }
+}
+
+void appendVariant(std::string &dst, const tVariant &src) {
+    append<uint16_t>(dst, src.vt);
+    if (auto size = numberSize(src.vt)) {
+        dst.append(reinterpret_cast<const char *>(&src.llVal), size);
+        return;
+    }
+    switch (src.vt) {
+        case VTYPE_BOOL:
+            append<uint8_t>(dst, src.bVal ? 1 : 0);
+            break;
+        case VTYPE_TM:
+            for (auto v : {src.tmVal.tm_sec, src.tmVal.tm_min, src.tmVal.tm_hour, src.tmVal.tm_mday, src.tmVal.tm_mon,
+                           src.tmVal.tm_year, src.tmVal.tm_wday, src.tmVal.tm_yday, src.tmVal.tm_isdst}) {
+                append<int32_t>(dst, v);
+            }
+            break;
+        case VTYPE_PWSTR:
+            append<uint32_t>(dst, src.wstrLen);
+            dst.append(reinterpret_cast<const char *>(src.pwstrVal), src.wstrLen * sizeof(WCHAR_T));
+            break;
+        case VTYPE_BLOB:
+            append<uint32_t>(dst, src.strLen);
+            dst.append(src.pstrVal, src.strLen);
+            break;
+        default:
+            break;
+    }
+}
+
+}
+
+struct CallRecorder::Node {
+    std::atomic<Node *> next{nullptr};
+    std::string data;
+    uint64_t flow = 0; // Trace flow from the caller to the writer
+};
+
+CallRecorder::~CallRecorder() {
+    stop();
+}
+
+void CallRecorder::start(const std::string &path) {
+    stop();
+
+    tail = new Node;
+    head.store(tail, std::memory_order_relaxed);
+    pending = 0;
+    dropped_count = 0;
+    origin = std::chrono::steady_clock::now();
+
+    std::ofstream probe(path, std::ios::binary | std::ios::trunc);
+    if (!probe) {
+        throw std::runtime_error(u8"Can't open record file");
+    }
+    probe.close();
+
+    closing = false;
+    running = true;
+    writer = std::thread(&CallRecorder::writerLoop, this, path);
+}
+
+void CallRecorder::stop() {
+    if (!writer.joinable()) {
+        return;
+    }
+
+    // Pushers that saw running still use the queue, it is drained and freed after they leave
+    running = false;
+    while (pushers.load() != 0) {
+        std::this_thread::yield();
+    }
+    closing = true;
+    writer.join();
+
+    while (tail) {
+        auto next = tail->next.load(std::memory_order_acquire);
+        delete tail;
+        tail = next;
+    }
+    head.store(nullptr, std::memory_order_relaxed);
+}
+
+void CallRecorder::push(std::string &&data) {
+    if (!running.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Sequentially consistent with stop: either it waits for this push or the push sees it stopping
+    pushers.fetch_add(1);
+    if (!running.load()) {
+        pushers.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    if (pending.fetch_add(data.size(), std::memory_order_relaxed) + data.size() > MAX_PENDING) {
+        pending.fetch_sub(data.size(), std::memory_order_relaxed);
+        dropped_count.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        auto node = new Node;
+        node->data = std::move(data);
+        node->flow = Trace::flowBegin("recordCall");
+        auto prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+    pushers.fetch_sub(1, std::memory_order_release);
+}
+
+void CallRecorder::writerLoop(std::string path) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(MAGIC, sizeof(MAGIC) - 1);
+
+    while (true) {
+        // Closing is observed before draining, so nothing pushed before it is lost
+        auto stopping = closing.load(std::memory_order_acquire);
+
+        size_t written = 0;
+        {
+            Trace::Scope scope("writeRecords");
+            while (auto next = tail->next.load(std::memory_order_acquire)) {
+                delete tail;
+                tail = next;
+                Trace::flowEnd("recordCall", next->flow);
+                file.write(next->data.data(), next->data.size());
+                pending.fetch_sub(next->data.size(), std::memory_order_relaxed);
+                next->data = std::string();
+                ++written;
+            }
+        }
+
+        if (stopping) {
+            break;
+        }
+        if (!written) {
+            file.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+CallRecorder::Entry::Entry(CallRecorder &recorder_, Kind kind, const char *name,
+                           const tVariant *params, long count)
+        : recorder(recorder_), start(std::chrono::steady_clock::now()) {
+
+    append<uint8_t>(data, kind);
+    append<uint8_t>(data, 0);
+    append<uint64_t>(data, std::chrono::duration_cast<std::chrono::nanoseconds>(start - recorder.origin).count());
+    append<uint64_t>(data, 0);
+    auto name_size = strlen(name);
+    append<uint16_t>(data, static_cast<uint16_t>(name_size));
+    data.append(name, name_size);
+    append<uint32_t>(data, static_cast<uint32_t>(count));
+    for (long i = 0; i < count; ++i) {
+        appendVariant(data, params[i]);
+    }
+}
+
+CallRecorder::Entry::~Entry() {
+    Trace::Scope scope("recordCall");
+    uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    data[SUCCESS_OFFSET] = success ? 1 : 0;
+    memcpy(&data[DURATION_OFFSET], &duration, sizeof(duration));
+    recorder.push(std::move(data));
+}
+
+bool CallRecorder::readHeader(std::istream &input) {
+    char magic[sizeof(MAGIC) - 1];
+    return input.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(magic)) == 0;
+}
+
+bool CallRecorder::read(std::istream &input, Record &record) {
+    uint8_t kind, success;
+    uint16_t name_size;
+    uint32_t count;
+
+    if (!extract(input, kind)) {
+        return false;
+    }
+
+    if (!extract(input, success) || !extract(input, record.timestamp) || !extract(input, record.duration)
+        || !extract(input, name_size)) {
+        throw std::runtime_error("Truncated record");
+    }
+    record.kind = static_cast<Kind>(kind);
+    record.success = success != 0;
+
+    record.name.resize(name_size);
+    if (!input.read(&record.name[0], name_size) || !extract(input, count)) {
+        throw std::runtime_error("Truncated record");
+    }
+
+    // Params reference these, so they must not reallocate
+    record.params.assign(count, tVariant{});
+    record.strings.clear();
+    record.strings.reserve(count);
+    record.blobs.clear();
+    record.blobs.reserve(count);
+
+    for (auto &param : record.params) {
+        tVarInit(&param);
+        uint16_t vt;
+        bool ok = extract(input, vt);
+        param.vt = vt;
+
+        if (auto size = numberSize(vt)) {
+            if (!ok || !input.read(reinterpret_cast<char *>(&param.llVal), size)) {
+                throw std::runtime_error("Truncated record");
+            }
+            continue;
+        }
+
+        switch (vt) {
+            case VTYPE_BOOL: {
+                uint8_t v = 0;
+                ok = ok && extract(input, v);
+                param.bVal = v != 0;
+                break;
+            }
+            case VTYPE_TM:
+                for (auto field : {&std::tm::tm_sec, &std::tm::tm_min, &std::tm::tm_hour, &std::tm::tm_mday,
+                                   &std::tm::tm_mon, &std::tm::tm_year, &std::tm::tm_wday, &std::tm::tm_yday,
+                                   &std::tm::tm_isdst}) {
+                    int32_t v = 0;
+                    ok = ok && extract(input, v);
+                    param.tmVal.*field = v;
+                }
+                break;
+            case VTYPE_PWSTR: {
+                uint32_t size = 0;
+                ok = ok && extract(input, size);
+                auto &str = record.strings.emplace_back(size, u'\0');
+                ok = ok && input.read(reinterpret_cast<char *>(&str[0]), size * sizeof(char16_t));
+                param.pwstrVal = reinterpret_cast<WCHAR_T *>(&str[0]);
+                param.wstrLen = size;
+                break;
+            }
+            case VTYPE_BLOB: {
+                uint32_t size = 0;
+                ok = ok && extract(input, size);
+                auto &blob = record.blobs.emplace_back(size);
+                ok = ok && input.read(blob.data(), size);
+                param.pstrVal = blob.data();
+                param.strLen = size;
+                break;
+            }
+            default:
+                break;
+        }
+
+        if (!ok) {
+            throw std::runtime_error("Truncated record");
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,136 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CALLRECORDER_H
+#define CALLRECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <types.h>
+
+// Records incoming calls to a binary file for offline replay.
+//
+// File starts with 8 byte magic "AIREC001" followed by records.
+// All numbers are little endian:
+//   u8 kind, u8 success, u64 timestamp ns, u64 duration ns,
+//   u16 name length, UTF-8 name, u32 params count, params...
+// Param is u16 vt followed by value:
+//   I1, UI1 - 1 byte, I2, UI2 - 2 bytes, I4, UI4, R4, INT, UINT - 4 bytes,
+//   I8, UI8, R8, DATE - 8 bytes, BOOL - u8, TM - 9 x i32 (tm_sec .. tm_isdst),
+//   PWSTR - u32 length, UTF-16 units, BLOB - u32 length, bytes.
+// Other types are stored as vt only.
+//
+// Callers serialize records themselves and push them to a wait-free queue,
+// a background thread drains it to disk. Records are dropped rather than
+// blocking callers when the writer falls behind.
+class CallRecorder {
+public:
+    enum Kind : uint8_t {
+        PROC,
+        FUNC,
+        GET_PROP,
+        SET_PROP
+    };
+
+    struct Record;
+    class Entry;
+
+    CallRecorder() = default;
+
+    CallRecorder(const CallRecorder &) = delete;
+
+    CallRecorder &operator=(const CallRecorder &) = delete;
+
+    ~CallRecorder();
+
+    bool active() const { return running.load(std::memory_order_relaxed); }
+
+    void start(const std::string &path);
+
+    // Flushes pending records and closes the file
+    void stop();
+
+    uint64_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+
+    // Reads next record, returns false on end of file
+    static bool read(std::istream &input, Record &record);
+
+    static bool readHeader(std::istream &input);
+
+private:
+    struct Node;
+
+    void push(std::string &&data);
+
+    void writerLoop(std::string path);
+
+    static constexpr char MAGIC[] = "AIREC001";
+    static constexpr uint64_t MAX_PENDING = 64u << 20;
+
+    std::atomic<bool> running{false};
+    std::atomic<bool> closing{false}; // Set once no push is in flight
+    std::atomic<uint32_t> pushers{0};
+    std::atomic<Node *> head{nullptr};
+    Node *tail = nullptr;
+    std::atomic<uint64_t> pending{0};
+    std::atomic<uint64_t> dropped_count{0};
+    std::chrono::steady_clock::time_point origin;
+    std::thread writer;
+};
+
+// Decoded record. Params point into strings and blobs of the same record.
+struct CallRecorder::Record {
+    Kind kind;
+    bool success;
+    uint64_t timestamp;
+    uint64_t duration;
+    std::string name;
+    std::vector<tVariant> params;
+    std::vector<std::u16string> strings;
+    std::vector<std::vector<char>> blobs;
+};
+
+// Serializes one call. Params are captured on construction, before
+// the handler may change them, result is appended on destruction.
+class CallRecorder::Entry {
+public:
+    Entry(CallRecorder &recorder_, Kind kind, const char *name, const tVariant *params, long count);
+
+    Entry(const Entry &) = delete;
+
+    Entry &operator=(const Entry &) = delete;
+
+    ~Entry();
+
+    void fail() { success = false; }
+
+private:
+    CallRecorder &recorder;
+    std::string data;
+    std::chrono::steady_clock::time_point start;
+    bool success = true;
+};
+
+#endif //CALLRECORDER_H
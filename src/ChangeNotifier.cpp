@@ -0,0 +1,74 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ChangeNotifier.h"
+#include "Trace.h"
+
+ChangeNotifier::~ChangeNotifier() {
+    stop();
+}
+
+void ChangeNotifier::start(std::chrono::milliseconds interval, size_t count, Version version, Notify notify) {
+    stop();
+
+    std::vector<uint64_t> known(count);
+    for (size_t i = 0; i < count; ++i) {
+        known[i] = version(i);
+    }
+
+    version_of = std::move(version);
+    notify_of = std::move(notify);
+    stopping = false;
+    worker = std::thread(&ChangeNotifier::loop, this, interval, std::move(known),
+                         Trace::flowBegin("startChangeNotifier"));
+}
+
+void ChangeNotifier::stop() {
+    if (!worker.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    worker.join();
+}
+
+// The flow from start ends in the first poll
+void ChangeNotifier::loop(std::chrono::milliseconds interval, std::vector<uint64_t> known, uint64_t flow) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wakeup.wait_for(lock, interval, [this]() { return stopping; })) {
+        lock.unlock();
+        {
+            Trace::Scope scope("pollChanges");
+            Trace::flowEnd("startChangeNotifier", flow);
+            flow = 0;
+            for (size_t i = 0; i < known.size(); ++i) {
+                auto current = version_of(i);
+                if (current != known[i]) {
+                    known[i] = current;
+                    notify_of(i);
+                }
+            }
+        }
+        lock.lock();
+    }
+}
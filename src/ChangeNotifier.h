@@ -0,0 +1,63 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CHANGENOTIFIER_H
+#define CHANGENOTIFIER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Polls versions of a fixed set of items on a background thread and
+// reports the ones that changed since the previous poll. Any number of
+// changes within an interval results in a single notification.
+class ChangeNotifier {
+public:
+    using Version = std::function<uint64_t(size_t item)>;
+    using Notify = std::function<void(size_t item)>;
+
+    ChangeNotifier() = default;
+
+    ChangeNotifier(const ChangeNotifier &) = delete;
+
+    ChangeNotifier &operator=(const ChangeNotifier &) = delete;
+
+    ~ChangeNotifier();
+
+    // Current versions are taken as known, only later changes are reported
+    void start(std::chrono::milliseconds interval, size_t count, Version version, Notify notify);
+
+    void stop();
+
+private:
+    void loop(std::chrono::milliseconds interval, std::vector<uint64_t> known, uint64_t flow);
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    Version version_of;
+    Notify notify_of;
+};
+
+#endif //CHANGENOTIFIER_H
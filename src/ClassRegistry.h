@@ -0,0 +1,179 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CLASSREGISTRY_H
+#define CLASSREGISTRY_H
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+
+#include <ComponentBase.h>
+#include <types.h>
+
+#include "Component.h"
+
+// Default construction policy, every GetClassObject creates a new instance
+struct HeapPolicy {
+    template<typename C>
+    static C *create() { return new C; }
+
+    template<typename C>
+    static void destroy(C *component) { delete component; }
+};
+
+// Component classes exported by the library, see exports.cpp for usage.
+//
+// A class names itself with a static constexpr char16_t CLASS_NAME[] member and
+// may choose how its instances are created and destroyed with a nested
+// ConstructionPolicy type providing create<C>() and destroy(C *), HeapPolicy otherwise.
+// The "|" separated name list and a perfect hash over names are built during
+// compilation, so the class is resolved from the host string without copying it.
+template<typename... Classes>
+class ClassRegistry {
+public:
+    static const WCHAR_T *names();
+
+    // Instance of the named class or nullptr
+    static IComponentBase *create(const WCHAR_T *name);
+
+    static void destroy(IComponentBase *object);
+
+private:
+    struct ClassDef {
+        const char16_t *alias;
+        const char16_t *alias_ru; // Same as alias, the table indexes two names per definition
+        Component *(*create)();
+    };
+
+    template<typename C, typename = void>
+    struct PolicyOf {
+        using Type = HeapPolicy;
+    };
+
+    template<typename C>
+    struct PolicyOf<C, std::void_t<typename C::ConstructionPolicy>> {
+        using Type = typename C::ConstructionPolicy;
+    };
+
+    static constexpr size_t COUNT = sizeof...(Classes);
+
+    static constexpr size_t length(const char16_t *name) {
+        size_t result = 0;
+        while (name[result]) {
+            ++result;
+        }
+        return result;
+    }
+
+    // Names with separators and the terminating zero
+    static constexpr size_t NAMES_SIZE = (length(Classes::CLASS_NAME) + ... + 0) + (COUNT > 0 ? COUNT : 1);
+
+    static constexpr std::array<char16_t, NAMES_SIZE> joinNames();
+
+    template<typename C>
+    static Component *construct();
+};
+
+template<typename... Classes>
+constexpr std::array<char16_t, ClassRegistry<Classes...>::NAMES_SIZE> ClassRegistry<Classes...>::joinNames() {
+    std::array<char16_t, NAMES_SIZE> result{};
+    std::array<const char16_t *, COUNT> names{Classes::CLASS_NAME...};
+
+    size_t size = 0;
+    for (size_t i = 0; i < COUNT; ++i) {
+        if (i > 0) {
+            result[size++] = u'|';
+        }
+        for (auto c = names[i]; *c; ++c) {
+            result[size++] = *c;
+        }
+    }
+
+    return result;
+}
+
+template<typename... Classes>
+template<typename C>
+Component *ClassRegistry<Classes...>::construct() {
+    static_assert(std::is_base_of<Component, C>::value, "Registered classes must derive from Component");
+
+    using Policy = typename PolicyOf<C>::Type;
+    Component *component = Policy::template create<C>();
+    if (component) {
+        component->release = [](Component *instance) { Policy::destroy(static_cast<C *>(instance)); };
+    }
+    return component;
+}
+
+template<typename... Classes>
+const WCHAR_T *ClassRegistry<Classes...>::names() {
+    static constexpr auto joined = joinNames();
+    return reinterpret_cast<const WCHAR_T *>(joined.data());
+}
+
+template<typename... Classes>
+IComponentBase *ClassRegistry<Classes...>::create(const WCHAR_T *name) {
+    static constexpr Component::StaticTable<ClassDef, COUNT> table(std::array<ClassDef, COUNT>{
+            ClassDef{Classes::CLASS_NAME, Classes::CLASS_NAME, &construct<Classes>}...});
+    static constexpr auto view = table.view();
+
+    auto index = view.find(name);
+    if (index < 0) {
+        return nullptr;
+    }
+
+    // Exceptions must not cross the C interface
+    try {
+        return view.defs[index].create();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+template<typename... Classes>
+void ClassRegistry<Classes...>::destroy(IComponentBase *object) {
+    auto component = static_cast<Component *>(object);
+    component->release(component);
+}
+
+// Defines GetClassNames, GetClassObject and DestroyObject exports for the given classes
+#define EXPORT_COMPONENTS(...) \
+    const WCHAR_T *GetClassNames() { \
+        return ClassRegistry<__VA_ARGS__>::names(); \
+    } \
+    \
+    long GetClassObject(const WCHAR_T *clsName, IComponentBase **pInterface) { \
+        if (!*pInterface) { \
+            *pInterface = ClassRegistry<__VA_ARGS__>::create(clsName); \
+            return (long) *pInterface; \
+        } \
+        return 0; \
+    } \
+    \
+    long DestroyObject(IComponentBase **pInterface) { \
+        if (!*pInterface) { \
+            return -1; \
+        } \
+        ClassRegistry<__VA_ARGS__>::destroy(*pInterface); \
+        *pInterface = nullptr; \
+        return 0; \
+    }
+
+#endif //CLASSREGISTRY_H
@@ -0,0 +1,759 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include <types.h>
+
+#include "Codecs.h"
+#include "Simd.h"
+
+namespace {
+
+constexpr char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+constexpr char BASE64_URL_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+constexpr char HEX_DIGITS[] = "0123456789ABCDEF";
+
+// Values of ASCII characters in decoding tables besides digits
+constexpr uint8_t SPACE = 0xFD;
+constexpr uint8_t PAD = 0xFE;
+constexpr uint8_t INVALID = 0xFF;
+
+using DecodeTable = std::array<uint8_t, 128>;
+
+constexpr DecodeTable makeTable(const char *digits, size_t count) {
+    DecodeTable table{};
+    for (auto &value : table) {
+        value = INVALID;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        table[static_cast<uint8_t>(digits[i])] = static_cast<uint8_t>(i);
+    }
+    for (auto c : {' ', '\t', '\r', '\n'}) {
+        table[static_cast<uint8_t>(c)] = SPACE;
+    }
+    return table;
+}
+
+constexpr DecodeTable makeBase64Table(const char *alphabet) {
+    auto table = makeTable(alphabet, 64);
+    table['='] = PAD;
+    return table;
+}
+
+constexpr DecodeTable makeHexTable() {
+    auto table = makeTable(HEX_DIGITS, 16);
+    for (uint8_t i = 10; i < 16; ++i) {
+        table['a' + i - 10] = i;
+    }
+    return table;
+}
+
+constexpr DecodeTable BASE64_VALUES = makeBase64Table(BASE64_ALPHABET);
+constexpr DecodeTable BASE64_URL_VALUES = makeBase64Table(BASE64_URL_ALPHABET);
+constexpr DecodeTable HEX_VALUES = makeHexTable();
+
+template<typename Char>
+uint8_t valueOf(Char c, const DecodeTable &table) {
+    auto unit = static_cast<std::make_unsigned_t<Char>>(c);
+    return unit < table.size() ? table[unit] : INVALID;
+}
+
+#ifdef ADDIN_SSE2
+
+// 16 code units narrowed to bytes. Units above 0xFF become 0x00 or 0xFF,
+// which are invalid in every format, so the scalar path reports them.
+template<typename Char>
+__m128i load16(const Char *src) {
+    if constexpr (sizeof(Char) == 1) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    } else {
+        static_assert(sizeof(Char) == 2, "UTF-16 code units expected");
+        return _mm_packus_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 8)));
+    }
+}
+
+// 16 ASCII characters as UTF-8 or UTF-16 code units
+template<typename Char>
+void store16(Char *out, __m128i chars) {
+    if constexpr (sizeof(Char) == 1) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), chars);
+    } else {
+        auto zero = _mm_setzero_si128();
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(chars, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 8), _mm_unpackhi_epi8(chars, zero));
+    }
+}
+
+// 16 bytes to 32 digits
+template<typename Char>
+void encodeHexBlock(const uint8_t *src, Char *out) {
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    auto low_mask = _mm_set1_epi8(0x0F);
+    auto high = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask);
+    auto low = _mm_and_si128(bytes, low_mask);
+
+    auto toDigits = [](__m128i values) {
+        auto letters = _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10));
+        return _mm_add_epi8(_mm_add_epi8(values, _mm_set1_epi8('0')), letters);
+    };
+    store16(out, toDigits(_mm_unpacklo_epi8(high, low)));
+    store16(out + 16, toDigits(_mm_unpackhi_epi8(high, low)));
+}
+
+// Values of 16 digits, false when any of them is not a digit
+bool hexValues(__m128i chars, __m128i &values) {
+    auto digits = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+    auto letters = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    auto minus_one = _mm_set1_epi8(-1);
+    auto is_digit = _mm_and_si128(_mm_cmpgt_epi8(digits, minus_one), _mm_cmplt_epi8(digits, _mm_set1_epi8(10)));
+    auto is_letter = _mm_and_si128(_mm_cmpgt_epi8(letters, minus_one), _mm_cmplt_epi8(letters, _mm_set1_epi8(6)));
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF) {
+        return false;
+    }
+    values = _mm_or_si128(_mm_and_si128(is_digit, digits),
+                          _mm_and_si128(is_letter, _mm_add_epi8(letters, _mm_set1_epi8(10))));
+    return true;
+}
+
+// Pairs of values to bytes in the low halves of 16 bit lanes
+__m128i hexPairs(__m128i values) {
+    return _mm_or_si128(_mm_and_si128(_mm_slli_epi16(values, 4), _mm_set1_epi16(0xF0)), _mm_srli_epi16(values, 8));
+}
+
+// 32 digits to 16 bytes, false when any of them is not a digit
+template<typename Char>
+bool decodeHexBlock(const Char *src, uint8_t *out) {
+    __m128i first, second;
+    if (!hexValues(load16(src), first) || !hexValues(load16(src + 16), second)) {
+        return false;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(hexPairs(first), hexPairs(second)));
+    return true;
+}
+
+// Offsets from Base64 indices to characters by the range they fall in
+__m128i base64Offsets(bool url) {
+    return url ? _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                               '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0)
+               : _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                               '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+}
+
+// Tables of Base64 decoding. Characters are validated by bit sets selected by
+// both nibbles: a bit set in both marks a low nibble invalid for the high one.
+struct Base64Lookup {
+    __m128i low_bits;
+    __m128i high_bits;
+    __m128i offsets;
+    __m128i special; // Character sharing the high nibble with others
+    __m128i special_shift; // Moves its offset to a lane of its own
+};
+
+Base64Lookup base64Lookup(bool url) {
+    if (url) {
+        // '_' shares the high nibble with letters, its offset is moved to lane 8
+        return {_mm_setr_epi8(0x0B, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0x07, 0x37, 0x37, 0x35, 0x37, 0x27),
+                _mm_setr_epi8(1, 1, 2, 4, 8, 0x10, 8, 0x20, 1, 1, 1, 1, 1, 1, 1, 1),
+                _mm_setr_epi8(0, 0, 17, 4, -65, -65, -71, -71, -32, 0, 0, 0, 0, 0, 0, 0),
+                _mm_set1_epi8('_'), _mm_set1_epi8(3)};
+    }
+    // '/' shares the high nibble with '+', its offset is moved to lane 1
+    return {_mm_setr_epi8(0x0B, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0x07, 0x15, 0x17, 0x17, 0x17, 0x15),
+            _mm_setr_epi8(1, 1, 2, 4, 8, 0x10, 8, 0x10, 1, 1, 1, 1, 1, 1, 1, 1),
+            _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+            _mm_set1_epi8('/'), _mm_set1_epi8(-1)};
+}
+
+// 12 bytes in the low lanes to 16 characters
+ADDIN_TARGET("ssse3")
+__m128i base64Chars(__m128i input, bool url) {
+    // Every 3 bytes spread over 4 lanes of 6 bits
+    input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    auto high = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    auto low = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    auto indices = _mm_or_si128(high, low);
+
+    // Offset from the index to its character by the range it falls in
+    auto range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13)));
+    return _mm_add_epi8(_mm_shuffle_epi8(base64Offsets(url), range), indices);
+}
+
+// 16 characters to bytes in the low 12 lanes, false when any of them is not in the alphabet
+ADDIN_TARGET("ssse3")
+bool base64Bytes(__m128i input, const Base64Lookup &lookup, __m128i &bytes) {
+    auto low_mask = _mm_set1_epi8(0x0F);
+    auto high = _mm_and_si128(_mm_srli_epi32(input, 4), low_mask);
+    auto low = _mm_and_si128(input, low_mask);
+
+    auto invalid = _mm_and_si128(_mm_shuffle_epi8(lookup.low_bits, low), _mm_shuffle_epi8(lookup.high_bits, high));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128()))) {
+        return false;
+    }
+
+    auto lanes = _mm_add_epi8(high, _mm_and_si128(_mm_cmpeq_epi8(input, lookup.special), lookup.special_shift));
+    auto values = _mm_add_epi8(input, _mm_shuffle_epi8(lookup.offsets, lanes));
+
+    // 4 x 6 bits to 3 bytes in every 32 bit lane, then lanes are packed
+    auto pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    auto words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    bytes = _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+template<typename Char>
+ADDIN_TARGET("ssse3")
+size_t encodeBase64Ssse3(const uint8_t *src, size_t groups, bool url, Char *out) {
+    size_t done = 0;
+    // 16 bytes are loaded for 4 groups
+    for (; groups - done >= 6; done += 4) {
+        store16(out + 4 * done, base64Chars(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * done)), url));
+    }
+    return done;
+}
+
+template<typename Char>
+ADDIN_TARGET("ssse3")
+size_t decodeBase64Ssse3(const Char *text, size_t size, bool url, uint8_t *out) {
+    auto lookup = base64Lookup(url);
+    size_t done = 0;
+    for (__m128i bytes; size - done >= 16 && base64Bytes(load16(text + done), lookup, bytes); done += 16) {
+        uint8_t buffer[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buffer), bytes);
+        memcpy(out + done / 4 * 3, buffer, 12);
+    }
+    return done;
+}
+
+// 32 code units narrowed to bytes, as by load16
+template<typename Char>
+ADDIN_TARGET("avx2")
+__m256i load32(const Char *src) {
+    if constexpr (sizeof(Char) == 1) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    } else {
+        // Packing stays within 128 bit lanes, quarters are put back in order
+        auto packed = _mm256_packus_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src)),
+                                          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 16)));
+        return _mm256_permute4x64_epi64(packed, 0xD8);
+    }
+}
+
+// 32 ASCII characters as UTF-8 or UTF-16 code units
+template<typename Char>
+ADDIN_TARGET("avx2")
+void store32(Char *out, __m256i chars) {
+    if constexpr (sizeof(Char) == 1) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), chars);
+    } else {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chars)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 16),
+                            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chars, 1)));
+    }
+}
+
+// Both 128 bit lanes as by the SSSE3 version, shuffles stay within lanes
+ADDIN_TARGET("avx2")
+__m256i base64Chars(__m256i input, bool url) {
+    auto spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    input = _mm256_shuffle_epi8(input, _mm256_broadcastsi128_si256(spread));
+    auto high = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0FC0FC00)),
+                                   _mm256_set1_epi32(0x04000040));
+    auto low = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003F03F0)),
+                                  _mm256_set1_epi32(0x01000010));
+    auto indices = _mm256_or_si256(high, low);
+
+    auto range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+                                                    _mm256_set1_epi8(13)));
+    auto offsets = _mm256_broadcastsi128_si256(base64Offsets(url));
+    return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+}
+
+// 32 characters to 24 bytes in the low lanes
+ADDIN_TARGET("avx2")
+bool base64Bytes(__m256i input, const Base64Lookup &lookup, __m256i &bytes) {
+    auto low_mask = _mm256_set1_epi8(0x0F);
+    auto high = _mm256_and_si256(_mm256_srli_epi32(input, 4), low_mask);
+    auto low = _mm256_and_si256(input, low_mask);
+
+    auto invalid = _mm256_and_si256(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(lookup.low_bits), low),
+                                    _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(lookup.high_bits), high));
+    if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(invalid, _mm256_setzero_si256()))) {
+        return false;
+    }
+
+    auto special = _mm256_cmpeq_epi8(input, _mm256_broadcastsi128_si256(lookup.special));
+    auto lanes = _mm256_add_epi8(high, _mm256_and_si256(special, _mm256_broadcastsi128_si256(lookup.special_shift)));
+    auto values = _mm256_add_epi8(input, _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(lookup.offsets), lanes));
+
+    auto pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    auto words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    auto pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    bytes = _mm256_shuffle_epi8(words, _mm256_broadcastsi128_si256(pack));
+    bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    return true;
+}
+
+// The SSSE3 kernel takes what is left
+template<typename Char>
+ADDIN_TARGET("avx2")
+size_t encodeBase64Avx2(const uint8_t *src, size_t groups, bool url, Char *out) {
+    size_t done = 0;
+    // 28 bytes are loaded for 8 groups
+    for (; groups - done >= 10; done += 8) {
+        auto first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * done));
+        auto second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * done + 12));
+        store32(out + 4 * done, base64Chars(_mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1), url));
+    }
+    return done + encodeBase64Ssse3(src + 3 * done, groups - done, url, out + 4 * done);
+}
+
+template<typename Char>
+ADDIN_TARGET("avx2")
+size_t decodeBase64Avx2(const Char *text, size_t size, bool url, uint8_t *out) {
+    auto lookup = base64Lookup(url);
+    size_t done = 0;
+    for (__m256i bytes; size - done >= 32 && base64Bytes(load32(text + done), lookup, bytes); done += 32) {
+        auto dst = reinterpret_cast<__m128i *>(out + done / 4 * 3);
+        _mm_storeu_si128(dst, _mm256_castsi256_si128(bytes));
+        _mm_storel_epi64(dst + 1, _mm256_extracti128_si256(bytes, 1));
+    }
+    return done + decodeBase64Ssse3(text + done, size - done, url, out + done / 4 * 3);
+}
+
+#elif defined(ADDIN_NEON)
+
+// 64 code units narrowed to bytes and spread over 4 registers by position in
+// the group. Units above 0xFF become 0xFF, which is invalid in every format.
+template<typename Char>
+uint8x16x4_t load64(const Char *src) {
+    if constexpr (sizeof(Char) == 1) {
+        return vld4q_u8(reinterpret_cast<const uint8_t *>(src));
+    } else {
+        static_assert(sizeof(Char) == 2, "UTF-16 code units expected");
+        auto units = reinterpret_cast<const uint16_t *>(src);
+        auto first = vld4q_u16(units), second = vld4q_u16(units + 32);
+        uint8x16x4_t result;
+        for (int i = 0; i < 4; ++i) {
+            result.val[i] = vcombine_u8(vqmovn_u16(first.val[i]), vqmovn_u16(second.val[i]));
+        }
+        return result;
+    }
+}
+
+// 4 registers interleaved to 64 ASCII characters as UTF-8 or UTF-16 code units
+template<typename Char>
+void store64(Char *out, const uint8x16x4_t &chars) {
+    if constexpr (sizeof(Char) == 1) {
+        vst4q_u8(reinterpret_cast<uint8_t *>(out), chars);
+    } else {
+        uint16x8x4_t low, high;
+        for (int i = 0; i < 4; ++i) {
+            low.val[i] = vmovl_u8(vget_low_u8(chars.val[i]));
+            high.val[i] = vmovl_high_u8(chars.val[i]);
+        }
+        vst4q_u16(reinterpret_cast<uint16_t *>(out), low);
+        vst4q_u16(reinterpret_cast<uint16_t *>(out) + 32, high);
+    }
+}
+
+// 64 bytes of a table for vqtbl4q_u8
+uint8x16x4_t loadTable(const uint8_t *table) {
+    return {{vld1q_u8(table), vld1q_u8(table + 16), vld1q_u8(table + 32), vld1q_u8(table + 48)}};
+}
+
+// 16 groups a step, deinterleaved by position in the group
+template<typename Char>
+size_t encodeBase64Neon(const uint8_t *src, size_t groups, bool url, Char *out) {
+    auto alphabet = loadTable(reinterpret_cast<const uint8_t *>(url ? BASE64_URL_ALPHABET : BASE64_ALPHABET));
+    auto mask = vdupq_n_u8(0x3F);
+    size_t done = 0;
+    for (; groups - done >= 16; done += 16) {
+        auto bytes = vld3q_u8(src + 3 * done);
+        uint8x16x4_t chars;
+        chars.val[0] = vshrq_n_u8(bytes.val[0], 2);
+        chars.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(bytes.val[0], 4), vshrq_n_u8(bytes.val[1], 4)), mask);
+        chars.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(bytes.val[1], 2), vshrq_n_u8(bytes.val[2], 6)), mask);
+        chars.val[3] = vandq_u8(bytes.val[2], mask);
+        for (auto &c : chars.val) {
+            c = vqtbl4q_u8(alphabet, c);
+        }
+        store64(out + 4 * done, chars);
+    }
+    return done;
+}
+
+// Characters are looked up in both halves of the decoding table,
+// whitespace, padding and characters beyond ASCII stop the loop
+template<typename Char>
+size_t decodeBase64Neon(const Char *text, size_t size, bool url, uint8_t *out) {
+    auto &table = url ? BASE64_URL_VALUES : BASE64_VALUES;
+    auto low = loadTable(table.data()), high = loadTable(table.data() + 64);
+    auto upper = vdupq_n_u8(64), beyond = vdupq_n_u8(128);
+    size_t done = 0;
+    for (; size - done >= 64; done += 64) {
+        auto chars = load64(text + done);
+        uint8x16x4_t values;
+        auto invalid = vdupq_n_u8(0);
+        for (int i = 0; i < 4; ++i) {
+            // Characters of the lower half wrap around beyond the upper one and keep their values
+            values.val[i] = vqtbx4q_u8(vqtbl4q_u8(low, chars.val[i]), high, vsubq_u8(chars.val[i], upper));
+            invalid = vorrq_u8(invalid, vorrq_u8(values.val[i], vcgeq_u8(chars.val[i], beyond)));
+        }
+        if (vmaxvq_u8(invalid) >= 64) {
+            break;
+        }
+        uint8x16x3_t bytes;
+        bytes.val[0] = vorrq_u8(vshlq_n_u8(values.val[0], 2), vshrq_n_u8(values.val[1], 4));
+        bytes.val[1] = vorrq_u8(vshlq_n_u8(values.val[1], 4), vshrq_n_u8(values.val[2], 2));
+        bytes.val[2] = vorrq_u8(vshlq_n_u8(values.val[2], 6), values.val[3]);
+        vst3q_u8(out + done / 4 * 3, bytes);
+    }
+    return done;
+}
+
+#endif
+
+// Vector loops over whole Base64 blocks in UTF-8 or UTF-16. They return
+// groups encoded or characters decoded, the rest is left to the scalar code.
+template<typename Char>
+struct Base64Kernels {
+    size_t (*encode)(const uint8_t *src, size_t groups, bool url, Char *out);
+    size_t (*decode)(const Char *text, size_t size, bool url, uint8_t *out);
+};
+
+template<typename Char>
+size_t encodeNothing(const uint8_t *, size_t, bool, Char *) {
+    return 0;
+}
+
+template<typename Char>
+size_t decodeNothing(const Char *, size_t, bool, uint8_t *) {
+    return 0;
+}
+
+template<typename Char>
+Base64Kernels<Char> selectKernels() {
+#if defined(ADDIN_SSE2)
+    if (cpuFeatures().avx2) {
+        return {encodeBase64Avx2<Char>, decodeBase64Avx2<Char>};
+    }
+    if (cpuFeatures().ssse3) {
+        return {encodeBase64Ssse3<Char>, decodeBase64Ssse3<Char>};
+    }
+#elif defined(ADDIN_NEON)
+    return {encodeBase64Neon<Char>, decodeBase64Neon<Char>};
+#endif
+    return {encodeNothing<Char>, decodeNothing<Char>};
+}
+
+// The widest the CPU has, selected at load
+template<typename Char>
+const Base64Kernels<Char> BASE64_KERNELS = selectKernels<Char>();
+
+template<typename Char>
+Char *encodeBase64(const uint8_t *src, size_t groups, bool url, Char *out) {
+    auto alphabet = url ? BASE64_URL_ALPHABET : BASE64_ALPHABET;
+    auto done = BASE64_KERNELS<Char>.encode(src, groups, url, out);
+    src += 3 * done;
+    out += 4 * done;
+    for (groups -= done; groups > 0; --groups, src += 3, out += 4) {
+        uint32_t bits = uint32_t(src[0]) << 16 | uint32_t(src[1]) << 8 | src[2];
+        out[0] = alphabet[bits >> 18];
+        out[1] = alphabet[(bits >> 12) & 0x3F];
+        out[2] = alphabet[(bits >> 6) & 0x3F];
+        out[3] = alphabet[bits & 0x3F];
+    }
+    return out;
+}
+
+template<typename Char>
+Char *encodeHex(const uint8_t *src, size_t size, Char *out) {
+#ifdef ADDIN_SSE2
+    for (; size >= 16; size -= 16, src += 16, out += 32) {
+        encodeHexBlock(src, out);
+    }
+#endif
+    for (; size > 0; --size, ++src, out += 2) {
+        out[0] = HEX_DIGITS[*src >> 4];
+        out[1] = HEX_DIGITS[*src & 0x0F];
+    }
+    return out;
+}
+
+}
+
+size_t Encoder::encodedSize(size_t size, bool finish) const {
+    if (format == CodecFormat::HEX) {
+        return 2 * size;
+    }
+    auto total = carry_size + size;
+    auto rest = finish ? total % 3 : 0;
+    return total / 3 * 4 + (rest == 0 ? 0 : format == CodecFormat::BASE64 ? 4 : rest + 1);
+}
+
+template<typename Char>
+Char *Encoder::encode(const char *data, size_t size, Char *out) {
+    auto src = reinterpret_cast<const uint8_t *>(data);
+
+    if (format == CodecFormat::HEX) {
+        return encodeHex(src, size, out);
+    }
+
+    auto url = format == CodecFormat::BASE64_URL;
+
+    // Completes the group left from the previous chunk
+    if (carry_size > 0) {
+        while (carry_size < 3 && size > 0) {
+            carry[carry_size++] = *src++;
+            --size;
+        }
+        if (carry_size < 3) {
+            return out;
+        }
+        out = encodeBase64(carry, 1, url, out);
+        carry_size = 0;
+    }
+
+    auto groups = size / 3;
+    out = encodeBase64(src, groups, url, out);
+
+    carry_size = size - 3 * groups;
+    memcpy(carry, src + 3 * groups, carry_size);
+    return out;
+}
+
+template<typename Char>
+Char *Encoder::finish(Char *out) {
+    if (carry_size == 0) {
+        return out;
+    }
+
+    auto alphabet = format == CodecFormat::BASE64_URL ? BASE64_URL_ALPHABET : BASE64_ALPHABET;
+    uint32_t bits = uint32_t(carry[0]) << 16 | (carry_size > 1 ? uint32_t(carry[1]) << 8 : 0);
+    *out++ = alphabet[bits >> 18];
+    *out++ = alphabet[(bits >> 12) & 0x3F];
+    if (carry_size > 1) {
+        *out++ = alphabet[(bits >> 6) & 0x3F];
+    }
+    if (format == CodecFormat::BASE64) {
+        for (auto i = carry_size; i < 3; ++i) {
+            *out++ = '=';
+        }
+    }
+    carry_size = 0;
+    return out;
+}
+
+void Encoder::encode(const char *data, size_t size, std::string &out) {
+    auto offset = out.size();
+    out.resize(offset + encodedSize(size, false));
+    encode(data, size, &out[offset]);
+}
+
+void Encoder::finish(std::string &out) {
+    auto offset = out.size();
+    out.resize(offset + encodedSize(0, true));
+    finish(&out[offset]);
+}
+
+template<typename Char>
+void Decoder::decode(const Char *text, size_t size, std::string &out) {
+    auto offset = out.size();
+    out.resize(offset + (format == CodecFormat::HEX ? (size + 1) / 2 : (size + 3) / 4 * 3));
+
+    auto begin = reinterpret_cast<uint8_t *>(&out[offset]);
+    auto end = format == CodecFormat::HEX ? decodeHex(text, size, begin) : decodeBase64(text, size, begin);
+    out.resize(offset + (end - begin));
+}
+
+void Decoder::finish(std::string &out) {
+    if (format == CodecFormat::HEX ? count > 0 : count == 1) {
+        throw std::invalid_argument(u8"Text ends in the middle of a group");
+    }
+    uint8_t rest[2];
+    out.append(reinterpret_cast<const char *>(rest), flush(rest) - rest);
+    padded = false;
+}
+
+template<typename Char>
+uint8_t *Decoder::decodeBase64(const Char *text, size_t size, uint8_t *out) {
+    auto &table = format == CodecFormat::BASE64_URL ? BASE64_URL_VALUES : BASE64_VALUES;
+
+    size_t i = 0;
+    while (i < size) {
+        if (count == 0 && !padded) {
+            auto done = BASE64_KERNELS<Char>.decode(text + i, size - i, format == CodecFormat::BASE64_URL, out);
+            i += done;
+            out += done / 4 * 3;
+            // Whole groups without whitespace and padding
+            for (; size - i >= 4; i += 4, out += 3) {
+                uint32_t a = valueOf(text[i], table), b = valueOf(text[i + 1], table);
+                uint32_t c = valueOf(text[i + 2], table), d = valueOf(text[i + 3], table);
+                if ((a | b | c | d) >= 64) {
+                    break;
+                }
+                uint32_t group = a << 18 | b << 12 | c << 6 | d;
+                out[0] = static_cast<uint8_t>(group >> 16);
+                out[1] = static_cast<uint8_t>(group >> 8);
+                out[2] = static_cast<uint8_t>(group);
+            }
+        }
+        // A block the fast path can't take, e.g. with a line break, and the rest of its group
+        auto stop = std::min(size, i + 16);
+        for (; i < size && (i < stop || count > 0); ++i) {
+            auto value = valueOf(text[i], table);
+            if (value < 64 && !padded) {
+                bits = bits << 6 | value;
+                if (++count == 4) {
+                    out[0] = static_cast<uint8_t>(bits >> 16);
+                    out[1] = static_cast<uint8_t>(bits >> 8);
+                    out[2] = static_cast<uint8_t>(bits);
+                    out += 3;
+                    bits = 0;
+                    count = 0;
+                }
+            } else if (value == PAD && (padded || count >= 2)) {
+                out = flush(out);
+                padded = true;
+            } else if (value != SPACE) {
+                throw std::invalid_argument(u8"Invalid Base64 text");
+            }
+        }
+    }
+    return out;
+}
+
+template<typename Char>
+uint8_t *Decoder::decodeHex(const Char *text, size_t size, uint8_t *out) {
+    size_t i = 0;
+    while (i < size) {
+        if (count == 0) {
+#ifdef ADDIN_SSE2
+            for (; size - i >= 32 && decodeHexBlock(text + i, out); i += 32, out += 16) {
+            }
+#endif
+            for (; size - i >= 2; i += 2, ++out) {
+                uint32_t high = valueOf(text[i], HEX_VALUES), low = valueOf(text[i + 1], HEX_VALUES);
+                if ((high | low) >= 16) {
+                    break;
+                }
+                *out = static_cast<uint8_t>(high << 4 | low);
+            }
+        }
+        auto stop = std::min(size, i + 32);
+        for (; i < size && (i < stop || count > 0); ++i) {
+            auto value = valueOf(text[i], HEX_VALUES);
+            if (value < 16) {
+                bits = bits << 4 | value;
+                if (++count == 2) {
+                    *out++ = static_cast<uint8_t>(bits);
+                    bits = 0;
+                    count = 0;
+                }
+            } else if (value != SPACE) {
+                throw std::invalid_argument(u8"Invalid hex text");
+            }
+        }
+    }
+    return out;
+}
+
+// Bytes of an incomplete Base64 group, 2 or 3 characters hold 1 or 2 bytes
+uint8_t *Decoder::flush(uint8_t *out) {
+    if (count == 2) {
+        *out++ = static_cast<uint8_t>(bits >> 4);
+    } else if (count == 3) {
+        *out++ = static_cast<uint8_t>(bits >> 10);
+        *out++ = static_cast<uint8_t>(bits >> 2);
+    }
+    bits = 0;
+    count = 0;
+    return out;
+}
+
+// Code units of UTF-8 strings and host strings
+template char *Encoder::encode(const char *, size_t, char *);
+
+template WCHAR_T *Encoder::encode(const char *, size_t, WCHAR_T *);
+
+template char *Encoder::finish(char *);
+
+template WCHAR_T *Encoder::finish(WCHAR_T *);
+
+template void Decoder::decode(const char *, size_t, std::string &);
+
+template void Decoder::decode(const WCHAR_T *, size_t, std::string &);
+
+int32_t CodecRegistry::openEncoder(CodecFormat format) {
+    encoders.emplace(++last_handle, Encoder(format));
+    return last_handle;
+}
+
+int32_t CodecRegistry::openDecoder(CodecFormat format) {
+    decoders.emplace(++last_handle, Decoder(format));
+    return last_handle;
+}
+
+Encoder &CodecRegistry::encoder(int32_t handle) {
+    auto it = encoders.find(handle);
+    if (it == encoders.end()) {
+        throw std::runtime_error(u8"Encoder is not open");
+    }
+    return it->second;
+}
+
+Decoder &CodecRegistry::decoder(int32_t handle) {
+    auto it = decoders.find(handle);
+    if (it == decoders.end()) {
+        throw std::runtime_error(u8"Decoder is not open");
+    }
+    return it->second;
+}
+
+bool CodecRegistry::finish(int32_t handle, std::string &out) {
+    auto encoder = encoders.find(handle);
+    if (encoder != encoders.end()) {
+        auto codec = encoder->second;
+        encoders.erase(encoder);
+        codec.finish(out);
+        return true;
+    }
+
+    auto decoder = decoders.find(handle);
+    if (decoder == decoders.end()) {
+        throw std::runtime_error(u8"Codec is not open");
+    }
+    auto codec = decoder->second;
+    decoders.erase(decoder);
+    codec.finish(out);
+    return false;
+}
+
+void CodecRegistry::clear() {
+    encoders.clear();
+    decoders.clear();
+}
@@ -0,0 +1,118 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CODECS_H
+#define CODECS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Text forms of binary data: Base64 of RFC 4648 with the standard or the
+// URL-safe alphabet, and hex in upper case as 1C writes it. Encoders emit
+// ASCII, decoders take UTF-8 or host UTF-16 code units, so host strings are
+// decoded as they are. Decoders skip whitespace, e.g. line breaks of 1C Base64
+// strings, accept digits in any case and Base64 with or without padding.
+enum class CodecFormat {
+    BASE64,
+    BASE64_URL, // Written without padding
+    HEX
+};
+
+// Encodes data given in chunks, bytes of an incomplete group wait for the next one
+class Encoder {
+public:
+    explicit Encoder(CodecFormat format_) : format(format_) {};
+
+    // Characters the next encode writes, along with the last group when finishing
+    size_t encodedSize(size_t size, bool finish) const;
+
+    // Writes text of all complete groups, returns its end
+    template<typename Char>
+    Char *encode(const char *data, size_t size, Char *out);
+
+    // Writes the last group, returns its end
+    template<typename Char>
+    Char *finish(Char *out);
+
+    // Appends text of all complete groups
+    void encode(const char *data, size_t size, std::string &out);
+
+    // Appends the last group
+    void finish(std::string &out);
+
+private:
+    CodecFormat format;
+    uint8_t carry[3] = {};
+    size_t carry_size = 0;
+};
+
+// Decodes text given in chunks, characters of an incomplete group wait for the next one
+class Decoder {
+public:
+    explicit Decoder(CodecFormat format_) : format(format_) {};
+
+    // Appends bytes of all complete groups, throws on invalid text
+    template<typename Char>
+    void decode(const Char *text, size_t size, std::string &out);
+
+    // Appends the last group, throws when it is incomplete
+    void finish(std::string &out);
+
+private:
+    template<typename Char>
+    uint8_t *decodeBase64(const Char *text, size_t size, uint8_t *out);
+
+    template<typename Char>
+    uint8_t *decodeHex(const Char *text, size_t size, uint8_t *out);
+
+    uint8_t *flush(uint8_t *out);
+
+    CodecFormat format;
+    uint32_t bits = 0;
+    size_t count = 0; // Characters of the current group
+    bool padded = false;
+};
+
+// Streaming codecs opened by a component, by handle
+class CodecRegistry {
+public:
+    int32_t openEncoder(CodecFormat format);
+
+    int32_t openDecoder(CodecFormat format);
+
+    // Throw when the handle is not an encoder or a decoder respectively
+    Encoder &encoder(int32_t handle);
+
+    Decoder &decoder(int32_t handle);
+
+    // Appends the last group and closes the codec even when it throws.
+    // Returns true for an encoder, so out is text, and false for a decoder.
+    bool finish(int32_t handle, std::string &out);
+
+    void clear();
+
+private:
+    int32_t last_handle = 0;
+    std::map<int32_t, Encoder> encoders;
+    std::map<int32_t, Decoder> decoders;
+};
+
+#endif //CODECS_H
@@ -1,4 +1,4 @@
-/*
+﻿/*
  *  Modern Native AddIn
  *  Copyright (C) 2018  Infactum
  *
@@ -18,35 +18,217 @@
  */
 
 #include <algorithm>
+#include <cmath>
 #include <codecvt>
-#include <cwctype>
+#include <cstring>
+#include <limits>
 #include <locale>
+#include <optional>
+#include <stdexcept>
+#include <vector>
 
+#include "CaseFolding.h"
 #include "Component.h"
+#include "Numbers.h"
+#include "Simd.h"
+#include "Trace.h"
 
 #ifdef _WINDOWS
 #pragma warning (disable : 4267)
 #endif
 
+namespace {
+
+// Calls sink for every UTF-16 unit of UTF-8 text, throws on malformed input
+template<typename Sink>
+void decodeUTF8(std::string_view src, Sink &&sink) {
+    static constexpr uint32_t min_code_point[] = {0, 0, 0x80, 0x800, 0x10000};
+
+    size_t i = 0;
+    while (i < src.size()) {
+        auto c = static_cast<uint8_t>(src[i]);
+        if (c < 0x80) {
+            sink(static_cast<char16_t>(c));
+            ++i;
+            continue;
+        }
+
+        uint32_t cp;
+        size_t length;
+        if ((c & 0xE0) == 0xC0) {
+            cp = c & 0x1F;
+            length = 2;
+        } else if ((c & 0xF0) == 0xE0) {
+            cp = c & 0x0F;
+            length = 3;
+        } else if ((c & 0xF8) == 0xF0) {
+            cp = c & 0x07;
+            length = 4;
+        } else {
+            throw std::range_error(u8"Invalid UTF-8 sequence");
+        }
+
+        if (src.size() - i < length) {
+            throw std::range_error(u8"Invalid UTF-8 sequence");
+        }
+        for (size_t k = 1; k < length; ++k) {
+            auto b = static_cast<uint8_t>(src[i + k]);
+            if ((b & 0xC0) != 0x80) {
+                throw std::range_error(u8"Invalid UTF-8 sequence");
+            }
+            cp = (cp << 6) | (b & 0x3F);
+        }
+        if (cp < min_code_point[length] || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000)) {
+            throw std::range_error(u8"Invalid UTF-8 sequence");
+        }
+
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            sink(static_cast<char16_t>(0xD800 + (cp >> 10)));
+            sink(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+        } else {
+            sink(static_cast<char16_t>(cp));
+        }
+        i += length;
+    }
+}
+
+bool isAscii(std::string_view src) {
+    size_t i = 0;
+#ifdef ADDIN_SSE2
+    for (; i + 16 <= src.size(); i += 16) {
+        if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src.data() + i)))) {
+            return false;
+        }
+    }
+#endif
+    for (; i < src.size(); ++i) {
+        if (static_cast<uint8_t>(src[i]) >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void widenAscii(std::string_view src, WCHAR_T *dst) {
+    size_t i = 0;
+#ifdef ADDIN_SSE2
+    auto zero = _mm_setzero_si128();
+    for (; i + 16 <= src.size(); i += 16) {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src.data() + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(bytes, zero));
+    }
+#endif
+    for (; i < src.size(); ++i) {
+        dst[i] = static_cast<WCHAR_T>(src[i]);
+    }
+}
+
+// Host number of any width or numeric text, false when the value doesn't fit exactly
+template<typename T>
+bool coerceNumber(const tVariant &src, T &dst) {
+    switch (src.vt) {
+        case VTYPE_I1:
+            return exactCast(src.i8Val, dst);
+        case VTYPE_I2:
+            return exactCast(src.shortVal, dst);
+        case VTYPE_I4:
+            return exactCast(src.lVal, dst);
+        case VTYPE_INT:
+            return exactCast(src.intVal, dst);
+        case VTYPE_I8:
+            return exactCast(src.llVal, dst);
+        case VTYPE_UI1:
+            return exactCast(src.ui8Val, dst);
+        case VTYPE_UI2:
+            return exactCast(src.ushortVal, dst);
+        case VTYPE_UI4:
+            return exactCast(src.ulVal, dst);
+        case VTYPE_UINT:
+            return exactCast(src.uintVal, dst);
+        case VTYPE_UI8:
+            return exactCast(src.ullVal, dst);
+        case VTYPE_R4:
+            return exactCast(src.fltVal, dst);
+        case VTYPE_R8:
+            return exactCast(src.dblVal, dst);
+        case VTYPE_PWSTR:
+            return parseNumber(std::basic_string_view(src.pwstrVal, src.wstrLen), dst);
+        default:
+            return false;
+    }
+}
+
+// Same for a value already converted from the host, e.g. one given to a property setter
+template<typename T>
+bool coerceNumber(const variant_t &src, T &dst) {
+    return std::visit(overloaded{
+            [&](const std::string &v) { return parseNumber(std::string_view(v), dst); },
+            [](bool) { return false; },
+            [&](const auto &v) {
+                if constexpr (std::is_arithmetic<std::decay_t<decltype(v)>>::value) {
+                    return exactCast(v, dst);
+                } else {
+                    return false;
+                }
+            }
+    }, src);
+}
+
+}
+
+Component::Component() : Component(staticRegistration<Component>()) {}
+
+Component::Component(const StaticRegistration &registration)
+        : static_methods(registration.methods), static_properties(registration.properties) {}
+
 bool Component::Init(void *connection_) {
     connection = static_cast<IAddInDefBase *>(connection_);
+
+    // Registration is complete at this point, so statistics slots can be laid out.
+    // Names are looked up on demand, static ones are encoded during compilation.
+    statistics.setSlots(GetNMethods() + GetNProps(), [this](size_t slot) -> const char * {
+        auto methods_count = static_cast<size_t>(GetNMethods());
+        if (slot < methods_count) {
+            return slot < static_methods.size ? static_methods.defs[slot].name.data()
+                                              : methods_meta[slot - static_methods.size].name.c_str();
+        }
+        slot -= methods_count;
+        return slot < static_properties.size ? static_properties.defs[slot].name.data()
+                                             : properties_meta[slot - static_properties.size].name.c_str();
+    });
+
+    property_versions.reset(new std::atomic<uint64_t>[GetNProps()]());
+
     return connection != nullptr;
 }
 
+void Component::Done() {
+    change_notifier.stop();
+    change_event_interval = 0;
+
+    shutdown();
+
+
+    call_recorder.stop();
+    record_file.clear();
+
+    if (!trace_file.empty()) {
+        Trace::flush(trace_file);
+        Trace::disable();
+        trace_file.clear();
+    }
+}
+
 bool Component::setMemManager(void *memory_manager_) {
     memory_manager = static_cast<IMemoryManager *>(memory_manager_);
     return memory_manager != nullptr;
 }
 
-void Component::SetLocale(const WCHAR_T *locale) {
-#ifdef CASE_INSENSITIVE
-    try {
-        std::locale::global(std::locale{toUTF8String(locale)});
-    } catch (std::runtime_error &) {
-        std::locale::global(std::locale{""});
-    }
-#endif
-}
+// Case insensitive lookup uses locale independent case folding,
+// so process global locale is left untouched
+void Component::SetLocale(const WCHAR_T *locale) {}
 
 bool Component::RegisterExtensionAs(WCHAR_T **ext_name) {
     auto name = extensionName();
@@ -61,58 +243,81 @@ bool Component::RegisterExtensionAs(WCHAR_T **ext_name) {
 }
 
 long Component::GetNProps() {
-    return properties_meta.size();
+    return static_properties.size + properties_meta.size();
 }
 
 long Component::FindProp(const WCHAR_T *prop_name) {
 
-    std::wstring lookup_name = toWstring(prop_name);
-
-#ifdef CASE_INSENSITIVE
-    lookup_name = toUpper(lookup_name);
-
-    for (auto i = 0u; i < properties_meta.size(); ++i) {
-        if (toUpper(properties_meta[i].alias) == lookup_name
-            || toUpper(properties_meta[i].alias_ru) == lookup_name) {
-            return static_cast<long>(i);
-        }
+    auto index = static_properties.find(prop_name);
+    if (index >= 0) {
+        return index;
     }
-#else
+
     for (auto i = 0u; i < properties_meta.size(); ++i) {
-        if (properties_meta[i].alias == lookup_name
-            || properties_meta[i].alias_ru == lookup_name) {
-            return static_cast<long>(i);
+        if (matchesKey(prop_name, properties_meta[i].key)
+            || matchesKey(prop_name, properties_meta[i].key_ru)) {
+            return static_cast<long>(static_properties.size + i);
         }
     }
-#endif
     return -1;
 
 }
 
 const WCHAR_T *Component::GetPropName(long num, long lang_alias) {
 
-    std::wstring *name;
-    if (lang_alias == 0) {
-        name = &(properties_meta[num].alias);
+    WCHAR_T *result = nullptr;
+    if (num < static_cast<long>(static_properties.size)) {
+        auto &def = static_properties.defs[num];
+        storeVariable(lang_alias == 0 ? def.alias : def.alias_ru, &result);
     } else {
-        name = &(properties_meta[num].alias_ru);
+        auto &meta = properties_meta[num - static_properties.size];
+        storeVariable(toUTF16String(lang_alias == 0 ? meta.alias : meta.alias_ru), &result);
     }
 
-    WCHAR_T *result = nullptr;
-    storeVariable(std::u16string(reinterpret_cast<const char16_t *>(name->c_str())), &result);
-
     return result;
 }
 
 bool Component::GetPropVal(const long num, tVariant *value) {
 
+    Statistics::Recorder recorder(statistics, GetNMethods() + num);
+    std::optional<CallRecorder::Entry> entry;
+    if (call_recorder.active()) {
+        entry.emplace(call_recorder, CallRecorder::GET_PROP, statistics.name(GetNMethods() + num), nullptr, 0);
+    }
+
     try {
-        auto tmp = properties_meta[num].getter();
-        storeVariable(*tmp, *value);
+        recorder.next(Statistics::HANDLER);
+        // Getters may return values of AtomicValue storage, which stay valid while pinned
+        Epoch::Guard guard;
+        variant_t scratch;
+        if (num < static_cast<long>(static_properties.size)) {
+            auto &def = static_properties.defs[num];
+            if (def.getter) {
+                auto &result = def.getter(*this, scratch);
+                recorder.next(Statistics::STORE);
+                storeVariable(result, *value);
+            } else {
+                recorder.next(Statistics::STORE);
+                storeVariable(def.constant, *value);
+            }
+        } else {
+            auto &result = properties_meta[num - static_properties.size].getter(scratch);
+            recorder.next(Statistics::STORE);
+            storeVariable(result, *value);
+        }
+        recorder.out(variantSize(*value));
     } catch (const std::exception &e) {
+        recorder.fail();
+        if (entry) {
+            entry->fail();
+        }
         AddError(ADDIN_E_FAIL, extensionName(), e.what(), true);
         return false;
     } catch (...) {
+        recorder.fail();
+        if (entry) {
+            entry->fail();
+        }
         AddError(ADDIN_E_FAIL, extensionName(), UNKNOWN_EXCP, true);
         return false;
     }
@@ -122,13 +327,40 @@ bool Component::GetPropVal(const long num, tVariant *value) {
 
 bool Component::SetPropVal(const long num, tVariant *value) {
 
+    Statistics::Recorder recorder(statistics, GetNMethods() + num);
+    recorder.in(variantSize(*value));
+    std::optional<CallRecorder::Entry> entry;
+    if (call_recorder.active()) {
+        entry.emplace(call_recorder, CallRecorder::SET_PROP, statistics.name(GetNMethods() + num), value, 1);
+    }
+
     try {
+        // Static properties without a setter, e.g. constants, have no handler to call
+        if (!IsPropWritable(num)) {
+            throw std::runtime_error(u8"Property is not writable");
+        }
         auto tmp = toStlVariant(*value);
-        properties_meta[num].setter(std::move(tmp));
+        recorder.next(Statistics::HANDLER);
+        if (num < static_cast<long>(static_properties.size)) {
+            static_properties.defs[num].setter(*this, std::move(tmp));
+        } else {
+            properties_meta[num - static_properties.size].setter(std::move(tmp));
+        }
+        if (property_versions) {
+            property_versions[num].fetch_add(1, std::memory_order_release);
+        }
     } catch (const std::exception &e) {
+        recorder.fail();
+        if (entry) {
+            entry->fail();
+        }
         AddError(ADDIN_E_FAIL, extensionName(), e.what(), true);
         return false;
     } catch (...) {
+        recorder.fail();
+        if (entry) {
+            entry->fail();
+        }
         AddError(ADDIN_E_FAIL, extensionName(), UNKNOWN_EXCP, true);
         return false;
     }
@@ -137,65 +369,79 @@ bool Component::SetPropVal(const long num, tVariant *value) {
 }
 
 bool Component::IsPropReadable(const long lPropNum) {
-    return static_cast<bool>(properties_meta[lPropNum].getter);
+    if (lPropNum < static_cast<long>(static_properties.size)) {
+        auto &def = static_properties.defs[lPropNum];
+        return def.getter != nullptr || def.constant.type != Literal::EMPTY;
+    }
+    return static_cast<bool>(properties_meta[lPropNum - static_properties.size].getter);
 }
 
 bool Component::IsPropWritable(const long lPropNum) {
-    return static_cast<bool>(properties_meta[lPropNum].setter);
+    if (lPropNum < static_cast<long>(static_properties.size)) {
+        return static_properties.defs[lPropNum].setter != nullptr;
+    }
+    return static_cast<bool>(properties_meta[lPropNum - static_properties.size].setter);
 }
 
 long Component::GetNMethods() {
-    return methods_meta.size();
+    return static_methods.size + methods_meta.size();
 }
 
 long Component::FindMethod(const WCHAR_T *method_name) {
 
-    std::wstring lookup_name = toWstring(method_name);
+    Trace::Scope scope("FindMethod");
 
-#ifdef CASE_INSENSITIVE
-    lookup_name = toUpper(lookup_name);
-
-    for (auto i = 0u; i < methods_meta.size(); ++i) {
-        if (toUpper(methods_meta[i].alias) == lookup_name
-            || toUpper(methods_meta[i].alias_ru) == lookup_name) {
-            return static_cast<long>(i);
-        }
+    auto index = static_methods.find(method_name);
+    if (index >= 0) {
+        return index;
     }
-#else
+
     for (auto i = 0u; i < methods_meta.size(); ++i) {
-        if (methods_meta[i].alias == lookup_name
-            || methods_meta[i].alias_ru == lookup_name) {
-            return static_cast<long>(i);
+        if (matchesKey(method_name, methods_meta[i].key)
+            || matchesKey(method_name, methods_meta[i].key_ru)) {
+            return static_cast<long>(static_methods.size + i);
         }
     }
-#endif
 
     return -1;
 }
 
 const WCHAR_T *Component::GetMethodName(const long num, const long lang_alias) {
 
-    std::wstring *name;
-    if (lang_alias == 0) {
-        name = &(methods_meta[num].alias);
+    WCHAR_T *result = nullptr;
+    if (num < static_cast<long>(static_methods.size)) {
+        auto &def = static_methods.defs[num];
+        storeVariable(lang_alias == 0 ? def.alias : def.alias_ru, &result);
     } else {
-        name = &(methods_meta[num].alias_ru);
+        auto &meta = methods_meta[num - static_methods.size];
+        storeVariable(toUTF16String(lang_alias == 0 ? meta.alias : meta.alias_ru), &result);
     }
 
-    WCHAR_T *result = nullptr;
-    storeVariable(std::u16string(reinterpret_cast<const char16_t *>(name->c_str())), &result);
-
     return result;
 
 }
 
 long Component::GetNParams(const long method_num) {
-    return methods_meta[method_num].params_count;
+    if (method_num < static_cast<long>(static_methods.size)) {
+        return static_methods.defs[method_num].params_count;
+    }
+    return methods_meta[method_num - static_methods.size].params_count;
 }
 
 bool Component::GetParamDefValue(const long method_num, const long param_num, tVariant *def_value) {
 
-    auto &def_args = methods_meta[method_num].default_args;
+    if (method_num < static_cast<long>(static_methods.size)) {
+        auto &def = static_methods.defs[method_num];
+        for (size_t i = 0; i < def.default_args_count; ++i) {
+            if (def.default_args[i].param == param_num) {
+                storeVariable(def.default_args[i].value, *def_value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    auto &def_args = methods_meta[method_num - static_methods.size].default_args;
 
     auto it = def_args.find(param_num);
     if (it == def_args.end()) {
@@ -207,50 +453,101 @@ bool Component::GetParamDefValue(const long method_num, const long param_num, tV
 }
 
 bool Component::HasRetVal(const long method_num) {
-    return methods_meta[method_num].returns_value;
+    if (method_num < static_cast<long>(static_methods.size)) {
+        return static_methods.defs[method_num].returns_value;
+    }
+    return methods_meta[method_num - static_methods.size].returns_value;
 }
 
 bool Component::CallAsProc(const long method_num, tVariant *params, const long array_size) {
 
+    Statistics::Recorder recorder(statistics, method_num);
+    std::optional<CallRecorder::Entry> entry;
+    if (call_recorder.active()) {
+        entry.emplace(call_recorder, CallRecorder::PROC, statistics.name(method_num), params, array_size);
+    }
+
+    std::optional<Error> error;
     try {
-        auto args = parseParams(params, array_size);
-        methods_meta[method_num].call(args);
+        for (long i = 0; i < array_size; ++i) {
+            recorder.in(variantSize(params[i]));
+        }
+        // Parameters are bound within PARSE, the binder switches to HANDLER
+        CallPhases phases{recorder, statistics.name(method_num)};
+        auto result = callMethod(method_num, params, array_size, phases);
+        if (!result) {
+            error = std::move(result.error());
+        } else {
+            recorder.next(Statistics::STORE);
 #ifdef OUT_PARAMS
-        storeParams(args, params);
+            for (long i = 0; i < array_size; ++i) {
+                recorder.out(variantSize(params[i]));
+            }
 #endif
+        }
     } catch (const std::exception &e) {
-        AddError(ADDIN_E_FAIL, extensionName(), e.what(), true);
-        return false;
+        error.emplace(e.what());
     } catch (...) {
-        AddError(ADDIN_E_FAIL, extensionName(), UNKNOWN_EXCP, true);
-        return false;
+        error.emplace(UNKNOWN_EXCP);
     }
 
-    return true;
+    return !error || failCall(recorder, entry, *error);
 }
 
 bool Component::CallAsFunc(const long method_num, tVariant *ret_value, tVariant *params, const long array_size) {
 
+    Statistics::Recorder recorder(statistics, method_num);
+    std::optional<CallRecorder::Entry> entry;
+    if (call_recorder.active()) {
+        entry.emplace(call_recorder, CallRecorder::FUNC, statistics.name(method_num), params, array_size);
+    }
+
+    std::optional<Error> error;
     try {
-        auto args = parseParams(params, array_size);
-        variant_t result = methods_meta[method_num].call(args);
-        storeVariable(result, *ret_value);
+        for (long i = 0; i < array_size; ++i) {
+            recorder.in(variantSize(params[i]));
+        }
+        // Parameters are bound within PARSE, the binder switches to HANDLER
+        CallPhases phases{recorder, statistics.name(method_num), ret_value};
+        auto result = callMethod(method_num, params, array_size, phases);
+        if (!result) {
+            error = std::move(result.error());
+        } else {
+            recorder.next(Statistics::STORE);
+            if (!phases.stored) {
+                storeVariable(*result, *ret_value);
+            }
+            recorder.out(variantSize(*ret_value));
 #ifdef OUT_PARAMS
-        storeParams(args, params);
+            for (long i = 0; i < array_size; ++i) {
+                recorder.out(variantSize(params[i]));
+            }
 #endif
+        }
     } catch (const std::exception &e) {
-        AddError(ADDIN_E_FAIL, extensionName(), e.what(), true);
-        return false;
+        error.emplace(e.what());
     } catch (...) {
-        AddError(ADDIN_E_FAIL, extensionName(), UNKNOWN_EXCP, true);
-        return false;
+        error.emplace(UNKNOWN_EXCP);
     }
 
-    return true;
+    return !error || failCall(recorder, entry, *error);
+
+}
 
+// Errors returned by handlers and exceptions thrown by them end up here
+bool Component::failCall(Statistics::Recorder &recorder, std::optional<CallRecorder::Entry> &entry,
+                         const Error &error) {
+    recorder.fail();
+    if (entry) {
+        entry->fail();
+    }
+    AddError(error.code, extensionName(), error.message, true);
+    return false;
 }
 
 void Component::AddError(unsigned short code, const std::string &src, const std::string &msg, bool throw_excp) {
+    Trace::Scope scope("AddError");
+
     WCHAR_T *source = nullptr;
     WCHAR_T *descr = nullptr;
 
@@ -259,11 +556,13 @@ void Component::AddError(unsigned short code, const std::string &src, const std:
 
     connection->AddError(code, source, descr, throw_excp);
 
-    memory_manager->FreeMemory(reinterpret_cast<void **>(&source));
-    memory_manager->FreeMemory(reinterpret_cast<void **>(&descr));
+    freeMemory(reinterpret_cast<void **>(&source));
+    freeMemory(reinterpret_cast<void **>(&descr));
 }
 
 bool Component::ExternalEvent(const std::string &src, const std::string &msg, const std::string &data) {
+    Trace::Scope scope("ExternalEvent");
+
     WCHAR_T *wszSource = nullptr;
     WCHAR_T *wszMessage = nullptr;
     WCHAR_T *wszData = nullptr;
@@ -274,9 +573,9 @@ bool Component::ExternalEvent(const std::string &src, const std::string &msg, co
 
     auto success = connection->ExternalEvent(wszSource, wszMessage, wszData);
 
-    memory_manager->FreeMemory(reinterpret_cast<void **>(&wszSource));
-    memory_manager->FreeMemory(reinterpret_cast<void **>(&wszMessage));
-    memory_manager->FreeMemory(reinterpret_cast<void **>(&wszData));
+    freeMemory(reinterpret_cast<void **>(&wszSource));
+    freeMemory(reinterpret_cast<void **>(&wszMessage));
+    freeMemory(reinterpret_cast<void **>(&wszData));
 
     return success;
 }
@@ -289,11 +588,42 @@ long Component::GetEventBufferDepth() {
     return connection->GetEventBufferDepth();
 }
 
+void Component::PropertyChanged(const std::wstring &alias) {
+    auto name = toUTF16String(alias);
+    auto num = FindProp(reinterpret_cast<const WCHAR_T *>(name.c_str()));
+    if (num >= 0 && property_versions) {
+        property_versions[num].fetch_add(1, std::memory_order_release);
+    }
+}
+
 void Component::AddProperty(const std::wstring &alias, const std::wstring &alias_ru,
                             std::function<std::shared_ptr<variant_t>(void)> getter,
                             std::function<void(variant_t &&)> setter) {
 
-    PropertyMeta meta{alias, alias_ru, std::move(getter), std::move(setter)};
+    std::function<const variant_t &(variant_t &)> reader;
+    if (getter) {
+        reader = [getter = std::move(getter)](variant_t &scratch) -> const variant_t & {
+            auto result = getter();
+            // Sole owner may give the value away
+            if (result.use_count() == 1) {
+                scratch = std::move(*result);
+            } else {
+                scratch = *result;
+            }
+            return scratch;
+        };
+    }
+
+    AddProperty(alias, alias_ru, std::move(reader), std::move(setter));
+
+}
+
+void Component::AddProperty(const std::wstring &alias, const std::wstring &alias_ru,
+                            std::function<const variant_t &(variant_t &scratch)> getter,
+                            std::function<void(variant_t &&)> setter) {
+
+    PropertyMeta meta{alias, alias_ru, lookupKey(alias), lookupKey(alias_ru), fromWstring(alias),
+                      std::move(getter), std::move(setter), nullptr};
     properties_meta.push_back(std::move(meta));
 
 }
@@ -306,8 +636,8 @@ void Component::AddProperty(const std::wstring &alias, const std::wstring &alias
     }
 
     AddProperty(alias, alias_ru,
-                [storage]() { // getter
-                    return storage;
+                [storage](variant_t &) -> const variant_t & { // getter
+                    return *storage;
                 },
                 [storage](variant_t &&v) -> void { //setter
                     *storage = std::move(v);
@@ -315,12 +645,53 @@ void Component::AddProperty(const std::wstring &alias, const std::wstring &alias
 
 }
 
+void Component::AddProperty(const std::wstring &alias, const std::wstring &alias_ru,
+                            std::shared_ptr<AtomicValue<variant_t>> storage) {
+
+    if (!storage) {
+        return;
+    }
+
+    AddProperty(alias, alias_ru,
+                [storage](variant_t &) -> const variant_t & { // getter
+                    return storage->get();
+                },
+                [storage](variant_t &&v) -> void { //setter
+                    storage->store(std::move(v));
+                });
+
+    properties_meta.back().version = [storage]() {
+        return storage->version();
+    };
+
+}
+
 variant_t Component::toStlVariant(tVariant src) {
     switch (src.vt) {
         case VTYPE_EMPTY:
             return UNDEFINED;
+        case VTYPE_I1:
+            return static_cast<int32_t>(src.i8Val);
+        case VTYPE_I2:
+            return static_cast<int32_t>(src.shortVal);
         case VTYPE_I4: //int32_t
-            return src.lVal;
+            return static_cast<int32_t>(src.lVal);
+        case VTYPE_INT:
+            return static_cast<int32_t>(src.intVal);
+        case VTYPE_UI1:
+            return static_cast<int32_t>(src.ui8Val);
+        case VTYPE_UI2:
+            return static_cast<int32_t>(src.ushortVal);
+        case VTYPE_UI4:
+            return static_cast<int64_t>(src.ulVal);
+        case VTYPE_UINT:
+            return static_cast<int64_t>(src.uintVal);
+        case VTYPE_I8: //int64_t
+            return static_cast<int64_t>(src.llVal);
+        case VTYPE_UI8: //uint64_t
+            return static_cast<uint64_t>(src.ullVal);
+        case VTYPE_R4: //float
+            return src.fltVal;
         case VTYPE_R8: //double
             return src.dblVal;
         case VTYPE_PWSTR: { //std::string
@@ -329,9 +700,11 @@ variant_t Component::toStlVariant(tVariant src) {
         case VTYPE_BOOL:
             return src.bVal;
         case VTYPE_BLOB:
-            return std::vector<char>(src.pstrVal, src.pstrVal + src.strLen);
+            return Blob(src.pstrVal, src.strLen);
         case VTYPE_TM:
-            return src.tmVal;
+            return Timestamp(src.tmVal);
+        case VTYPE_DATE:
+            return Timestamp::fromOleDate(src.date);
         default:
             throw std::bad_cast();
     }
@@ -339,13 +712,9 @@ variant_t Component::toStlVariant(tVariant src) {
 
 void Component::storeVariable(const variant_t &src, tVariant &dst) {
 
-    if (dst.vt == VTYPE_PWSTR && dst.pwstrVal != nullptr) {
-        memory_manager->FreeMemory(reinterpret_cast<void **>(&dst.pwstrVal));
-    }
+    Trace::Scope scope("storeVariable");
 
-    if ((dst.vt == VTYPE_PSTR || dst.vt == VTYPE_BLOB) && dst.pstrVal != nullptr) {
-        memory_manager->FreeMemory(reinterpret_cast<void **>(&dst.pstrVal));
-    }
+    clearVariable(dst);
 
     std::visit(overloaded{
             [&](std::monostate) { dst.vt = VTYPE_EMPTY; },
@@ -353,6 +722,18 @@ void Component::storeVariable(const variant_t &src, tVariant &dst) {
                 dst.vt = VTYPE_I4;
                 dst.lVal = v;
             },
+            [&](const int64_t &v) {
+                dst.vt = VTYPE_I8;
+                dst.llVal = v;
+            },
+            [&](const uint64_t &v) {
+                dst.vt = VTYPE_UI8;
+                dst.ullVal = v;
+            },
+            [&](const float &v) {
+                dst.vt = VTYPE_R4;
+                dst.fltVal = v;
+            },
             [&](const double &v) {
                 dst.vt = VTYPE_R8;
                 dst.dblVal = v;
@@ -361,106 +742,516 @@ void Component::storeVariable(const variant_t &src, tVariant &dst) {
                 dst.vt = VTYPE_BOOL;
                 dst.bVal = v;
             },
-            [&](const std::tm &v) {
+            [&](const Timestamp &v) {
                 dst.vt = VTYPE_TM;
-                dst.tmVal = v;
+                dst.tmVal = v.toTm();
             },
             [&](const std::string &v) { storeVariable(v, dst); },
-            [&](const std::vector<char> &v) { storeVariable(v, dst); }
+            [&](const Blob &v) { storeVariable(v, dst); }
     }, src);
 
 }
 
-void Component::storeVariable(const std::string &src, tVariant &dst) {
+void Component::clearVariable(tVariant &dst) {
+
+    if (dst.vt == VTYPE_PWSTR && dst.pwstrVal != nullptr) {
+        freeMemory(reinterpret_cast<void **>(&dst.pwstrVal));
+    }
 
-    std::u16string tmp = toUTF16String(src);
+    if ((dst.vt == VTYPE_PSTR || dst.vt == VTYPE_BLOB) && dst.pstrVal != nullptr) {
+        freeMemory(reinterpret_cast<void **>(&dst.pstrVal));
+    }
+}
 
+void Component::storeVariable(const std::string &src, tVariant &dst) {
     dst.vt = VTYPE_PWSTR;
-    storeVariable(tmp, &dst.pwstrVal);
-    dst.wstrLen = static_cast<uint32_t>(tmp.length());
+    dst.wstrLen = static_cast<uint32_t>(storeUTF16(src, &dst.pwstrVal));
 }
 
 void Component::storeVariable(const std::string &src, WCHAR_T **dst) {
-    std::u16string tmp = toUTF16String(src);
-    storeVariable(tmp, dst);
+    storeUTF16(src, dst);
+}
+
+size_t Component::storeUTF16(std::string_view src, WCHAR_T **dst) {
+
+    // ASCII, e.g. encoded binary data, is widened without decoding
+    if (isAscii(src)) {
+        if (!allocMemory(reinterpret_cast<void **>(dst), (src.size() + 1) * sizeof(char16_t))) {
+            throw std::bad_alloc();
+        }
+        widenAscii(src, *dst);
+        (*dst)[src.size()] = 0;
+        return src.size();
+    }
+
+    size_t size = 0;
+    decodeUTF8(src, [&](char16_t) { ++size; });
+
+    if (!allocMemory(reinterpret_cast<void **>(dst), (size + 1) * sizeof(char16_t))) {
+        throw std::bad_alloc();
+    };
+
+    auto out = *dst;
+    decodeUTF8(src, [&](char16_t c) { *out++ = c; });
+    *out = 0;
+
+    return size;
 }
 
-void Component::storeVariable(const std::u16string &src, WCHAR_T **dst) {
+void Component::storeVariable(std::u16string_view src, WCHAR_T **dst) {
 
     size_t c_size = (src.size() + 1) * sizeof(char16_t);
 
-    if (!memory_manager || !memory_manager->AllocMemory(reinterpret_cast<void **>(dst), c_size)) {
+    if (!allocMemory(reinterpret_cast<void **>(dst), c_size)) {
         throw std::bad_alloc();
     };
 
-    memcpy(*dst, src.c_str(), c_size);
+    memcpy(*dst, src.data(), src.size() * sizeof(char16_t));
+    (*dst)[src.size()] = 0;
 }
 
-void Component::storeVariable(const std::vector<char> &src, tVariant &dst) {
+void Component::storeVariable(const HostText &src, CallPhases &phases) {
+    Trace::Scope scope("storeVariable");
+
+    // Side effects of the writer, e.g. of a streaming encoder, happen either way
+    if (!phases.result) {
+        std::vector<WCHAR_T> scratch(src.size + 1);
+        src.write(scratch.data());
+        return;
+    }
+
+    auto &dst = *phases.result;
+    clearVariable(dst);
+    WCHAR_T *text;
+    if (!allocMemory(reinterpret_cast<void **>(&text), static_cast<unsigned long>((src.size + 1) * sizeof(WCHAR_T)))) {
+        throw std::bad_alloc();
+    }
+    WCHAR_T *end;
+    try {
+        end = src.write(text);
+    } catch (...) {
+        freeMemory(reinterpret_cast<void **>(&text));
+        throw;
+    }
+    *end = 0;
+
+    dst.vt = VTYPE_PWSTR;
+    dst.pwstrVal = text;
+    dst.wstrLen = static_cast<uint32_t>(end - text);
+    phases.stored = true;
+}
+
+void Component::storeVariable(const Literal &src, tVariant &dst) {
+
+    clearVariable(dst);
+
+    switch (src.type) {
+        case Literal::INT:
+            dst.vt = VTYPE_I4;
+            dst.lVal = src.int_value;
+            break;
+        case Literal::DOUBLE:
+            dst.vt = VTYPE_R8;
+            dst.dblVal = src.double_value;
+            break;
+        case Literal::BOOL:
+            dst.vt = VTYPE_BOOL;
+            dst.bVal = src.bool_value;
+            break;
+        case Literal::STRING: {
+            std::u16string_view tmp(src.string_value);
+            dst.vt = VTYPE_PWSTR;
+            storeVariable(tmp, &dst.pwstrVal);
+            dst.wstrLen = static_cast<uint32_t>(tmp.size());
+            break;
+        }
+        default:
+            dst.vt = VTYPE_EMPTY;
+            break;
+    }
+}
+
+void Component::storeVariable(const Blob &src, tVariant &dst) {
 
     dst.vt = VTYPE_BLOB;
     dst.strLen = src.size();
 
-    if (!memory_manager || !memory_manager->AllocMemory(reinterpret_cast<void **>(&dst.pstrVal), src.size())) {
+    if (!allocMemory(reinterpret_cast<void **>(&dst.pstrVal), src.size())) {
         throw std::bad_alloc();
     };
 
     memcpy(dst.pstrVal, src.data(), src.size());
 }
 
-std::vector<variant_t> Component::parseParams(tVariant *params, long array_size) {
-    std::vector<variant_t> result;
+std::u16string Component::lookupKey(const std::wstring &alias) {
+#ifdef CASE_INSENSITIVE
+    return foldCase(toUTF16String(alias));
+#else
+    return toUTF16String(alias);
+#endif
+}
+
+bool Component::matchesKey(const WCHAR_T *name, const std::u16string &key) {
+    size_t i = 0;
+    for (; name[i] != 0; ++i) {
+#ifdef CASE_INSENSITIVE
+        auto c = foldCase(static_cast<char16_t>(name[i]));
+#else
+        auto c = static_cast<char16_t>(name[i]);
+#endif
+        if (i >= key.size() || key[i] != c) {
+            return false;
+        }
+    }
+    return i == key.size();
+}
+
+uint64_t Component::variantSize(const tVariant &src) {
+    switch (src.vt) {
+        case VTYPE_I1:
+        case VTYPE_UI1:
+            return sizeof(src.i8Val);
+        case VTYPE_I2:
+        case VTYPE_UI2:
+            return sizeof(src.shortVal);
+        case VTYPE_I4:
+        case VTYPE_UI4:
+            return sizeof(src.lVal);
+        case VTYPE_INT:
+        case VTYPE_UINT:
+            return sizeof(src.intVal);
+        case VTYPE_I8:
+        case VTYPE_UI8:
+            return sizeof(src.llVal);
+        case VTYPE_R4:
+            return sizeof(src.fltVal);
+        case VTYPE_R8:
+            return sizeof(src.dblVal);
+        case VTYPE_BOOL:
+            return sizeof(src.bVal);
+        case VTYPE_DATE:
+            return sizeof(src.date);
+        case VTYPE_TM:
+            return sizeof(src.tmVal);
+        case VTYPE_PWSTR:
+            return src.wstrLen * sizeof(WCHAR_T);
+        case VTYPE_PSTR:
+        case VTYPE_BLOB:
+            return src.strLen;
+        default:
+            return 0;
+    }
+}
+
+Expected<variant_t> Component::callMethod(long method_num, tVariant *params, long count, CallPhases &phases) {
+    if (method_num < static_cast<long>(static_methods.size)) {
+        return static_methods.defs[method_num].call(*this, params, count, phases);
+    }
+    return methods_meta[method_num - static_methods.size].call(params, count, phases);
+}
+
+bool Component::coerce(const tVariant &src, variant_t &dst) {
+    dst = toStlVariant(src);
+    return true;
+}
+
+bool Component::coerce(const tVariant &src, int32_t &dst) {
+    return coerceNumber(src, dst);
+}
+
+bool Component::coerce(const tVariant &src, int64_t &dst) {
+    return coerceNumber(src, dst);
+}
+
+bool Component::coerce(const tVariant &src, uint64_t &dst) {
+    return coerceNumber(src, dst);
+}
+
+bool Component::coerce(const tVariant &src, float &dst) {
+    return coerceNumber(src, dst);
+}
+
+bool Component::coerce(const tVariant &src, double &dst) {
+    return coerceNumber(src, dst);
+}
+
+bool Component::coerce(const tVariant &src, bool &dst) {
+    if (src.vt != VTYPE_BOOL) {
+        return false;
+    }
+    dst = src.bVal;
+    return true;
+}
+
+bool Component::coerce(const tVariant &src, std::string &dst) {
+    switch (src.vt) {
+        case VTYPE_PWSTR:
+            dst = toUTF8String(std::basic_string_view(src.pwstrVal, src.wstrLen));
+            return true;
+        case VTYPE_R4:
+            formatNumber(src.fltVal, dst);
+            return true;
+        case VTYPE_R8:
+            formatNumber(src.dblVal, dst);
+            return true;
+        default: {
+            // Integers of every width fit int64_t except UI8
+            int64_t value;
+            if (src.vt == VTYPE_UI8) {
+                formatNumber(src.ullVal, dst);
+                return true;
+            }
+            if (!coerceNumber(src, value)) {
+                return false;
+            }
+            formatNumber(value, dst);
+            return true;
+        }
+    }
+}
+
+bool Component::coerce(const tVariant &src, Timestamp &dst) {
+    switch (src.vt) {
+        case VTYPE_TM:
+            dst = Timestamp(src.tmVal);
+            return true;
+        case VTYPE_DATE:
+            dst = Timestamp::fromOleDate(src.date);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool Component::coerce(const tVariant &src, Blob &dst) {
+    if (src.vt != VTYPE_BLOB) {
+        return false;
+    }
+    dst = Blob(src.pstrVal, src.strLen);
+    return true;
+}
+
+bool Component::coerce(const tVariant &src, tVariant &dst) {
+    dst = src;
+    return true;
+}
+
+long Component::findProperty(const variant_t &name) {
+    std::u16string tmp;
+    decodeUTF8(std::get<std::string>(name), [&](char16_t c) { tmp.push_back(c); });
 
-    auto size = static_cast<const unsigned long>(array_size);
-    result.reserve(size);
-    for (size_t i = 0; i < size; i++) {
-        result.emplace_back(toStlVariant(params[i]));
+    auto num = FindProp(reinterpret_cast<const WCHAR_T *>(tmp.c_str()));
+    if (num < 0) {
+        throw std::runtime_error(u8"Property not found");
     }
+    return num;
+}
 
+// Sum of monotonic counters, so it only grows
+uint64_t Component::propertyVersion(long num) {
+    uint64_t result = property_versions ? property_versions[num].load(std::memory_order_acquire) : 0;
+    if (num >= static_cast<long>(static_properties.size)) {
+        auto &version = properties_meta[num - static_properties.size].version;
+        if (version) {
+            result += version();
+        }
+    }
     return result;
 }
 
-void Component::storeParams(const std::vector<variant_t> &src, tVariant *dest) {
-    for (size_t i = 0; i < src.size(); i++) {
-        storeVariable(src[i], dest[i]);
+variant_t Component::readProperty(long num) {
+    if (!IsPropReadable(num)) {
+        throw std::runtime_error(u8"Property is not readable");
+    }
+
+    Epoch::Guard guard;
+    variant_t scratch;
+
+    if (num >= static_cast<long>(static_properties.size)) {
+        auto &result = properties_meta[num - static_properties.size].getter(scratch);
+        if (&result == &scratch) {
+            return scratch;
+        }
+        return result;
+    }
+
+    auto &def = static_properties.defs[num];
+    if (def.getter) {
+        auto &result = def.getter(*this, scratch);
+        if (&result == &scratch) {
+            return scratch;
+        }
+        return result;
+    }
+
+    switch (def.constant.type) {
+        case Literal::INT:
+            return def.constant.int_value;
+        case Literal::DOUBLE:
+            return def.constant.double_value;
+        case Literal::BOOL:
+            return def.constant.bool_value;
+        case Literal::STRING:
+            return toUTF8String(reinterpret_cast<const WCHAR_T *>(def.constant.string_value));
+        default:
+            return UNDEFINED;
+    }
+}
+
+variant_t Component::getIfChanged(const variant_t &name, tVariant &known_version) {
+    auto num = findProperty(name);
+
+    // Version is taken first, so a concurrent change is never missed
+    auto version = propertyVersion(num);
+    // Known version of any number type, other values never match
+    uint64_t known;
+    if (coerce(known_version, known) && known == version) {
+        return UNDEFINED;
+    }
+
+    auto value = readProperty(num);
+    storeVariable(variant_t(static_cast<double>(version)), known_version);
+    return value;
+}
+
+variant_t Component::getPropertyVersion(const variant_t &name) {
+    return static_cast<double>(propertyVersion(findProperty(name)));
+}
+
+void Component::setChangeEventInterval(variant_t &&value) {
+    int32_t interval;
+    if (!coerceNumber(value, interval) || interval < 0) {
+        throw std::invalid_argument(u8"Interval must be a non-negative integer");
     }
+
+    change_notifier.stop();
+    change_event_interval = interval;
+    if (interval == 0) {
+        return;
+    }
+
+    change_notifier.start(std::chrono::milliseconds(interval), GetNProps(),
+                          [this](size_t num) { return propertyVersion(num); },
+                          [this](size_t num) {
+                              ExternalEvent(extensionName(), u8"PropertyChanged",
+                                            statistics.name(GetNMethods() + num));
+                          });
+}
+
+bool Component::recycle() {
+    Done();
+
+    connection = nullptr;
+    memory_manager = nullptr;
+    property_versions.reset();
+    // Counters are not kept while pooled, Init lays out statistics again
+    statistics.clear();
+
+    try {
+        reset();
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+void Component::resetStatistics() {
+    statistics.reset();
 }
 
-std::wstring Component::toUpper(std::wstring str) {
-    std::transform(str.begin(), str.end(), str.begin(), std::towupper);
-    return str;
+variant_t Component::statisticsSnapshot() {
+    return statistics.snapshot();
+}
+
+variant_t Component::traceFile() {
+    return trace_file;
+}
+
+void Component::setTraceFile(variant_t &&value) {
+    auto path = std::get<std::string>(value);
+    if (trace_file.empty() && !path.empty()) {
+        Trace::enable();
+    } else if (!trace_file.empty() && path.empty()) {
+        Trace::disable();
+    }
+    trace_file = std::move(path);
+}
+
+variant_t Component::recordFile() {
+    return record_file;
+}
+
+void Component::setRecordFile(variant_t &&value) {
+    auto path = std::get<std::string>(value);
+    if (path.empty()) {
+        call_recorder.stop();
+    } else {
+        call_recorder.start(path);
+    }
+    record_file = std::move(path);
+}
+
+variant_t Component::changeEventInterval() {
+    return change_event_interval;
+}
+
+void Component::flushTrace() {
+    if (trace_file.empty()) {
+        throw std::runtime_error(u8"Trace file is not set");
+    }
+    if (!Trace::flush(trace_file)) {
+        throw std::runtime_error(u8"Failed to write trace file");
+    }
+}
+
+bool Component::allocMemory(void **dst, unsigned long size) {
+    Trace::Scope scope("AllocMemory");
+    return memory_manager && memory_manager->AllocMemory(dst, size);
+}
+
+void Component::freeMemory(void **ptr) {
+    Trace::Scope scope("FreeMemory");
+    memory_manager->FreeMemory(ptr);
 }
 
 std::string Component::toUTF8String(std::basic_string_view<WCHAR_T> src) {
 #ifdef _WINDOWS
     // VS bug
     // https://social.msdn.microsoft.com/Forums/en-US/8f40dcd8-c67f-4eba-9134-a19b9178e481/vs-2015-rc-linker-stdcodecvt-error?forum=vcgeneral
-    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> cvt_utf8_utf16;
+    static thread_local std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> cvt_utf8_utf16;
     return cvt_utf8_utf16.to_bytes(src.data(), src.data() + src.size());
 #else
-    static std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> cvt_utf8_utf16;
+    static thread_local std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> cvt_utf8_utf16;
     return cvt_utf8_utf16.to_bytes(reinterpret_cast<const char16_t *>(src.data()),
                                    reinterpret_cast<const char16_t *>(src.data() + src.size()));
 #endif
 }
 
-std::wstring Component::toWstring(std::basic_string_view<WCHAR_T> src) {
+std::string Component::fromWstring(const std::wstring &src) {
 #ifdef _WINDOWS
-    return std::wstring(src);
+    return toUTF8String(src);
 #else
-    std::wstring_convert<std::codecvt_utf16<wchar_t, 0x10ffff, std::little_endian>> conv;
-    return conv.from_bytes(reinterpret_cast<const char*>(src.data()),
-                           reinterpret_cast<const char*>(src.data() + src.size()));
+    std::wstring_convert<std::codecvt_utf8<wchar_t>> conv;
+    return conv.to_bytes(src);
 #endif
 }
 
-std::u16string Component::toUTF16String(std::string_view src) {
+std::u16string Component::toUTF16String(const std::wstring &src) {
 #ifdef _WINDOWS
-    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> cvt_utf8_utf16;
-    std::wstring tmp = cvt_utf8_utf16.from_bytes(src.data(), src.data() + src.size());
-    return std::u16string(reinterpret_cast<const char16_t *>(tmp.data()), tmp.size());
+    return std::u16string(reinterpret_cast<const char16_t *>(src.data()), src.size());
 #else
-    static std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> cvt_utf8_utf16;
-    return cvt_utf8_utf16.from_bytes(src.data(), src.data() + src.size());
+    std::u16string result;
+    result.reserve(src.size());
+    for (auto c : src) {
+        auto cp = static_cast<uint32_t>(c);
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            result.push_back(static_cast<char16_t>(0xD800 + (cp >> 10)));
+            result.push_back(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+        } else {
+            result.push_back(static_cast<char16_t>(cp));
+        }
+    }
+    return result;
 #endif
 }
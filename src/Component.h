@@ -20,11 +20,19 @@
 #ifndef COMPONENT_H
 #define COMPONENT_H
 
+#include <array>
+#include <cstdint>
 #include <ctime>
 #include <functional>
+#include <initializer_list>
 #include <map>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
@@ -33,26 +41,91 @@
 #include <IMemoryManager.h>
 #include <types.h>
 
-template<class... Ts>
-struct overloaded : Ts ... {
-    using Ts::operator()...;
-};
-template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+#include "AtomicValue.h"
+#include "CallRecorder.h"
+#include "CaseFolding.h"
+#include "ChangeNotifier.h"
+#include "Expected.h"
+#include "Statistics.h"
+#include "Trace.h"
+#include "Variant.h"
 
-#define UNDEFINED std::monostate()
+template<typename... Classes>
+class ClassRegistry;
 
-typedef std::variant<
-        std::monostate,
-        int32_t,
-        double,
-        bool,
-        std::string,
-        std::tm,
-        std::vector<char>
-> variant_t;
+template<typename C, size_t Capacity>
+class InstancePool;
 
 class Component : public IComponentBase {
 public:
+    // Compile time registration, see SampleAddIn for usage
+    struct Literal;
+    struct ParamDefault;
+    struct MethodDef;
+    struct PropertyDef;
+    template<typename Def, size_t N>
+    class StaticTable;
+    struct StaticRegistration;
+
+    // Text a handler writes straight to host memory instead of returning a string,
+    // e.g. encoded data. Write gets room for size code units and returns the end.
+    struct HostText {
+        size_t size;
+        std::function<WCHAR_T *(WCHAR_T *out)> write;
+    };
+
+    // Type erased view of a StaticTable
+    template<typename Def>
+    struct TableView {
+        const Def *defs = nullptr;
+        size_t size = 0;
+        const uint32_t *displacements = nullptr;
+        size_t buckets = 0;
+        const int32_t *slots = nullptr;
+        size_t slots_mask = 0;
+
+        long find(const WCHAR_T *name) const;
+    };
+
+    // Built-in methods and properties only
+    Component();
+
+    // Statically registered methods and properties precede ones added at runtime,
+    // see staticRegistration for tables with the built-in ones
+    explicit Component(const StaticRegistration &registration);
+
+    // Compile time registration tables of a class, empty unless the class defines its own
+    static constexpr auto methods() { return std::array<MethodDef, 0>{}; }
+
+    static constexpr auto properties() { return std::array<PropertyDef, 0>{}; }
+
+    template<auto F>
+    static constexpr MethodDef method(const char16_t *alias, const char16_t *alias_ru,
+                                      std::initializer_list<ParamDefault> def_args = {});
+
+    // Handler F of the object held by the data member Member, e.g. a feature
+    // of the class, see Features.h
+    template<auto Member, auto F>
+    static constexpr MethodDef method(const char16_t *alias, const char16_t *alias_ru,
+                                      std::initializer_list<ParamDefault> def_args = {});
+
+    // Getter returns variant_t by value or a reference to stable storage
+    template<auto Getter, auto Setter = nullptr>
+    static constexpr PropertyDef property(const char16_t *alias, const char16_t *alias_ru);
+
+    static constexpr PropertyDef constant(const char16_t *alias, const char16_t *alias_ru, Literal value);
+
+    // Definitions or arrays of them, e.g. methods of a feature
+    template<typename... Defs>
+    static constexpr auto makeMethods(const Defs &... defs);
+
+    template<typename... Defs>
+    static constexpr auto makeProperties(const Defs &... defs);
+
+    // Tables of C::methods() and C::properties() followed by the built-in ones,
+    // built during compilation. Definitions of the class win over built-in ones.
+    template<typename C>
+    static const StaticRegistration &staticRegistration();
 
     bool ADDIN_API Init(void *connection_) final;
 
@@ -60,7 +133,7 @@ public:
 
     long ADDIN_API GetInfo() final { return 2100; };
 
-    void ADDIN_API Done() final {};
+    void ADDIN_API Done() final;
 
     void ADDIN_API SetLocale(const WCHAR_T *locale) final;
 
@@ -100,6 +173,13 @@ public:
 protected:
     virtual std::string extensionName() = 0;
 
+    // Restores the state of a new instance before a pooled one is handed out again.
+    // Registration made by constructors is kept, an exception discards the instance.
+    virtual void reset() {}
+
+    // Releases what the class holds until Done, e.g. files opened by its features
+    virtual void shutdown() {}
+
     void AddError(unsigned short code, const std::string &src, const std::string &msg, bool throw_excp);
 
     bool ExternalEvent(const std::string &src, const std::string &msg, const std::string &data);
@@ -108,53 +188,240 @@ protected:
 
     long GetEventBufferDepth();
 
+    // Marks a property changed by the component itself, e.g. from a background job.
+    // Changes through SetPropVal and AtomicValue storage are tracked automatically.
+    void PropertyChanged(const std::wstring &alias);
+
     void AddProperty(const std::wstring &alias, const std::wstring &alias_ru,
                      std::function<std::shared_ptr<variant_t>(void)> getter = nullptr,
                      std::function<void(variant_t &&)> setter = nullptr);
 
+    // Getter returns a reference to stable storage, or fills scratch and returns it,
+    // so reading a property does not allocate beyond the value itself
+    void AddProperty(const std::wstring &alias, const std::wstring &alias_ru,
+                     std::function<const variant_t &(variant_t &scratch)> getter,
+                     std::function<void(variant_t &&)> setter = nullptr);
+
     void AddProperty(const std::wstring &alias, const std::wstring &alias_ru,
                      std::shared_ptr<variant_t> storage);
 
+    // Storage safe to read and write from any thread, readers never block
+    void AddProperty(const std::wstring &alias, const std::wstring &alias_ru,
+                     std::shared_ptr<AtomicValue<variant_t>> storage);
+
     template<typename T, typename C, typename ... Ts>
     void AddMethod(const std::wstring &alias, const std::wstring &alias_ru, C *c, T(C::*f)(Ts ...),
                    std::map<long, variant_t> &&def_args = {});
 
 private:
+    template<typename... Classes>
+    friend class ClassRegistry;
+
+    template<typename C, size_t Capacity>
+    friend class InstancePool;
+
     class PropertyMeta;
 
     class MethodMeta;
 
-    template<size_t... Indices>
-    static auto refTupleGen(std::vector<variant_t> &v, std::index_sequence<Indices...>);
+    template<typename F>
+    struct MethodTraits;
+
+    template<typename M>
+    struct MemberTraits;
+
+    template<typename Def>
+    struct DefsCount;
+
+    template<typename P>
+    struct Binder;
+
+    // Phases of a method call reported by the binder:
+    // parameters are bound in PARSE, the handler runs in HANDLER
+    struct CallPhases {
+        Statistics::Recorder &recorder;
+        const char *name;
+        tVariant *result = nullptr; // Host variable of a function
+        bool stored = false; // The handler has written result itself
+    };
+
+    static constexpr size_t NAME_SIZE = 64;
+
+    // Index of the first parameter not matching its binder or -1
+    template<typename Binders, size_t... Indices>
+    static long bindParams(Binders &binders, tVariant *params, std::index_sequence<Indices...>);
+
+    template<typename Binders, size_t... Indices>
+    static void storeOutParams(Component &component, Binders &binders, tVariant *params,
+                               std::index_sequence<Indices...>);
+
+    // Handler f of c, which is the component itself or an object it holds
+    template<typename C, typename F>
+    static Expected<variant_t> call(Component &component, C &c, F f, tVariant *params, long count,
+                                    CallPhases &phases);
+
+    template<auto F>
+    static Expected<variant_t> invoke(Component &component, tVariant *params, long count, CallPhases &phases);
+
+    template<auto Member, auto F>
+    static Expected<variant_t> invokeMember(Component &component, tVariant *params, long count,
+                                            CallPhases &phases);
+
+    template<typename F>
+    static constexpr MethodDef methodDef(const char16_t *alias, const char16_t *alias_ru,
+                                         std::initializer_list<ParamDefault> def_args,
+                                         Expected<variant_t> (*invoker)(Component &, tVariant *, long, CallPhases &));
+
+    template<typename Def, size_t N, typename... Defs>
+    static constexpr void appendDefs(std::array<Def, N> &result, size_t &size, const Def &def,
+                                     const Defs &... defs);
+
+    template<typename Def, size_t N, size_t M, typename... Defs>
+    static constexpr void appendDefs(std::array<Def, N> &result, size_t &size, const std::array<Def, M> &defs,
+                                     const Defs &... rest);
+
+    template<typename Def, size_t N>
+    static constexpr void appendDefs(std::array<Def, N> &, size_t &) {}
+
+    template<auto Getter>
+    static const variant_t &getProperty(Component &component, variant_t &scratch);
+
+    template<auto Setter>
+    static void setProperty(Component &component, variant_t &&value);
+
+    static constexpr std::array<char, NAME_SIZE> utf8Name(const char16_t *src);
+
+    static constexpr char16_t keyChar(char16_t c) {
+#ifdef CASE_INSENSITIVE
+        return foldCase(c);
+#else
+        return c;
+#endif
+    }
+
+    template<typename Char>
+    static constexpr uint32_t nameHash(const Char *name, uint32_t seed);
+
+    template<typename Char>
+    static constexpr bool matchesName(const Char *name, const char16_t *key);
+
+    Expected<variant_t> callMethod(long method_num, tVariant *params, long count, CallPhases &phases);
+
+    bool failCall(Statistics::Recorder &recorder, std::optional<CallRecorder::Entry> &entry, const Error &error);
 
     static variant_t toStlVariant(tVariant src);
 
     static std::string toUTF8String(std::basic_string_view<WCHAR_T> src);
 
-    static std::wstring toWstring(std::basic_string_view<WCHAR_T> src);
+    static std::string fromWstring(const std::wstring &src);
 
-    static std::u16string toUTF16String(std::string_view src);
+    static std::u16string toUTF16String(const std::wstring &src);
 
     void storeVariable(const std::string &src, tVariant &dst);
 
     void storeVariable(const std::string &src, WCHAR_T **dst);
 
-    void storeVariable(const std::u16string &src, WCHAR_T **dst);
+    // Encodes UTF-8 directly to host memory, returns length in UTF-16 units
+    size_t storeUTF16(std::string_view src, WCHAR_T **dst);
+
+    void storeVariable(std::u16string_view src, WCHAR_T **dst);
+
+    void storeVariable(const Literal &src, tVariant &dst);
 
-    void storeVariable(const std::vector<char> &src, tVariant &dst);
+    void storeVariable(const Blob &src, tVariant &dst);
 
     void storeVariable(const variant_t &src, tVariant &dst);
 
-    static std::vector<variant_t> parseParams(tVariant *params, long array_size);
+    void clearVariable(tVariant &dst);
+
+    // Writes text to phases.result, to scratch memory for procedures
+    void storeVariable(const HostText &src, CallPhases &phases);
+
+    // Host value as a handler parameter, false when it can't be converted
+    static bool coerce(const tVariant &src, variant_t &dst);
+
+    static bool coerce(const tVariant &src, int32_t &dst);
+
+    static bool coerce(const tVariant &src, int64_t &dst);
+
+    static bool coerce(const tVariant &src, uint64_t &dst);
+
+    static bool coerce(const tVariant &src, float &dst);
+
+    static bool coerce(const tVariant &src, double &dst);
+
+    static bool coerce(const tVariant &src, bool &dst);
+
+    static bool coerce(const tVariant &src, std::string &dst);
+
+    static bool coerce(const tVariant &src, Timestamp &dst);
+
+    static bool coerce(const tVariant &src, Blob &dst);
+
+    // The host value itself, strings and blobs are not copied
+    static bool coerce(const tVariant &src, tVariant &dst);
+
+    // UTF-16 name used by FindMethod/FindProp, case folded in CASE_INSENSITIVE mode
+    static std::u16string lookupKey(const std::wstring &alias);
+
+    static bool matchesKey(const WCHAR_T *name, const std::u16string &key);
+
+    static uint64_t variantSize(const tVariant &src);
+
+    // Returns a destroyed instance to the state after construction, false if it can't be reused
+    bool recycle();
+
+    // Statistics, tracing, call recording and change tracking of every component
+    static constexpr auto builtinMethods();
+
+    static constexpr auto builtinProperties();
+
+    void resetStatistics();
+
+    variant_t statisticsSnapshot();
 
-    void storeParams(const std::vector<variant_t> &src, tVariant *dest);
+    variant_t traceFile();
 
-    static std::wstring toUpper(std::wstring str);
+    void setTraceFile(variant_t &&value);
+
+    variant_t recordFile();
+
+    void setRecordFile(variant_t &&value);
+
+    variant_t changeEventInterval();
+
+    long findProperty(const variant_t &name);
+
+    uint64_t propertyVersion(long num);
+
+    variant_t readProperty(long num);
+
+    variant_t getIfChanged(const variant_t &name, tVariant &known_version);
+
+    variant_t getPropertyVersion(const variant_t &name);
+
+    void setChangeEventInterval(variant_t &&value);
+
+    void flushTrace();
+
+    bool allocMemory(void **dst, unsigned long size);
+
+    void freeMemory(void **ptr);
 
     IAddInDefBase *connection;
     IMemoryManager *memory_manager;
+    TableView<MethodDef> static_methods;
+    TableView<PropertyDef> static_properties;
     std::vector<PropertyMeta> properties_meta;
     std::vector<MethodMeta> methods_meta;
+    Statistics statistics;
+    std::string trace_file;
+    CallRecorder call_recorder;
+    std::string record_file;
+    std::unique_ptr<std::atomic<uint64_t>[]> property_versions;
+    int32_t change_event_interval = 0;
+    ChangeNotifier change_notifier;
+    void (*release)(Component *component) = nullptr; // Construction policy of the class, set by ClassRegistry
     static constexpr char UNKNOWN_EXCP[] = u8"Unknown unhandled exception";
 
 };
@@ -171,8 +438,12 @@ public:
 
     std::wstring alias;
     std::wstring alias_ru;
-    std::function<std::shared_ptr<variant_t>(void)> getter;
+    std::u16string key;
+    std::u16string key_ru;
+    std::string name;
+    std::function<const variant_t &(variant_t &scratch)> getter;
     std::function<void(variant_t &&)> setter;
+    std::function<uint64_t(void)> version; // Changes made bypassing SetPropVal
 };
 
 class Component::MethodMeta {
@@ -187,34 +458,580 @@ public:
 
     std::wstring alias;
     std::wstring alias_ru;
+    std::u16string key;
+    std::u16string key_ru;
+    std::string name;
     long params_count;
     bool returns_value;
     std::map<long, variant_t> default_args;
-    std::function<variant_t(std::vector<variant_t> &params)> call;
+    std::function<Expected<variant_t>(tVariant *params, long count, CallPhases &phases)> call;
+};
+
+// Value of a default argument or a constant property, encoded during compilation
+struct Component::Literal {
+    enum Type {
+        EMPTY,
+        INT,
+        DOUBLE,
+        BOOL,
+        STRING
+    };
+
+    constexpr Literal() = default;
+
+    constexpr Literal(int32_t v) : type(INT), int_value(v) {};
+
+    constexpr Literal(double v) : type(DOUBLE), double_value(v) {};
+
+    constexpr Literal(bool v) : type(BOOL), bool_value(v) {};
+
+    constexpr Literal(const char16_t *v) : type(STRING), string_value(v) {};
+
+    Type type = EMPTY;
+    int32_t int_value = 0;
+    double double_value = 0;
+    bool bool_value = false;
+    const char16_t *string_value = nullptr;
+};
+
+struct Component::ParamDefault {
+    long param = -1;
+    Literal value;
 };
 
-template<size_t... Indices>
-auto Component::refTupleGen(std::vector<variant_t> &v, std::index_sequence<Indices...>) {
-    return std::forward_as_tuple(v[Indices]...);
+struct Component::MethodDef {
+    static constexpr size_t MAX_DEFAULTS = 8;
+
+    const char16_t *alias;
+    const char16_t *alias_ru;
+    long params_count;
+    bool returns_value;
+    Expected<variant_t> (*call)(Component &component, tVariant *params, long count, CallPhases &phases);
+    std::array<ParamDefault, MAX_DEFAULTS> default_args;
+    size_t default_args_count;
+    std::array<char, NAME_SIZE> name; // UTF-8 alias for statistics and traces
+};
+
+struct Component::PropertyDef {
+    const char16_t *alias;
+    const char16_t *alias_ru;
+    const variant_t &(*getter)(Component &component, variant_t &scratch);
+    void (*setter)(Component &component, variant_t &&value);
+    Literal constant; // Value of a property without getter
+    std::array<char, NAME_SIZE> name;
+};
+
+struct Component::StaticRegistration {
+    TableView<MethodDef> methods;
+    TableView<PropertyDef> properties;
+};
+
+// Definitions with a perfect hash over both aliases (hash and displace).
+// A key selects a bucket by the seed 0 hash, the bucket displacement is the seed
+// of the second hash selecting a slot, so lookup hashes the name twice and
+// compares it with a single candidate. Displacements are searched for the
+// largest buckets first; failure is a compile error.
+template<typename Def, size_t N>
+class Component::StaticTable {
+public:
+    constexpr explicit StaticTable(const std::array<Def, N> &defs_);
+
+    constexpr TableView<Def> view() const {
+        return {defs.data(), N, displacements.data(), BUCKETS, slots.data(), SLOTS - 1};
+    }
+
+private:
+    static constexpr size_t KEYS = 2 * N;
+    static constexpr size_t BUCKETS = N > 0 ? N : 1;
+
+    static constexpr size_t slotsFor(size_t keys) {
+        size_t result = 2;
+        while (result < 2 * keys) {
+            result *= 2;
+        }
+        return result;
+    }
+
+    static constexpr size_t SLOTS = slotsFor(KEYS);
+    static constexpr uint32_t MAX_DISPLACEMENT = 1u << 16;
+
+    constexpr uint32_t place(const std::array<const char16_t *, KEYS> &keys,
+                             const std::array<size_t, KEYS> &grouped, size_t first, size_t last,
+                             std::array<size_t, KEYS> &taken);
+
+    std::array<Def, N> defs;
+    std::array<uint32_t, BUCKETS> displacements;
+    std::array<int32_t, SLOTS> slots;
+};
+
+template<typename T, typename C, typename... Ts>
+struct Component::MethodTraits<T (C::*)(Ts...)> {
+    using Result = T;
+    using Class = C;
+    using Binders = std::tuple<Binder<Ts>...>;
+    static constexpr long ARITY = sizeof...(Ts);
+    static constexpr bool RETURNS_VALUE = !std::is_same<T, void>::value && !std::is_same<T, Expected<void>>::value;
+};
+
+template<typename T, typename C, typename... Ts>
+struct Component::MethodTraits<T (C::*)(Ts...) const> : MethodTraits<T (C::*)(Ts...)> {
+};
+
+template<typename T, typename C>
+struct Component::MemberTraits<T C::*> {
+    using Type = T;
+    using Class = C;
+};
+
+template<typename Def>
+struct Component::DefsCount {
+    static constexpr size_t value = 1;
+};
+
+template<typename Def, size_t N>
+struct Component::DefsCount<std::array<Def, N>> {
+    static constexpr size_t value = N;
+};
+
+// Takes a handler parameter straight from the host variant. Parameters declared
+// as variant_t get it as is, as tVariant get the host value without copying
+// strings and blobs, typed ones are coerced: numbers from strings and back
+// without intermediate UTF-8 text, and between numeric types whenever the
+// value survives exactly. Non-const references are output parameters.
+template<typename P>
+struct Component::Binder {
+    using Type = std::decay_t<P>;
+
+    static constexpr bool OUTPUT = std::is_lvalue_reference<P>::value &&
+                                   !std::is_const<std::remove_reference_t<P>>::value;
+
+    bool bind(const tVariant &param) { return coerce(param, value); }
+
+    P get() {
+        if constexpr (std::is_reference<P>::value) {
+            return value;
+        } else {
+            return std::move(value);
+        }
+    }
+
+    void store(Component &component, tVariant &param) {
+        if constexpr (OUTPUT) {
+            component.storeVariable(variant_t(std::move(value)), param);
+        }
+    }
+
+    Type value{};
+};
+
+// The host variable itself, written by the handler directly, so it is an
+// output parameter in builds without OUT_PARAMS too
+template<>
+struct Component::Binder<tVariant &> {
+    static constexpr bool OUTPUT = false;
+
+    bool bind(tVariant &param) {
+        value = &param;
+        return true;
+    }
+
+    tVariant &get() { return *value; }
+
+    void store(Component &, tVariant &) {}
+
+    tVariant *value = nullptr;
+};
+
+template<typename Binders, size_t... Indices>
+long Component::bindParams(Binders &binders, tVariant *params, std::index_sequence<Indices...>) {
+    long mismatch = -1;
+    (void) (... && (std::get<Indices>(binders).bind(params[Indices]) || (mismatch = Indices, false)));
+    return mismatch;
+}
+
+template<typename Binders, size_t... Indices>
+void Component::storeOutParams(Component &component, Binders &binders, tVariant *params,
+                               std::index_sequence<Indices...>) {
+    (std::get<Indices>(binders).store(component, params[Indices]), ...);
+}
+
+template<typename C, typename F>
+Expected<variant_t> Component::call([[maybe_unused]] Component &component, C &c, F f, tVariant *params,
+                                    long count, CallPhases &phases) {
+    using Traits = MethodTraits<F>;
+    using Result = typename Traits::Result;
+    using Indices = std::make_index_sequence<Traits::ARITY>;
+
+    if (count != Traits::ARITY) {
+        return Error(u8"Wrong number of parameters");
+    }
+
+    typename Traits::Binders binders;
+    long mismatch;
+    {
+        Trace::Scope scope("parseParams");
+        mismatch = bindParams(binders, params, Indices());
+    }
+    if (mismatch >= 0) {
+        return Error(u8"Invalid type of parameter " + std::to_string(mismatch + 1));
+    }
+
+    auto apply = [&](auto &... binder) -> Result {
+        return (c.*f)(binder.get()...);
+    };
+
+    phases.recorder.next(Statistics::HANDLER);
+    Expected<variant_t> result = UNDEFINED;
+    {
+        Trace::Scope scope("handler", phases.name);
+        if constexpr (std::is_same<Result, void>::value) {
+            std::apply(apply, binders);
+        } else if constexpr (is_expected<Result>::value) {
+            auto value = std::apply(apply, binders);
+            if (!value) {
+                return std::move(value.error());
+            }
+            if constexpr (!std::is_same<Result, Expected<void>>::value) {
+                result = variant_t(std::move(*value));
+            }
+        } else if constexpr (std::is_same<Result, HostText>::value) {
+            component.storeVariable(std::apply(apply, binders), phases);
+        } else {
+            result = std::apply(apply, binders);
+        }
+    }
+
+#ifdef OUT_PARAMS
+    phases.recorder.next(Statistics::STORE);
+    storeOutParams(component, binders, params, Indices());
+#endif
+    return result;
 }
 
 template<typename T, typename C, typename ... Ts>
 void Component::AddMethod(const std::wstring &alias, const std::wstring &alias_ru, C *c, T(C::*f)(Ts ...),
                           std::map<long, variant_t> &&def_args) {
 
-    MethodMeta meta{alias, alias_ru, sizeof...(Ts), !std::is_same<T, void>::value, std::move(def_args),
-                    [f, c](std::vector<variant_t> &params) -> variant_t {
-                        auto args = refTupleGen(params, std::make_index_sequence<sizeof...(Ts)>());
-                        if constexpr (std::is_same<T, void>::value) {
-                            std::apply(f, std::tuple_cat(std::make_tuple(c), args));
-                            return UNDEFINED;
-                        } else {
-                            return std::apply(f, std::tuple_cat(std::make_tuple(c), args));
-                        }
+    MethodMeta meta{alias, alias_ru, lookupKey(alias), lookupKey(alias_ru), fromWstring(alias), sizeof...(Ts),
+                    MethodTraits<decltype(f)>::RETURNS_VALUE, std::move(def_args),
+                    [this, f, c](tVariant *params, long count, CallPhases &phases) -> Expected<variant_t> {
+                        return call(*this, *c, f, params, count, phases);
                     }
     };
 
     methods_meta.push_back(std::move(meta));
 };
 
+template<auto F>
+Expected<variant_t> Component::invoke(Component &component, tVariant *params, long count, CallPhases &phases) {
+    return call(component, static_cast<typename MethodTraits<decltype(F)>::Class &>(component), F, params, count,
+                phases);
+}
+
+template<auto Member, auto F>
+Expected<variant_t> Component::invokeMember(Component &component, tVariant *params, long count,
+                                            CallPhases &phases) {
+    auto &owner = static_cast<typename MemberTraits<decltype(Member)>::Class &>(component);
+    return call(component, owner.*Member, F, params, count, phases);
+}
+
+template<auto Getter>
+const variant_t &Component::getProperty(Component &component, variant_t &scratch) {
+    using Traits = MethodTraits<decltype(Getter)>;
+
+    auto &c = static_cast<typename Traits::Class &>(component);
+    if constexpr (std::is_reference<typename Traits::Result>::value) {
+        return (c.*Getter)();
+    } else {
+        scratch = (c.*Getter)();
+        return scratch;
+    }
+}
+
+template<auto Setter>
+void Component::setProperty(Component &component, variant_t &&value) {
+    (static_cast<typename MethodTraits<decltype(Setter)>::Class &>(component).*Setter)(std::move(value));
+}
+
+template<auto F>
+constexpr Component::MethodDef Component::method(const char16_t *alias, const char16_t *alias_ru,
+                                                 std::initializer_list<ParamDefault> def_args) {
+    return methodDef<decltype(F)>(alias, alias_ru, def_args, &invoke<F>);
+}
+
+template<auto Member, auto F>
+constexpr Component::MethodDef Component::method(const char16_t *alias, const char16_t *alias_ru,
+                                                 std::initializer_list<ParamDefault> def_args) {
+    static_assert(std::is_same<typename MemberTraits<decltype(Member)>::Type,
+                               typename MethodTraits<decltype(F)>::Class>::value,
+                  "Handler must be a member function of the member type");
+
+    return methodDef<decltype(F)>(alias, alias_ru, def_args, &invokeMember<Member, F>);
+}
+
+template<typename F>
+constexpr Component::MethodDef Component::methodDef(const char16_t *alias, const char16_t *alias_ru,
+                                                    std::initializer_list<ParamDefault> def_args,
+                                                    Expected<variant_t> (*invoker)(Component &, tVariant *, long,
+                                                                                   CallPhases &)) {
+    using Traits = MethodTraits<F>;
+
+    MethodDef def{alias, alias_ru, Traits::ARITY, Traits::RETURNS_VALUE, invoker, {}, 0, utf8Name(alias)};
+
+    if (def_args.size() > MethodDef::MAX_DEFAULTS) {
+        throw std::length_error("Too many default arguments");
+    }
+    for (auto &arg : def_args) {
+        def.default_args[def.default_args_count++] = arg;
+    }
+
+    return def;
+}
+
+template<auto Getter, auto Setter>
+constexpr Component::PropertyDef Component::property(const char16_t *alias, const char16_t *alias_ru) {
+    PropertyDef def{alias, alias_ru, nullptr, nullptr, {}, utf8Name(alias)};
+
+    if constexpr (!std::is_null_pointer<decltype(Getter)>::value) {
+        def.getter = &getProperty<Getter>;
+    }
+    if constexpr (!std::is_null_pointer<decltype(Setter)>::value) {
+        def.setter = &setProperty<Setter>;
+    }
+
+    return def;
+}
+
+constexpr Component::PropertyDef Component::constant(const char16_t *alias, const char16_t *alias_ru,
+                                                    Literal value) {
+    return {alias, alias_ru, nullptr, nullptr, value, utf8Name(alias)};
+}
+
+template<typename Def, size_t N, typename... Defs>
+constexpr void Component::appendDefs(std::array<Def, N> &result, size_t &size, const Def &def,
+                                     const Defs &... defs) {
+    result[size++] = def;
+    appendDefs(result, size, defs...);
+}
+
+template<typename Def, size_t N, size_t M, typename... Defs>
+constexpr void Component::appendDefs(std::array<Def, N> &result, size_t &size, const std::array<Def, M> &defs,
+                                     const Defs &... rest) {
+    for (auto &def : defs) {
+        result[size++] = def;
+    }
+    appendDefs(result, size, rest...);
+}
+
+template<typename... Defs>
+constexpr auto Component::makeMethods(const Defs &... defs) {
+    std::array<MethodDef, (size_t{0} + ... + DefsCount<Defs>::value)> result{};
+    size_t size = 0;
+    appendDefs(result, size, defs...);
+    return result;
+}
+
+template<typename... Defs>
+constexpr auto Component::makeProperties(const Defs &... defs) {
+    std::array<PropertyDef, (size_t{0} + ... + DefsCount<Defs>::value)> result{};
+    size_t size = 0;
+    appendDefs(result, size, defs...);
+    return result;
+}
+
+constexpr auto Component::builtinMethods() {
+    return makeMethods(
+            method<&Component::resetStatistics>(u"ResetStatistics", u"СброситьСтатистику"),
+            method<&Component::flushTrace>(u"FlushTrace", u"ЗаписатьТрассировку"),
+            // Returns property value only if its version differs from the known one,
+            // the new version is written back to the second parameter in every build
+            method<&Component::getIfChanged>(u"GetIfChanged", u"ПолучитьЕслиИзменилось"),
+            method<&Component::getPropertyVersion>(u"PropertyVersion", u"ВерсияСвойства")
+    );
+}
+
+constexpr auto Component::builtinProperties() {
+    return makeProperties(
+            property<&Component::statisticsSnapshot>(u"Statistics", u"Статистика"),
+            // Non empty path enables tracing, trace is written there on FlushTrace and Done
+            property<&Component::traceFile, &Component::setTraceFile>(u"TraceFile", u"ФайлТрассировки"),
+            // Non empty path starts recording of incoming calls for offline replay
+            property<&Component::recordFile, &Component::setRecordFile>(u"RecordFile", u"ФайлЗаписи"),
+            // Non zero interval in milliseconds enables PropertyChanged external events,
+            // all changes of a property within an interval are reported once
+            property<&Component::changeEventInterval, &Component::setChangeEventInterval>(
+                    u"ChangeEventInterval", u"ИнтервалСобытийИзменения")
+    );
+}
+
+template<typename C>
+const Component::StaticRegistration &Component::staticRegistration() {
+    static constexpr auto method_defs = makeMethods(C::methods(), builtinMethods());
+    static constexpr auto property_defs = makeProperties(C::properties(), builtinProperties());
+    static constexpr StaticTable<MethodDef, method_defs.size()> methods(method_defs);
+    static constexpr StaticTable<PropertyDef, property_defs.size()> properties(property_defs);
+    static constexpr StaticRegistration registration{methods.view(), properties.view()};
+    return registration;
+}
+
+constexpr std::array<char, Component::NAME_SIZE> Component::utf8Name(const char16_t *src) {
+    std::array<char, NAME_SIZE> result{};
+
+    size_t size = 0;
+    for (; *src; ++src) {
+        uint32_t cp = *src;
+        if (cp >= 0xD800 && cp < 0xDC00 && src[1] >= 0xDC00 && src[1] < 0xE000) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (src[1] - 0xDC00);
+            ++src;
+        }
+
+        size_t length = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+        if (size + length >= NAME_SIZE) {
+            throw std::length_error("Name is too long");
+        }
+
+        if (length == 1) {
+            result[size++] = static_cast<char>(cp);
+            continue;
+        }
+        constexpr uint8_t lead[] = {0, 0, 0xC0, 0xE0, 0xF0};
+        result[size++] = static_cast<char>(lead[length] | (cp >> (6 * (length - 1))));
+        for (auto i = length - 1; i-- > 0;) {
+            result[size++] = static_cast<char>(0x80 | ((cp >> (6 * i)) & 0x3F));
+        }
+    }
+
+    return result;
+}
+
+template<typename Char>
+constexpr uint32_t Component::nameHash(const Char *name, uint32_t seed) {
+    // FNV-1a over UTF-16 units with murmur3 finalizer, so every bit of the
+    // result depends on every unit
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (; *name; ++name) {
+        h = (h ^ keyChar(static_cast<char16_t>(*name))) * 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+template<typename Char>
+constexpr bool Component::matchesName(const Char *name, const char16_t *key) {
+    for (; *name && *key; ++name, ++key) {
+        if (keyChar(static_cast<char16_t>(*name)) != keyChar(*key)) {
+            return false;
+        }
+    }
+    return *name == 0 && *key == 0;
+}
+
+template<typename Def>
+long Component::TableView<Def>::find(const WCHAR_T *name) const {
+    if (size == 0) {
+        return -1;
+    }
+
+    auto displacement = displacements[nameHash(name, 0) % buckets];
+    if (displacement == 0) {
+        return -1;
+    }
+
+    auto index = slots[nameHash(name, displacement) & slots_mask];
+    if (index < 0) {
+        return -1;
+    }
+
+    auto &def = defs[index];
+    return matchesName(name, def.alias) || matchesName(name, def.alias_ru) ? index : -1;
+}
+
+template<typename Def, size_t N>
+constexpr Component::StaticTable<Def, N>::StaticTable(const std::array<Def, N> &defs_)
+        : defs(defs_), displacements{}, slots{} {
+
+    for (size_t i = 0; i < SLOTS; ++i) {
+        slots[i] = -1;
+    }
+
+    // Keys grouped by bucket with a counting sort
+    std::array<const char16_t *, KEYS> keys{};
+    std::array<uint32_t, KEYS> hashes{};
+    std::array<size_t, BUCKETS + 1> starts{};
+
+    for (size_t k = 0; k < KEYS; ++k) {
+        keys[k] = k % 2 ? defs[k / 2].alias_ru : defs[k / 2].alias;
+        hashes[k] = nameHash(keys[k], 0);
+        ++starts[hashes[k] % BUCKETS + 1];
+    }
+    for (size_t b = 0; b < BUCKETS; ++b) {
+        starts[b + 1] += starts[b];
+    }
+
+    std::array<size_t, BUCKETS> sizes{};
+    std::array<size_t, KEYS> grouped{};
+    for (size_t k = 0; k < KEYS; ++k) {
+        auto b = hashes[k] % BUCKETS;
+        grouped[starts[b] + sizes[b]++] = k;
+    }
+
+    // Same alias is reachable through the first definition only
+    size_t largest = 0;
+    for (size_t b = 0; b < BUCKETS; ++b) {
+        size_t size = 0;
+        for (auto i = starts[b]; i < starts[b + 1]; ++i) {
+            bool duplicate = false;
+            for (auto j = starts[b]; j < starts[b] + size && !duplicate; ++j) {
+                duplicate = matchesName(keys[grouped[j]], keys[grouped[i]]);
+            }
+            if (!duplicate) {
+                grouped[starts[b] + size++] = grouped[i];
+            }
+        }
+        sizes[b] = size;
+        largest = size > largest ? size : largest;
+    }
+
+    std::array<size_t, KEYS> taken{};
+    for (auto size = largest; size > 0; --size) {
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            if (sizes[b] == size) {
+                displacements[b] = place(keys, grouped, starts[b], starts[b] + size, taken);
+            }
+        }
+    }
+}
+
+template<typename Def, size_t N>
+constexpr uint32_t Component::StaticTable<Def, N>::place(const std::array<const char16_t *, KEYS> &keys,
+                                                         const std::array<size_t, KEYS> &grouped,
+                                                         size_t first, size_t last,
+                                                         std::array<size_t, KEYS> &taken) {
+    for (uint32_t displacement = 1; displacement < MAX_DISPLACEMENT; ++displacement) {
+        bool fits = true;
+
+        for (auto i = first; i < last && fits; ++i) {
+            auto slot = nameHash(keys[grouped[i]], displacement) & (SLOTS - 1);
+            fits = slots[slot] < 0;
+            for (auto j = first; j < i && fits; ++j) {
+                fits = taken[j] != slot;
+            }
+            taken[i] = slot;
+        }
+
+        if (fits) {
+            for (auto i = first; i < last; ++i) {
+                slots[taken[i]] = static_cast<int32_t>(grouped[i] / 2);
+            }
+            return displacement;
+        }
+    }
+
+    throw std::logic_error("Perfect hash is not found");
+}
+
 #endif //COMPONENT_H
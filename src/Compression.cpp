@@ -0,0 +1,987 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Compression.h"
+#include "Trace.h"
+
+// All supported targets are little endian, so words are loaded as is
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr uint32_t FRAME_MAGIC = 0x184D2204;
+constexpr uint32_t SKIPPABLE_MAGIC = 0x184D2A50; // Low 4 bits are free
+constexpr uint32_t UNCOMPRESSED_BLOCK = 0x80000000;
+
+constexpr uint8_t FLAG_VERSION = 0x40;
+constexpr uint8_t FLAG_INDEPENDENT = 0x20;
+constexpr uint8_t FLAG_BLOCK_CHECKSUM = 0x10;
+constexpr uint8_t FLAG_CONTENT_SIZE = 0x08;
+constexpr uint8_t FLAG_CONTENT_CHECKSUM = 0x04;
+constexpr uint8_t FLAG_DICTIONARY = 0x01;
+
+constexpr size_t BLOCK_SIZE = 256 * 1024;
+constexpr uint8_t BLOCK_SIZE_ID = 5;
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5; // Blocks end with literals
+constexpr size_t MATCH_FIND_LIMIT = 12; // Last match starts at least this far from the end
+constexpr size_t MAX_DISTANCE = 65535;
+constexpr size_t WINDOW_SIZE = 65536;
+
+constexpr int HASH_LOG = 14;
+constexpr unsigned SKIP_TRIGGER = 6;
+constexpr int CHAIN_HASH_LOG = 15;
+constexpr unsigned CHAIN_ATTEMPTS = 256;
+constexpr size_t OPTIMAL_LENGTH = 18; // Match length fitting the token
+constexpr uint32_t NO_POSITION = UINT32_MAX;
+
+// Decoded data preceding a frame is not reserved beyond this
+constexpr uint64_t MAX_RESERVE = 1u << 30;
+
+template<typename T>
+T load(const void *src) {
+    T value;
+    memcpy(&value, src, sizeof(T));
+    return value;
+}
+
+template<typename T>
+void append(std::string &dst, T value) {
+    dst.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+uint64_t elapsedNs(clock_type::time_point start) {
+    return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count());
+}
+
+// Queried once, as it reads system files on every call
+unsigned hardwareThreads() {
+    static const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+    return count;
+}
+
+uint32_t xxh32(const void *data, size_t size) {
+    Xxh32 hash;
+    hash.update(static_cast<const char *>(data), size);
+    return hash.digest();
+}
+
+unsigned trailingZeros(uint64_t value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, static_cast<uint32_t>(value))) {
+        return index;
+    }
+    _BitScanForward(&index, static_cast<uint32_t>(value >> 32));
+    return index + 32;
+#else
+    return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+}
+
+// Length of the common prefix, input is read up to the limit
+size_t matchLength(const uint8_t *input, const uint8_t *match, const uint8_t *limit) {
+    auto start = input;
+    for (; input + 8 <= limit; input += 8, match += 8) {
+        if (auto diff = load<uint64_t>(input) ^ load<uint64_t>(match)) {
+            return static_cast<size_t>(input - start) + trailingZeros(diff) / 8;
+        }
+    }
+    for (; input < limit && *input == *match; ++input, ++match) {}
+    return static_cast<size_t>(input - start);
+}
+
+size_t blockBound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+// Block format: sequences of a token with literal and match length nibbles,
+// literal length bytes, literals, 16 bit offset and match length bytes.
+// Lengths of 15 continue in bytes added up until one is less than 255.
+
+uint8_t *writeLength(uint8_t *out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+uint8_t *writeLiterals(uint8_t *out, uint8_t match_nibble, const uint8_t *literals, size_t count) {
+    *out++ = static_cast<uint8_t>((std::min<size_t>(count, 15) << 4) | match_nibble);
+    if (count >= 15) {
+        out = writeLength(out, count - 15);
+    }
+    memcpy(out, literals, count);
+    return out + count;
+}
+
+uint8_t *writeSequence(uint8_t *out, const uint8_t *literals, size_t count, size_t offset, size_t length) {
+    length -= MIN_MATCH;
+    out = writeLiterals(out, static_cast<uint8_t>(std::min<size_t>(length, 15)), literals, count);
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+    if (length >= 15) {
+        out = writeLength(out, length - 15);
+    }
+    return out;
+}
+
+uint32_t hash5(const uint8_t *input, int hash_log) {
+    return static_cast<uint32_t>(((load<uint64_t>(input) << 24) * 889523592379ULL) >> (64 - hash_log));
+}
+
+uint32_t hash4(const uint8_t *input, int hash_log) {
+    return (load<uint32_t>(input) * 2654435761u) >> (32 - hash_log);
+}
+
+// Tables of small inputs are sized by them, so they are cheap to clear
+int hashLog(size_t size, int max_log) {
+    int hash_log = 8;
+    while (hash_log < max_log && (size_t{1} << hash_log) < size) {
+        ++hash_log;
+    }
+    return hash_log;
+}
+
+// Takes the first match of a position found by the hash table. Positions
+// without matches are skipped faster and faster, so incompressible data passes quickly.
+size_t compressFast(const uint8_t *src, size_t size, uint8_t *dst) {
+    auto out = dst;
+    auto anchor = src;
+
+    if (size > MATCH_FIND_LIMIT) {
+        auto hash_log = hashLog(size, HASH_LOG);
+        std::vector<uint32_t> table(size_t{1} << hash_log);
+        auto input = src + 1;
+        auto find_limit = src + size - MATCH_FIND_LIMIT;
+        auto match_limit = src + size - LAST_LITERALS;
+
+        while (input <= find_limit) {
+            const uint8_t *match = nullptr;
+            unsigned attempts = 1u << SKIP_TRIGGER;
+            for (; input <= find_limit; input += attempts++ >> SKIP_TRIGGER) {
+                auto &slot = table[hash5(input, hash_log)];
+                auto candidate = src + slot;
+                slot = static_cast<uint32_t>(input - src);
+                if (static_cast<size_t>(input - candidate) <= MAX_DISTANCE
+                    && load<uint32_t>(candidate) == load<uint32_t>(input)) {
+                    match = candidate;
+                    break;
+                }
+            }
+            if (!match) {
+                break;
+            }
+
+            while (input > anchor && match > src && input[-1] == match[-1]) {
+                --input;
+                --match;
+            }
+            auto length = MIN_MATCH + matchLength(input + MIN_MATCH, match + MIN_MATCH, match_limit);
+            out = writeSequence(out, anchor, static_cast<size_t>(input - anchor),
+                                static_cast<size_t>(input - match), length);
+            input += length;
+            anchor = input;
+
+            if (input <= find_limit) {
+                table[hash5(input - 2, hash_log)] = static_cast<uint32_t>(input - 2 - src);
+            }
+        }
+    }
+
+    out = writeLiterals(out, 0, anchor, static_cast<size_t>(src + size - anchor));
+    return static_cast<size_t>(out - dst);
+}
+
+// Match of the high ratio mode, the source is offset bytes before start
+struct Match {
+    size_t start;
+    size_t length;
+    size_t offset;
+
+    size_t end() const { return start + length; }
+};
+
+// Searches matches through chains of earlier positions with the same hash,
+// as lz4 does in its high compression levels. Matches found at the end of
+// the current one may extend back into it, the current one is shortened
+// then, so each position gets the longest of up to three overlapping matches.
+size_t compressHigh(const uint8_t *src, size_t size, uint8_t *dst) {
+    auto out = dst;
+    auto anchor = src;
+
+    if (size > MATCH_FIND_LIMIT) {
+        auto hash_log = hashLog(size, CHAIN_HASH_LOG);
+        std::vector<uint32_t> heads(size_t{1} << hash_log, NO_POSITION);
+        // Distance to the previous position, by position in the window
+        std::vector<uint16_t> chain(std::min(size, WINDOW_SIZE));
+        size_t inserted = 0;
+        auto find_limit = size - MATCH_FIND_LIMIT;
+        auto match_limit = src + size - LAST_LITERALS;
+
+        // Match of a position longer than the given one, which may start back down
+        // to low. The given match is returned when there is none.
+        auto search = [&](size_t position, size_t low, Match best) {
+            for (; inserted <= position; ++inserted) {
+                auto &head = heads[hash4(src + inserted, hash_log)];
+                chain[inserted % WINDOW_SIZE] = static_cast<uint16_t>(
+                        head == NO_POSITION ? MAX_DISTANCE : std::min(inserted - head, MAX_DISTANCE));
+                head = static_cast<uint32_t>(inserted);
+            }
+
+            auto input = src + position;
+            size_t candidate = heads[hash4(input, hash_log)];
+            for (auto attempts = CHAIN_ATTEMPTS; attempts; --attempts) {
+                // Positions after this one are in the chains when an earlier match is searched again
+                if (candidate < position) {
+                    if (position - candidate > MAX_DISTANCE) {
+                        break;
+                    }
+                    auto match = src + candidate;
+                    // Only a match reaching past the end of the best one may be longer,
+                    // as lz4 the check assumes it extends back down to low
+                    auto look_back = position - low;
+                    if ((candidate < look_back || load<uint16_t>(src + low + best.length - 1)
+                                                  == load<uint16_t>(match - look_back + best.length - 1))
+                        && load<uint32_t>(match) == load<uint32_t>(input)) {
+                        size_t back = 0;
+                        while (position - back > low && candidate > back && input[-1 - back] == match[-1 - back]) {
+                            ++back;
+                        }
+                        auto length = back + MIN_MATCH + matchLength(input + MIN_MATCH, match + MIN_MATCH, match_limit);
+                        if (length > best.length) {
+                            best = {position - back, length, position - candidate};
+                            if (input + length - back == match_limit) {
+                                break;
+                            }
+                        }
+                    }
+                }
+                auto distance = chain[candidate % WINDOW_SIZE];
+                if (distance > candidate) {
+                    break;
+                }
+                candidate -= distance;
+            }
+            return best;
+        };
+
+        auto emit = [&](const Match &match) {
+            out = writeSequence(out, anchor, static_cast<size_t>(src + match.start - anchor), match.offset,
+                                match.length);
+            anchor = src + match.end();
+        };
+
+        // Starts the second match after the first one limited to OPTIMAL_LENGTH, returns that length
+        auto trim = [](const Match &first, Match &second) {
+            auto length = std::min({first.length, OPTIMAL_LENGTH, second.end() - MIN_MATCH - first.start});
+            if (first.start + length > second.start) {
+                auto correction = first.start + length - second.start;
+                second.start += correction;
+                second.length -= correction;
+            }
+            return length;
+        };
+
+        size_t position = 0;
+        while (position <= find_limit) {
+            auto first = search(position, position, {position, MIN_MATCH - 1, 0});
+            if (first.length < MIN_MATCH) {
+                ++position;
+                continue;
+            }
+            // Kept in case later matches shorten the first one too much
+            auto saved = first;
+
+            bool searching = true;
+            while (searching) {
+                auto second = first.end() <= find_limit ? search(first.end() - 2, first.start, first) : first;
+                if (second.length == first.length) {
+                    emit(first);
+                    break;
+                }
+                if (saved.start < first.start && second.start < saved.end()) {
+                    first = saved;
+                }
+                if (second.start - first.start < 3) {
+                    // First match is too short to be kept
+                    first = second;
+                    continue;
+                }
+
+                while (true) {
+                    if (second.start - first.start < OPTIMAL_LENGTH) {
+                        trim(first, second);
+                    }
+                    auto third = second.end() <= find_limit ? search(second.end() - 3, second.start, second) : second;
+
+                    if (third.length == second.length) {
+                        first.length = std::min(first.length, second.start - first.start);
+                        emit(first);
+                        emit(second);
+                        searching = false;
+                        break;
+                    }
+
+                    if (third.start < first.end() + 3) {
+                        if (third.start >= first.end()) {
+                            // Second match is dropped, the third one is searched further as the first
+                            if (second.start < first.end()) {
+                                auto correction = first.end() - second.start;
+                                second.start += correction;
+                                second.length -= correction;
+                                if (second.length < MIN_MATCH) {
+                                    second = third;
+                                }
+                            }
+                            emit(first);
+                            first = third;
+                            saved = second;
+                            break;
+                        }
+                        second = third;
+                        continue;
+                    }
+
+                    if (second.start < first.end()) {
+                        if (second.start - first.start < OPTIMAL_LENGTH) {
+                            first.length = trim(first, second);
+                        } else {
+                            first.length = second.start - first.start;
+                        }
+                    }
+                    emit(first);
+                    first = second;
+                    second = third;
+                }
+            }
+            position = static_cast<size_t>(anchor - src);
+        }
+    }
+
+    out = writeLiterals(out, 0, anchor, static_cast<size_t>(src + size - anchor));
+    return static_cast<size_t>(out - dst);
+}
+
+// Appends block size and data, stored as is when it does not compress.
+// The flow links a block given to a worker with the thread submitting it.
+void compressBlock(const char *data, size_t size, bool high_ratio, std::string &out, uint64_t flow = 0) {
+    Trace::Scope scope("compressBlock");
+    Trace::flowEnd("compressBlock", flow);
+
+    auto offset = out.size();
+    out.resize(offset + sizeof(uint32_t) + blockBound(size));
+    auto src = reinterpret_cast<const uint8_t *>(data);
+    auto dst = reinterpret_cast<uint8_t *>(&out[offset + sizeof(uint32_t)]);
+
+    auto written = high_ratio ? compressHigh(src, size, dst) : compressFast(src, size, dst);
+    auto header = static_cast<uint32_t>(written);
+    if (written >= size) {
+        memcpy(dst, src, size);
+        written = size;
+        header = static_cast<uint32_t>(size) | UNCOMPRESSED_BLOCK;
+    }
+    memcpy(&out[offset], &header, sizeof(header));
+    out.resize(offset + sizeof(uint32_t) + written);
+}
+
+size_t readLength(const uint8_t *&input, const uint8_t *end) {
+    size_t length = 0;
+    uint8_t byte;
+    do {
+        if (input == end) {
+            throw std::runtime_error(u8"Malformed LZ4 block");
+        }
+        byte = *input++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+// Returns the end of decoded data. Matches may refer back to the lowest address.
+uint8_t *decodeSequences(const uint8_t *input, size_t size, uint8_t *out, uint8_t *out_end, const uint8_t *lowest) {
+    auto end = input + size;
+    while (true) {
+        if (input == end) {
+            throw std::runtime_error(u8"Malformed LZ4 block");
+        }
+        unsigned token = *input++;
+        size_t count = token >> 4;
+        size_t length = token & 15;
+        size_t offset;
+
+        // Short literals and matches are copied by fixed sizes when both sides have room
+        if (count < 15 && length < 15 && end - input >= 18 && out_end - out >= 32) {
+            memcpy(out, input, 16);
+            out += count;
+            input += count;
+            offset = load<uint16_t>(input);
+            input += 2;
+            length += MIN_MATCH;
+            if (offset >= 8 && offset <= static_cast<size_t>(out - lowest)) {
+                auto match = out - offset;
+                memcpy(out, match, 8);
+                memcpy(out + 8, match + 8, 8);
+                memcpy(out + 16, match + 16, 2);
+                out += length;
+                continue;
+            }
+        } else {
+            if (count == 15) {
+                count += readLength(input, end);
+            }
+            if (count > static_cast<size_t>(end - input) || count > static_cast<size_t>(out_end - out)) {
+                throw std::runtime_error(u8"Malformed LZ4 block");
+            }
+            memcpy(out, input, count);
+            out += count;
+            input += count;
+
+            // The last sequence has no match
+            if (input == end) {
+                return out;
+            }
+
+            if (end - input < 2) {
+                throw std::runtime_error(u8"Malformed LZ4 block");
+            }
+            offset = load<uint16_t>(input);
+            input += 2;
+            if (length == 15) {
+                length += readLength(input, end);
+            }
+            length += MIN_MATCH;
+        }
+
+        if (!offset || offset > static_cast<size_t>(out - lowest) || length > static_cast<size_t>(out_end - out)) {
+            throw std::runtime_error(u8"Malformed LZ4 block");
+        }
+        auto match = out - offset;
+        if (offset >= 8 && static_cast<size_t>(out_end - out) >= length + 8) {
+            // Each 8 bytes are complete before they are read
+            for (size_t i = 0; i < length; i += 8) {
+                memcpy(out + i, match + i, 8);
+            }
+        } else {
+            for (size_t i = 0; i < length; ++i) {
+                out[i] = match[i];
+            }
+        }
+        out += length;
+    }
+}
+
+}
+
+// Work of one run, queued once for every worker asked to help
+struct CompressionWorkers::Batch {
+    const std::function<void()> &work;
+    size_t pending; // Queued or running on workers
+};
+
+std::shared_ptr<CompressionWorkers> CompressionWorkers::acquire() {
+    static std::mutex mutex;
+    static std::weak_ptr<CompressionWorkers> shared;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto result = shared.lock();
+    if (!result) {
+        result = std::make_shared<CompressionWorkers>(hardwareThreads() - 1);
+        shared = result;
+    }
+    return result;
+}
+
+CompressionWorkers::CompressionWorkers(unsigned count) {
+    for (unsigned i = 0; i < count; ++i) {
+        try {
+            threads.emplace_back(&CompressionWorkers::loop, this);
+        } catch (const std::system_error &) {
+            break; // Fewer threads do the same work
+        }
+    }
+}
+
+CompressionWorkers::~CompressionWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+void CompressionWorkers::run(size_t helpers, const std::function<void()> &work) {
+    Batch batch{work, std::min(helpers, threads.size())};
+    if (batch.pending) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.insert(queue.end(), batch.pending, &batch);
+        }
+        wake.notify_all();
+    }
+
+    work();
+
+    // Helpers that have not started are not needed anymore, others are waited for
+    std::unique_lock<std::mutex> lock(mutex);
+    auto unstarted = std::remove(queue.begin(), queue.end(), &batch);
+    batch.pending -= static_cast<size_t>(queue.end() - unstarted);
+    queue.erase(unstarted, queue.end());
+    done.wait(lock, [&batch]() { return batch.pending == 0; });
+}
+
+void CompressionWorkers::loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+        auto batch = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        batch->work();
+        lock.lock();
+
+        if (--batch->pending == 0) {
+            done.notify_all();
+        }
+    }
+}
+
+Compressor::Compressor(bool high_ratio_, CompressionCounters *counters_, std::shared_ptr<CompressionWorkers> workers_,
+                       uint64_t content_size_)
+        : high_ratio(high_ratio_), counters(counters_), workers(std::move(workers_)), content_size(content_size_) {
+}
+
+void Compressor::compress(const char *data, size_t size, std::string &out) {
+    auto start = clock_type::now();
+    auto offset = out.size();
+
+    if (!started) {
+        writeHeader(out);
+    }
+    checksum.update(data, size);
+    total += size;
+
+    auto rest = size;
+    if (!pending.empty()) {
+        auto fill = std::min(BLOCK_SIZE - pending.size(), rest);
+        pending.append(data, fill);
+        data += fill;
+        rest -= fill;
+        if (pending.size() == BLOCK_SIZE) {
+            writeBlocks(pending.data(), pending.size(), out);
+            pending.clear();
+        }
+    }
+
+    auto whole = rest / BLOCK_SIZE * BLOCK_SIZE;
+    writeBlocks(data, whole, out);
+    pending.append(data + whole, rest - whole);
+
+    if (counters) {
+        counters->input += size;
+        counters->output += out.size() - offset;
+        counters->ns += elapsedNs(start);
+    }
+}
+
+void Compressor::finish(std::string &out) {
+    auto start = clock_type::now();
+    auto offset = out.size();
+
+    if (content_size != UNKNOWN_SIZE && total != content_size) {
+        throw std::logic_error(u8"Compressed size differs from the declared content size");
+    }
+    if (!started) {
+        writeHeader(out);
+    }
+    writeBlocks(pending.data(), pending.size(), out);
+    pending = std::string();
+    append<uint32_t>(out, 0);
+    append<uint32_t>(out, checksum.digest());
+
+    if (counters) {
+        counters->output += out.size() - offset;
+        counters->ns += elapsedNs(start);
+    }
+}
+
+size_t Compressor::bound(size_t size) {
+    auto blocks = size / BLOCK_SIZE + 1;
+    return size + size / 255 + blocks * (sizeof(uint32_t) + 16) + 23;
+}
+
+void Compressor::writeHeader(std::string &out) {
+    uint8_t header[15];
+    memcpy(header, &FRAME_MAGIC, sizeof(FRAME_MAGIC));
+    header[4] = FLAG_VERSION | FLAG_INDEPENDENT | FLAG_CONTENT_CHECKSUM;
+    header[5] = BLOCK_SIZE_ID << 4;
+    size_t size = 6;
+    if (content_size != UNKNOWN_SIZE) {
+        header[4] |= FLAG_CONTENT_SIZE;
+        memcpy(header + size, &content_size, sizeof(content_size));
+        size += sizeof(content_size);
+    }
+    header[size] = static_cast<uint8_t>(xxh32(header + 4, size - 4) >> 8);
+    out.append(reinterpret_cast<const char *>(header), size + 1);
+    started = true;
+}
+
+// Blocks are independent, so several of them are compressed in parallel
+void Compressor::writeBlocks(const char *data, size_t size, std::string &out) {
+    auto count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    auto blockSize = [size](size_t index) { return std::min(BLOCK_SIZE, size - index * BLOCK_SIZE); };
+
+    if (count <= 1 || !workers || !workers->size()) {
+        for (size_t i = 0; i < count; ++i) {
+            compressBlock(data + i * BLOCK_SIZE, blockSize(i), high_ratio, out);
+        }
+        return;
+    }
+
+    std::vector<std::string> blocks(count);
+    std::vector<uint64_t> flows(count);
+    for (auto &flow : flows) {
+        flow = Trace::flowBegin("compressBlock");
+    }
+    std::atomic<size_t> next{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    std::function<void()> work = [&]() {
+        try {
+            for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+                compressBlock(data + i * BLOCK_SIZE, blockSize(i), high_ratio, blocks[i], flows[i]);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            error = std::current_exception();
+            next = count;
+        }
+    };
+
+    workers->run(count - 1, work);
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    for (auto &block : blocks) {
+        out += block;
+    }
+}
+
+void Decompressor::decompress(const char *data, size_t size, std::string &out) {
+    auto start = clock_type::now();
+    auto offset = out.size();
+
+    // Complete parts are parsed where they are, the rest waits for the next chunk
+    if (input.empty()) {
+        auto used = parse(reinterpret_cast<const uint8_t *>(data), size, out);
+        input.assign(data + used, size - used);
+    } else {
+        input.append(data, size);
+        auto used = parse(reinterpret_cast<const uint8_t *>(input.data()), input.size(), out);
+        input.erase(0, used);
+    }
+
+    if (counters) {
+        counters->input += size;
+        counters->output += out.size() - offset;
+        counters->ns += elapsedNs(start);
+    }
+}
+
+void Decompressor::finish() {
+    if (!frames || state != State::MAGIC || !input.empty()) {
+        throw std::runtime_error(u8"Incomplete LZ4 frame");
+    }
+}
+
+size_t Decompressor::parse(const uint8_t *data, size_t size, std::string &out) {
+    size_t position = 0;
+    while (true) {
+        auto rest = size - position;
+        auto part = data + position;
+
+        switch (state) {
+            case State::MAGIC: {
+                if (rest < sizeof(uint32_t)) {
+                    return position;
+                }
+                auto magic = load<uint32_t>(part);
+                if (magic == FRAME_MAGIC) {
+                    position += sizeof(uint32_t);
+                    state = State::HEADER;
+                } else if ((magic & 0xFFFFFFF0) == SKIPPABLE_MAGIC) {
+                    if (rest < 2 * sizeof(uint32_t)) {
+                        return position;
+                    }
+                    skip = load<uint32_t>(part + sizeof(uint32_t));
+                    position += 2 * sizeof(uint32_t);
+                    state = State::SKIP;
+                } else {
+                    throw std::runtime_error(u8"Not an LZ4 frame");
+                }
+                break;
+            }
+            case State::SKIP: {
+                auto skipped = static_cast<size_t>(std::min<uint64_t>(skip, rest));
+                position += skipped;
+                skip -= skipped;
+                if (skip) {
+                    return position;
+                }
+                state = State::MAGIC;
+                break;
+            }
+            case State::HEADER: {
+                auto used = parseHeader(part, rest);
+                if (!used) {
+                    return position;
+                }
+                position += used;
+                state = State::BLOCK;
+                if (content_size <= MAX_RESERVE) {
+                    out.reserve(out.size() + content_size);
+                }
+                break;
+            }
+            case State::BLOCK: {
+                if (rest < sizeof(uint32_t)) {
+                    return position;
+                }
+                auto header = load<uint32_t>(part);
+                if (!header) {
+                    position += sizeof(uint32_t);
+                    state = State::CHECKSUM;
+                    break;
+                }
+
+                auto block_size = header & ~UNCOMPRESSED_BLOCK;
+                if (block_size > block_max) {
+                    throw std::runtime_error(u8"Malformed LZ4 frame");
+                }
+                auto block = part + sizeof(uint32_t);
+                if (rest - sizeof(uint32_t) < block_size + (block_checksums ? sizeof(uint32_t) : 0)) {
+                    return position;
+                }
+                if (block_checksums && xxh32(block, block_size) != load<uint32_t>(block + block_size)) {
+                    throw std::runtime_error(u8"LZ4 block checksum mismatch");
+                }
+                decodeBlock(block, block_size, !(header & UNCOMPRESSED_BLOCK), out);
+                position += sizeof(uint32_t) + block_size + (block_checksums ? sizeof(uint32_t) : 0);
+                break;
+            }
+            case State::CHECKSUM: {
+                if (content_checksum) {
+                    if (rest < sizeof(uint32_t)) {
+                        return position;
+                    }
+                    if (checksum.digest() != load<uint32_t>(part)) {
+                        throw std::runtime_error(u8"LZ4 content checksum mismatch");
+                    }
+                    position += sizeof(uint32_t);
+                }
+                if (content_size != Compressor::UNKNOWN_SIZE && content_total != content_size) {
+                    throw std::runtime_error(u8"LZ4 content size mismatch");
+                }
+                state = State::MAGIC;
+                break;
+            }
+        }
+    }
+}
+
+// Returns the header size, 0 when it is incomplete
+size_t Decompressor::parseHeader(const uint8_t *data, size_t size) {
+    if (size < 2) {
+        return 0;
+    }
+    auto flags = data[0];
+    auto size_id = (data[1] >> 4) & 7;
+    if ((flags & 0xC0) != FLAG_VERSION || size_id < 4) {
+        throw std::runtime_error(u8"Unsupported LZ4 frame");
+    }
+    if (flags & FLAG_DICTIONARY) {
+        throw std::runtime_error(u8"LZ4 frames with dictionaries are not supported");
+    }
+
+    size_t header_size = 2 + ((flags & FLAG_CONTENT_SIZE) ? sizeof(uint64_t) : 0);
+    if (size <= header_size) {
+        return 0;
+    }
+    if (static_cast<uint8_t>(xxh32(data, header_size) >> 8) != data[header_size]) {
+        throw std::runtime_error(u8"LZ4 header checksum mismatch");
+    }
+
+    frames = true;
+    linked = !(flags & FLAG_INDEPENDENT);
+    block_checksums = (flags & FLAG_BLOCK_CHECKSUM) != 0;
+    content_checksum = (flags & FLAG_CONTENT_CHECKSUM) != 0;
+    block_max = size_t{1} << (8 + 2 * size_id);
+    content_size = (flags & FLAG_CONTENT_SIZE) ? load<uint64_t>(data + 2) : Compressor::UNKNOWN_SIZE;
+    content_total = 0;
+    checksum = Xxh32();
+    window.clear();
+    return header_size + 1;
+}
+
+// Independent blocks are decoded in place, linked ones after the window of
+// preceding output they may refer to
+void Decompressor::decodeBlock(const uint8_t *data, size_t size, bool compressed, std::string &out) {
+    Trace::Scope scope("decompressBlock");
+
+    // Output beyond the declared content size is malformed anyway
+    auto capacity = block_max;
+    if (content_size != Compressor::UNKNOWN_SIZE) {
+        capacity = static_cast<size_t>(std::min<uint64_t>(
+                capacity, content_size > content_total ? content_size - content_total : 0));
+    }
+
+    auto offset = out.size();
+    if (!compressed) {
+        out.append(reinterpret_cast<const char *>(data), size);
+        if (linked) {
+            window.append(reinterpret_cast<const char *>(data), size);
+        }
+    } else if (!linked) {
+        out.resize(offset + capacity);
+        auto begin = reinterpret_cast<uint8_t *>(out.data() + offset);
+        auto end = decodeSequences(data, size, begin, begin + capacity, begin);
+        out.resize(offset + static_cast<size_t>(end - begin));
+    } else {
+        auto history = window.size();
+        window.resize(history + capacity);
+        auto begin = reinterpret_cast<uint8_t *>(window.data());
+        auto end = decodeSequences(data, size, begin + history, begin + history + capacity, begin);
+        window.resize(static_cast<size_t>(end - begin));
+        out.append(window, history, std::string::npos);
+    }
+
+    if (linked && window.size() > WINDOW_SIZE) {
+        window.erase(0, window.size() - WINDOW_SIZE);
+    }
+    checksum.update(out.data() + offset, out.size() - offset);
+    content_total += out.size() - offset;
+}
+
+int32_t CompressionRegistry::openCompressor(bool high_ratio) {
+    compressors.emplace(++last_handle, Compressor(high_ratio, &compressed, workers()));
+    return last_handle;
+}
+
+int32_t CompressionRegistry::openDecompressor() {
+    decompressors.emplace(++last_handle, Decompressor(&decompressed));
+    return last_handle;
+}
+
+Compressor &CompressionRegistry::compressor(int32_t handle) {
+    auto it = compressors.find(handle);
+    if (it == compressors.end()) {
+        throw std::runtime_error(u8"Compressor is not open");
+    }
+    return it->second;
+}
+
+Decompressor &CompressionRegistry::decompressor(int32_t handle) {
+    auto it = decompressors.find(handle);
+    if (it == decompressors.end()) {
+        throw std::runtime_error(u8"Decompressor is not open");
+    }
+    return it->second;
+}
+
+void CompressionRegistry::finish(int32_t handle, std::string &out) {
+    auto compressor = compressors.find(handle);
+    if (compressor != compressors.end()) {
+        auto context = std::move(compressor->second);
+        compressors.erase(compressor);
+        context.finish(out);
+        return;
+    }
+
+    auto decompressor = decompressors.find(handle);
+    if (decompressor == decompressors.end()) {
+        throw std::runtime_error(u8"Compression is not open");
+    }
+    auto context = std::move(decompressor->second);
+    decompressors.erase(decompressor);
+    context.finish();
+}
+
+std::string CompressionRegistry::statistics() const {
+    std::ostringstream oss;
+    // Ratio is of uncompressed to compressed size, throughput of uncompressed bytes
+    auto write = [&oss](const char *name, const CompressionCounters &counters, uint64_t raw, uint64_t packed) {
+        oss << '"' << name << "\":{\"bytes_in\":" << counters.input << ",\"bytes_out\":" << counters.output
+            << ",\"ns\":" << counters.ns << ",\"ratio\":" << (packed ? static_cast<double>(raw) / packed : 0)
+            << ",\"bytes_per_second\":" << (counters.ns ? static_cast<uint64_t>(raw * 1e9 / counters.ns) : 0) << '}';
+    };
+    oss << '{';
+    write("compress", compressed, compressed.input, compressed.output);
+    oss << ',';
+    write("decompress", decompressed, decompressed.output, decompressed.input);
+    oss << '}';
+    return oss.str();
+}
+
+std::shared_ptr<CompressionWorkers> CompressionRegistry::workers() {
+    if (!shared_workers) {
+        shared_workers = CompressionWorkers::acquire();
+    }
+    return shared_workers;
+}
+
+void CompressionRegistry::clear() {
+    compressors.clear();
+    decompressors.clear();
+    shared_workers.reset();
+    compressed = CompressionCounters();
+    decompressed = CompressionCounters();
+}
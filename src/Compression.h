@@ -0,0 +1,196 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Hashing.h"
+
+// Compression in the LZ4 frame format, readable by the lz4 tool and libraries.
+// Frames are written with independent 256 KB blocks, compressed in parallel
+// on threads shared by the process when a call brings several of them, and
+// a content checksum. The fast mode
+// takes the first match found by a hash table, the high ratio mode searches
+// hash chains for overlapping matches the way lz4 -9 does.
+// Decompression accepts any LZ4 frame without a dictionary: linked blocks,
+// block checksums, concatenated and skippable frames.
+
+struct CompressionCounters {
+    uint64_t input = 0;
+    uint64_t output = 0;
+    uint64_t ns = 0;
+};
+
+// Threads compressing blocks for all components of the process. Started by
+// the first component that needs them and stopped when the last one releases
+// them, so calls do not pay for thread creation.
+class CompressionWorkers {
+public:
+    // Workers of the process, one per hardware thread besides the caller
+    static std::shared_ptr<CompressionWorkers> acquire();
+
+    explicit CompressionWorkers(unsigned count);
+
+    CompressionWorkers(const CompressionWorkers &) = delete;
+
+    CompressionWorkers &operator=(const CompressionWorkers &) = delete;
+
+    ~CompressionWorkers();
+
+    size_t size() const { return threads.size(); }
+
+    // Runs work on the calling thread and on up to helpers workers at once,
+    // returns when all of them are done. Work must not throw.
+    void run(size_t helpers, const std::function<void()> &work);
+
+private:
+    struct Batch;
+
+    void loop();
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::deque<Batch *> queue;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
+
+// Compresses data given in chunks, bytes of an incomplete block wait for the next one
+class Compressor {
+public:
+    static constexpr uint64_t UNKNOWN_SIZE = UINT64_MAX;
+
+    // Without workers blocks are compressed on the calling thread. Content size, when known, is written to the frame.
+    explicit Compressor(bool high_ratio_, CompressionCounters *counters_ = nullptr,
+                        std::shared_ptr<CompressionWorkers> workers_ = nullptr, uint64_t content_size_ = UNKNOWN_SIZE);
+
+    // Appends the frame header and all complete blocks
+    void compress(const char *data, size_t size, std::string &out);
+
+    // Appends the last block and the end of the frame
+    void finish(std::string &out);
+
+    // Upper bound of a frame holding the given size
+    static size_t bound(size_t size);
+
+private:
+    void writeHeader(std::string &out);
+
+    void writeBlocks(const char *data, size_t count, std::string &out);
+
+    bool high_ratio;
+    CompressionCounters *counters;
+    std::shared_ptr<CompressionWorkers> workers;
+    uint64_t content_size;
+    uint64_t total = 0;
+    bool started = false;
+    std::string pending;
+    Xxh32 checksum;
+};
+
+// Decompresses frames given in chunks, bytes of an incomplete block wait for the next one
+class Decompressor {
+public:
+    explicit Decompressor(CompressionCounters *counters_ = nullptr) : counters(counters_) {};
+
+    // Appends data of all complete blocks, throws on malformed frames
+    void decompress(const char *data, size_t size, std::string &out);
+
+    // Throws when the last frame is incomplete
+    void finish();
+
+private:
+    enum class State {
+        MAGIC,
+        HEADER,
+        BLOCK,
+        CHECKSUM,
+        SKIP
+    };
+
+    // Consumes whole parts of a frame, returns the bytes used
+    size_t parse(const uint8_t *data, size_t size, std::string &out);
+
+    size_t parseHeader(const uint8_t *data, size_t size);
+
+    void decodeBlock(const uint8_t *data, size_t size, bool compressed, std::string &out);
+
+    CompressionCounters *counters;
+    State state = State::MAGIC;
+    std::string input; // Unconsumed bytes of an incomplete part
+    bool frames = false; // At least one frame started
+    bool linked = false;
+    bool block_checksums = false;
+    bool content_checksum = false;
+    size_t block_max = 0;
+    uint64_t content_size = Compressor::UNKNOWN_SIZE;
+    uint64_t content_total = 0;
+    uint64_t skip = 0;
+    Xxh32 checksum;
+    std::string window; // Output preceding a linked block
+};
+
+// Compression contexts opened by a component, by handle, and counters of
+// all compression done by it
+class CompressionRegistry {
+public:
+    int32_t openCompressor(bool high_ratio);
+
+    int32_t openDecompressor();
+
+    // Throw when the handle is not open
+    Compressor &compressor(int32_t handle);
+
+    Decompressor &decompressor(int32_t handle);
+
+    // Finishes the context and closes it
+    void finish(int32_t handle, std::string &out);
+
+    // Bytes in and out, times, ratios and throughput as JSON
+    std::string statistics() const;
+
+    // Workers of the process, held until clear
+    std::shared_ptr<CompressionWorkers> workers();
+
+    void clear();
+
+    CompressionCounters compressed;
+    CompressionCounters decompressed;
+
+private:
+    int32_t last_handle = 0;
+    std::map<int32_t, Compressor> compressors;
+    std::map<int32_t, Decompressor> decompressors;
+    std::shared_ptr<CompressionWorkers> shared_workers;
+};
+
+#endif //COMPRESSION_H
@@ -0,0 +1,408 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "CsvReader.h"
+#include "Simd.h"
+#include "Trace.h"
+
+// All supported targets are little endian, so numbers are copied as is
+
+namespace {
+
+constexpr uint64_t CHUNK_SIZE = 1u << 20;
+
+using clock_type = std::chrono::steady_clock;
+
+uint64_t elapsedNs(clock_type::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+}
+
+void append32(std::string &dst, uint32_t value) {
+    dst.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+}
+
+CsvReader::CsvReader(const std::string &path, const CsvDialect &dialect_)
+        : dialect(dialect_), file(path), pending_columns(1), header_ready(!dialect_.header) {
+    parser = std::thread(&CsvReader::parserLoop, this);
+}
+
+CsvReader::~CsvReader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    consumed.notify_all();
+    parser.join();
+}
+
+bool CsvReader::nextBatch(std::string_view &batch) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!waitBatch(lock)) {
+        return false;
+    }
+    next_row = current_rows;
+    batch = current;
+    return true;
+}
+
+bool CsvReader::nextRow() {
+    if (next_row < current_rows) {
+        ++next_row;
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!waitBatch(lock)) {
+        return false;
+    }
+    next_row = 1;
+    return true;
+}
+
+std::string_view CsvReader::field(size_t column_) const {
+    if (next_row == 0 || column_ >= read32(4)) {
+        return {};
+    }
+    size_t start = read32(8 + 4 * column_);
+    size_t begin = read32(start + 4 * (next_row - 1));
+    size_t end = read32(start + 4 * next_row);
+    return std::string_view(current.data() + start + 4 * (current_rows + 1) + begin, end - begin);
+}
+
+size_t CsvReader::columns() {
+    return current.empty() ? names().size() : read32(4);
+}
+
+const std::vector<std::string> &CsvReader::names() {
+    std::unique_lock<std::mutex> lock(mutex);
+    parsed.wait(lock, [this] { return header_ready || finished; });
+    return header_names;
+}
+
+std::string CsvReader::statistics() const {
+    auto bytes = bytes_parsed.load(std::memory_order_relaxed);
+    auto ns = parse_ns.load(std::memory_order_relaxed);
+
+    std::ostringstream oss;
+    oss << "{\"bytes\":" << bytes << ",\"rows\":" << rows_parsed.load(std::memory_order_relaxed)
+        << ",\"parse_ns\":" << ns << ",\"wait_ns\":" << wait_ns.load(std::memory_order_relaxed)
+        << ",\"bytes_per_second\":" << (ns ? static_cast<uint64_t>(bytes * 1e9 / ns) : 0) << '}';
+    return oss.str();
+}
+
+bool CsvReader::waitBatch(std::unique_lock<std::mutex> &lock) {
+    auto start = clock_type::now();
+    {
+        Trace::Scope scope("waitCsvBatch");
+        parsed.wait(lock, [this] { return !batches.empty() || finished; });
+    }
+    wait_ns.fetch_add(elapsedNs(start), std::memory_order_relaxed);
+
+    if (batches.empty()) {
+        current.clear();
+        current_rows = 0;
+        next_row = 0;
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return false;
+    }
+
+    current = std::move(batches.front());
+    batches.pop_front();
+    Trace::flowEnd("csvBatch", batch_flows.front());
+    batch_flows.pop_front();
+    consumed.notify_one();
+    current_rows = read32(0);
+    return true;
+}
+
+uint32_t CsvReader::read32(size_t offset) const {
+    uint32_t result;
+    memcpy(&result, current.data() + offset, sizeof(result));
+    return result;
+}
+
+void CsvReader::parserLoop() {
+    try {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) {
+                    return;
+                }
+            }
+
+            auto start = clock_type::now();
+            blocked_ns = 0;
+            std::string_view chunk;
+            bool more;
+            {
+                Trace::Scope scope("parseCsv");
+                more = file.readChunk(CHUNK_SIZE, chunk);
+                if (more) {
+                    parse(chunk.data(), chunk.data() + chunk.size());
+                } else {
+                    if (state == QUOTED) {
+                        throw std::runtime_error(u8"Unterminated quoted field");
+                    }
+                    // The last record may lack a line break
+                    if (state != FIELD_START || column > 0) {
+                        endRecord();
+                    }
+                    finishBatch();
+                }
+            }
+            bytes_parsed.fetch_add(chunk.size(), std::memory_order_relaxed);
+            parse_ns.fetch_add(elapsedNs(start) - blocked_ns, std::memory_order_relaxed);
+
+            if (!more) {
+                break;
+            }
+        }
+    } catch (const Stopped &) {
+        return;
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    parsed.notify_all();
+}
+
+void CsvReader::parse(const char *begin, const char *end) {
+    auto p = begin;
+    while (p < end) {
+        if (skip_lf) {
+            skip_lf = false;
+            if (*p == '\n') {
+                ++p;
+                continue;
+            }
+        }
+
+        if (column == pending_columns.size()) {
+            pending_columns.push_back(Column{std::string(), std::vector<uint32_t>(rows, 0)});
+        }
+        auto &text = pending_columns[column].text;
+
+        switch (state) {
+            case QUOTED: {
+                auto quote = static_cast<const char *>(memchr(p, dialect.quote, end - p));
+                auto stop = quote ? quote : end;
+                text.append(p, stop);
+                text_size += stop - p;
+                p = stop;
+                if (quote) {
+                    ++p;
+                    state = QUOTE_SEEN;
+                }
+                break;
+            }
+            case QUOTE_SEEN:
+                if (*p == dialect.quote) {
+                    // Doubled quote stands for itself
+                    text += *p++;
+                    ++text_size;
+                    state = QUOTED;
+                } else {
+                    state = UNQUOTED;
+                }
+                break;
+            case FIELD_START:
+                if (column == 0 && (*p == '\n' || *p == '\r')) {
+                    skip_lf = *p++ == '\r';
+                    break;
+                }
+                if (dialect.quote && *p == dialect.quote) {
+                    ++p;
+                    state = QUOTED;
+                    break;
+                }
+                state = UNQUOTED;
+                // fallthrough
+            case UNQUOTED: {
+                auto size = scan(p, end - p);
+                text.append(p, size);
+                text_size += size;
+                p += size;
+                if (p == end) {
+                    break;
+                }
+                auto c = *p++;
+                if (c == dialect.delimiter) {
+                    endField();
+                } else if (c == '\n' || c == '\r') {
+                    skip_lf = c == '\r';
+                    endRecord();
+                } else {
+                    // Quote in the middle of a field
+                    text += c;
+                    ++text_size;
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Finds the first delimiter, quote or line break
+size_t CsvReader::scan(const char *begin, size_t size) const {
+    auto quote = dialect.quote ? dialect.quote : dialect.delimiter;
+    size_t i = 0;
+#if defined(ADDIN_SSE2)
+    auto delimiters = _mm_set1_epi8(dialect.delimiter);
+    auto quotes = _mm_set1_epi8(quote);
+    auto lf = _mm_set1_epi8('\n');
+    auto cr = _mm_set1_epi8('\r');
+    for (; i + 16 <= size; i += 16) {
+        auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin + i));
+        auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, delimiters), _mm_cmpeq_epi8(bytes, quotes)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(bytes, lf), _mm_cmpeq_epi8(bytes, cr)));
+        if (auto mask = static_cast<unsigned>(_mm_movemask_epi8(hits))) {
+            return i + firstBit(mask);
+        }
+    }
+#elif defined(ADDIN_NEON)
+    auto delimiters = vdupq_n_u8(static_cast<uint8_t>(dialect.delimiter));
+    auto quotes = vdupq_n_u8(static_cast<uint8_t>(quote));
+    auto lf = vdupq_n_u8('\n');
+    auto cr = vdupq_n_u8('\r');
+    for (; i + 16 <= size; i += 16) {
+        auto bytes = vld1q_u8(reinterpret_cast<const uint8_t *>(begin + i));
+        auto hits = vorrq_u8(vorrq_u8(vceqq_u8(bytes, delimiters), vceqq_u8(bytes, quotes)),
+                             vorrq_u8(vceqq_u8(bytes, lf), vceqq_u8(bytes, cr)));
+        if (vmaxvq_u8(hits)) {
+            // The exact position is found below
+            break;
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        auto c = begin[i];
+        if (c == dialect.delimiter || c == quote || c == '\n' || c == '\r') {
+            break;
+        }
+    }
+    return i;
+}
+
+void CsvReader::endField() {
+    auto &current_column = pending_columns[column];
+    if (current_column.text.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error(u8"Record is too large");
+    }
+    current_column.ends.push_back(static_cast<uint32_t>(current_column.text.size()));
+    ++column;
+    state = FIELD_START;
+}
+
+void CsvReader::endRecord() {
+    if (column == pending_columns.size()) {
+        // Empty last field in a new column
+        pending_columns.push_back(Column{std::string(), std::vector<uint32_t>(rows, 0)});
+    }
+    endField();
+
+    // Short rows get empty fields
+    for (; column < pending_columns.size(); ++column) {
+        auto &c = pending_columns[column];
+        c.ends.push_back(static_cast<uint32_t>(c.text.size()));
+    }
+    column = 0;
+    ++rows;
+
+    if (!header_ready) {
+        std::vector<std::string> names;
+        for (auto &c : pending_columns) {
+            names.push_back(std::move(c.text));
+        }
+        pending_columns.assign(names.size(), Column());
+        rows = 0;
+        text_size = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            header_names = std::move(names);
+            header_ready = true;
+        }
+        parsed.notify_all();
+        return;
+    }
+
+    if (text_size >= BATCH_SIZE) {
+        finishBatch();
+    }
+}
+
+void CsvReader::finishBatch() {
+    if (rows == 0) {
+        return;
+    }
+
+    auto count = pending_columns.size();
+    auto offset = 8 + 4 * count;
+    size_t size = offset;
+    for (auto &c : pending_columns) {
+        size += 4 * (rows + 1) + c.text.size();
+    }
+
+    std::string batch;
+    batch.reserve(size);
+    append32(batch, static_cast<uint32_t>(rows));
+    append32(batch, static_cast<uint32_t>(count));
+    for (auto &c : pending_columns) {
+        append32(batch, static_cast<uint32_t>(offset));
+        offset += 4 * (rows + 1) + c.text.size();
+    }
+    for (auto &c : pending_columns) {
+        append32(batch, 0);
+        batch.append(reinterpret_cast<const char *>(c.ends.data()), 4 * c.ends.size());
+        batch.append(c.text);
+        c.text.clear();
+        c.ends.clear();
+    }
+
+    rows_parsed.fetch_add(rows, std::memory_order_relaxed);
+    rows = 0;
+    text_size = 0;
+
+    auto start = clock_type::now();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        consumed.wait(lock, [this] { return stopping || batches.size() < MAX_BATCHES; });
+        if (stopping) {
+            throw Stopped();
+        }
+        batches.push_back(std::move(batch));
+        batch_flows.push_back(Trace::flowBegin("csvBatch"));
+    }
+    parsed.notify_one();
+    blocked_ns += elapsedNs(start);
+}
@@ -0,0 +1,154 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CSVREADER_H
+#define CSVREADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "FileStreams.h"
+
+struct CsvDialect {
+    char delimiter = ',';
+    char quote = '"'; // Zero disables quoting
+    bool header = false; // First record holds column names
+};
+
+// Streaming reader of delimited text. A background thread parses the file
+// ahead into batches of about BATCH_SIZE bytes, at most MAX_BATCHES of them
+// wait for the consumer, so memory use does not depend on the file size.
+//
+// A batch is packed column by column, all numbers are u32 little endian:
+//   rows, columns, offsets of columns from the batch start,
+//   then every column: rows + 1 field offsets from its text start, UTF-8 text.
+// Rows shorter than the widest one are padded with empty fields.
+// Quoted fields may contain delimiters, line breaks and doubled quotes,
+// empty lines are skipped.
+class CsvReader {
+public:
+    static constexpr size_t BATCH_SIZE = 1u << 20;
+    static constexpr size_t MAX_BATCHES = 4;
+
+    // UTF-8 path, throws when the file can't be opened
+    CsvReader(const std::string &path, const CsvDialect &dialect);
+
+    CsvReader(const CsvReader &) = delete;
+
+    CsvReader &operator=(const CsvReader &) = delete;
+
+    ~CsvReader();
+
+    // Next packed batch, false at end of file. Rows of the current batch
+    // not visited by nextRow are skipped. The view is valid until the next read.
+    bool nextBatch(std::string_view &batch);
+
+    // Moves to the next row, false at end of file
+    bool nextRow();
+
+    // Column of the current row, empty for missing ones
+    std::string_view field(size_t column) const;
+
+    // Columns of the current batch, of the header before the first row
+    size_t columns();
+
+    // Empty without a header
+    const std::vector<std::string> &names();
+
+    // Compact JSON with bytes and rows parsed and time spent
+    std::string statistics() const;
+
+private:
+    enum State {
+        FIELD_START,
+        UNQUOTED,
+        QUOTED,
+        QUOTE_SEEN
+    };
+
+    struct Column {
+        std::string text;
+        std::vector<uint32_t> ends;
+    };
+
+    // Thrown on the parser thread when the reader is being destroyed
+    struct Stopped {
+    };
+
+    void parserLoop();
+
+    void parse(const char *begin, const char *end);
+
+    size_t scan(const char *begin, size_t size) const;
+
+    void endField();
+
+    void endRecord();
+
+    void finishBatch();
+
+    // Waits for the parser, called with the mutex held
+    bool waitBatch(std::unique_lock<std::mutex> &lock);
+
+    uint32_t read32(size_t offset) const;
+
+    CsvDialect dialect;
+    MappedFileReader file;
+
+    // Parser thread state
+    State state = FIELD_START;
+    bool skip_lf = false;
+    size_t column = 0;
+    size_t rows = 0;
+    size_t text_size = 0;
+    uint64_t blocked_ns = 0; // Waiting for the consumer while parsing a chunk
+    std::vector<Column> pending_columns;
+
+    std::mutex mutex;
+    std::condition_variable parsed;
+    std::condition_variable consumed;
+    std::deque<std::string> batches;
+    std::deque<uint64_t> batch_flows; // Trace flows from the parser to the consumer
+    std::vector<std::string> header_names;
+    bool header_ready;
+    bool finished = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread parser;
+
+    // Consumer state
+    std::string current;
+    size_t current_rows = 0;
+    size_t next_row = 0;
+
+    std::atomic<uint64_t> bytes_parsed{0};
+    std::atomic<uint64_t> rows_parsed{0};
+    std::atomic<uint64_t> parse_ns{0};
+    std::atomic<uint64_t> wait_ns{0};
+};
+
+#endif //CSVREADER_H
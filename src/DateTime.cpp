@@ -0,0 +1,338 @@
+﻿/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cmath>
+#include <stdexcept>
+
+#include "DateTime.h"
+
+namespace {
+
+struct Names {
+    std::string_view months[12];
+    std::string_view months_abbr[12];
+    std::string_view weekdays[7];
+    std::string_view weekdays_abbr[7];
+};
+
+// Indexed by DateFormat::Language
+const Names names[] = {
+        {
+                {"January", "February", "March", "April", "May", "June",
+                 "July", "August", "September", "October", "November", "December"},
+                {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"},
+                {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"},
+                {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"}
+        },
+        {
+                {u8"января", u8"февраля", u8"марта", u8"апреля", u8"мая", u8"июня",
+                 u8"июля", u8"августа", u8"сентября", u8"октября", u8"ноября", u8"декабря"},
+                {u8"янв", u8"фев", u8"мар", u8"апр", u8"мая", u8"июн",
+                 u8"июл", u8"авг", u8"сен", u8"окт", u8"ноя", u8"дек"},
+                {u8"воскресенье", u8"понедельник", u8"вторник", u8"среда", u8"четверг", u8"пятница", u8"суббота"},
+                {u8"Вс", u8"Пн", u8"Вт", u8"Ср", u8"Чт", u8"Пт", u8"Сб"}
+        }
+};
+
+constexpr int32_t OLE_EPOCH = daysFromCivil(1899, 12, 30);
+
+// Divisor must be positive
+constexpr int64_t floorDiv(int64_t a, int64_t b) {
+    return (a - ((a >> 63) & (b - 1))) / b;
+}
+
+uint32_t daysInMonth(int32_t year, uint32_t month) {
+    auto december = month == 12;
+    return static_cast<uint32_t>(daysFromCivil(year + december, month % 12 + 1, 1) - daysFromCivil(year, month, 1));
+}
+
+void appendNumber(std::string &out, int64_t value, size_t width) {
+    char buffer[24];
+    auto end = buffer + sizeof(buffer);
+    auto begin = end;
+    auto magnitude = static_cast<uint64_t>(value < 0 ? -value : value);
+    do {
+        *--begin = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    while (static_cast<size_t>(end - begin) < width) {
+        *--begin = '0';
+    }
+    if (value < 0) {
+        *--begin = '-';
+    }
+    out.append(begin, end);
+}
+
+bool readNumber(std::string_view text, size_t &pos, size_t max_digits, uint32_t &value) {
+    value = 0;
+    size_t digits = 0;
+    while (pos < text.size() && digits < max_digits && text[pos] >= '0' && text[pos] <= '9') {
+        value = value * 10 + (text[pos++] - '0');
+        ++digits;
+    }
+    return digits > 0;
+}
+
+template<size_t N>
+bool readName(std::string_view text, size_t &pos, const std::string_view (&table)[N], uint32_t &index) {
+    for (uint32_t i = 0; i < N; ++i) {
+        if (text.compare(pos, table[i].size(), table[i]) == 0) {
+            pos += table[i].size();
+            index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+Timestamp::Timestamp(const std::tm &tm) {
+    // Out of range fields are normalized like timegm does
+    auto years = floorDiv(tm.tm_mon, 12);
+    auto year = static_cast<int32_t>(tm.tm_year + 1900 + years);
+    auto month = static_cast<uint32_t>(tm.tm_mon - years * 12 + 1);
+    int64_t days = daysFromCivil(year, month, 1) + tm.tm_mday - 1;
+    value = days * SECONDS_PER_DAY + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+}
+
+std::tm Timestamp::toTm() const {
+    auto day_number = days();
+    auto date = civilFromDays(day_number);
+    auto seconds = secondOfDay();
+
+    std::tm result{};
+    result.tm_sec = static_cast<int>(seconds % 60);
+    result.tm_min = static_cast<int>(seconds / 60 % 60);
+    result.tm_hour = static_cast<int>(seconds / 3600);
+    result.tm_mday = static_cast<int>(date.day);
+    result.tm_mon = static_cast<int>(date.month - 1);
+    result.tm_year = date.year - 1900;
+    result.tm_wday = static_cast<int>(weekdayFromDays(day_number));
+    result.tm_yday = day_number - daysFromCivil(date.year, 1, 1);
+    return result;
+}
+
+Timestamp Timestamp::fromOleDate(double date) {
+    auto whole = std::trunc(date);
+    auto seconds = std::llround(std::fabs(date - whole) * SECONDS_PER_DAY);
+    return Timestamp((static_cast<int64_t>(whole) + OLE_EPOCH) * SECONDS_PER_DAY + seconds);
+}
+
+double Timestamp::toOleDate() const {
+    double whole = days() - OLE_EPOCH;
+    double fraction = static_cast<double>(secondOfDay()) / SECONDS_PER_DAY;
+    return whole < 0 ? whole - fraction : whole + fraction;
+}
+
+DateFormat::DateFormat(std::string_view pattern, Language language_) : language(language_) {
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%' || (i + 1 < pattern.size() && pattern[i + 1] == '%')) {
+            i += pattern[i] == '%';
+            if (tokens.empty() || tokens.back().field != LITERAL) {
+                tokens.push_back({LITERAL, static_cast<uint32_t>(literals.size()), 0});
+            }
+            literals.push_back(pattern[i]);
+            ++tokens.back().size;
+            continue;
+        }
+
+        if (++i == pattern.size()) {
+            throw std::invalid_argument("Incomplete date format specifier");
+        }
+
+        Field field;
+        switch (pattern[i]) {
+            case 'Y':
+                field = YEAR;
+                break;
+            case 'y':
+                field = YEAR_2;
+                break;
+            case 'm':
+                field = MONTH;
+                break;
+            case 'd':
+                field = DAY;
+                break;
+            case 'H':
+                field = HOUR;
+                break;
+            case 'M':
+                field = MINUTE;
+                break;
+            case 'S':
+                field = SECOND;
+                break;
+            case 'j':
+                field = DAY_OF_YEAR;
+                break;
+            case 'B':
+                field = MONTH_NAME;
+                break;
+            case 'b':
+                field = MONTH_ABBR;
+                break;
+            case 'A':
+                field = WEEKDAY_NAME;
+                break;
+            case 'a':
+                field = WEEKDAY_ABBR;
+                break;
+            default:
+                throw std::invalid_argument("Unsupported date format specifier");
+        }
+        tokens.push_back({field, 0, 0});
+    }
+}
+
+void DateFormat::format(Timestamp value, std::string &out) const {
+    auto day_number = value.days();
+    auto date = civilFromDays(day_number);
+    auto seconds = value.secondOfDay();
+    auto &table = names[language];
+
+    for (auto &token : tokens) {
+        switch (token.field) {
+            case LITERAL:
+                out.append(literals, token.offset, token.size);
+                break;
+            case YEAR:
+                appendNumber(out, date.year, 4);
+                break;
+            case YEAR_2:
+                appendNumber(out, date.year - floorDiv(date.year, 100) * 100, 2);
+                break;
+            case MONTH:
+                appendNumber(out, date.month, 2);
+                break;
+            case DAY:
+                appendNumber(out, date.day, 2);
+                break;
+            case HOUR:
+                appendNumber(out, seconds / 3600, 2);
+                break;
+            case MINUTE:
+                appendNumber(out, seconds / 60 % 60, 2);
+                break;
+            case SECOND:
+                appendNumber(out, seconds % 60, 2);
+                break;
+            case DAY_OF_YEAR:
+                appendNumber(out, day_number - daysFromCivil(date.year, 1, 1) + 1, 3);
+                break;
+            case MONTH_NAME:
+                out.append(table.months[date.month - 1]);
+                break;
+            case MONTH_ABBR:
+                out.append(table.months_abbr[date.month - 1]);
+                break;
+            case WEEKDAY_NAME:
+                out.append(table.weekdays[weekdayFromDays(day_number)]);
+                break;
+            case WEEKDAY_ABBR:
+                out.append(table.weekdays_abbr[weekdayFromDays(day_number)]);
+                break;
+        }
+    }
+}
+
+std::string DateFormat::format(Timestamp value) const {
+    std::string result;
+    format(value, result);
+    return result;
+}
+
+bool DateFormat::parse(std::string_view text, Timestamp &value) const {
+    auto &table = names[language];
+    int32_t year = 1970;
+    uint32_t month = 1, day = 1, hour = 0, minute = 0, second = 0, day_of_year = 0, number = 0;
+    size_t pos = 0;
+
+    for (auto &token : tokens) {
+        bool ok = true;
+        switch (token.field) {
+            case LITERAL:
+                ok = text.compare(pos, token.size, literals, token.offset, token.size) == 0;
+                pos += token.size;
+                break;
+            case YEAR:
+                ok = readNumber(text, pos, 4, number);
+                year = static_cast<int32_t>(number);
+                break;
+            case YEAR_2:
+                // POSIX rule: 69..99 are 1969..1999, 00..68 are 2000..2068
+                ok = readNumber(text, pos, 2, number);
+                year = static_cast<int32_t>(number < 69 ? 2000 + number : 1900 + number);
+                break;
+            case MONTH:
+                ok = readNumber(text, pos, 2, month);
+                break;
+            case DAY:
+                ok = readNumber(text, pos, 2, day);
+                break;
+            case HOUR:
+                ok = readNumber(text, pos, 2, hour);
+                break;
+            case MINUTE:
+                ok = readNumber(text, pos, 2, minute);
+                break;
+            case SECOND:
+                ok = readNumber(text, pos, 2, second);
+                break;
+            case DAY_OF_YEAR:
+                ok = readNumber(text, pos, 3, day_of_year) && day_of_year > 0;
+                break;
+            case MONTH_NAME:
+                ok = readName(text, pos, table.months, month);
+                ++month;
+                break;
+            case MONTH_ABBR:
+                ok = readName(text, pos, table.months_abbr, month);
+                ++month;
+                break;
+            case WEEKDAY_NAME:
+                ok = readName(text, pos, table.weekdays, number);
+                break;
+            case WEEKDAY_ABBR:
+                ok = readName(text, pos, table.weekdays_abbr, number);
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    if (pos != text.size() || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month)
+        || hour > 23 || minute > 59 || second > 59) {
+        return false;
+    }
+
+    int64_t days = daysFromCivil(year, month, day);
+    if (day_of_year) {
+        days = daysFromCivil(year, 1, 1) + day_of_year - 1;
+        if (day_of_year > static_cast<uint32_t>(daysFromCivil(year + 1, 1, 1) - daysFromCivil(year, 1, 1))) {
+            return false;
+        }
+    }
+
+    value = Timestamp(days * Timestamp::SECONDS_PER_DAY + hour * 3600 + minute * 60 + second);
+    return true;
+}
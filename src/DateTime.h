@@ -0,0 +1,176 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DATETIME_H
+#define DATETIME_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Proleptic Gregorian calendar on days since 1970-01-01.
+// Euclidean affine functions by Neri and Schneider: all arithmetic is
+// unsigned on a shifted epoch, so conversions have no branches.
+// Valid for years -32800..1000000.
+struct CivilDate {
+    int32_t year;
+    uint32_t month; // 1..12
+    uint32_t day;   // 1..31
+
+    // Whole 400 year eras moving the epoch back, so intermediate values stay unsigned
+    static constexpr uint32_t ERAS_SHIFT = 82;
+    static constexpr uint32_t DAYS_SHIFT = 719468 + 146097 * ERAS_SHIFT;
+    static constexpr uint32_t YEARS_SHIFT = 400 * ERAS_SHIFT;
+};
+
+constexpr int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day) {
+    const uint32_t january_or_february = month <= 2;
+    const uint32_t y = static_cast<uint32_t>(year) + CivilDate::YEARS_SHIFT - january_or_february;
+    const uint32_t m = month + 12 * january_or_february;
+    const uint32_t century = y / 100;
+    const uint32_t year_days = 1461 * y / 4 - century + century / 4;
+    const uint32_t month_days = (979 * m - 2919) / 32;
+    return static_cast<int32_t>(year_days + month_days + day - 1 - CivilDate::DAYS_SHIFT);
+}
+
+constexpr CivilDate civilFromDays(int32_t days) {
+    const uint32_t n = static_cast<uint32_t>(days) + CivilDate::DAYS_SHIFT;
+    const uint32_t n1 = 4 * n + 3;
+    const uint32_t century = n1 / 146097;
+    const uint32_t century_days = n1 % 146097 / 4;
+    const uint64_t p2 = uint64_t(2939745) * (4 * century_days + 3);
+    const uint32_t year_of_century = static_cast<uint32_t>(p2 >> 32);
+    const uint32_t year_days = static_cast<uint32_t>(p2) / 2939745 / 4;
+    const uint32_t n3 = 2141 * year_days + 197913;
+    const uint32_t month = n3 >> 16;
+    const uint32_t day = (n3 & 0xFFFF) / 2141;
+    const uint32_t january_or_february = year_days >= 306;
+    return {static_cast<int32_t>(100 * century + year_of_century - CivilDate::YEARS_SHIFT + january_or_february),
+            month - 12 * january_or_february, day + 1};
+}
+
+// 0 is Sunday, like tm_wday
+constexpr uint32_t weekdayFromDays(int32_t days) {
+    return static_cast<uint32_t>((days % 7 + 11) % 7);
+}
+
+// Date and time as seconds since 1970-01-01 00:00:00.
+// 1C dates carry no time zone, so calendar fields are converted as is.
+// Converts implicitly from and to std::tm, so handlers written against
+// std::tm keep compiling.
+class Timestamp {
+public:
+    static constexpr int64_t SECONDS_PER_DAY = 86400;
+
+    constexpr Timestamp() = default;
+
+    constexpr explicit Timestamp(int64_t seconds_) : value(seconds_) {};
+
+    Timestamp(const std::tm &tm);
+
+    constexpr Timestamp(CivilDate date, uint32_t hour = 0, uint32_t minute = 0, uint32_t second = 0)
+            : value(daysFromCivil(date.year, date.month, date.day) * SECONDS_PER_DAY
+                    + hour * 3600 + minute * 60 + second) {};
+
+    operator std::tm() const { return toTm(); }
+
+    std::tm toTm() const;
+
+    // OLE Automation date of VTYPE_DATE: days since 1899-12-30,
+    // time of day is the fraction, counted forward from the day even for negative dates
+    static Timestamp fromOleDate(double date);
+
+    double toOleDate() const;
+
+    constexpr int64_t seconds() const { return value; }
+
+    // Floor division, so time before 1970 belongs to the right day
+    constexpr int32_t days() const {
+        return static_cast<int32_t>((value - ((value >> 63) & (SECONDS_PER_DAY - 1))) / SECONDS_PER_DAY);
+    }
+
+    constexpr uint32_t secondOfDay() const {
+        return static_cast<uint32_t>(value - int64_t(days()) * SECONDS_PER_DAY);
+    }
+
+    constexpr bool operator==(const Timestamp &other) const { return value == other.value; }
+
+    constexpr bool operator!=(const Timestamp &other) const { return value != other.value; }
+
+    constexpr bool operator<(const Timestamp &other) const { return value < other.value; }
+
+private:
+    int64_t value = 0;
+};
+
+// Formats and parses dates by a pattern compiled once, e.g.
+//     static const DateFormat format(u8"%d.%m.%Y %H:%M:%S");
+//     auto text = format.format(timestamp);
+// Specifiers: %Y %y %m %d %H %M %S %j, month names %B (genitive in Russian) %b,
+// weekday names %A %a and %%. Names come from built-in tables, so neither
+// formatting nor parsing constructs a std::locale or a stream.
+class DateFormat {
+public:
+    enum Language {
+        EN,
+        RU
+    };
+
+    // Throws std::invalid_argument on unsupported specifiers
+    explicit DateFormat(std::string_view pattern, Language language_ = RU);
+
+    // Appends to out, so a reused buffer does not allocate
+    void format(Timestamp value, std::string &out) const;
+
+    std::string format(Timestamp value) const;
+
+    // Whole text must match the pattern, fields missing from it are taken from 1970-01-01 00:00:00
+    bool parse(std::string_view text, Timestamp &value) const;
+
+private:
+    enum Field : uint8_t {
+        LITERAL,
+        YEAR,
+        YEAR_2,
+        MONTH,
+        DAY,
+        HOUR,
+        MINUTE,
+        SECOND,
+        DAY_OF_YEAR,
+        MONTH_NAME,
+        MONTH_ABBR,
+        WEEKDAY_NAME,
+        WEEKDAY_ABBR
+    };
+
+    struct Token {
+        Field field;
+        uint32_t offset; // Literal text in literals
+        uint32_t size;
+    };
+
+    std::vector<Token> tokens;
+    std::string literals;
+    Language language;
+};
+
+#endif //DATETIME_H
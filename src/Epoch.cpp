@@ -0,0 +1,192 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Epoch.h"
+
+// Participant state is the pinned epoch shifted left with the low bit
+// set while the thread is inside a critical section
+struct Epoch::Participant {
+    std::atomic<uint64_t> state{0};
+    std::atomic<bool> used{true};
+    Participant *next = nullptr;
+};
+
+struct Epoch::Retired {
+    void *ptr;
+    void (*deleter)(void *);
+    uint64_t epoch;
+};
+
+namespace {
+
+// Set once thread local state is gone, e.g. for objects destroyed after it
+// during process exit. Such threads hand retired objects to orphans.
+thread_local bool local_destroyed = false;
+
+}
+
+// Whatever is left on process exit is freed, no reader can remain by then
+struct Epoch::Orphans : std::vector<Retired> {
+    ~Orphans() {
+        for (size_t i = 0; i < size(); ++i) {
+            auto r = (*this)[i];
+            r.deleter(r.ptr);
+        }
+    }
+};
+
+struct Epoch::Local {
+    ~Local() {
+        local_destroyed = true;
+        if (participant) {
+            participant->state.store(0, std::memory_order_release);
+            participant->used.store(false, std::memory_order_release);
+        }
+        if (!retired.empty()) {
+            std::lock_guard<std::mutex> lock(orphans_mutex);
+            orphans.insert(orphans.end(), retired.begin(), retired.end());
+        }
+    }
+
+    Participant *participant = nullptr;
+    unsigned depth = 0;
+    bool reclaiming = false;
+    std::vector<Retired> retired;
+};
+
+std::atomic<uint64_t> Epoch::global_epoch{1};
+std::atomic<Epoch::Participant *> Epoch::participants{nullptr};
+std::mutex Epoch::orphans_mutex;
+Epoch::Orphans Epoch::orphans;
+
+Epoch::Local &Epoch::local() {
+    static thread_local Local instance;
+    return instance;
+}
+
+// Reuses a participant of a finished thread or appends a new one.
+// Participants are never freed, so the list is walked without locks.
+Epoch::Participant *Epoch::acquire() {
+    for (auto p = participants.load(std::memory_order_acquire); p; p = p->next) {
+        bool used = false;
+        if (!p->used.load(std::memory_order_relaxed)
+            && p->used.compare_exchange_strong(used, true, std::memory_order_acq_rel)) {
+            return p;
+        }
+    }
+
+    auto fresh = new Participant;
+    auto head = participants.load(std::memory_order_relaxed);
+    do {
+        fresh->next = head;
+    } while (!participants.compare_exchange_weak(head, fresh, std::memory_order_release,
+                                                 std::memory_order_relaxed));
+    return fresh;
+}
+
+Epoch::Guard::Guard() {
+    if (local_destroyed) {
+        return;
+    }
+    auto &l = local();
+    if (l.depth++ > 0) {
+        return;
+    }
+    if (!l.participant) {
+        l.participant = acquire();
+    }
+    // Must be visible before any protected pointer is loaded
+    l.participant->state.store((global_epoch.load(std::memory_order_relaxed) << 1) | 1,
+                               std::memory_order_seq_cst);
+}
+
+Epoch::Guard::~Guard() {
+    if (local_destroyed) {
+        return;
+    }
+    auto &l = local();
+    if (--l.depth == 0) {
+        l.participant->state.store(0, std::memory_order_release);
+        // Old versions would otherwise wait for the next write of this thread
+        if (!l.retired.empty()) {
+            collect();
+        }
+    }
+}
+
+bool Epoch::tryAdvance() {
+    auto epoch = global_epoch.load(std::memory_order_seq_cst);
+    for (auto p = participants.load(std::memory_order_acquire); p; p = p->next) {
+        auto state = p->state.load(std::memory_order_seq_cst);
+        if ((state & 1) && (state >> 1) != epoch) {
+            return false;
+        }
+    }
+    global_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+// Deleters may retire more objects, they are appended and kept
+void Epoch::reclaim(std::vector<Retired> &retired, uint64_t epoch) {
+    size_t keep = 0;
+    for (size_t i = 0; i < retired.size(); ++i) {
+        auto r = retired[i];
+        if (r.epoch + 2 <= epoch) {
+            r.deleter(r.ptr);
+        } else {
+            retired[keep++] = r;
+        }
+    }
+    retired.resize(keep);
+}
+
+void Epoch::retire(void *ptr, void (*deleter)(void *)) {
+    if (local_destroyed) {
+        std::lock_guard<std::mutex> lock(orphans_mutex);
+        orphans.push_back({ptr, deleter, global_epoch.load(std::memory_order_seq_cst)});
+        return;
+    }
+    local().retired.push_back({ptr, deleter, global_epoch.load(std::memory_order_seq_cst)});
+    collect();
+}
+
+void Epoch::collect() {
+    tryAdvance();
+    auto epoch = global_epoch.load(std::memory_order_seq_cst);
+
+    if (!local_destroyed && !local().reclaiming) {
+        local().reclaiming = true;
+        reclaim(local().retired, epoch);
+        local().reclaiming = false;
+    }
+
+    std::vector<Retired> orphaned;
+    {
+        std::unique_lock<std::mutex> lock(orphans_mutex, std::try_to_lock);
+        if (!lock || orphans.empty()) {
+            return;
+        }
+        orphaned.swap(orphans);
+    }
+    reclaim(orphaned, epoch);
+    if (!orphaned.empty()) {
+        std::lock_guard<std::mutex> lock(orphans_mutex);
+        orphans.insert(orphans.end(), orphaned.begin(), orphaned.end());
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Epoch based memory reclamation.
+// Readers pin the current epoch with a Guard, which is a single store,
+// and never block. Writers retire unlinked objects, which are deleted once
+// the global epoch has advanced twice, i.e. every thread that could have
+// seen them has left its critical section.
+class Epoch {
+public:
+    class Guard;
+
+    // Deletes ptr once no guarded reader may still reference it
+    template<typename T>
+    static void retire(T *ptr) {
+        retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+    }
+
+    static void retire(void *ptr, void (*deleter)(void *));
+
+    // Advances the epoch if possible and frees what became unreachable
+    static void collect();
+
+private:
+    struct Participant;
+    struct Retired;
+    struct Orphans;
+    struct Local;
+
+    static Local &local();
+
+    static Participant *acquire();
+
+    static bool tryAdvance();
+
+    static void reclaim(std::vector<Retired> &retired, uint64_t epoch);
+
+    static std::atomic<uint64_t> global_epoch;
+    static std::atomic<Participant *> participants;
+    static std::mutex orphans_mutex;
+    static Orphans orphans;
+};
+
+// Critical section of a reader. Guards nest.
+class Epoch::Guard {
+public:
+    Guard();
+
+    Guard(const Guard &) = delete;
+
+    Guard &operator=(const Guard &) = delete;
+
+    ~Guard();
+};
+
+#endif //EPOCH_H
@@ -0,0 +1,109 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EXPECTED_H
+#define EXPECTED_H
+
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include <types.h>
+
+// Failure reported to 1C by a handler without throwing
+struct Error {
+    explicit Error(std::string message_, unsigned short code_ = ADDIN_E_FAIL)
+            : message(std::move(message_)), code(code_) {};
+
+    std::string message;
+    unsigned short code;
+};
+
+// Handler result holding either a value or an Error, like std::expected.
+// Use it for calls that fail routinely, e.g. validation: the error reaches
+// AddError directly, without the cost of unwinding an exception.
+//     Expected<variant_t> find(const std::string &key) {
+//         if (key.empty()) return Error(u8"Key is empty");
+//         ...
+//     }
+template<typename T>
+class Expected {
+public:
+    template<typename U = T, typename = std::enable_if_t<
+            std::is_constructible_v<T, U &&> &&
+            !std::is_same_v<std::decay_t<U>, Error> &&
+            !std::is_same_v<std::decay_t<U>, Expected>>>
+    Expected(U &&value) : storage(std::in_place_index<0>, std::forward<U>(value)) {};
+
+    Expected(Error error) : storage(std::in_place_index<1>, std::move(error)) {};
+
+    bool has_value() const { return storage.index() == 0; }
+
+    explicit operator bool() const { return has_value(); }
+
+    T &value() { return std::get<0>(storage); }
+
+    const T &value() const { return std::get<0>(storage); }
+
+    T &operator*() { return *std::get_if<0>(&storage); }
+
+    const T &operator*() const { return *std::get_if<0>(&storage); }
+
+    T *operator->() { return std::get_if<0>(&storage); }
+
+    const T *operator->() const { return std::get_if<0>(&storage); }
+
+    Error &error() { return *std::get_if<1>(&storage); }
+
+    const Error &error() const { return *std::get_if<1>(&storage); }
+
+private:
+    std::variant<T, Error> storage;
+};
+
+template<>
+class Expected<void> {
+public:
+    Expected() = default;
+
+    Expected(Error error) : failure(std::move(error)) {};
+
+    bool has_value() const { return !failure.has_value(); }
+
+    explicit operator bool() const { return has_value(); }
+
+    Error &error() { return *failure; }
+
+    const Error &error() const { return *failure; }
+
+private:
+    std::optional<Error> failure;
+};
+
+template<typename T>
+struct is_expected : std::false_type {
+};
+
+template<typename T>
+struct is_expected<Expected<T>> : std::true_type {
+};
+
+#endif //EXPECTED_H
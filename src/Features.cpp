@@ -0,0 +1,386 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+#include "CsvReader.h"
+#include "Features.h"
+
+namespace {
+
+CodecFormat codecFormat(const std::string &name) {
+    auto matches = [&name](const char *expected) {
+        return std::equal(name.begin(), name.end(), expected, expected + strlen(expected),
+                          [](char a, char b) { return tolower(static_cast<unsigned char>(a)) == b; });
+    };
+    if (matches("base64")) {
+        return CodecFormat::BASE64;
+    }
+    if (matches("base64url")) {
+        return CodecFormat::BASE64_URL;
+    }
+    if (matches("hex")) {
+        return CodecFormat::HEX;
+    }
+    throw std::invalid_argument(u8"Unknown format, expected Base64, Base64URL or Hex");
+}
+
+const tVariant &blobParam(const tVariant &data) {
+    if (data.vt != VTYPE_BLOB) {
+        throw std::invalid_argument(u8"Binary data expected");
+    }
+    return data;
+}
+
+// Text goes straight to host memory, the writer runs before the handler's call returns
+Component::HostText encodeParam(Encoder &encoder, const tVariant &data) {
+    auto &blob = blobParam(data);
+    return {encoder.encodedSize(blob.strLen, false),
+            [&encoder, &blob](WCHAR_T *out) { return encoder.encode(blob.pstrVal, blob.strLen, out); }};
+}
+
+// All of the data, by an encoder of the writer's own
+Component::HostText encodeParam(CodecFormat format, const tVariant &data) {
+    auto &blob = blobParam(data);
+    return {Encoder(format).encodedSize(blob.strLen, true), [format, &blob](WCHAR_T *out) {
+        Encoder encoder(format);
+        return encoder.finish(encoder.encode(blob.pstrVal, blob.strLen, out));
+    }};
+}
+
+// Buffers of huge results are not kept for later calls
+void resetBuffer(std::string &buffer) {
+    if (buffer.capacity() > (16u << 20)) {
+        buffer = std::string();
+    }
+    buffer.clear();
+}
+
+// Bytes are decoded to the buffer, which the returned blob refers to
+Blob decodeParam(Decoder &decoder, const tVariant &text, bool finish, std::string &buffer) {
+    resetBuffer(buffer);
+    switch (text.vt) {
+        case VTYPE_PWSTR:
+            decoder.decode(text.pwstrVal, text.wstrLen, buffer);
+            break;
+        case VTYPE_PSTR:
+            decoder.decode(text.pstrVal, text.strLen, buffer);
+            break;
+        default:
+            throw std::invalid_argument(u8"String expected");
+    }
+    if (finish) {
+        decoder.finish(buffer);
+    }
+    return Blob::borrow(&buffer[0], buffer.size());
+}
+
+// Output goes to the buffer, which the returned blob refers to
+Blob compressParam(Compressor &compressor, const tVariant &data, bool finish, std::string &buffer) {
+    resetBuffer(buffer);
+    auto &blob = blobParam(data);
+    if (finish) {
+        buffer.reserve(Compressor::bound(blob.strLen));
+    }
+    compressor.compress(blob.pstrVal, blob.strLen, buffer);
+    if (finish) {
+        compressor.finish(buffer);
+    }
+    return Blob::borrow(&buffer[0], buffer.size());
+}
+
+Blob decompressParam(Decompressor &decompressor, const tVariant &data, bool finish, std::string &buffer) {
+    resetBuffer(buffer);
+    auto &blob = blobParam(data);
+    decompressor.decompress(blob.pstrVal, blob.strLen, buffer);
+    if (finish) {
+        decompressor.finish();
+    }
+    return Blob::borrow(&buffer[0], buffer.size());
+}
+
+Hasher::Algorithm hashAlgorithm(const std::string &name) {
+    auto matches = [&name](const char *expected) {
+        return std::equal(name.begin(), name.end(), expected, expected + strlen(expected),
+                          [](char a, char b) { return tolower(static_cast<unsigned char>(a)) == b; });
+    };
+    if (matches("crc32c")) {
+        return Hasher::CRC32C;
+    }
+    if (matches("xxh3")) {
+        return Hasher::XXH3;
+    }
+    if (matches("xxh128")) {
+        return Hasher::XXH128;
+    }
+    if (matches("sha256")) {
+        return Hasher::SHA256;
+    }
+    throw std::invalid_argument(u8"Unknown algorithm, expected CRC32C, XXH3, XXH128 or SHA256");
+}
+
+// Bytes are hashed where the host keeps them, strings as UTF-16 code units
+void hashParam(Hasher &hasher, const tVariant &data) {
+    switch (data.vt) {
+        case VTYPE_BLOB:
+        case VTYPE_PSTR:
+            hasher.update(data.pstrVal, data.strLen);
+            break;
+        case VTYPE_PWSTR:
+            hasher.update(reinterpret_cast<const char *>(data.pwstrVal), data.wstrLen * sizeof(WCHAR_T));
+            break;
+        default:
+            throw std::invalid_argument(u8"Binary data or string expected");
+    }
+}
+
+variant_t digestValue(Hasher &hasher) {
+    std::string digest;
+    hasher.finish(digest);
+    if (hasher.algorithm() == Hasher::CRC32C) {
+        int64_t crc = 0;
+        for (auto byte : digest) {
+            crc = (crc << 8) | static_cast<uint8_t>(byte);
+        }
+        return crc;
+    }
+    std::string text;
+    Encoder encoder(CodecFormat::HEX);
+    encoder.encode(digest.data(), digest.size(), text);
+    return text;
+}
+
+}
+
+std::string SegmentMethods::create(int64_t size) {
+    if (size < 0) {
+        throw std::invalid_argument(u8"Size must not be negative");
+    }
+    return segments.create(static_cast<uint64_t>(size));
+}
+
+void SegmentMethods::retain(const std::string &path) {
+    segments.retain(path);
+}
+
+void SegmentMethods::release(const std::string &path) {
+    segments.release(path);
+}
+
+int32_t FileMethods::openFileReader(const std::string &path) {
+    return files.openReader(path);
+}
+
+int32_t FileMethods::openFileWriter(const std::string &path, bool append) {
+    return files.openWriter(path, append);
+}
+
+variant_t FileMethods::readLine(int32_t handle) {
+    std::string_view line;
+    if (!files.reader(handle).readLine(line)) {
+        return UNDEFINED;
+    }
+    return std::string(line);
+}
+
+// Size in bytes of the file, the chunk ends on a character boundary
+variant_t FileMethods::readChunk(int32_t handle, int64_t size) {
+    if (size <= 0) {
+        throw std::invalid_argument(u8"Size must be positive");
+    }
+    std::string_view chunk;
+    if (!files.reader(handle).readChunk(static_cast<uint64_t>(size), chunk)) {
+        return UNDEFINED;
+    }
+    return std::string(chunk);
+}
+
+void FileMethods::writeText(int32_t handle, const std::string &text) {
+    files.writer(handle).write(text);
+}
+
+void FileMethods::flushFile(int32_t handle) {
+    files.writer(handle).flush();
+}
+
+void FileMethods::closeFile(int32_t handle) {
+    files.close(handle);
+}
+
+int32_t FileMethods::openCsv(const std::string &path, const std::string &delimiter, const std::string &quote,
+                             bool header) {
+    if (delimiter.size() != 1 || delimiter[0] == '\n' || delimiter[0] == '\r') {
+        throw std::invalid_argument(u8"Delimiter must be a single ASCII character");
+    }
+    if (quote.size() > 1 || quote == delimiter || quote == "\n" || quote == "\r") {
+        throw std::invalid_argument(u8"Quote must be empty or a single ASCII character");
+    }
+
+    CsvDialect dialect;
+    dialect.delimiter = delimiter[0];
+    dialect.quote = quote.empty() ? '\0' : quote[0];
+    dialect.header = header;
+    return files.openCsv(path, dialect);
+}
+
+variant_t FileMethods::readCsvBatch(int32_t handle) {
+    std::string_view batch;
+    if (!files.csv(handle).nextBatch(batch)) {
+        return UNDEFINED;
+    }
+    // The batch stays with the reader until the next read, so it is copied to the host once
+    return Blob::borrow(const_cast<char *>(batch.data()), batch.size());
+}
+
+bool FileMethods::nextCsvRow(int32_t handle) {
+    return files.csv(handle).nextRow();
+}
+
+std::string FileMethods::csvField(int32_t handle, int32_t column) {
+    if (column < 0) {
+        throw std::out_of_range(u8"Column index out of range");
+    }
+    return std::string(files.csv(handle).field(static_cast<size_t>(column)));
+}
+
+int32_t FileMethods::csvColumnCount(int32_t handle) {
+    return static_cast<int32_t>(files.csv(handle).columns());
+}
+
+std::string FileMethods::csvColumnName(int32_t handle, int32_t column) {
+    auto &names = files.csv(handle).names();
+    if (column < 0 || static_cast<size_t>(column) >= names.size()) {
+        throw std::out_of_range(u8"Column index out of range");
+    }
+    return names[column];
+}
+
+std::string FileMethods::csvStatistics(int32_t handle) {
+    return files.csv(handle).statistics();
+}
+
+Component::HostText CodecMethods::base64Encode(const tVariant &data, bool url) {
+    return encodeParam(url ? CodecFormat::BASE64_URL : CodecFormat::BASE64, data);
+}
+
+variant_t CodecMethods::base64Decode(const tVariant &text, bool url) {
+    Decoder decoder(url ? CodecFormat::BASE64_URL : CodecFormat::BASE64);
+    return decodeParam(decoder, text, true, buffer);
+}
+
+Component::HostText CodecMethods::hexEncode(const tVariant &data) {
+    return encodeParam(CodecFormat::HEX, data);
+}
+
+variant_t CodecMethods::hexDecode(const tVariant &text) {
+    Decoder decoder(CodecFormat::HEX);
+    return decodeParam(decoder, text, true, buffer);
+}
+
+int32_t CodecMethods::openEncoder(const std::string &format) {
+    return codecs.openEncoder(codecFormat(format));
+}
+
+int32_t CodecMethods::openDecoder(const std::string &format) {
+    return codecs.openDecoder(codecFormat(format));
+}
+
+Component::HostText CodecMethods::encodeChunk(int32_t handle, const tVariant &data) {
+    return encodeParam(codecs.encoder(handle), data);
+}
+
+variant_t CodecMethods::decodeChunk(int32_t handle, const tVariant &text) {
+    return decodeParam(codecs.decoder(handle), text, false, buffer);
+}
+
+variant_t CodecMethods::finishCodec(int32_t handle) {
+    std::string rest;
+    if (codecs.finish(handle, rest)) {
+        return rest;
+    }
+    return Blob(rest.data(), rest.size());
+}
+
+void CodecMethods::clear() {
+    codecs.clear();
+    std::string().swap(buffer);
+}
+
+variant_t HashMethods::hash(const tVariant &data, const std::string &algorithm) {
+    Hasher hasher(hashAlgorithm(algorithm));
+    hashParam(hasher, data);
+    return digestValue(hasher);
+}
+
+int32_t HashMethods::openHash(const std::string &algorithm) {
+    return hashes.open(hashAlgorithm(algorithm));
+}
+
+void HashMethods::updateHash(int32_t handle, const tVariant &data) {
+    hashParam(hashes.hasher(handle), data);
+}
+
+variant_t HashMethods::finishHash(int32_t handle) {
+    auto hasher = hashes.take(handle);
+    return digestValue(hasher);
+}
+
+variant_t CompressionMethods::compress(const tVariant &data, bool high_ratio) {
+    Compressor compressor(high_ratio, &compression.compressed, compression.workers(), blobParam(data).strLen);
+    return compressParam(compressor, data, true, buffer);
+}
+
+variant_t CompressionMethods::decompress(const tVariant &data) {
+    Decompressor decompressor(&compression.decompressed);
+    return decompressParam(decompressor, data, true, buffer);
+}
+
+int32_t CompressionMethods::openCompressor(bool high_ratio) {
+    return compression.openCompressor(high_ratio);
+}
+
+int32_t CompressionMethods::openDecompressor() {
+    return compression.openDecompressor();
+}
+
+variant_t CompressionMethods::compressChunk(int32_t handle, const tVariant &data) {
+    return compressParam(compression.compressor(handle), data, false, buffer);
+}
+
+variant_t CompressionMethods::decompressChunk(int32_t handle, const tVariant &data) {
+    return decompressParam(compression.decompressor(handle), data, false, buffer);
+}
+
+variant_t CompressionMethods::finishCompression(int32_t handle) {
+    std::string rest;
+    compression.finish(handle, rest);
+    return Blob(rest.data(), rest.size());
+}
+
+std::string CompressionMethods::compressionStatistics() {
+    return compression.statistics();
+}
+
+void CompressionMethods::clear() {
+    compression.clear();
+    std::string().swap(buffer);
+}
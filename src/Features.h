@@ -0,0 +1,266 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FEATURES_H
+#define FEATURES_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Codecs.h"
+#include "Component.h"
+#include "Compression.h"
+#include "FileStreams.h"
+#include "Hashing.h"
+#include "SharedMemory.h"
+
+// Optional groups of methods with their state. A component enables a feature
+// by holding it as a member, adding Feature::methods<&Class::member>() to its
+// own methods and clearing it in shutdown(), see SampleAddIn.
+
+// Bulk data goes through memory mapped files: the host reads and writes a segment
+// by its path, methods exchange only paths and offsets. Segments are removed when
+// released as many times as created and retained, remaining ones on clear.
+class SegmentMethods {
+public:
+    template<auto Member>
+    static constexpr auto methods() {
+        return std::array{
+                Component::method<Member, &SegmentMethods::create>(u"CreateSegment", u"СоздатьСегмент"),
+                Component::method<Member, &SegmentMethods::retain>(u"RetainSegment", u"ЗахватитьСегмент"),
+                Component::method<Member, &SegmentMethods::release>(u"ReleaseSegment", u"ОсвободитьСегмент")
+        };
+    }
+
+    // Segment created by CreateSegment, mapped at least until the returned pointer is released
+    std::shared_ptr<SharedSegment> find(const std::string &path) { return segments.find(path); }
+
+    void clear() { segments.clear(); }
+
+private:
+    std::string create(int64_t size);
+
+    void retain(const std::string &path);
+
+    void release(const std::string &path);
+
+    SegmentRegistry segments;
+};
+
+// Large UTF-8 files are read through a memory mapping, line by line or in chunks,
+// and written in batches by a background thread. Open files are closed on clear.
+class FileMethods {
+public:
+    template<auto Member>
+    static constexpr auto methods() {
+        return std::array{
+                Component::method<Member, &FileMethods::openFileReader>(u"OpenFileReader", u"ОткрытьФайлДляЧтения"),
+                Component::method<Member, &FileMethods::openFileWriter>(u"OpenFileWriter", u"ОткрытьФайлДляЗаписи",
+                                                                        {{1, false}}),
+                // Undefined at end of file
+                Component::method<Member, &FileMethods::readLine>(u"ReadLine", u"ПрочитатьСтроку"),
+                Component::method<Member, &FileMethods::readChunk>(u"ReadChunk", u"ПрочитатьФрагмент"),
+                Component::method<Member, &FileMethods::writeText>(u"WriteText", u"ЗаписатьТекст"),
+                Component::method<Member, &FileMethods::flushFile>(u"FlushFile", u"СброситьФайл"),
+                Component::method<Member, &FileMethods::closeFile>(u"CloseFile", u"ЗакрытьФайл")
+        };
+    }
+
+    // Delimited text is parsed ahead by a background thread. Rows are read either
+    // one by one or as packed column batches, see CsvReader. CloseFile closes it,
+    // so the class enables methods() as well.
+    template<auto Member>
+    static constexpr auto csvMethods() {
+        return std::array{
+                Component::method<Member, &FileMethods::openCsv>(u"OpenCsv", u"ОткрытьCSV",
+                                                                 {{1, u","}, {2, u"\""}, {3, false}}),
+                // Undefined at end of file
+                Component::method<Member, &FileMethods::readCsvBatch>(u"ReadCsvBatch", u"ПрочитатьПакетCSV"),
+                Component::method<Member, &FileMethods::nextCsvRow>(u"NextCsvRow", u"СледующаяСтрокаCSV"),
+                Component::method<Member, &FileMethods::csvField>(u"CsvField", u"ПолеCSV"),
+                Component::method<Member, &FileMethods::csvColumnCount>(u"CsvColumnCount", u"КоличествоКолонокCSV"),
+                Component::method<Member, &FileMethods::csvColumnName>(u"CsvColumnName", u"ИмяКолонкиCSV"),
+                // Bytes and rows parsed, parse and wait times as JSON
+                Component::method<Member, &FileMethods::csvStatistics>(u"CsvStatistics", u"СтатистикаCSV")
+        };
+    }
+
+    void clear() { files.clear(); }
+
+private:
+    int32_t openFileReader(const std::string &path);
+
+    int32_t openFileWriter(const std::string &path, bool append);
+
+    variant_t readLine(int32_t handle);
+
+    variant_t readChunk(int32_t handle, int64_t size);
+
+    void writeText(int32_t handle, const std::string &text);
+
+    void flushFile(int32_t handle);
+
+    void closeFile(int32_t handle);
+
+    int32_t openCsv(const std::string &path, const std::string &delimiter, const std::string &quote, bool header);
+
+    variant_t readCsvBatch(int32_t handle);
+
+    bool nextCsvRow(int32_t handle);
+
+    std::string csvField(int32_t handle, int32_t column);
+
+    int32_t csvColumnCount(int32_t handle);
+
+    std::string csvColumnName(int32_t handle, int32_t column);
+
+    std::string csvStatistics(int32_t handle);
+
+    FileRegistry files;
+};
+
+// Binary data as Base64 or hex text and back, see Codecs.h.
+// Data too large for one call goes in chunks through a codec opened
+// for a format: Base64, Base64URL or Hex. FinishCodec returns the rest and closes it.
+class CodecMethods {
+public:
+    template<auto Member>
+    static constexpr auto methods() {
+        return std::array{
+                Component::method<Member, &CodecMethods::base64Encode>(u"Base64Encode", u"ЗакодироватьBase64",
+                                                                       {{1, false}}),
+                Component::method<Member, &CodecMethods::base64Decode>(u"Base64Decode", u"РаскодироватьBase64",
+                                                                       {{1, false}}),
+                Component::method<Member, &CodecMethods::hexEncode>(u"HexEncode", u"ЗакодироватьHex"),
+                Component::method<Member, &CodecMethods::hexDecode>(u"HexDecode", u"РаскодироватьHex"),
+                Component::method<Member, &CodecMethods::openEncoder>(u"OpenEncoder", u"ОткрытьКодировщик"),
+                Component::method<Member, &CodecMethods::openDecoder>(u"OpenDecoder", u"ОткрытьДекодировщик"),
+                Component::method<Member, &CodecMethods::encodeChunk>(u"EncodeChunk", u"ЗакодироватьФрагмент"),
+                Component::method<Member, &CodecMethods::decodeChunk>(u"DecodeChunk", u"РаскодироватьФрагмент"),
+                Component::method<Member, &CodecMethods::finishCodec>(u"FinishCodec", u"ЗавершитьКодирование")
+        };
+    }
+
+    // Closes codecs and frees the buffer
+    void clear();
+
+private:
+    Component::HostText base64Encode(const tVariant &data, bool url);
+
+    variant_t base64Decode(const tVariant &text, bool url);
+
+    Component::HostText hexEncode(const tVariant &data);
+
+    variant_t hexDecode(const tVariant &text);
+
+    int32_t openEncoder(const std::string &format);
+
+    int32_t openDecoder(const std::string &format);
+
+    Component::HostText encodeChunk(int32_t handle, const tVariant &data);
+
+    variant_t decodeChunk(int32_t handle, const tVariant &text);
+
+    variant_t finishCodec(int32_t handle);
+
+    CodecRegistry codecs;
+    std::string buffer; // Decoded bytes returned by the last call
+};
+
+// Checksum or hash of binary data or of a string as UTF-16 bytes by algorithm:
+// CRC32C as a number, XXH3, XXH128 or SHA256 as hex text, see Hashing.h.
+// Data hashed in chunks, FinishHash returns the result and closes the context.
+class HashMethods {
+public:
+    template<auto Member>
+    static constexpr auto methods() {
+        return std::array{
+                Component::method<Member, &HashMethods::hash>(u"Hash", u"Хеш"),
+                Component::method<Member, &HashMethods::openHash>(u"OpenHash", u"ОткрытьХеш"),
+                Component::method<Member, &HashMethods::updateHash>(u"UpdateHash", u"ДобавитьКХешу"),
+                Component::method<Member, &HashMethods::finishHash>(u"FinishHash", u"ЗавершитьХеш")
+        };
+    }
+
+    void clear() { hashes.clear(); }
+
+private:
+    variant_t hash(const tVariant &data, const std::string &algorithm);
+
+    int32_t openHash(const std::string &algorithm);
+
+    void updateHash(int32_t handle, const tVariant &data);
+
+    variant_t finishHash(int32_t handle);
+
+    HashRegistry hashes;
+};
+
+// Binary data to LZ4 frames and back, fast or with a higher ratio, see Compression.h.
+// Data given in chunks, e.g. by cursors or file readers. Chunks return
+// the output of complete blocks, FinishCompression the rest and closes the context.
+class CompressionMethods {
+public:
+    template<auto Member>
+    static constexpr auto methods() {
+        return std::array{
+                Component::method<Member, &CompressionMethods::compress>(u"Compress", u"СжатьДанные", {{1, false}}),
+                Component::method<Member, &CompressionMethods::decompress>(u"Decompress", u"РаспаковатьДанные"),
+                Component::method<Member, &CompressionMethods::openCompressor>(u"OpenCompressor", u"ОткрытьСжатие",
+                                                                               {{0, false}}),
+                Component::method<Member, &CompressionMethods::openDecompressor>(u"OpenDecompressor",
+                                                                                 u"ОткрытьРаспаковку"),
+                Component::method<Member, &CompressionMethods::compressChunk>(u"CompressChunk", u"СжатьФрагмент"),
+                Component::method<Member, &CompressionMethods::decompressChunk>(u"DecompressChunk",
+                                                                                u"РаспаковатьФрагмент"),
+                Component::method<Member, &CompressionMethods::finishCompression>(u"FinishCompression",
+                                                                                  u"ЗавершитьСжатие"),
+                // Bytes in and out, time, ratio and throughput of compression and decompression as JSON
+                Component::method<Member, &CompressionMethods::compressionStatistics>(u"CompressionStatistics",
+                                                                                      u"СтатистикаСжатия")
+        };
+    }
+
+    // Closes contexts and frees the buffer
+    void clear();
+
+private:
+    variant_t compress(const tVariant &data, bool high_ratio);
+
+    variant_t decompress(const tVariant &data);
+
+    int32_t openCompressor(bool high_ratio);
+
+    int32_t openDecompressor();
+
+    variant_t compressChunk(int32_t handle, const tVariant &data);
+
+    variant_t decompressChunk(int32_t handle, const tVariant &data);
+
+    variant_t finishCompression(int32_t handle);
+
+    std::string compressionStatistics();
+
+    CompressionRegistry compression;
+    std::string buffer; // Compressed or decompressed bytes returned by the last call
+};
+
+#endif //FEATURES_H
@@ -0,0 +1,462 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "CsvReader.h"
+#include "FileStreams.h"
+#include "Trace.h"
+
+namespace {
+
+constexpr auto FLUSH_INTERVAL = std::chrono::seconds(1);
+
+#ifdef _WINDOWS
+
+std::wstring toWide(const std::string &src) {
+    auto size = MultiByteToWideChar(CP_UTF8, 0, src.data(), static_cast<int>(src.size()), nullptr, 0);
+    std::wstring result(size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, src.data(), static_cast<int>(src.size()), &result[0], size);
+    return result;
+}
+
+uint64_t granularity() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+}
+
+#else
+
+uint64_t granularity() {
+    return static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+#endif
+
+bool isContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+}
+
+#ifdef _WINDOWS
+
+MappedFileReader::MappedFileReader(const std::string &path) {
+    file = CreateFileW(toWide(path).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        throw std::runtime_error(u8"Failed to open file");
+    }
+
+    // The destructor doesn't run for a failed constructor
+    try {
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            throw std::runtime_error(u8"Failed to open file");
+        }
+        file_size = static_cast<uint64_t>(size.QuadPart);
+
+        // Empty files can't be mapped
+        if (file_size > 0) {
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mapping) {
+                throw std::runtime_error(u8"Failed to map file");
+            }
+        }
+
+        skipBom();
+    } catch (...) {
+        this->close();
+        throw;
+    }
+}
+
+MappedFileReader::~MappedFileReader() {
+    close();
+}
+
+void MappedFileReader::close() {
+    unmap();
+    if (mapping) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+    if (file) {
+        CloseHandle(file);
+        file = nullptr;
+    }
+}
+
+const char *MappedFileReader::map(uint64_t offset, uint64_t size) {
+    auto end = std::min(file_size, offset + size);
+    if (window && offset >= window_offset && end <= window_offset + window_size) {
+        return window + (offset - window_offset);
+    }
+
+    unmap();
+    auto start = offset / granularity() * granularity();
+    auto length = std::max(end, std::min(file_size, start + WINDOW_SIZE)) - start;
+    window = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, static_cast<DWORD>(start >> 32),
+                                                     static_cast<DWORD>(start), static_cast<SIZE_T>(length)));
+    if (!window) {
+        throw std::runtime_error(u8"Failed to map file");
+    }
+    window_offset = start;
+    window_size = length;
+    return window + (offset - start);
+}
+
+void MappedFileReader::unmap() {
+    if (window) {
+        UnmapViewOfFile(window);
+        window = nullptr;
+    }
+}
+
+#else
+
+MappedFileReader::MappedFileReader(const std::string &path) {
+    file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        throw std::runtime_error(u8"Failed to open file");
+    }
+
+    // The destructor doesn't run for a failed constructor
+    try {
+        struct stat info{};
+        if (fstat(file, &info) != 0) {
+            throw std::runtime_error(u8"Failed to open file");
+        }
+        file_size = static_cast<uint64_t>(info.st_size);
+
+        skipBom();
+    } catch (...) {
+        this->close();
+        throw;
+    }
+}
+
+MappedFileReader::~MappedFileReader() {
+    close();
+}
+
+void MappedFileReader::close() {
+    unmap();
+    if (file >= 0) {
+        ::close(file);
+        file = -1;
+    }
+}
+
+const char *MappedFileReader::map(uint64_t offset, uint64_t size) {
+    auto end = std::min(file_size, offset + size);
+    if (window && offset >= window_offset && end <= window_offset + window_size) {
+        return window + (offset - window_offset);
+    }
+
+    unmap();
+    auto start = offset / granularity() * granularity();
+    auto length = std::max(end, std::min(file_size, start + WINDOW_SIZE)) - start;
+    auto address = mmap(nullptr, static_cast<size_t>(length), PROT_READ, MAP_SHARED, file, static_cast<off_t>(start));
+    if (address == MAP_FAILED) {
+        throw std::runtime_error(u8"Failed to map file");
+    }
+    madvise(address, static_cast<size_t>(length), MADV_SEQUENTIAL);
+
+    window = static_cast<const char *>(address);
+    window_offset = start;
+    window_size = length;
+    return window + (offset - start);
+}
+
+void MappedFileReader::unmap() {
+    if (window) {
+        munmap(const_cast<char *>(window), static_cast<size_t>(window_size));
+        window = nullptr;
+    }
+}
+
+#endif
+
+void MappedFileReader::skipBom() {
+    if (file_size >= 3 && memcmp(map(0, 3), "\xEF\xBB\xBF", 3) == 0) {
+        position = 3;
+    }
+}
+
+bool MappedFileReader::readLine(std::string_view &line) {
+    if (position >= file_size) {
+        return false;
+    }
+
+    // Rest of the current window first, a line crossing its end is mapped anew
+    uint64_t available = std::min(file_size - position, WINDOW_SIZE);
+    if (window && position >= window_offset && position < window_offset + window_size) {
+        available = window_offset + window_size - position;
+    }
+
+    while (true) {
+        auto begin = map(position, available);
+        auto found = static_cast<const char *>(memchr(begin, '\n', static_cast<size_t>(available)));
+        if (found || position + available == file_size) {
+            auto length = static_cast<size_t>(found ? found - begin : available);
+            position += length + (found ? 1 : 0);
+            if (found && length > 0 && begin[length - 1] == '\r') {
+                --length;
+            }
+            line = std::string_view(begin, length);
+            return true;
+        }
+        available = std::min(file_size - position, std::max(available * 2, WINDOW_SIZE));
+    }
+}
+
+bool MappedFileReader::readChunk(uint64_t size, std::string_view &chunk) {
+    if (position >= file_size || size == 0) {
+        return false;
+    }
+
+    // A few bytes past the end show whether it splits a character
+    auto length = std::min(size, file_size - position);
+    auto begin = map(position, length + 4);
+
+    if (position + length < file_size) {
+        auto cut = length;
+        while (cut > 0 && isContinuation(begin[cut])) {
+            --cut;
+        }
+        if (cut == 0) {
+            // Shorter than one character, the whole character is returned
+            cut = 1;
+            while (position + cut < file_size && cut < 4 && isContinuation(begin[cut])) {
+                ++cut;
+            }
+        }
+        length = cut;
+    }
+
+    position += length;
+    chunk = std::string_view(begin, static_cast<size_t>(length));
+    return true;
+}
+
+BufferedFileWriter::BufferedFileWriter(const std::string &path, bool append) {
+#ifdef _WINDOWS
+    file = _wfopen(toWide(path).c_str(), append ? L"ab" : L"wb");
+#else
+    file = fopen(path.c_str(), append ? "ab" : "wb");
+#endif
+    if (!file) {
+        throw std::runtime_error(u8"Failed to open file");
+    }
+    // Buffering is done here, so writes of whole buffers go straight to the file
+    setvbuf(file, nullptr, _IONBF, 0);
+
+    current.reserve(BUFFER_SIZE);
+    writer = std::thread(&BufferedFileWriter::writerLoop, this);
+}
+
+BufferedFileWriter::~BufferedFileWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        submit();
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    fclose(file);
+}
+
+void BufferedFileWriter::write(std::string_view data) {
+    std::unique_lock<std::mutex> lock(mutex);
+    checkError();
+
+    while (!data.empty()) {
+        auto part = data.substr(0, BUFFER_SIZE - current.size());
+        current.append(part);
+        data.remove_prefix(part.size());
+
+        if (current.size() == BUFFER_SIZE) {
+            written.wait(lock, [this] { return pending.size() < MAX_PENDING || failed; });
+            checkError();
+            submit();
+            wake.notify_one();
+        }
+    }
+}
+
+void BufferedFileWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    submit();
+    wake.notify_one();
+    written.wait(lock, [this] { return (pending.empty() && in_flight == 0) || failed; });
+    checkError();
+}
+
+void BufferedFileWriter::submit() {
+    if (current.empty()) {
+        return;
+    }
+    pending.push_back(std::move(current));
+    pending_flows.push_back(Trace::flowBegin("writeBuffer"));
+    if (spare.empty()) {
+        current = std::string();
+        current.reserve(BUFFER_SIZE);
+    } else {
+        current = std::move(spare.back());
+        spare.pop_back();
+    }
+}
+
+void BufferedFileWriter::checkError() {
+    if (failed) {
+        throw std::runtime_error(u8"Failed to write file");
+    }
+}
+
+void BufferedFileWriter::writerLoop() {
+    std::vector<std::string> batch;
+    std::vector<uint64_t> flows;
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        if (pending.empty() && !stopping &&
+            !wake.wait_for(lock, FLUSH_INTERVAL, [this] { return stopping || !pending.empty(); })) {
+            // Nothing written for a while, a partly filled buffer goes out
+            Trace::Scope scope("submitIdleBuffer");
+            submit();
+        }
+
+        if (pending.empty()) {
+            if (stopping) {
+                break;
+            }
+            continue;
+        }
+
+        batch.swap(pending);
+        flows.swap(pending_flows);
+        in_flight = batch.size();
+        lock.unlock();
+
+        bool success = true;
+        {
+            Trace::Scope scope("writeBuffers");
+            for (auto flow : flows) {
+                Trace::flowEnd("writeBuffer", flow);
+            }
+            for (auto &buffer : batch) {
+                success = success && fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+            }
+        }
+
+        lock.lock();
+        failed = failed || !success;
+        in_flight = 0;
+        for (auto &buffer : batch) {
+            if (spare.size() < MAX_PENDING) {
+                buffer.clear();
+                spare.push_back(std::move(buffer));
+            }
+        }
+        batch.clear();
+        flows.clear();
+        written.notify_all();
+    }
+}
+
+FileRegistry::FileRegistry() = default;
+
+FileRegistry::~FileRegistry() = default;
+
+int32_t FileRegistry::openReader(const std::string &path) {
+    auto reader = std::make_unique<MappedFileReader>(path);
+    readers.emplace(++last_handle, std::move(reader));
+    return last_handle;
+}
+
+int32_t FileRegistry::openWriter(const std::string &path, bool append) {
+    auto writer = std::make_unique<BufferedFileWriter>(path, append);
+    writers.emplace(++last_handle, std::move(writer));
+    return last_handle;
+}
+
+int32_t FileRegistry::openCsv(const std::string &path, const CsvDialect &dialect) {
+    auto reader = std::make_unique<CsvReader>(path, dialect);
+    csv_readers.emplace(++last_handle, std::move(reader));
+    return last_handle;
+}
+
+MappedFileReader &FileRegistry::reader(int32_t handle) {
+    auto it = readers.find(handle);
+    if (it == readers.end()) {
+        throw std::runtime_error(u8"File is not open for reading");
+    }
+    return *it->second;
+}
+
+BufferedFileWriter &FileRegistry::writer(int32_t handle) {
+    auto it = writers.find(handle);
+    if (it == writers.end()) {
+        throw std::runtime_error(u8"File is not open for writing");
+    }
+    return *it->second;
+}
+
+CsvReader &FileRegistry::csv(int32_t handle) {
+    auto it = csv_readers.find(handle);
+    if (it == csv_readers.end()) {
+        throw std::runtime_error(u8"File is not open as CSV");
+    }
+    return *it->second;
+}
+
+void FileRegistry::close(int32_t handle) {
+    auto writer = writers.find(handle);
+    if (writer != writers.end()) {
+        // Errors of the last writes are reported before the file is closed
+        auto file = std::move(writer->second);
+        writers.erase(writer);
+        file->flush();
+        return;
+    }
+    if (!readers.erase(handle) && !csv_readers.erase(handle)) {
+        throw std::runtime_error(u8"File is not open");
+    }
+}
+
+void FileRegistry::clear() {
+    readers.clear();
+    writers.clear();
+    csv_readers.clear();
+}
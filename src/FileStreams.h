@@ -0,0 +1,161 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FILESTREAMS_H
+#define FILESTREAMS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Sequential reader of a UTF-8 file through a sliding read only mapping.
+// The window is hinted as sequential, so the kernel reads ahead and drops
+// pages behind, and files larger than the address space can be read too.
+class MappedFileReader {
+public:
+    // UTF-8 path, throws when the file can't be opened
+    explicit MappedFileReader(const std::string &path);
+
+    MappedFileReader(const MappedFileReader &) = delete;
+
+    MappedFileReader &operator=(const MappedFileReader &) = delete;
+
+    ~MappedFileReader();
+
+    // Next line without \n or \r\n, false at end of file.
+    // The view is valid until the next read.
+    bool readLine(std::string_view &line);
+
+    // Up to size bytes cut at a character boundary, false at end of file
+    bool readChunk(uint64_t size, std::string_view &chunk);
+
+    uint64_t size() const { return file_size; }
+
+private:
+    static constexpr uint64_t WINDOW_SIZE = 64u << 20;
+
+    // Maps at least [offset, offset + size) clipped to the file, returns its start
+    const char *map(uint64_t offset, uint64_t size);
+
+    void unmap();
+
+    void skipBom();
+
+    void close();
+
+    uint64_t file_size = 0;
+    uint64_t position = 0;
+    uint64_t window_offset = 0;
+    uint64_t window_size = 0;
+    const char *window = nullptr;
+#ifdef _WINDOWS
+    void *file = nullptr;
+    void *mapping = nullptr;
+#else
+    int file = -1;
+#endif
+};
+
+// Writer collecting small writes in a buffer. Full buffers are written by
+// a background thread in batches, a partly filled one after FLUSH_INTERVAL
+// of inactivity. Write errors are reported by the following call.
+class BufferedFileWriter {
+public:
+    static constexpr size_t BUFFER_SIZE = 1u << 20;
+    static constexpr size_t MAX_PENDING = 8;
+
+    // UTF-8 path, the file is truncated unless appending
+    BufferedFileWriter(const std::string &path, bool append);
+
+    BufferedFileWriter(const BufferedFileWriter &) = delete;
+
+    BufferedFileWriter &operator=(const BufferedFileWriter &) = delete;
+
+    // Writes everything left, errors are lost at this point
+    ~BufferedFileWriter();
+
+    void write(std::string_view data);
+
+    // Returns when everything written so far is in the file
+    void flush();
+
+private:
+    // Queues the current buffer for writing, called with the mutex held
+    void submit();
+
+    void writerLoop();
+
+    void checkError();
+
+    std::FILE *file;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable written;
+    std::string current;
+    std::vector<std::string> pending;
+    std::vector<uint64_t> pending_flows; // Trace flows from submitting to writing
+    std::vector<std::string> spare; // Written buffers kept for reuse
+    size_t in_flight = 0;
+    bool stopping = false;
+    bool failed = false;
+    std::thread writer;
+};
+
+class CsvReader;
+struct CsvDialect;
+
+// Files opened by a component, by handle
+class FileRegistry {
+public:
+    FileRegistry();
+
+    ~FileRegistry();
+
+    int32_t openReader(const std::string &path);
+
+    int32_t openWriter(const std::string &path, bool append);
+
+    int32_t openCsv(const std::string &path, const CsvDialect &dialect);
+
+    // Throws when the handle is not open for reading or writing respectively
+    MappedFileReader &reader(int32_t handle);
+
+    BufferedFileWriter &writer(int32_t handle);
+
+    CsvReader &csv(int32_t handle);
+
+    void close(int32_t handle);
+
+    void clear();
+
+private:
+    int32_t last_handle = 0;
+    std::map<int32_t, std::unique_ptr<MappedFileReader>> readers;
+    std::map<int32_t, std::unique_ptr<BufferedFileWriter>> writers;
+    std::map<int32_t, std::unique_ptr<CsvReader>> csv_readers;
+};
+
+#endif //FILESTREAMS_H
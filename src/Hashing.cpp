@@ -0,0 +1,894 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "Hashing.h"
+#include "Simd.h"
+
+// All supported targets are little endian, so words are loaded as is
+
+namespace {
+
+template<typename T>
+T load(const void *src) {
+    T value;
+    memcpy(&value, src, sizeof(T));
+    return value;
+}
+
+uint32_t byteSwap(uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+}
+
+uint64_t byteSwap(uint64_t value) {
+    return (static_cast<uint64_t>(byteSwap(static_cast<uint32_t>(value))) << 32)
+           | byteSwap(static_cast<uint32_t>(value >> 32));
+}
+
+uint32_t rotateLeft(uint32_t value, int shift) {
+    return (value << shift) | (value >> (32 - shift));
+}
+
+uint64_t rotateLeft(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+template<typename T>
+void appendBigEndian(std::string &digest, T value) {
+    for (auto shift = static_cast<int>(sizeof(T) * 8) - 8; shift >= 0; shift -= 8) {
+        digest.push_back(static_cast<char>(value >> shift));
+    }
+}
+
+// CRC-32C
+
+constexpr uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+struct CrcTables {
+    uint32_t slices[8][256];
+};
+
+// Tables for the slicing by 8 algorithm, one byte of an 8 byte word each
+constexpr CrcTables makeCrcTables() {
+    CrcTables tables{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        auto crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+        tables.slices[0][i] = crc;
+    }
+    for (size_t slice = 1; slice < 8; ++slice) {
+        for (size_t i = 0; i < 256; ++i) {
+            auto prev = tables.slices[slice - 1][i];
+            tables.slices[slice][i] = (prev >> 8) ^ tables.slices[0][prev & 0xFF];
+        }
+    }
+    return tables;
+}
+
+constexpr CrcTables CRC_TABLES = makeCrcTables();
+
+uint32_t crc32cPortable(uint32_t crc, const uint8_t *data, size_t size) {
+    const auto &t = CRC_TABLES.slices;
+    for (; size >= 8; data += 8, size -= 8) {
+        auto low = load<uint32_t>(data) ^ crc;
+        auto high = load<uint32_t>(data + 4);
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+              ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+    for (; size; ++data, --size) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef ADDIN_SSE2
+
+ADDIN_TARGET("sse4.2")
+uint32_t crc32cSse42(uint32_t crc, const uint8_t *data, size_t size) {
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t wide = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        wide = _mm_crc32_u64(wide, load<uint64_t>(data));
+    }
+    crc = static_cast<uint32_t>(wide);
+#endif
+    for (; size >= 4; data += 4, size -= 4) {
+        crc = _mm_crc32_u32(crc, load<uint32_t>(data));
+    }
+    for (; size; ++data, --size) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+#elif defined(ADDIN_NEON)
+
+ADDIN_TARGET(ADDIN_ARM_CRC)
+uint32_t crc32cArm(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size >= 8; data += 8, size -= 8) {
+        crc = __crc32cd(crc, load<uint64_t>(data));
+    }
+    for (; size; ++data, --size) {
+        crc = __crc32cb(crc, *data);
+    }
+    return crc;
+}
+
+#endif
+
+using CrcFunction = uint32_t (*)(uint32_t crc, const uint8_t *data, size_t size);
+
+CrcFunction selectCrc32c() {
+#if defined(ADDIN_SSE2)
+    if (cpuFeatures().sse42) {
+        return crc32cSse42;
+    }
+#elif defined(ADDIN_NEON)
+    if (cpuFeatures().crc32) {
+        return crc32cArm;
+    }
+#endif
+    return crc32cPortable;
+}
+
+// Instructions of the CPU when it has them, selected at load
+const CrcFunction crc32c = selectCrc32c();
+
+// XXH32 and XXH3
+
+constexpr uint32_t PRIME32_1 = 0x9E3779B1;
+constexpr uint32_t PRIME32_2 = 0x85EBCA77;
+constexpr uint32_t PRIME32_3 = 0xC2B2AE3D;
+constexpr uint32_t PRIME32_4 = 0x27D4EB2F;
+constexpr uint32_t PRIME32_5 = 0x165667B1;
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9;
+constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63;
+constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5;
+constexpr uint64_t PRIME_MX1 = 0x165667919E3779F9;
+constexpr uint64_t PRIME_MX2 = 0x9FB21C651E98DF25;
+
+constexpr size_t SECRET_SIZE = 192;
+constexpr size_t STRIPE_SIZE = 64;
+constexpr size_t SECRET_CONSUME_RATE = 8;
+constexpr size_t BLOCK_STRIPES = (SECRET_SIZE - STRIPE_SIZE) / SECRET_CONSUME_RATE;
+constexpr size_t SECRET_MERGEACCS_START = 11;
+constexpr size_t SECRET_LASTACC_START = 7;
+constexpr size_t SECRET_SIZE_MIN = 136;
+constexpr size_t MID_SIZE_MAX = 240;
+
+alignas(64) constexpr uint8_t SECRET[SECRET_SIZE] = {
+        0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+        0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+        0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+        0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+        0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+        0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+        0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+        0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+        0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+        0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+        0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+        0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct Product {
+    uint64_t low;
+    uint64_t high;
+};
+
+Product multiply(uint64_t left, uint64_t right) {
+#if defined(__SIZEOF_INT128__)
+    auto product = static_cast<unsigned __int128>(left) * right;
+    return {static_cast<uint64_t>(product), static_cast<uint64_t>(product >> 64)};
+#elif defined(_MSC_VER) && defined(_M_X64)
+    Product product;
+    product.low = _umul128(left, right, &product.high);
+    return product;
+#else
+    uint64_t lo_lo = (left & 0xFFFFFFFF) * (right & 0xFFFFFFFF);
+    uint64_t hi_lo = (left >> 32) * (right & 0xFFFFFFFF);
+    uint64_t lo_hi = (left & 0xFFFFFFFF) * (right >> 32);
+    uint64_t hi_hi = (left >> 32) * (right >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    return {(cross << 32) | (lo_lo & 0xFFFFFFFF), hi_hi + (hi_lo >> 32) + (cross >> 32)};
+#endif
+}
+
+uint64_t multiplyFold(uint64_t left, uint64_t right) {
+    auto product = multiply(left, right);
+    return product.low ^ product.high;
+}
+
+uint64_t xxh64Avalanche(uint64_t value) {
+    value ^= value >> 33;
+    value *= PRIME64_2;
+    value ^= value >> 29;
+    value *= PRIME64_3;
+    return value ^ (value >> 32);
+}
+
+uint64_t avalanche(uint64_t value) {
+    value ^= value >> 37;
+    value *= PRIME_MX1;
+    return value ^ (value >> 32);
+}
+
+uint64_t strongAvalanche(uint64_t value, uint64_t size) {
+    value ^= rotateLeft(value, 49) ^ rotateLeft(value, 24);
+    value *= PRIME_MX2;
+    value ^= (value >> 35) + size;
+    value *= PRIME_MX2;
+    return value ^ (value >> 28);
+}
+
+uint64_t mix16(const uint8_t *input, const uint8_t *secret) {
+    return multiplyFold(load<uint64_t>(input) ^ load<uint64_t>(secret),
+                        load<uint64_t>(input + 8) ^ load<uint64_t>(secret + 8));
+}
+
+void mix32(uint64_t &low, uint64_t &high, const uint8_t *first, const uint8_t *second, const uint8_t *secret) {
+    low += mix16(first, secret);
+    low ^= load<uint64_t>(second) + load<uint64_t>(second + 8);
+    high += mix16(second, secret + 16);
+    high ^= load<uint64_t>(first) + load<uint64_t>(first + 8);
+}
+
+uint64_t xxh3Short(const uint8_t *input, size_t size) {
+    if (size > 8) {
+        auto low = load<uint64_t>(input) ^ (load<uint64_t>(SECRET + 24) ^ load<uint64_t>(SECRET + 32));
+        auto high = load<uint64_t>(input + size - 8) ^ (load<uint64_t>(SECRET + 40) ^ load<uint64_t>(SECRET + 48));
+        return avalanche(size + byteSwap(low) + high + multiplyFold(low, high));
+    }
+    if (size >= 4) {
+        auto first = load<uint32_t>(input);
+        auto last = load<uint32_t>(input + size - 4);
+        auto keyed = (last + (static_cast<uint64_t>(first) << 32))
+                     ^ (load<uint64_t>(SECRET + 8) ^ load<uint64_t>(SECRET + 16));
+        return strongAvalanche(keyed, size);
+    }
+    if (size) {
+        uint32_t combined = (static_cast<uint32_t>(input[0]) << 16) | (static_cast<uint32_t>(input[size >> 1]) << 24)
+                            | input[size - 1] | (static_cast<uint32_t>(size) << 8);
+        return xxh64Avalanche(combined ^ (load<uint32_t>(SECRET) ^ load<uint32_t>(SECRET + 4)));
+    }
+    return xxh64Avalanche(load<uint64_t>(SECRET + 56) ^ load<uint64_t>(SECRET + 64));
+}
+
+uint64_t xxh3Medium(const uint8_t *input, size_t size) {
+    uint64_t acc = size * PRIME64_1;
+    if (size <= 128) {
+        if (size > 32) {
+            if (size > 64) {
+                if (size > 96) {
+                    acc += mix16(input + 48, SECRET + 96);
+                    acc += mix16(input + size - 64, SECRET + 112);
+                }
+                acc += mix16(input + 32, SECRET + 64);
+                acc += mix16(input + size - 48, SECRET + 80);
+            }
+            acc += mix16(input + 16, SECRET + 32);
+            acc += mix16(input + size - 32, SECRET + 48);
+        }
+        acc += mix16(input, SECRET);
+        acc += mix16(input + size - 16, SECRET + 16);
+        return avalanche(acc);
+    }
+
+    size_t rounds = size / 16;
+    for (size_t i = 0; i < 8; ++i) {
+        acc += mix16(input + 16 * i, SECRET + 16 * i);
+    }
+    acc = avalanche(acc);
+    for (size_t i = 8; i < rounds; ++i) {
+        acc += mix16(input + 16 * i, SECRET + 16 * (i - 8) + 3);
+    }
+    acc += mix16(input + size - 16, SECRET + SECRET_SIZE_MIN - 17);
+    return avalanche(acc);
+}
+
+Product xxh128Short(const uint8_t *input, size_t size) {
+    if (size > 8) {
+        auto low = load<uint64_t>(input);
+        auto high = load<uint64_t>(input + size - 8);
+        auto mixed = multiply(low ^ high ^ (load<uint64_t>(SECRET + 32) ^ load<uint64_t>(SECRET + 40)), PRIME64_1);
+        mixed.low += static_cast<uint64_t>(size - 1) << 54;
+        high ^= load<uint64_t>(SECRET + 48) ^ load<uint64_t>(SECRET + 56);
+        mixed.high += high + static_cast<uint64_t>(static_cast<uint32_t>(high)) * (PRIME32_2 - 1);
+        mixed.low ^= byteSwap(mixed.high);
+        auto result = multiply(mixed.low, PRIME64_2);
+        result.high += mixed.high * PRIME64_2;
+        return {avalanche(result.low), avalanche(result.high)};
+    }
+    if (size >= 4) {
+        auto first = load<uint32_t>(input);
+        auto last = load<uint32_t>(input + size - 4);
+        auto keyed = (first + (static_cast<uint64_t>(last) << 32))
+                     ^ (load<uint64_t>(SECRET + 16) ^ load<uint64_t>(SECRET + 24));
+        auto mixed = multiply(keyed, PRIME64_1 + (static_cast<uint64_t>(size) << 2));
+        mixed.high += mixed.low << 1;
+        mixed.low ^= mixed.high >> 3;
+        mixed.low ^= mixed.low >> 35;
+        mixed.low *= PRIME_MX2;
+        mixed.low ^= mixed.low >> 28;
+        return {mixed.low, avalanche(mixed.high)};
+    }
+    if (size) {
+        uint32_t low = (static_cast<uint32_t>(input[0]) << 16) | (static_cast<uint32_t>(input[size >> 1]) << 24)
+                       | input[size - 1] | (static_cast<uint32_t>(size) << 8);
+        uint32_t swapped = byteSwap(low);
+        uint32_t high = (swapped << 13) | (swapped >> 19);
+        return {xxh64Avalanche(low ^ static_cast<uint64_t>(load<uint32_t>(SECRET) ^ load<uint32_t>(SECRET + 4))),
+                xxh64Avalanche(high ^ static_cast<uint64_t>(load<uint32_t>(SECRET + 8) ^ load<uint32_t>(SECRET + 12)))};
+    }
+    return {xxh64Avalanche(load<uint64_t>(SECRET + 64) ^ load<uint64_t>(SECRET + 72)),
+            xxh64Avalanche(load<uint64_t>(SECRET + 80) ^ load<uint64_t>(SECRET + 88))};
+}
+
+Product xxh128Medium(const uint8_t *input, size_t size) {
+    uint64_t low = size * PRIME64_1;
+    uint64_t high = 0;
+    if (size <= 128) {
+        if (size > 32) {
+            if (size > 64) {
+                if (size > 96) {
+                    mix32(low, high, input + 48, input + size - 64, SECRET + 96);
+                }
+                mix32(low, high, input + 32, input + size - 48, SECRET + 64);
+            }
+            mix32(low, high, input + 16, input + size - 32, SECRET + 32);
+        }
+        mix32(low, high, input, input + size - 16, SECRET);
+    } else {
+        size_t rounds = size / 32;
+        for (size_t i = 0; i < 4; ++i) {
+            mix32(low, high, input + 32 * i, input + 32 * i + 16, SECRET + 32 * i);
+        }
+        low = avalanche(low);
+        high = avalanche(high);
+        for (size_t i = 4; i < rounds; ++i) {
+            mix32(low, high, input + 32 * i, input + 32 * i + 16, SECRET + 3 + 32 * (i - 4));
+        }
+        mix32(low, high, input + size - 16, input + size - 32, SECRET + SECRET_SIZE_MIN - 17 - 16);
+    }
+    return {avalanche(low + high), 0 - avalanche(low * PRIME64_1 + high * PRIME64_4 + size * PRIME64_2)};
+}
+
+uint32_t xxh32Round(uint32_t acc, uint32_t input) {
+    return rotateLeft(acc + input * PRIME32_2, 13) * PRIME32_1;
+}
+
+// Eight accumulator lanes of the long input loop, held in registers while
+// stripes are consumed
+#ifdef ADDIN_SSE2
+
+class Lanes {
+public:
+    explicit Lanes(const uint64_t *acc) {
+        for (int i = 0; i < 4; ++i) {
+            lanes[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc) + i);
+        }
+    }
+
+    void store(uint64_t *acc) const {
+        for (int i = 0; i < 4; ++i) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(acc) + i, lanes[i]);
+        }
+    }
+
+    void accumulate(const uint8_t *input, const uint8_t *secret) {
+        for (int i = 0; i < 4; ++i) {
+            auto data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input) + i);
+            auto key = _mm_xor_si128(data, _mm_loadu_si128(reinterpret_cast<const __m128i *>(secret) + i));
+            auto product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+            auto swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[i] = _mm_add_epi64(product, _mm_add_epi64(lanes[i], swapped));
+        }
+    }
+
+    void scramble(const uint8_t *secret) {
+        auto prime = _mm_set1_epi32(static_cast<int>(PRIME32_1));
+        for (int i = 0; i < 4; ++i) {
+            auto data = _mm_xor_si128(lanes[i], _mm_srli_epi64(lanes[i], 47));
+            auto key = _mm_xor_si128(data, _mm_loadu_si128(reinterpret_cast<const __m128i *>(secret) + i));
+            auto low = _mm_mul_epu32(key, prime);
+            auto high = _mm_mul_epu32(_mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+            lanes[i] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+        }
+    }
+
+private:
+    __m128i lanes[4];
+};
+
+#else
+
+class Lanes {
+public:
+    explicit Lanes(const uint64_t *acc) {
+        memcpy(lanes, acc, sizeof(lanes));
+    }
+
+    void store(uint64_t *acc) const {
+        memcpy(acc, lanes, sizeof(lanes));
+    }
+
+    void accumulate(const uint8_t *input, const uint8_t *secret) {
+        for (int i = 0; i < 8; ++i) {
+            auto data = load<uint64_t>(input + 8 * i);
+            auto key = data ^ load<uint64_t>(secret + 8 * i);
+            lanes[i ^ 1] += data;
+            lanes[i] += (key & 0xFFFFFFFF) * (key >> 32);
+        }
+    }
+
+    void scramble(const uint8_t *secret) {
+        for (int i = 0; i < 8; ++i) {
+            auto value = lanes[i] ^ (lanes[i] >> 47) ^ load<uint64_t>(secret + 8 * i);
+            lanes[i] = value * PRIME32_1;
+        }
+    }
+
+private:
+    uint64_t lanes[8];
+};
+
+#endif
+
+// Consumes whole stripes, scrambling the accumulators after each block
+void accumulate(uint64_t *acc, size_t &block_stripes, const uint8_t *input, size_t count) {
+    Lanes lanes(acc);
+    for (; count; --count, input += STRIPE_SIZE) {
+        lanes.accumulate(input, SECRET + block_stripes * SECRET_CONSUME_RATE);
+        if (++block_stripes == BLOCK_STRIPES) {
+            lanes.scramble(SECRET + SECRET_SIZE - STRIPE_SIZE);
+            block_stripes = 0;
+        }
+    }
+    lanes.store(acc);
+}
+
+void accumulateLast(uint64_t *acc, const uint8_t *stripe) {
+    Lanes lanes(acc);
+    lanes.accumulate(stripe, SECRET + SECRET_SIZE - STRIPE_SIZE - SECRET_LASTACC_START);
+    lanes.store(acc);
+}
+
+uint64_t mergeAccumulators(const uint64_t *acc, const uint8_t *secret, uint64_t start) {
+    for (int i = 0; i < 4; ++i) {
+        start += multiplyFold(acc[2 * i] ^ load<uint64_t>(secret + 16 * i),
+                              acc[2 * i + 1] ^ load<uint64_t>(secret + 16 * i + 8));
+    }
+    return avalanche(start);
+}
+
+// SHA-256
+
+constexpr uint32_t SHA256_ROUNDS[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+constexpr uint32_t SHA256_INITIAL[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+uint32_t rotateRight(uint32_t value, int shift) {
+    return (value >> shift) | (value << (32 - shift));
+}
+
+void sha256Portable(uint32_t *state, const uint8_t *data, size_t blocks) {
+    for (; blocks; --blocks, data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = byteSwap(load<uint32_t>(data + 4 * i));
+        }
+        for (int i = 16; i < 64; ++i) {
+            auto s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            auto s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            auto t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25))
+                      + ((e & f) ^ (~e & g)) + SHA256_ROUNDS[i] + w[i];
+            auto t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef ADDIN_SSE2
+
+// Four rounds on message words of the group, with the message schedule of
+// later groups interleaved as the SHA extensions expect
+template<int GROUP>
+ADDIN_TARGET("sha,sse4.1")
+void sha256Rounds(__m128i (&message)[4], __m128i &abef, __m128i &cdgh, const uint8_t *block) {
+    constexpr auto current = GROUP % 4;
+    constexpr auto next = (GROUP + 1) % 4;
+    constexpr auto prev = (GROUP + 3) % 4;
+
+    if constexpr (GROUP < 4) {
+        auto order = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+        message[current] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block) + GROUP), order);
+    }
+
+    auto words = _mm_add_epi32(message[current],
+                               _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_ROUNDS) + GROUP));
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words);
+    if constexpr (GROUP >= 3 && GROUP < 15) {
+        message[next] = _mm_add_epi32(message[next], _mm_alignr_epi8(message[current], message[prev], 4));
+        message[next] = _mm_sha256msg2_epu32(message[next], message[current]);
+    }
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(words, 0x0E));
+    if constexpr (GROUP >= 1 && GROUP < 13) {
+        message[prev] = _mm_sha256msg1_epu32(message[prev], message[current]);
+    }
+}
+
+template<int... GROUPS>
+ADDIN_TARGET("sha,sse4.1")
+void sha256Block(__m128i &abef, __m128i &cdgh, const uint8_t *block, std::integer_sequence<int, GROUPS...>) {
+    __m128i message[4];
+    (sha256Rounds<GROUPS>(message, abef, cdgh, block), ...);
+}
+
+ADDIN_TARGET("sha,sse4.1")
+void sha256Extensions(uint32_t *state, const uint8_t *data, size_t blocks) {
+    // Extensions keep the state as ABEF and CDGH words
+    auto dcba = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0xB1);
+    auto hgfe = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state) + 1), 0x1B);
+    auto abef = _mm_alignr_epi8(dcba, hgfe, 8);
+    auto cdgh = _mm_blend_epi16(hgfe, dcba, 0xF0);
+
+    for (; blocks; --blocks, data += 64) {
+        auto abef_saved = abef;
+        auto cdgh_saved = cdgh;
+        sha256Block(abef, cdgh, data, std::make_integer_sequence<int, 16>());
+        abef = _mm_add_epi32(abef, abef_saved);
+        cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+    }
+
+    auto feba = _mm_shuffle_epi32(abef, 0x1B);
+    auto dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state) + 1, _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#elif defined(ADDIN_NEON)
+
+// Four rounds a step, the message schedule of later steps runs along
+ADDIN_TARGET(ADDIN_ARM_SHA2)
+void sha256Extensions(uint32_t *state, const uint8_t *data, size_t blocks) {
+    auto abcd = vld1q_u32(state);
+    auto efgh = vld1q_u32(state + 4);
+
+    for (; blocks; --blocks, data += 64) {
+        auto abcd_saved = abcd;
+        auto efgh_saved = efgh;
+        uint32x4_t message[4];
+        for (int i = 0; i < 4; ++i) {
+            message[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+        }
+        for (int group = 0; group < 16; ++group) {
+            auto &current = message[group % 4];
+            auto words = vaddq_u32(current, vld1q_u32(SHA256_ROUNDS + 4 * group));
+            if (group < 12) {
+                current = vsha256su1q_u32(vsha256su0q_u32(current, message[(group + 1) % 4]),
+                                          message[(group + 2) % 4], message[(group + 3) % 4]);
+            }
+            auto abcd_before = abcd;
+            abcd = vsha256hq_u32(abcd, efgh, words);
+            efgh = vsha256h2q_u32(efgh, abcd_before, words);
+        }
+        abcd = vaddq_u32(abcd, abcd_saved);
+        efgh = vaddq_u32(efgh, efgh_saved);
+    }
+
+    vst1q_u32(state, abcd);
+    vst1q_u32(state + 4, efgh);
+}
+
+#endif
+
+using BlocksFunction = void (*)(uint32_t *state, const uint8_t *data, size_t blocks);
+
+BlocksFunction selectSha256() {
+#if defined(ADDIN_SSE2)
+    if (cpuFeatures().sha) {
+        return sha256Extensions;
+    }
+#elif defined(ADDIN_NEON)
+    if (cpuFeatures().sha2) {
+        return sha256Extensions;
+    }
+#endif
+    return sha256Portable;
+}
+
+// Instructions of the CPU when it has them, selected at load
+const BlocksFunction sha256 = selectSha256();
+
+}
+
+void Crc32c::update(const char *data, size_t size) {
+    crc = crc32c(crc, reinterpret_cast<const uint8_t *>(data), size);
+}
+
+void Crc32c::finish(std::string &digest) {
+    appendBigEndian(digest, ~crc);
+}
+
+void Xxh32::update(const char *data, size_t size) {
+    auto input = reinterpret_cast<const uint8_t *>(data);
+    total += size;
+
+    if (buffered) {
+        auto fill = std::min(sizeof(buffer) - buffered, size);
+        memcpy(buffer + buffered, input, fill);
+        buffered += fill;
+        input += fill;
+        size -= fill;
+        if (buffered < sizeof(buffer)) {
+            return;
+        }
+        for (int i = 0; i < 4; ++i) {
+            acc[i] = xxh32Round(acc[i], load<uint32_t>(buffer + 4 * i));
+        }
+        buffered = 0;
+    }
+
+    // Separate lanes, as vectorizing them makes multiplications slower
+    if (size >= sizeof(buffer)) {
+        auto lane0 = acc[0], lane1 = acc[1], lane2 = acc[2], lane3 = acc[3];
+        for (; size >= sizeof(buffer); input += sizeof(buffer), size -= sizeof(buffer)) {
+            lane0 = xxh32Round(lane0, load<uint32_t>(input));
+            lane1 = xxh32Round(lane1, load<uint32_t>(input + 4));
+            lane2 = xxh32Round(lane2, load<uint32_t>(input + 8));
+            lane3 = xxh32Round(lane3, load<uint32_t>(input + 12));
+        }
+        acc[0] = lane0;
+        acc[1] = lane1;
+        acc[2] = lane2;
+        acc[3] = lane3;
+    }
+
+    memcpy(buffer, input, size);
+    buffered = size;
+}
+
+uint32_t Xxh32::digest() const {
+    uint32_t hash = total >= sizeof(buffer)
+                    ? rotateLeft(acc[0], 1) + rotateLeft(acc[1], 7) + rotateLeft(acc[2], 12) + rotateLeft(acc[3], 18)
+                    : PRIME32_5;
+    hash += static_cast<uint32_t>(total);
+
+    size_t i = 0;
+    for (; i + 4 <= buffered; i += 4) {
+        hash = rotateLeft(hash + load<uint32_t>(buffer + i) * PRIME32_3, 17) * PRIME32_4;
+    }
+    for (; i < buffered; ++i) {
+        hash = rotateLeft(hash + buffer[i] * PRIME32_5, 11) * PRIME32_1;
+    }
+
+    hash ^= hash >> 15;
+    hash *= PRIME32_2;
+    hash ^= hash >> 13;
+    hash *= PRIME32_3;
+    return hash ^ (hash >> 16);
+}
+
+Xxh3::Xxh3(bool wide_)
+        : wide(wide_),
+          acc{PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1} {
+}
+
+// Input is consumed only when more follows, so at least one byte is
+// buffered for the last stripe when finishing
+void Xxh3::update(const char *data, size_t size) {
+    auto input = reinterpret_cast<const uint8_t *>(data);
+    total += size;
+
+    if (buffered + size <= BUFFER_SIZE) {
+        memcpy(buffer + buffered, input, size);
+        buffered += size;
+        return;
+    }
+
+    if (buffered) {
+        auto fill = BUFFER_SIZE - buffered;
+        memcpy(buffer + buffered, input, fill);
+        input += fill;
+        size -= fill;
+        consume(buffer, BUFFER_SIZE / STRIPE_SIZE);
+        buffered = 0;
+    }
+
+    if (size > STRIPE_SIZE) {
+        auto count = (size - 1) / STRIPE_SIZE;
+        consume(input, count);
+        input += count * STRIPE_SIZE;
+        size -= count * STRIPE_SIZE;
+    }
+
+    memcpy(buffer, input, size);
+    buffered = size;
+}
+
+void Xxh3::consume(const uint8_t *stripes, size_t count) {
+    accumulate(acc, block_stripes, stripes, count);
+    memcpy(last_stripe, stripes + (count - 1) * STRIPE_SIZE, STRIPE_SIZE);
+}
+
+void Xxh3::finish(std::string &digest) {
+    if (total <= MID_SIZE_MAX) {
+        if (wide) {
+            auto hash = total <= 16 ? xxh128Short(buffer, buffered) : xxh128Medium(buffer, buffered);
+            appendBigEndian(digest, hash.high);
+            appendBigEndian(digest, hash.low);
+        } else {
+            appendBigEndian(digest, total <= 16 ? xxh3Short(buffer, buffered) : xxh3Medium(buffer, buffered));
+        }
+        return;
+    }
+
+    if (buffered >= STRIPE_SIZE) {
+        accumulate(acc, block_stripes, buffer, (buffered - 1) / STRIPE_SIZE);
+        accumulateLast(acc, buffer + buffered - STRIPE_SIZE);
+    } else {
+        uint8_t stripe[STRIPE_SIZE];
+        memcpy(stripe, last_stripe + buffered, STRIPE_SIZE - buffered);
+        memcpy(stripe + STRIPE_SIZE - buffered, buffer, buffered);
+        accumulateLast(acc, stripe);
+    }
+
+    auto low = mergeAccumulators(acc, SECRET + SECRET_MERGEACCS_START, total * PRIME64_1);
+    if (wide) {
+        auto high = mergeAccumulators(acc, SECRET + SECRET_SIZE - sizeof(acc) - SECRET_MERGEACCS_START,
+                                      ~(total * PRIME64_2));
+        appendBigEndian(digest, high);
+    }
+    appendBigEndian(digest, low);
+}
+
+Sha256::Sha256() {
+    memcpy(state, SHA256_INITIAL, sizeof(state));
+}
+
+void Sha256::update(const char *data, size_t size) {
+    auto input = reinterpret_cast<const uint8_t *>(data);
+    total += size;
+
+    if (buffered) {
+        auto fill = std::min(sizeof(buffer) - buffered, size);
+        memcpy(buffer + buffered, input, fill);
+        buffered += fill;
+        input += fill;
+        size -= fill;
+        if (buffered < sizeof(buffer)) {
+            return;
+        }
+        sha256(state, buffer, 1);
+        buffered = 0;
+    }
+
+    auto blocks = size / sizeof(buffer);
+    sha256(state, input, blocks);
+    input += blocks * sizeof(buffer);
+    size -= blocks * sizeof(buffer);
+
+    memcpy(buffer, input, size);
+    buffered = size;
+}
+
+void Sha256::finish(std::string &digest) {
+    auto bits = total * 8;
+    buffer[buffered++] = 0x80;
+    if (buffered > sizeof(buffer) - 8) {
+        memset(buffer + buffered, 0, sizeof(buffer) - buffered);
+        sha256(state, buffer, 1);
+        buffered = 0;
+    }
+    memset(buffer + buffered, 0, sizeof(buffer) - 8 - buffered);
+    for (int i = 0; i < 8; ++i) {
+        buffer[sizeof(buffer) - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+    sha256(state, buffer, 1);
+
+    for (auto word : state) {
+        appendBigEndian(digest, word);
+    }
+}
+
+Hasher::Hasher(Algorithm algorithm_) : kind(algorithm_), state(Crc32c()) {
+    switch (kind) {
+        case XXH3:
+        case XXH128:
+            state = Xxh3(kind == XXH128);
+            break;
+        case SHA256:
+            state = Sha256();
+            break;
+        default:
+            break;
+    }
+}
+
+void Hasher::update(const char *data, size_t size) {
+    std::visit([data, size](auto &hash) { hash.update(data, size); }, state);
+}
+
+void Hasher::finish(std::string &digest) {
+    std::visit([&digest](auto &hash) { hash.finish(digest); }, state);
+}
+
+int32_t HashRegistry::open(Hasher::Algorithm algorithm) {
+    hashers.emplace(++last_handle, Hasher(algorithm));
+    return last_handle;
+}
+
+Hasher &HashRegistry::hasher(int32_t handle) {
+    auto it = hashers.find(handle);
+    if (it == hashers.end()) {
+        throw std::runtime_error(u8"Hash is not open");
+    }
+    return it->second;
+}
+
+Hasher HashRegistry::take(int32_t handle) {
+    auto hash = hasher(handle);
+    hashers.erase(handle);
+    return hash;
+}
+
+void HashRegistry::clear() {
+    hashers.clear();
+}
@@ -0,0 +1,138 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HASHING_H
+#define HASHING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <variant>
+
+// Checksums and hashes computed over data given in chunks. Digests are
+// appended in their canonical big endian byte order.
+
+// CRC-32C (Castagnoli), with SSE4.2 or ARMv8 CRC instructions when the CPU has them
+class Crc32c {
+public:
+    void update(const char *data, size_t size);
+
+    void finish(std::string &digest);
+
+private:
+    uint32_t crc = 0xFFFFFFFF;
+};
+
+// XXH3 with the default secret and seed 0, 64 or 128 bit digest.
+// Gives the same results as the reference implementation for any chunking.
+class Xxh3 {
+public:
+    explicit Xxh3(bool wide_);
+
+    void update(const char *data, size_t size);
+
+    void finish(std::string &digest);
+
+private:
+    static constexpr size_t STRIPE_SIZE = 64;
+    static constexpr size_t BUFFER_SIZE = 4 * STRIPE_SIZE;
+
+    void consume(const uint8_t *stripes, size_t count);
+
+    bool wide;
+    uint64_t acc[8];
+    uint8_t buffer[BUFFER_SIZE];
+    uint8_t last_stripe[STRIPE_SIZE]; // Consumed bytes preceding the buffer
+    size_t buffered = 0;
+    size_t block_stripes = 0;
+    uint64_t total = 0;
+};
+
+// XXH32 with seed 0, checksum of LZ4 frames
+class Xxh32 {
+public:
+    void update(const char *data, size_t size);
+
+    uint32_t digest() const;
+
+private:
+    uint32_t acc[4] = {0x9E3779B1u + 0x85EBCA77u, 0x85EBCA77u, 0, 0u - 0x9E3779B1u};
+    uint8_t buffer[16];
+    size_t buffered = 0;
+    uint64_t total = 0;
+};
+
+// SHA-256, with x86 SHA or ARMv8 SHA2 instructions when the CPU has them
+class Sha256 {
+public:
+    Sha256();
+
+    void update(const char *data, size_t size);
+
+    void finish(std::string &digest);
+
+private:
+    uint32_t state[8];
+    uint8_t buffer[64];
+    size_t buffered = 0;
+    uint64_t total = 0;
+};
+
+class Hasher {
+public:
+    enum Algorithm {
+        CRC32C,
+        XXH3,
+        XXH128,
+        SHA256
+    };
+
+    explicit Hasher(Algorithm algorithm_);
+
+    Algorithm algorithm() const { return kind; }
+
+    void update(const char *data, size_t size);
+
+    void finish(std::string &digest);
+
+private:
+    Algorithm kind;
+    std::variant<Crc32c, Xxh3, Sha256> state;
+};
+
+// Hashing contexts opened by a component, by handle
+class HashRegistry {
+public:
+    int32_t open(Hasher::Algorithm algorithm);
+
+    // Throws when the handle is not open
+    Hasher &hasher(int32_t handle);
+
+    // Removes the context to be finished by the caller
+    Hasher take(int32_t handle);
+
+    void clear();
+
+private:
+    int32_t last_handle = 0;
+    std::map<int32_t, Hasher> hashers;
+};
+
+#endif //HASHING_H
@@ -0,0 +1,175 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef INSTANCEPOOL_H
+#define INSTANCEPOOL_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "Component.h"
+
+// Destroyed instances of one class kept for reuse, so the platform creating
+// and destroying objects at high rates skips construction and registration.
+//
+// Free list is a fixed array of slots claimed with compare and swap: no locks,
+// no ABA and no allocation. Instances beyond capacity are deleted. The fewest
+// pooled instances seen during an idle interval were not needed by anyone,
+// so that many are deleted on the first acquire or release after the interval ends.
+template<typename C, size_t Capacity>
+class InstancePool {
+public:
+    static constexpr std::chrono::steady_clock::duration IDLE_INTERVAL = std::chrono::seconds(10);
+
+    InstancePool() = default;
+
+    InstancePool(const InstancePool &) = delete;
+
+    InstancePool &operator=(const InstancePool &) = delete;
+
+    ~InstancePool();
+
+    // Pooled instance or a new one
+    C *acquire();
+
+    void release(C *instance);
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+    // Deletes every pooled instance
+    void clear();
+
+private:
+    C *take();
+
+    bool put(C *instance);
+
+    void trim();
+
+    std::array<std::atomic<C *>, Capacity> slots{};
+    // Not less than the number of pooled instances, so it never wraps
+    std::atomic<size_t> count{0};
+    std::atomic<size_t> low_watermark{0};
+    std::atomic<int64_t> interval_end{0};
+};
+
+// Construction policy reusing up to Capacity destroyed instances of a class
+template<size_t Capacity>
+struct PoolPolicy {
+    template<typename C>
+    static InstancePool<C, Capacity> &pool() {
+        static InstancePool<C, Capacity> instance;
+        return instance;
+    }
+
+    template<typename C>
+    static C *create() { return pool<C>().acquire(); }
+
+    template<typename C>
+    static void destroy(C *component) { pool<C>().release(component); }
+};
+
+template<typename C, size_t Capacity>
+InstancePool<C, Capacity>::~InstancePool() {
+    clear();
+}
+
+template<typename C, size_t Capacity>
+C *InstancePool<C, Capacity>::acquire() {
+    auto instance = take();
+    trim();
+    return instance ? instance : new C;
+}
+
+template<typename C, size_t Capacity>
+void InstancePool<C, Capacity>::release(C *instance) {
+    if (!instance->recycle() || !put(instance)) {
+        delete instance;
+    }
+    trim();
+}
+
+template<typename C, size_t Capacity>
+void InstancePool<C, Capacity>::clear() {
+    while (auto instance = take()) {
+        delete instance;
+    }
+}
+
+template<typename C, size_t Capacity>
+C *InstancePool<C, Capacity>::take() {
+    if (count.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+
+    for (auto &slot : slots) {
+        if (!slot.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        if (auto instance = slot.exchange(nullptr, std::memory_order_acquire)) {
+            auto pooled = count.fetch_sub(1, std::memory_order_relaxed) - 1;
+            auto low = low_watermark.load(std::memory_order_relaxed);
+            while (pooled < low && !low_watermark.compare_exchange_weak(low, pooled, std::memory_order_relaxed)) {
+            }
+            return instance;
+        }
+    }
+    return nullptr;
+}
+
+template<typename C, size_t Capacity>
+bool InstancePool<C, Capacity>::put(C *instance) {
+    count.fetch_add(1, std::memory_order_relaxed);
+
+    for (auto &slot : slots) {
+        C *expected = nullptr;
+        if (!slot.load(std::memory_order_relaxed) &&
+            slot.compare_exchange_strong(expected, instance, std::memory_order_release, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+
+    count.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+template<typename C, size_t Capacity>
+void InstancePool<C, Capacity>::trim() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    auto end = interval_end.load(std::memory_order_relaxed);
+    if (now < end || !interval_end.compare_exchange_strong(end, now + IDLE_INTERVAL.count(),
+                                                           std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Only the thread that started the new interval gets here
+    auto unused = low_watermark.exchange(count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    for (; unused > 0; --unused) {
+        auto instance = take();
+        if (!instance) {
+            break;
+        }
+        delete instance;
+    }
+}
+
+#endif //INSTANCEPOOL_H
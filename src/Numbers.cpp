@@ -0,0 +1,238 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <locale>
+#include <sstream>
+
+#include <types.h>
+
+#include "Numbers.h"
+
+namespace {
+
+// Floating point <charconv> is missing from older standard libraries, e.g. libc++ of Android NDK
+#ifdef __cpp_lib_to_chars
+constexpr bool FLOATING_CHARCONV = true;
+#else
+constexpr bool FLOATING_CHARCONV = false;
+#endif
+
+// Inputs longer than this are normalized to the heap
+constexpr size_t INLINE_SIZE = 64;
+
+// Units taken by a space at pos: ASCII space, tab, no-break space or narrow no-break space
+template<typename Char>
+size_t spaceLength(std::basic_string_view<Char> text, size_t pos) {
+    auto c = text[pos];
+    if (c == ' ' || c == '\t') {
+        return 1;
+    }
+    if constexpr (sizeof(Char) == 1) {
+        if (text.compare(pos, 2, "\xC2\xA0") == 0) {
+            return 2;
+        }
+        if (text.compare(pos, 3, "\xE2\x80\xAF") == 0) {
+            return 3;
+        }
+        return 0;
+    } else {
+        return c == 0xA0 || c == 0x202F ? 1 : 0;
+    }
+}
+
+template<typename Char>
+bool isDigit(Char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Rewrites 1C style number as from_chars input: drops group separators and "+",
+// replaces comma with point. Out must hold text.size() units, returns the size
+// or -1 when text is not a number.
+template<typename Char>
+ptrdiff_t normalize(std::basic_string_view<Char> text, char *out) {
+    size_t first = 0, last = text.size();
+    while (first < last) {
+        auto space = spaceLength(text, first);
+        if (!space) {
+            break;
+        }
+        first += space;
+    }
+    // Trailing spaces are checked after the number
+    auto begin = out;
+    if (first < last && (text[first] == '-' || text[first] == '+')) {
+        if (text[first++] == '-') {
+            *out++ = '-';
+        }
+    }
+
+    bool digits = false, point = false;
+    while (first < last) {
+        auto c = text[first];
+        if (isDigit(c)) {
+            *out++ = static_cast<char>(c);
+            digits = true;
+            ++first;
+        } else if ((c == '.' || c == ',') && !point) {
+            *out++ = '.';
+            point = true;
+            ++first;
+        } else if (auto space = spaceLength(text, first)) {
+            // Group separator is followed by a digit, anything else ends the number
+            if (point || !digits || first + space >= last || !isDigit(text[first + space])) {
+                break;
+            }
+            first += space;
+        } else {
+            break;
+        }
+    }
+    if (!digits) {
+        return -1;
+    }
+
+    if (first < last && (text[first] == 'e' || text[first] == 'E')) {
+        *out++ = 'e';
+        if (++first < last && (text[first] == '-' || text[first] == '+')) {
+            if (text[first++] == '-') {
+                *out++ = '-';
+            }
+        }
+        auto exponent = first;
+        while (first < last && isDigit(text[first])) {
+            *out++ = static_cast<char>(text[first++]);
+        }
+        if (first == exponent) {
+            return -1;
+        }
+    }
+
+    while (first < last) {
+        auto space = spaceLength(text, first);
+        if (!space) {
+            return -1;
+        }
+        first += space;
+    }
+    return out - begin;
+}
+
+template<typename T>
+bool parseNormalized(const char *first, const char *last, T &value) {
+#ifdef __cpp_lib_to_chars
+    auto result = std::from_chars(first, last, value);
+    return result.ec == std::errc() && result.ptr == last;
+#else
+    std::istringstream stream(std::string(first, last));
+    stream.imbue(std::locale::classic());
+    stream >> value;
+    return !stream.fail() && stream.peek() == std::char_traits<char>::eof() && std::isfinite(value);
+#endif
+}
+
+template<typename T>
+bool parseNormalizedNumber(const char *first, const char *last, T &value) {
+    if constexpr (std::is_integral<T>::value) {
+        // Plain integers are parsed as is, the rest must be whole numbers within range
+        if (std::all_of(first + (first < last && *first == '-'), last, isDigit<char>)) {
+            auto result = std::from_chars(first, last, value);
+            return result.ec == std::errc() && result.ptr == last;
+        }
+        double number = 0;
+        return parseNormalized(first, last, number) && exactCast(number, value);
+    } else {
+        return parseNormalized(first, last, value);
+    }
+}
+
+template<typename T, typename Char>
+bool parseText(std::basic_string_view<Char> text, T &value) {
+    if (text.size() <= INLINE_SIZE) {
+        char buffer[INLINE_SIZE];
+        auto size = normalize(text, buffer);
+        return size >= 0 && parseNormalizedNumber(buffer, buffer + size, value);
+    }
+    std::string buffer(text.size(), '\0');
+    auto size = normalize(text, &buffer[0]);
+    return size >= 0 && parseNormalizedNumber(buffer.data(), buffer.data() + size, value);
+}
+
+template<typename T>
+size_t formatText(T value, char *out) {
+    if constexpr (std::is_integral<T>::value || FLOATING_CHARCONV) {
+        return static_cast<size_t>(std::to_chars(out, out + NUMBER_SIZE, value).ptr - out);
+    } else {
+        // Shortest precision that survives the round trip
+        std::string text;
+        for (int precision = std::numeric_limits<T>::digits10; precision <= std::numeric_limits<T>::max_digits10;
+             ++precision) {
+            std::ostringstream stream;
+            stream.imbue(std::locale::classic());
+            stream.precision(precision);
+            stream << value;
+            text = stream.str();
+            T back = 0;
+            if (parseNormalized(text.data(), text.data() + text.size(), back) && back == value) {
+                break;
+            }
+        }
+        return text.copy(out, NUMBER_SIZE);
+    }
+}
+
+}
+
+template<typename T, typename Char>
+size_t formatNumber(T value, Char *out) {
+    char buffer[NUMBER_SIZE];
+    auto size = formatText(value, buffer);
+    std::copy(buffer, buffer + size, out);
+    return size;
+}
+
+template<typename T>
+void formatNumber(T value, std::string &out) {
+    char buffer[NUMBER_SIZE];
+    out.append(buffer, formatText(value, buffer));
+}
+
+template<typename T, typename Char>
+bool parseNumber(std::basic_string_view<Char> text, T &value) {
+    return parseText(text, value);
+}
+
+// Code units of UTF-8 strings, host strings and UTF-16 literals
+#define INSTANTIATE_NUMBERS(T) \
+    template size_t formatNumber(T, char *); \
+    template size_t formatNumber(T, char16_t *); \
+    template size_t formatNumber(T, WCHAR_T *); \
+    template void formatNumber(T, std::string &); \
+    template bool parseNumber(std::basic_string_view<char>, T &); \
+    template bool parseNumber(std::basic_string_view<char16_t>, T &); \
+    template bool parseNumber(std::basic_string_view<WCHAR_T>, T &);
+
+INSTANTIATE_NUMBERS(int32_t)
+INSTANTIATE_NUMBERS(int64_t)
+INSTANTIATE_NUMBERS(uint64_t)
+INSTANTIATE_NUMBERS(float)
+INSTANTIATE_NUMBERS(double)
@@ -0,0 +1,97 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NUMBERS_H
+#define NUMBERS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Numbers as text. Formatting gives the shortest text that parses back to
+// the same value, parsing accepts what 1C produces for numbers. Both work
+// on UTF-8 and UTF-16 code units alike, so numbers coming from or going to
+// the host never pass through an intermediate std::string.
+// Number types are int32_t, int64_t, uint64_t, float and double.
+
+// Enough for any formatted number, e.g. "-2.2250738585072014e-308"
+constexpr size_t NUMBER_SIZE = 32;
+
+// Writes at most NUMBER_SIZE units without terminating zero, returns the count
+template<typename T, typename Char>
+size_t formatNumber(T value, Char *out);
+
+// Appends to out, so a reused buffer does not allocate
+template<typename T>
+void formatNumber(T value, std::string &out);
+
+// Whole text must be a number: optional spaces around it, sign, digits
+// grouped by spaces or no-break spaces, point or comma as the decimal
+// separator and an exponent, e.g. "1 234,5" or "-1.5e3". Integers must
+// fit T without rounding, "1e3" and "5.0" are accepted.
+template<typename T, typename Char>
+bool parseNumber(std::basic_string_view<Char> text, T &value);
+
+// Converts when the value survives the conversion exactly, e.g. 2^53 + 1
+// does not fit double and 0.5 does not fit any integer. Infinities and NaN
+// convert between floating types only.
+template<typename To, typename From>
+bool exactCast(From value, To &result) {
+    static_assert(std::is_arithmetic<To>::value && std::is_arithmetic<From>::value, "Numbers only");
+
+    if constexpr (std::is_floating_point<From>::value) {
+        if constexpr (std::is_integral<To>::value) {
+            // Bounds are powers of two, exact in any floating type
+            constexpr From upper = static_cast<From>(std::numeric_limits<To>::max() / 2 + 1) * 2;
+            constexpr From lower = std::is_signed<To>::value ? -upper : From(0);
+            if (!(value >= lower && value < upper) || std::trunc(value) != value) {
+                return false;
+            }
+        } else if (std::isfinite(value) && (std::fabs(value) > std::numeric_limits<To>::max() ||
+                                            static_cast<From>(static_cast<To>(value)) != value)) {
+            return false;
+        }
+    } else if constexpr (std::is_integral<To>::value) {
+        if constexpr (std::is_signed<From>::value) {
+            if (value < 0 && (!std::is_signed<To>::value ||
+                              static_cast<int64_t>(value) < static_cast<int64_t>(std::numeric_limits<To>::min()))) {
+                return false;
+            }
+        }
+        if (value > 0 && static_cast<uint64_t>(value) > static_cast<uint64_t>(std::numeric_limits<To>::max())) {
+            return false;
+        }
+    } else {
+        // Integer to floating: rounding shows in the round trip, which must stay in range
+        constexpr To upper = static_cast<To>(std::numeric_limits<From>::max() / 2 + 1) * 2;
+        auto converted = static_cast<To>(value);
+        if (converted >= upper || static_cast<From>(converted) != value) {
+            return false;
+        }
+    }
+
+    result = static_cast<To>(value);
+    return true;
+}
+
+#endif //NUMBERS_H
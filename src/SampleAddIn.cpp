@@ -18,87 +18,164 @@
  */
 
 #include <chrono>
-#include <iomanip>
-#include <sstream>
+#include <cstring>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <thread>
 
+#include "Numbers.h"
 #include "SampleAddIn.h"
 
+namespace {
+
+// Integer of any width as int64_t, false for other types and unsigned values out of its range
+bool toInt64(const variant_t &value, int64_t &result) {
+    return std::visit(overloaded{
+            [&](int32_t v) { result = v; return true; },
+            [&](int64_t v) { result = v; return true; },
+            [&](uint64_t v) { return exactCast(v, result); },
+            [](const auto &) { return false; }
+    }, value);
+}
+
+bool isInteger(const variant_t &value) {
+    return std::holds_alternative<int32_t>(value) || std::holds_alternative<int64_t>(value)
+           || std::holds_alternative<uint64_t>(value);
+}
+
+double toDouble(const variant_t &value) {
+    return std::visit(overloaded{
+            [](int32_t v) { return static_cast<double>(v); },
+            [](int64_t v) { return static_cast<double>(v); },
+            [](uint64_t v) { return static_cast<double>(v); },
+            [](const auto &) { return 0.0; }
+    }, value);
+}
+
+}
+
 std::string SampleAddIn::extensionName() {
     return "Sample";
 }
 
-SampleAddIn::SampleAddIn() {
+// Method and property registration.
+// Tables are built during compilation: names are stored as UTF-16 literals
+// and looked up by a perfect hash, so instance construction does not depend
+// on their number. Lambdas as method handlers are not supported.
+constexpr auto SampleAddIn::methods() {
+    return makeMethods(
+            method<&SampleAddIn::add>(u"Add", u"Сложить"),
+            method<&SampleAddIn::message>(u"Message", u"Сообщить"),
+            method<&SampleAddIn::currentDate>(u"CurrentDate", u"ТекущаяДата"),
+            method<&SampleAddIn::assign>(u"Assign", u"Присвоить"),
+            method<&SampleAddIn::samplePropertyValue>(u"SamplePropertyValue", u"ЗначениеСвойстваОбразца"),
+            method<&SampleAddIn::notify>(u"Notify", u"Оповестить"),
+            method<&SampleAddIn::copySegment>(u"CopySegment", u"КопироватьСегмент"),
+            // Method with default arguments
+            method<&SampleAddIn::sleep>(u"Sleep", u"Ожидать", {{0, 5}}),
+            // Optional features, see Features.h
+            SegmentMethods::methods<&SampleAddIn::segments>(),
+            FileMethods::methods<&SampleAddIn::files>(),
+            FileMethods::csvMethods<&SampleAddIn::files>(),
+            CodecMethods::methods<&SampleAddIn::codecs>(),
+            HashMethods::methods<&SampleAddIn::hashes>(),
+            CompressionMethods::methods<&SampleAddIn::compression>()
+    );
+}
+
+// Getter and optional setter are member functions, getter may return
+// a reference to stable storage to avoid copying. Constant values are
+// encoded during compilation and copied to the host as is.
+constexpr auto SampleAddIn::properties() {
+    return makeProperties(
+            constant(u"Version", u"ВерсияКомпоненты", u"1.0.0")
+    );
+}
+
+SampleAddIn::SampleAddIn() : Component(staticRegistration<SampleAddIn>()) {
+    // Runtime registration is still available, e.g. for properties backed by storage.
     // Universal property. Could store any supported by native api type.
-    sample_property = std::make_shared<variant_t>();
+    // Safe to update from background threads while 1C reads it.
+    sample_property = std::make_shared<AtomicValue<variant_t>>();
     AddProperty(L"SampleProperty", L"ОбразецСвойства", sample_property);
 
-    // Full featured property registration example
-    AddProperty(L"Version", L"ВерсияКомпоненты", [&]() {
-        auto s = std::string(Version);
-        return std::make_shared<variant_t>(std::move(s));
-    });
-
-    // Method registration.
-    // Lambdas as method handlers are not supported.
-    AddMethod(L"Add", L"Сложить", this, &SampleAddIn::add);
-    AddMethod(L"Message", L"Сообщить", this, &SampleAddIn::message);
-    AddMethod(L"CurrentDate", L"ТекущаяДата", this, &SampleAddIn::currentDate);
-    AddMethod(L"Assign", L"Присвоить", this, &SampleAddIn::assign);
-    AddMethod(L"SamplePropertyValue", L"ЗначениеСвойстваОбразца", this, &SampleAddIn::samplePropertyValue);
+    // Full featured runtime registration looks like
+    //        AddProperty(L"Version", L"ВерсияКомпоненты", [&](variant_t &scratch) -> const variant_t & {
+    //            scratch = std::string(u8"1.0.0");
+    //            return scratch;
+    //        });
+    //        AddMethod(L"Sleep", L"Ожидать", this, &SampleAddIn::sleep, {{0, 5}});
+}
 
-    // Method registration with default arguments
-    //
-    // Notice that if variant_t would be non-copy you can't use initializer list.
-    // Proper way to register def args would be then:
-    //        std::map<long, variant_t> def_args;
-    //        def_args.insert({0, 5});
-    //        AddMethod(u"Sleep", u"Ожидать", this, &SampleAddIn::sleep, std::move(def_args));
-    //
-    AddMethod(L"Sleep", L"Ожидать", this, &SampleAddIn::sleep, {{0, 5}});
+// Runtime registration is kept by pooled instances, only values are cleared
+void SampleAddIn::reset() {
+    sample_property->store(UNDEFINED);
+}
 
+void SampleAddIn::shutdown() {
+    segments.clear();
+    files.clear();
+    codecs.clear();
+    hashes.clear();
+    compression.clear();
 }
 
 // Sample of addition method. Support both integer and string params.
-// Every exceptions derived from std::exceptions are handled by components API
-variant_t SampleAddIn::add(const variant_t &a, const variant_t &b) {
-    if (std::holds_alternative<int32_t>(a) && std::holds_alternative<int32_t>(b)) {
-        return std::get<int32_t>(a) + std::get<int32_t>(b);
+// Integers of mixed widths are added as int64_t, the sum of two int32_t stays
+// int32_t when it fits, and a sum out of int64_t range is returned as double.
+// Unsupported types are an expected failure, so it is returned rather than thrown.
+// Exceptions derived from std::exception are handled by components API as well.
+Expected<variant_t> SampleAddIn::add(const variant_t &a, const variant_t &b) {
+    if (isInteger(a) && isInteger(b)) {
+        int64_t x, y;
+        if (toInt64(a, x) && toInt64(b, y)
+            && (y >= 0 ? x <= std::numeric_limits<int64_t>::max() - y : x >= std::numeric_limits<int64_t>::min() - y)) {
+            int32_t sum;
+            if (std::holds_alternative<int32_t>(a) && std::holds_alternative<int32_t>(b) && exactCast(x + y, sum)) {
+                return sum;
+            }
+            return x + y;
+        }
+        return toDouble(a) + toDouble(b);
     } else if (std::holds_alternative<std::string>(a) && std::holds_alternative<std::string>(b)) {
         return std::string{std::get<std::string>(a) + std::get<std::string>(b)};
     } else {
-        throw std::runtime_error(u8"Неподдерживаемые типы данных");
+        return Error(u8"Неподдерживаемые типы данных");
     }
 }
 
 void SampleAddIn::message(const variant_t &msg) {
     std::visit(overloaded{
             [&](const std::string &v) { AddError(ADDIN_E_INFO, extensionName(), v, false); },
-            [&](const int32_t &v) {
-                AddError(ADDIN_E_INFO, extensionName(), std::to_string(static_cast<int>(v)), false);
+            [&](const auto &v) {
+                // Numbers of any width, shortest text that reads back as the same number
+                std::string text;
+                formatNumber(v, text);
+                AddError(ADDIN_E_INFO, extensionName(), text, false);
             },
-            [&](const double &v) { AddError(ADDIN_E_INFO, extensionName(), std::to_string(v), false); },
             [&](const bool &v) {
                 AddError(ADDIN_E_INFO, extensionName(), std::string(v ? u8"Истина" : u8"Ложь"), false);
             },
-            [&](const std::tm &v) {
-                std::ostringstream oss;
-                oss.imbue(std::locale("ru_RU.utf8"));
-                oss << std::put_time(&v, "%c");
-                AddError(ADDIN_E_INFO, extensionName(), oss.str(), false);
+            [&](const Timestamp &v) {
+                // Same as %c of ru_RU locale, the pattern is compiled once
+                static const DateFormat date_format(u8"%a %d %b %Y %H:%M:%S");
+                AddError(ADDIN_E_INFO, extensionName(), date_format.format(v), false);
             },
-            [&](const std::vector<char> &v) {},
+            [&](const Blob &v) {},
             [&](const std::monostate &) {}
     }, msg);
 }
 
-void SampleAddIn::sleep(const variant_t &delay) {
-    using namespace std;
-    // It safe to get any type from variant.
-    // Exceptions are handled by component API.
-    this_thread::sleep_for(chrono::seconds(get<int32_t>(delay)));
+// Typed parameters are bound by components API,
+// a value of another type is reported to 1C without exceptions
+void SampleAddIn::sleep(int32_t delay) {
+    std::this_thread::sleep_for(std::chrono::seconds(delay));
+}
+
+// Sends external event to 1C. It is handled by ExternalEvent procedure of the caller module
+void SampleAddIn::notify(const std::string &message, const std::string &data) {
+    ExternalEvent(extensionName(), message, data);
 }
 
 // Out params support option must be enabled for this to work
@@ -109,7 +186,19 @@ void SampleAddIn::assign(variant_t &out) {
 // Despite that you can return property value through method this is not recommended
 // due to unwanted data copying
 variant_t SampleAddIn::samplePropertyValue() {
-    return *sample_property;
+    return sample_property->load();
+}
+
+// Bulk data sample: copies a range between segments made by CreateSegment,
+// the host writes and reads them as files
+void SampleAddIn::copySegment(const std::string &source, int64_t source_offset,
+                              const std::string &target, int64_t target_offset, int64_t size) {
+    if (source_offset < 0 || target_offset < 0 || size < 0) {
+        throw std::out_of_range(u8"Range is out of segment");
+    }
+    auto src = segments.find(source);
+    auto dst = segments.find(target);
+    memmove(dst->at(target_offset, size), src->at(source_offset, size), size);
 }
 
 variant_t SampleAddIn::currentDate() {
@@ -21,29 +21,53 @@
 #define SAMPLEADDIN_H
 
 #include "Component.h"
+#include "Features.h"
+#include "InstancePool.h"
 
 class SampleAddIn final : public Component {
 public:
-    const char *Version = u8"1.0.0";
+    static constexpr char16_t CLASS_NAME[] = u"Sample";
+
+    // Destroyed instances are reused by the following GetClassObject calls
+    using ConstructionPolicy = PoolPolicy<64>;
 
     SampleAddIn();
 
+    // Compile time registration tables, defined in SampleAddIn.cpp
+    static constexpr auto methods();
+
+    static constexpr auto properties();
+
 private:
     std::string extensionName() override;
 
-    variant_t add(const variant_t &a, const variant_t &b);
+    void reset() override;
+
+    void shutdown() override;
+
+    Expected<variant_t> add(const variant_t &a, const variant_t &b);
 
     void message(const variant_t &msg);
 
-    void sleep(const variant_t &delay);
+    void sleep(int32_t delay);
+
+    void notify(const std::string &message, const std::string &data);
 
     void assign(variant_t &out);
 
+    void copySegment(const std::string &source, int64_t source_offset,
+                     const std::string &target, int64_t target_offset, int64_t size);
+
     variant_t samplePropertyValue();
 
     variant_t currentDate();
 
-    std::shared_ptr<variant_t> sample_property;
+    std::shared_ptr<AtomicValue<variant_t>> sample_property;
+    SegmentMethods segments;
+    FileMethods files;
+    CodecMethods codecs;
+    HashMethods hashes;
+    CompressionMethods compression;
 };
 
 #endif //SAMPLEADDIN_H
@@ -0,0 +1,236 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SharedMemory.h"
+
+namespace {
+
+std::atomic<uint64_t> segments_created{0};
+
+#ifdef _WINDOWS
+
+std::wstring toWide(const std::string &src) {
+    auto size = MultiByteToWideChar(CP_UTF8, 0, src.data(), static_cast<int>(src.size()), nullptr, 0);
+    std::wstring result(size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, src.data(), static_cast<int>(src.size()), &result[0], size);
+    return result;
+}
+
+std::string fromWide(const std::wstring &src) {
+    auto size = WideCharToMultiByte(CP_UTF8, 0, src.data(), static_cast<int>(src.size()),
+                                    nullptr, 0, nullptr, nullptr);
+    std::string result(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, src.data(), static_cast<int>(src.size()), &result[0], size, nullptr, nullptr);
+    return result;
+}
+
+std::string directory() {
+    wchar_t buffer[MAX_PATH + 1];
+    auto size = GetTempPathW(MAX_PATH + 1, buffer);
+    return fromWide(std::wstring(buffer, size));
+}
+
+unsigned long processId() {
+    return GetCurrentProcessId();
+}
+
+#else
+
+std::string directory() {
+    struct stat info{};
+    if (stat("/dev/shm", &info) == 0 && S_ISDIR(info.st_mode)) {
+        return "/dev/shm/";
+    }
+    auto tmp = getenv("TMPDIR");
+    return std::string(tmp && *tmp ? tmp : "/tmp") + "/";
+}
+
+unsigned long processId() {
+    return static_cast<unsigned long>(getpid());
+}
+
+#endif
+
+// Unique within the process, clock ticks separate processes reusing an id
+std::string segmentName() {
+    auto ticks = std::chrono::steady_clock::now().time_since_epoch().count();
+    return "addin-" + std::to_string(processId()) + "-" + std::to_string(ticks) + "-" +
+           std::to_string(segments_created.fetch_add(1, std::memory_order_relaxed)) + ".shm";
+}
+
+}
+
+#ifdef _WINDOWS
+
+SharedSegment::SharedSegment(uint64_t size) : file_path(directory() + segmentName()), length(size) {
+    file = CreateFileW(toWide(file_path).c_str(), GENERIC_READ | GENERIC_WRITE,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                       CREATE_NEW, FILE_ATTRIBUTE_TEMPORARY, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        throw std::runtime_error(u8"Failed to create segment file");
+    }
+
+    if (size == 0) {
+        return;
+    }
+
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                 static_cast<DWORD>(size), nullptr);
+    view = mapping ? static_cast<char *>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0)) : nullptr;
+    if (!view) {
+        close();
+        throw std::runtime_error(u8"Failed to map segment file");
+    }
+}
+
+SharedSegment::~SharedSegment() {
+    close();
+}
+
+void SharedSegment::close() {
+    if (view) {
+        UnmapViewOfFile(view);
+        view = nullptr;
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+    if (file) {
+        CloseHandle(file);
+        file = nullptr;
+        // Fails while the host keeps the file open, it stays in the temporary directory then
+        DeleteFileW(toWide(file_path).c_str());
+    }
+}
+
+#else
+
+SharedSegment::SharedSegment(uint64_t size) : file_path(directory() + segmentName()), length(size) {
+    file = open(file_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (file < 0) {
+        throw std::runtime_error(u8"Failed to create segment file");
+    }
+
+    if (size == 0) {
+        return;
+    }
+
+    if (ftruncate(file, static_cast<off_t>(size)) != 0) {
+        close();
+        throw std::runtime_error(u8"Failed to resize segment file");
+    }
+
+    auto address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (address == MAP_FAILED) {
+        close();
+        throw std::runtime_error(u8"Failed to map segment file");
+    }
+    view = static_cast<char *>(address);
+}
+
+SharedSegment::~SharedSegment() {
+    close();
+}
+
+void SharedSegment::close() {
+    if (view) {
+        munmap(view, length);
+        view = nullptr;
+    }
+    if (file >= 0) {
+        ::close(file);
+        file = -1;
+        unlink(file_path.c_str());
+    }
+}
+
+#endif
+
+char *SharedSegment::at(uint64_t offset, uint64_t size) {
+    if (offset > length || size > length - offset) {
+        throw std::out_of_range(u8"Range is out of segment");
+    }
+    return view + offset;
+}
+
+std::string SegmentRegistry::create(uint64_t size) {
+    auto segment = std::make_shared<SharedSegment>(size);
+    auto path = segment->path();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.emplace(path, Entry{std::move(segment), 1});
+    return path;
+}
+
+void SegmentRegistry::retain(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++entry(path).references;
+}
+
+void SegmentRegistry::release(const std::string &path) {
+    std::shared_ptr<SharedSegment> last;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &found = entry(path);
+        if (--found.references > 0) {
+            return;
+        }
+        // Unmapped outside of the lock, unless a handler still holds it
+        last = std::move(found.segment);
+        entries.erase(path);
+    }
+}
+
+std::shared_ptr<SharedSegment> SegmentRegistry::find(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entry(path).segment;
+}
+
+void SegmentRegistry::clear() {
+    std::map<std::string, Entry> removed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        removed.swap(entries);
+    }
+}
+
+SegmentRegistry::Entry &SegmentRegistry::entry(const std::string &path) {
+    auto it = entries.find(path);
+    if (it == entries.end()) {
+        throw std::runtime_error(u8"Segment not found");
+    }
+    return it->second;
+}
@@ -0,0 +1,97 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SHAREDMEMORY_H
+#define SHAREDMEMORY_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Memory mapped file in /dev/shm or the temporary directory. The host opens
+// the same file by path, so bulk data crosses the add-in boundary without
+// IMemoryManager copies and without the 4 GB limit of BLOB length.
+class SharedSegment {
+public:
+    // Creates a new zero filled file of the given size, throws on failure
+    explicit SharedSegment(uint64_t size);
+
+    SharedSegment(const SharedSegment &) = delete;
+
+    SharedSegment &operator=(const SharedSegment &) = delete;
+
+    // Unmaps and removes the file
+    ~SharedSegment();
+
+    // UTF-8 path, also the segment name in component methods
+    const std::string &path() const { return file_path; }
+
+    uint64_t size() const { return length; }
+
+    char *data() { return view; }
+
+    // Range of the segment, throws std::out_of_range when it doesn't fit
+    char *at(uint64_t offset, uint64_t size);
+
+private:
+    // Unmaps and removes the file, also undoes a failed constructor
+    void close();
+
+    std::string file_path;
+    uint64_t length;
+    char *view = nullptr;
+#ifdef _WINDOWS
+    void *file = nullptr;
+    void *mapping = nullptr;
+#else
+    int file = -1;
+#endif
+};
+
+// Segments of a component by path. A segment is removed when its last
+// reference is released, or with all others by clear. Handlers holding
+// a segment keep it mapped until they return.
+class SegmentRegistry {
+public:
+    // Path of a new segment with one reference
+    std::string create(uint64_t size);
+
+    void retain(const std::string &path);
+
+    void release(const std::string &path);
+
+    std::shared_ptr<SharedSegment> find(const std::string &path);
+
+    void clear();
+
+private:
+    struct Entry {
+        std::shared_ptr<SharedSegment> segment;
+        uint64_t references;
+    };
+
+    Entry &entry(const std::string &path);
+
+    std::mutex mutex;
+    std::map<std::string, Entry> entries;
+};
+
+#endif //SHAREDMEMORY_H
@@ -0,0 +1,99 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <cstdint>
+
+#include "Simd.h"
+
+#if defined(ADDIN_SSE2) && !defined(_MSC_VER)
+#include <cpuid.h>
+#elif defined(ADDIN_NEON) && defined(__linux__)
+#include <sys/auxv.h>
+// Bits of AT_HWCAP, when headers of the C library lack them
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+
+namespace {
+
+#ifdef ADDIN_SSE2
+
+// Registers eax, ebx, ecx and edx of a cpuid leaf
+void cpuid(unsigned leaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    __cpuidex(reinterpret_cast<int *>(regs), static_cast<int>(leaf), 0);
+#else
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switches
+uint64_t enabledState() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t low, high;
+    __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    return uint64_t(high) << 32 | low;
+#endif
+}
+
+#endif
+
+CpuFeatures detectFeatures() {
+    CpuFeatures features;
+#ifdef ADDIN_SSE2
+    unsigned regs[4];
+    cpuid(0, regs);
+    auto max_leaf = regs[0];
+
+    cpuid(1, regs);
+    features.ssse3 = regs[2] & (1u << 9);
+    features.sse42 = regs[2] & (1u << 20);
+    auto sse41 = (regs[2] & (1u << 19)) != 0;
+    // XMM and YMM state saved, AVX present
+    auto avx = (regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) && (enabledState() & 6) == 6;
+
+    if (max_leaf >= 7) {
+        cpuid(7, regs);
+        features.avx2 = avx && (regs[1] & (1u << 5));
+        features.sha = sse41 && (regs[1] & (1u << 29));
+    }
+#elif defined(ADDIN_NEON) && defined(__linux__)
+    auto hwcap = getauxval(AT_HWCAP);
+    features.crc32 = hwcap & HWCAP_CRC32;
+    features.sha2 = hwcap & HWCAP_SHA2;
+#elif defined(ADDIN_NEON) && defined(__APPLE__)
+    // Every Apple arm64 CPU has them
+    features.crc32 = true;
+    features.sha2 = true;
+#endif
+    return features;
+}
+
+}
+
+const CpuFeatures &cpuFeatures() {
+    static const CpuFeatures features = detectFeatures();
+    return features;
+}
@@ -0,0 +1,86 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+// Vector instruction sets. SSE2 is part of every x86-64 target and NEON of
+// arm64, code uses them without checks. Later x86 sets and the CRC32 and
+// SHA2 extensions of arm64 are compiled into functions marked with
+// ADDIN_TARGET and called once cpuFeatures() reports them.
+// Code using them keeps a portable fallback.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ADDIN_SSE2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__)
+#define ADDIN_NEON
+#include <arm_acle.h>
+#include <arm_neon.h>
+#endif
+
+// Compiles a function for instruction sets beyond the target, e.g. "avx2".
+// MSVC takes intrinsics of any set anywhere.
+#if defined(__GNUC__) || defined(__clang__)
+#define ADDIN_TARGET(features) __attribute__((target(features)))
+#else
+#define ADDIN_TARGET(features)
+#endif
+
+// Extensions of arm64 as target attributes name them
+#ifdef __clang__
+#define ADDIN_ARM_CRC "crc"
+#define ADDIN_ARM_SHA2 "sha2"
+#else
+#define ADDIN_ARM_CRC "+crc"
+#define ADDIN_ARM_SHA2 "+crypto"
+#endif
+
+// Instruction sets of the running CPU beyond the target
+struct CpuFeatures {
+    bool ssse3 = false;
+    bool sse42 = false;
+    bool avx2 = false; // Also enabled by the OS for the upper halves of registers
+    bool sha = false; // Along with SSE4.1 its code needs
+    bool crc32 = false; // Of arm64
+    bool sha2 = false; // Of arm64
+};
+
+// Detected on the first call
+const CpuFeatures &cpuFeatures();
+
+#ifdef ADDIN_SSE2
+
+// Index of the lowest set bit of a non zero mask
+inline unsigned firstBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+#endif
+
+#endif //SIMD_H
@@ -0,0 +1,268 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <sstream>
+
+#include "Statistics.h"
+
+namespace {
+
+unsigned magnitude(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#else
+    unsigned result = 0;
+    while (value >>= 1) {
+        ++result;
+    }
+    return result;
+#endif
+}
+
+void atomicMax(std::atomic<uint64_t> &target, uint64_t value) {
+    auto current = target.load(std::memory_order_relaxed);
+    while (current < value && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+void appendEscaped(std::ostringstream &oss, const char *src) {
+    static constexpr char hex[] = "0123456789abcdef";
+    for (; *src; ++src) {
+        auto c = static_cast<unsigned char>(*src);
+        if (c == '"' || c == '\\') {
+            oss << '\\' << static_cast<char>(c);
+        } else if (c < 0x20) {
+            oss << "\\u00" << hex[c >> 4] << hex[c & 15];
+        } else {
+            oss << static_cast<char>(c);
+        }
+    }
+}
+
+}
+
+Statistics::~Statistics() {
+    clear();
+}
+
+void Statistics::setSlots(size_t count, Namer namer) {
+    clear();
+    slots_count = count;
+    slot_namer = std::move(namer);
+}
+
+void Statistics::clear() {
+    for (auto &s : shards) {
+        auto slots = s.exchange(nullptr);
+        if (!slots) {
+            continue;
+        }
+        for (size_t slot = 0; slot < slots_count; ++slot) {
+            delete slots[slot].load();
+        }
+        delete[] slots;
+    }
+}
+
+const char *Statistics::name(size_t slot) const {
+    return slot < slots_count ? slot_namer(slot) : "";
+}
+
+size_t Statistics::bucketIndex(uint64_t value) {
+    if (value < (1u << SUB_BITS)) {
+        return static_cast<size_t>(value);
+    }
+
+    auto m = magnitude(value);
+    if (m > MAX_MAGNITUDE) {
+        return BUCKETS - 1;
+    }
+
+    auto sub = (value >> (m - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+    return ((m - SUB_BITS + 1) << SUB_BITS) | sub;
+}
+
+// Upper bound of the bucket values
+uint64_t Statistics::bucketValue(size_t index) {
+    if (index < (1u << SUB_BITS)) {
+        return index;
+    }
+
+    auto m = (index >> SUB_BITS) + SUB_BITS - 1;
+    auto sub = index & ((1u << SUB_BITS) - 1);
+    return ((((1u << SUB_BITS) | sub) + 1) << (m - SUB_BITS)) - 1;
+}
+
+Statistics::Counters &Statistics::counters(size_t slot) {
+    static std::atomic<size_t> thread_counter{0};
+    static thread_local const size_t thread_index = thread_counter.fetch_add(1) % SHARDS;
+
+    auto slots = shards[thread_index].load(std::memory_order_acquire);
+    if (!slots) {
+        auto fresh = new std::atomic<Counters *>[slots_count]();
+        if (shards[thread_index].compare_exchange_strong(slots, fresh, std::memory_order_acq_rel)) {
+            slots = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+
+    auto result = slots[slot].load(std::memory_order_acquire);
+    if (!result) {
+        auto fresh = new Counters();
+        if (slots[slot].compare_exchange_strong(result, fresh, std::memory_order_acq_rel)) {
+            result = fresh;
+        } else {
+            delete fresh;
+        }
+    }
+    return *result;
+}
+
+void Statistics::record(size_t slot, const std::array<uint64_t, PHASES_COUNT> &phases_ns,
+                        uint64_t bytes_in, uint64_t bytes_out, bool error) {
+
+    if (slot >= slots_count) {
+        return;
+    }
+
+    auto &c = counters(slot);
+    c.calls.fetch_add(1, std::memory_order_relaxed);
+    if (error) {
+        c.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    c.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+    c.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < PHASES_COUNT; ++i) {
+        auto &h = c.phases[i];
+        h.sum.fetch_add(phases_ns[i], std::memory_order_relaxed);
+        atomicMax(h.max, phases_ns[i]);
+        h.buckets[bucketIndex(phases_ns[i])].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Statistics::reset() {
+    for (auto &s : shards) {
+        auto slots = s.load(std::memory_order_acquire);
+        if (!slots) {
+            continue;
+        }
+        for (size_t slot = 0; slot < slots_count; ++slot) {
+            auto counters = slots[slot].load(std::memory_order_acquire);
+            if (!counters) {
+                continue;
+            }
+            auto &c = *counters;
+            c.calls.store(0, std::memory_order_relaxed);
+            c.errors.store(0, std::memory_order_relaxed);
+            c.bytes_in.store(0, std::memory_order_relaxed);
+            c.bytes_out.store(0, std::memory_order_relaxed);
+            for (auto &h : c.phases) {
+                h.sum.store(0, std::memory_order_relaxed);
+                h.max.store(0, std::memory_order_relaxed);
+                for (auto &b : h.buckets) {
+                    b.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+}
+
+// {"Add":{"calls":1,"errors":0,"in":8,"out":4,"parse":[mean,p50,p99,p999,max],...},...}
+// All latencies are in nanoseconds.
+std::string Statistics::snapshot() const {
+    static constexpr const char *phase_names[PHASES_COUNT] = {"parse", "handler", "store"};
+
+    std::ostringstream oss;
+    oss << '{';
+
+    bool first = true;
+    for (size_t slot = 0; slot < slots_count; ++slot) {
+        uint64_t calls = 0, errors = 0, bytes_in = 0, bytes_out = 0;
+        std::array<uint64_t, PHASES_COUNT> sum{}, max{};
+        std::array<std::array<uint64_t, BUCKETS>, PHASES_COUNT> merged{};
+
+        for (auto &s : shards) {
+            auto slots = s.load(std::memory_order_acquire);
+            auto counters = slots ? slots[slot].load(std::memory_order_acquire) : nullptr;
+            if (!counters) {
+                continue;
+            }
+            auto &c = *counters;
+            calls += c.calls.load(std::memory_order_relaxed);
+            errors += c.errors.load(std::memory_order_relaxed);
+            bytes_in += c.bytes_in.load(std::memory_order_relaxed);
+            bytes_out += c.bytes_out.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < PHASES_COUNT; ++i) {
+                auto &h = c.phases[i];
+                sum[i] += h.sum.load(std::memory_order_relaxed);
+                max[i] = std::max(max[i], h.max.load(std::memory_order_relaxed));
+                for (size_t b = 0; b < BUCKETS; ++b) {
+                    merged[i][b] += h.buckets[b].load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        if (calls == 0) {
+            continue;
+        }
+
+        if (!first) {
+            oss << ',';
+        }
+        first = false;
+
+        oss << '"';
+        appendEscaped(oss, name(slot));
+        oss << "\":{\"calls\":" << calls << ",\"errors\":" << errors
+            << ",\"in\":" << bytes_in << ",\"out\":" << bytes_out;
+
+        for (size_t i = 0; i < PHASES_COUNT; ++i) {
+            uint64_t total = 0;
+            for (auto b : merged[i]) {
+                total += b;
+            }
+
+            auto percentile = [&](double q) -> uint64_t {
+                auto rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+                uint64_t seen = 0;
+                for (size_t b = 0; b < BUCKETS; ++b) {
+                    seen += merged[i][b];
+                    if (seen >= rank) {
+                        return std::min(bucketValue(b), max[i]);
+                    }
+                }
+                return max[i];
+            };
+
+            oss << ",\"" << phase_names[i] << "\":[";
+            if (total > 0) {
+                oss << sum[i] / total << ',' << percentile(0.5) << ','
+                    << percentile(0.99) << ',' << percentile(0.999) << ',' << max[i];
+            }
+            oss << ']';
+        }
+
+        oss << '}';
+    }
+
+    oss << '}';
+    return oss.str();
+}
@@ -0,0 +1,153 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Per method/property call statistics.
+// Every thread records into its own shard with relaxed atomic increments,
+// so recording never takes a lock. Shards are merged only on snapshot.
+// Counters of a slot are allocated on its first call within a shard,
+// so memory grows with methods in use rather than with registered ones.
+class Statistics {
+public:
+    enum Phase {
+        PARSE,
+        HANDLER,
+        STORE,
+        PHASES_COUNT
+    };
+
+    class Recorder;
+
+    Statistics() = default;
+
+    Statistics(const Statistics &) = delete;
+
+    Statistics &operator=(const Statistics &) = delete;
+
+    ~Statistics();
+
+    // Returns UTF-8 name of a slot, which must stay valid while slots are in use
+    using Namer = std::function<const char *(size_t slot)>;
+
+    // Must be called before any recording. Slots are methods followed by properties.
+    void setSlots(size_t count, Namer namer);
+
+    // Frees all counters, recording is possible again after setSlots
+    void clear();
+
+    void record(size_t slot, const std::array<uint64_t, PHASES_COUNT> &phases_ns,
+                uint64_t bytes_in, uint64_t bytes_out, bool error);
+
+    void reset();
+
+    const char *name(size_t slot) const;
+
+    // Compact JSON snapshot of all non-empty slots
+    std::string snapshot() const;
+
+private:
+    // Log-linear (HDR-style) histogram: 4 sub-buckets per power of two,
+    // exact below 4 ns, saturating at ~2^40 ns.
+    static constexpr unsigned SUB_BITS = 2;
+    static constexpr unsigned MAX_MAGNITUDE = 40;
+    static constexpr size_t BUCKETS = ((MAX_MAGNITUDE - SUB_BITS + 2) << SUB_BITS);
+    static constexpr size_t SHARDS = 16;
+
+    struct Histogram {
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets;
+    };
+
+    struct Counters {
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> bytes_in;
+        std::atomic<uint64_t> bytes_out;
+        std::array<Histogram, PHASES_COUNT> phases;
+    };
+
+    static size_t bucketIndex(uint64_t value);
+
+    static uint64_t bucketValue(size_t index);
+
+    Counters &counters(size_t slot);
+
+    size_t slots_count = 0;
+    Namer slot_namer;
+    std::array<std::atomic<std::atomic<Counters *> *>, SHARDS> shards{};
+};
+
+// Measures phases of a single call. Phases are switched in order,
+// the result is stored on destruction.
+class Statistics::Recorder {
+public:
+    Recorder(Statistics &statistics_, size_t slot_)
+            : statistics(statistics_), slot(slot_), last(clock::now()) {};
+
+    Recorder(const Recorder &) = delete;
+
+    Recorder &operator=(const Recorder &) = delete;
+
+    ~Recorder() {
+        next(PHASES_COUNT);
+        statistics.record(slot, phases, bytes_in, bytes_out, error);
+    }
+
+    // Closes current phase and starts the given one
+    void next(Phase phase) {
+        auto now = clock::now();
+        if (current < PHASES_COUNT) {
+            phases[current] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+        }
+        last = now;
+        current = phase;
+    }
+
+    void in(uint64_t bytes) { bytes_in += bytes; }
+
+    void out(uint64_t bytes) { bytes_out += bytes; }
+
+    void fail() { error = true; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    Statistics &statistics;
+    size_t slot;
+    clock::time_point last;
+    Phase current = PARSE;
+    std::array<uint64_t, PHASES_COUNT> phases{};
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    bool error = false;
+};
+
+#endif //STATISTICS_H
@@ -0,0 +1,206 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#include "Trace.h"
+
+std::atomic<int> Trace::users{0};
+std::mutex Trace::registry_mutex;
+std::vector<std::shared_ptr<Trace::Buffer>> Trace::registry;
+
+struct Trace::Event {
+    const char *name;
+    char phase;
+    char detail[31];
+    uint64_t ts;
+    uint64_t dur;
+    uint64_t id;
+};
+
+// Single producer ring. The owning thread is the only writer,
+// flush reads it concurrently and drops possibly overwritten entries.
+// The writer fills a slot before publishing the next head, so the slot
+// of the published head may be half written.
+struct Trace::Buffer {
+    static constexpr size_t CAPACITY = 1u << 14;
+
+    explicit Buffer(uint32_t tid_) : tid(tid_), events(new Event[CAPACITY]) {};
+
+    const uint32_t tid;
+    std::unique_ptr<Event[]> events;
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> flushed{0}; // Events before it are taken by a flush
+};
+
+namespace {
+
+void appendEscaped(std::string &out, const char *src) {
+    for (; *src; ++src) {
+        auto c = static_cast<unsigned char>(*src);
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(static_cast<char>(c));
+        } else if (c >= 0x20) {
+            out.push_back(static_cast<char>(c));
+        }
+    }
+}
+
+}
+
+void Trace::enable() {
+    users.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Trace::disable() {
+    users.fetch_sub(1, std::memory_order_relaxed);
+}
+
+uint64_t Trace::now() {
+    using namespace std::chrono;
+    static const auto origin = steady_clock::now();
+    return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now() - origin).count());
+}
+
+uint64_t Trace::flowBegin(const char *name) {
+    if (!enabled()) {
+        return 0;
+    }
+    static std::atomic<uint64_t> counter{0};
+    auto id = counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    write(Event{name, 's', {}, now(), 0, id});
+    return id;
+}
+
+void Trace::flowEnd(const char *name, uint64_t id) {
+    if (id && enabled()) {
+        write(Event{name, 'f', {}, now(), 0, id});
+    }
+}
+
+void Trace::write(const Event &event) {
+    static thread_local std::shared_ptr<Buffer> buffer;
+
+    if (!buffer) {
+        static std::atomic<uint32_t> threads{0};
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        buffer = std::make_shared<Buffer>(++threads);
+        registry.push_back(buffer);
+    }
+
+    auto head = buffer->head.load(std::memory_order_relaxed);
+    buffer->events[head % Buffer::CAPACITY] = event;
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::Scope::close() {
+    Event event{name, 'X', {}, start, now() - start, 0};
+    if (detail) {
+        strncpy(event.detail, detail, sizeof(event.detail) - 1);
+    }
+    write(event);
+}
+
+bool Trace::flush(const std::string &path) {
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        buffers = registry;
+    }
+
+    std::string out = "{\"traceEvents\":[";
+    bool first = true;
+
+    for (auto &buffer : buffers) {
+        auto head = buffer->head.load(std::memory_order_acquire);
+
+        // Concurrent flushes take disjoint ranges
+        auto from = buffer->flushed.load(std::memory_order_relaxed);
+        while (from < head && !buffer->flushed.compare_exchange_weak(from, head, std::memory_order_relaxed)) {}
+        if (from >= head) {
+            continue;
+        }
+        from = std::max(from, head > Buffer::CAPACITY ? head - Buffer::CAPACITY : 0);
+
+        std::vector<Event> events;
+        events.reserve(static_cast<size_t>(head - from));
+        for (auto i = from; i < head; ++i) {
+            events.push_back(buffer->events[i % Buffer::CAPACITY]);
+        }
+
+        // Entries the writer has lapped while copying are garbage, including
+        // the slot it may be writing now. The fence keeps copying before the check.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto after = buffer->head.load(std::memory_order_relaxed);
+        auto valid_from = after + 1 > Buffer::CAPACITY ? after + 1 - Buffer::CAPACITY : 0;
+
+        for (auto i = from; i < head; ++i) {
+            if (i < valid_from) {
+                continue;
+            }
+            auto &e = events[static_cast<size_t>(i - from)];
+
+            if (!first) {
+                out.push_back(',');
+            }
+            first = false;
+
+            out += "{\"name\":\"";
+            appendEscaped(out, e.name);
+            out += "\",\"ph\":\"";
+            out.push_back(e.phase);
+            out += "\",\"pid\":1,\"tid\":" + std::to_string(buffer->tid);
+            out += ",\"ts\":" + std::to_string(e.ts / 1000) + '.' + std::to_string(e.ts % 1000 + 1000).substr(1);
+
+            if (e.phase == 'X') {
+                out += ",\"dur\":" + std::to_string(e.dur / 1000) + '.' + std::to_string(e.dur % 1000 + 1000).substr(1);
+                if (e.detail[0]) {
+                    out += ",\"args\":{\"detail\":\"";
+                    appendEscaped(out, e.detail);
+                    out += "\"}";
+                }
+            } else {
+                out += ",\"cat\":\"flow\",\"id\":" + std::to_string(e.id);
+                if (e.phase == 'f') {
+                    out += ",\"bp\":\"e\"";
+                }
+            }
+            out.push_back('}');
+        }
+    }
+
+    out += "]}";
+
+    // Buffers of finished threads are referenced only by the registry
+    buffers.clear();
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.erase(std::remove_if(registry.begin(), registry.end(),
+                                      [](const std::shared_ptr<Buffer> &b) { return b.use_count() == 1; }),
+                       registry.end());
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << out;
+    return static_cast<bool>(file);
+}
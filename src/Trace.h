@@ -0,0 +1,97 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process wide event tracing in Chrome trace-event format.
+// Events are written to per-thread ring buffers and flushed to a JSON file
+// that can be opened in chrome://tracing or ui.perfetto.dev.
+// When no one has enabled tracing, every probe costs a single relaxed load.
+class Trace {
+public:
+    class Scope;
+
+    static bool enabled() { return users.load(std::memory_order_relaxed) > 0; }
+
+    // Enabling is reference counted, so several components may trace at once
+    static void enable();
+
+    static void disable();
+
+    // Flow events link a slice on one thread with a slice on another,
+    // e.g. task submission with its execution on a worker thread.
+    // Both ends are called within slices. Returns the id for flowEnd,
+    // 0 when tracing is disabled.
+    static uint64_t flowBegin(const char *name);
+
+    // Does nothing for flow 0
+    static void flowEnd(const char *name, uint64_t id);
+
+    // Writes all buffered events to path and drops them from buffers
+    static bool flush(const std::string &path);
+
+private:
+    friend class Scope;
+
+    struct Event;
+    struct Buffer;
+
+    static uint64_t now();
+
+    static void write(const Event &event);
+
+    static std::atomic<int> users;
+    static std::mutex registry_mutex;
+    static std::vector<std::shared_ptr<Buffer>> registry;
+};
+
+// Complete ("X") event covering the lifetime of the object.
+// Detail is copied into the buffer on close, so it only has to outlive the scope.
+class Trace::Scope {
+public:
+    explicit Scope(const char *name_, const char *detail_ = nullptr)
+            : name(enabled() ? name_ : nullptr), detail(detail_), start(name ? now() : 0) {};
+
+    Scope(const Scope &) = delete;
+
+    Scope &operator=(const Scope &) = delete;
+
+    ~Scope() {
+        if (name) {
+            close();
+        }
+    }
+
+private:
+    void close();
+
+    const char *name;
+    const char *detail;
+    uint64_t start;
+};
+
+#endif //TRACE_H
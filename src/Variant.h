@@ -0,0 +1,195 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VARIANT_H
+#define VARIANT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "DateTime.h"
+
+template<class... Ts>
+struct overloaded : Ts ... {
+    using Ts::operator()...;
+};
+template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+
+#define UNDEFINED std::monostate()
+
+// Byte buffer with small buffer optimization. Payloads up to INLINE_SIZE
+// bytes are kept inside the object, so short blobs cost no allocation and
+// the type stays as small as std::string.
+class Blob {
+public:
+    static constexpr size_t INLINE_SIZE = 3 * sizeof(void *);
+
+    Blob() = default;
+
+    // Refers to memory owned elsewhere, e.g. a Java direct buffer, so returning
+    // it from a handler copies the bytes to the host once. The memory must outlive
+    // the blob and blobs moved from it, copies always own their bytes.
+    static Blob borrow(char *src, size_t size) {
+        Blob result;
+        result.storage.heap = src;
+        result.length = size | BORROWED;
+        return result;
+    }
+
+    explicit Blob(size_t size, char fill = 0) {
+        allocate(size);
+        memset(data(), fill, size);
+    }
+
+    Blob(const char *src, size_t size) {
+        allocate(size);
+        if (size) {
+            memcpy(data(), src, size);
+        }
+    }
+
+    template<typename It, typename = std::enable_if_t<!std::is_integral_v<It>>>
+    Blob(It first, It last) {
+        allocate(static_cast<size_t>(std::distance(first, last)));
+        std::copy(first, last, data());
+    }
+
+    Blob(const std::vector<char> &src) : Blob(src.data(), src.size()) {};
+
+    Blob(const Blob &other) : Blob(other.data(), other.size()) {};
+
+    Blob(Blob &&other) noexcept { steal(other); }
+
+    Blob &operator=(const Blob &other) {
+        if (this != &other) {
+            Blob tmp(other);
+            release();
+            steal(tmp);
+        }
+        return *this;
+    }
+
+    Blob &operator=(Blob &&other) noexcept {
+        if (this != &other) {
+            release();
+            steal(other);
+        }
+        return *this;
+    }
+
+    ~Blob() { release(); }
+
+    size_t size() const { return length & ~BORROWED; }
+
+    bool empty() const { return size() == 0; }
+
+    bool borrowed() const { return (length & BORROWED) != 0; }
+
+    char *data() { return isInline() ? storage.buffer : storage.heap; }
+
+    const char *data() const { return isInline() ? storage.buffer : storage.heap; }
+
+    char *begin() { return data(); }
+
+    char *end() { return data() + size(); }
+
+    const char *begin() const { return data(); }
+
+    const char *end() const { return data() + size(); }
+
+    char &operator[](size_t i) { return data()[i]; }
+
+    const char &operator[](size_t i) const { return data()[i]; }
+
+    // Keeps existing bytes, new ones are zeroed
+    void resize(size_t size) {
+        if (size == this->size() && !borrowed()) {
+            return;
+        }
+        Blob tmp(size);
+        memcpy(tmp.data(), data(), size < this->size() ? size : this->size());
+        *this = std::move(tmp);
+    }
+
+    std::vector<char> toVector() const { return std::vector<char>(begin(), end()); }
+
+    bool operator==(const Blob &other) const {
+        return size() == other.size() && (empty() || memcmp(data(), other.data(), size()) == 0);
+    }
+
+    bool operator!=(const Blob &other) const { return !(*this == other); }
+
+private:
+    // Kept in the top bit of length, which makes borrowed blobs never inline
+    static constexpr size_t BORROWED = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+    bool isInline() const { return length <= INLINE_SIZE; }
+
+    void allocate(size_t size) {
+        if (size > INLINE_SIZE) {
+            storage.heap = new char[size];
+        }
+        length = size;
+    }
+
+    void release() {
+        if (!isInline() && !borrowed()) {
+            delete[] storage.heap;
+        }
+        length = 0;
+    }
+
+    void steal(Blob &other) {
+        memcpy(&storage, &other.storage, sizeof(storage));
+        length = other.length;
+        other.length = 0;
+    }
+
+    union {
+        char buffer[INLINE_SIZE];
+        char *heap;
+    } storage{};
+    size_t length = 0;
+};
+
+// Alternatives are kept small: the largest ones are std::string and Blob,
+// both with inline storage for short values, and the index fits one byte.
+// Integers keep the width the host passed: narrower ones widen to int32_t,
+// UI4 widens to int64_t, so no value changes on the way in or out.
+typedef std::variant<
+        std::monostate,
+        int32_t,
+        int64_t,
+        uint64_t,
+        float,
+        double,
+        bool,
+        std::string,
+        Timestamp,
+        Blob
+> variant_t;
+
+#endif //VARIANT_H
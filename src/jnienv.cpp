@@ -1,13 +1,131 @@
 #include <cstdlib>
+#include <stdexcept>
+
 #include "jnienv.h"
 
 static JavaVM *sJavaVM = nullptr;
 
+namespace {
+
+struct MemberDef {
+    JniClass owner;
+    const char *name;
+    const char *signature;
+    bool is_static;
+};
+
+// Order follows the enums in jnienv.h
+constexpr const char *class_defs[] = {
+        "java/lang/String",
+        "java/lang/Thread",
+        "android/os/Build$VERSION",
+        "java/nio/Buffer"
+};
+
+constexpr MemberDef method_defs[] = {
+        {JniClass::THREAD, "currentThread", "()Ljava/lang/Thread;", true},
+        {JniClass::THREAD, "getName", "()Ljava/lang/String;", false},
+        {JniClass::BUFFER, "position", "()I", false},
+        {JniClass::BUFFER, "limit", "()I", false}
+};
+
+constexpr MemberDef field_defs[] = {
+        {JniClass::BUILD_VERSION, "SDK_INT", "I", true}
+};
+
+static_assert(sizeof(class_defs) / sizeof(class_defs[0]) == static_cast<size_t>(JniClass::COUNT),
+              "Class definitions do not match JniClass");
+static_assert(sizeof(method_defs) / sizeof(method_defs[0]) == static_cast<size_t>(JniMethod::COUNT),
+              "Method definitions do not match JniMethod");
+static_assert(sizeof(field_defs) / sizeof(field_defs[0]) == static_cast<size_t>(JniField::COUNT),
+              "Field definitions do not match JniField");
+
+jclass classes[static_cast<size_t>(JniClass::COUNT)] = {};
+jmethodID methods[static_cast<size_t>(JniMethod::COUNT)] = {};
+jfieldID fields[static_cast<size_t>(JniField::COUNT)] = {};
+
+// Threads attached here are detached when they exit, as ART requires
+struct ThreadEnv {
+    ~ThreadEnv() {
+        if (attached && sJavaVM) {
+            sJavaVM->DetachCurrentThread();
+        }
+    }
+
+    JNIEnv *env = nullptr;
+    bool attached = false;
+};
+
+thread_local ThreadEnv thread_env;
+
+// Failed lookups leave a pending exception, which must be cleared before the next JNI call
+template<typename T>
+T checked(JNIEnv *env, T result) {
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        return nullptr;
+    }
+    return result;
+}
+
+void resolve(JNIEnv *env) {
+    for (size_t i = 0; i < static_cast<size_t>(JniClass::COUNT); ++i) {
+        auto local = checked(env, env->FindClass(class_defs[i]));
+        if (local) {
+            classes[i] = static_cast<jclass>(env->NewGlobalRef(local));
+            env->DeleteLocalRef(local);
+        }
+    }
+
+    for (size_t i = 0; i < static_cast<size_t>(JniMethod::COUNT); ++i) {
+        auto &def = method_defs[i];
+        auto cls = classes[static_cast<size_t>(def.owner)];
+        if (cls) {
+            methods[i] = checked(env, def.is_static ? env->GetStaticMethodID(cls, def.name, def.signature)
+                                                    : env->GetMethodID(cls, def.name, def.signature));
+        }
+    }
+
+    for (size_t i = 0; i < static_cast<size_t>(JniField::COUNT); ++i) {
+        auto &def = field_defs[i];
+        auto cls = classes[static_cast<size_t>(def.owner)];
+        if (cls) {
+            fields[i] = checked(env, def.is_static ? env->GetStaticFieldID(cls, def.name, def.signature)
+                                                   : env->GetFieldID(cls, def.name, def.signature));
+        }
+    }
+}
+
+void release(JNIEnv *env) {
+    for (auto &cls : classes) {
+        if (cls) {
+            env->DeleteGlobalRef(cls);
+            cls = nullptr;
+        }
+    }
+    for (auto &method : methods) {
+        method = nullptr;
+    }
+    for (auto &field : fields) {
+        field = nullptr;
+    }
+}
+
+}
+
 JNIEnv *getJniEnv() {
+    if (!sJavaVM) {
+        return nullptr;
+    }
+    if (thread_env.env) {
+        return thread_env.env;
+    }
+
     JNIEnv *env = nullptr;
 
     switch (sJavaVM->GetEnv((void **) &env, JNI_VERSION_1_6)) {
         case JNI_OK:
+            // Attached by someone else, who may detach it at any time, so it is not cached
             return env;
 
         case JNI_EDETACHED: {
@@ -17,6 +135,8 @@ JNIEnv *getJniEnv() {
             args.version = JNI_VERSION_1_6;
 
             if (!sJavaVM->AttachCurrentThreadAsDaemon(&env, &args)) {
+                thread_env.env = env;
+                thread_env.attached = true;
                 return env;
             }
             break;
@@ -26,11 +146,100 @@ JNIEnv *getJniEnv() {
     return nullptr;
 };
 
-extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *aJavaVM, void *aReserved) {
+jclass getJniClass(JniClass id) {
+    return classes[static_cast<size_t>(id)];
+}
+
+jmethodID getJniMethod(JniMethod id) {
+    return methods[static_cast<size_t>(id)];
+}
+
+jfieldID getJniField(JniField id) {
+    return fields[static_cast<size_t>(id)];
+}
+
+Blob getDirectBuffer(JNIEnv *env, jobject buffer) {
+    auto address = static_cast<char *>(env->GetDirectBufferAddress(buffer));
+    auto position_id = getJniMethod(JniMethod::BUFFER_POSITION);
+    auto limit_id = getJniMethod(JniMethod::BUFFER_LIMIT);
+    if (!address || !position_id || !limit_id) {
+        return Blob();
+    }
+
+    auto position = env->CallIntMethod(buffer, position_id);
+    auto limit = env->CallIntMethod(buffer, limit_id);
+    if (env->ExceptionCheck()) {
+        env->ExceptionClear();
+        return Blob();
+    }
+
+    return Blob::borrow(address + position, static_cast<size_t>(limit - position));
+}
+
+JniBufferRing::JniBufferRing(size_t count_, size_t capacity)
+        : slots(new Slot[count_]), count(count_) {
+
+    auto env = getJniEnv();
+    if (!env) {
+        throw std::runtime_error(u8"JNI environment is not available");
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        auto &slot = slots[i];
+        slot.memory.reset(new char[capacity]);
+        auto local = env->NewDirectByteBuffer(slot.memory.get(), static_cast<jlong>(capacity));
+        if (!local) {
+            env->ExceptionClear();
+            releaseBuffers(env);
+            throw std::runtime_error(u8"Failed to create direct buffer");
+        }
+        slot.buffer = env->NewGlobalRef(local);
+        env->DeleteLocalRef(local);
+    }
+}
+
+JniBufferRing::~JniBufferRing() {
+    if (auto env = getJniEnv()) {
+        releaseBuffers(env);
+    }
+}
+
+void JniBufferRing::releaseBuffers(JNIEnv *env) {
+    for (size_t i = 0; i < count; ++i) {
+        if (slots[i].buffer) {
+            env->DeleteGlobalRef(slots[i].buffer);
+            slots[i].buffer = nullptr;
+        }
+    }
+}
+
+long JniBufferRing::acquire() {
+    auto start = next.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        auto index = (start + i) % count;
+        if (!slots[index].busy.exchange(true, std::memory_order_acquire)) {
+            return static_cast<long>(index);
+        }
+    }
+    return -1;
+}
+
+extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *aJavaVM, void * /*aReserved*/) {
     sJavaVM = aJavaVM;
+
+    JNIEnv *env = nullptr;
+    if (aJavaVM->GetEnv((void **) &env, JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+    resolve(env);
+
     return JNI_VERSION_1_6;
 }
 
-extern "C" JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *aJavaVM, void *aReserved) {
+extern "C" JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *aJavaVM, void * /*aReserved*/) {
+    JNIEnv *env = nullptr;
+    if (aJavaVM->GetEnv((void **) &env, JNI_VERSION_1_6) == JNI_OK) {
+        release(env);
+    }
     sJavaVM = nullptr;
-}
\ No newline at end of file
+}
@@ -1,8 +1,91 @@
 #ifndef JNIENV_H
 #define JNIENV_H
 
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
 #include <jni.h>
 
+#include "Variant.h"
+
+// Environment of the calling thread. Threads attached here are cached until they exit,
+// threads attached by someone else are looked up on every call.
 JNIEnv *getJniEnv();
 
-#endif //JNIENV_H
\ No newline at end of file
+// Java classes and members used by the component, listed in jnienv.cpp.
+// They are resolved once at JNI_OnLoad, where FindClass still sees the
+// application class loader, and kept as global references until JNI_OnUnload.
+// Entries that failed to resolve are nullptr.
+
+enum class JniClass : size_t {
+    STRING,
+    THREAD,
+    BUILD_VERSION,
+    BUFFER,
+    COUNT
+};
+
+enum class JniMethod : size_t {
+    THREAD_CURRENT_THREAD,
+    THREAD_GET_NAME,
+    BUFFER_POSITION,
+    BUFFER_LIMIT,
+    COUNT
+};
+
+enum class JniField : size_t {
+    BUILD_VERSION_SDK_INT,
+    COUNT
+};
+
+jclass getJniClass(JniClass id);
+
+jmethodID getJniMethod(JniMethod id);
+
+jfieldID getJniField(JniField id);
+
+// Bytes between position and limit of a direct java.nio.ByteBuffer, borrowed
+// without copying, so storing them to a tVariant copies once into host memory.
+// Valid while the buffer is referenced and not written, empty for heap buffers.
+Blob getDirectBuffer(JNIEnv *env, jobject buffer);
+
+// Direct buffers over native memory allocated once and handed to Java in turn,
+// so repeated transfers reuse the same memory instead of new Java arrays.
+// A buffer taken by acquire is skipped by others until released.
+class JniBufferRing {
+public:
+    JniBufferRing(size_t count, size_t capacity);
+
+    JniBufferRing(const JniBufferRing &) = delete;
+
+    JniBufferRing &operator=(const JniBufferRing &) = delete;
+
+    ~JniBufferRing();
+
+    // Index of the next free buffer or -1 when all are in use
+    long acquire();
+
+    // Global reference to pass to Java, which fills the buffer and flips it
+    jobject buffer(long index) const { return slots[index].buffer; }
+
+    // Filled part of the buffer, valid until release
+    Blob contents(JNIEnv *env, long index) const { return getDirectBuffer(env, slots[index].buffer); }
+
+    void release(long index) { slots[index].busy.store(false, std::memory_order_release); }
+
+private:
+    struct Slot {
+        std::unique_ptr<char[]> memory;
+        jobject buffer = nullptr;
+        std::atomic<bool> busy{false};
+    };
+
+    void releaseBuffers(JNIEnv *env);
+
+    std::unique_ptr<Slot[]> slots;
+    size_t count;
+    std::atomic<size_t> next{0};
+};
+
+#endif //JNIENV_H
@@ -0,0 +1,358 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "jnienv.h"
+
+extern "C" jint JNI_OnLoad(JavaVM *aJavaVM, void *aReserved);
+
+extern "C" void JNI_OnUnload(JavaVM *aJavaVM, void *aReserved);
+
+// jnienv.cpp against mock JNI function tables: a VM knowing a few classes
+// and methods, counting references and thread attachments.
+
+struct _jmethodID {
+    const char *name;
+};
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures; \
+        } \
+    } while (false)
+
+struct MockClass : _jclass {
+    explicit MockClass(const char *name_) : name(name_) {}
+
+    const char *name;
+};
+
+struct MockBuffer : _jobject {
+    char *address = nullptr;
+    jint position = 0;
+    jint limit = 0;
+    bool throws = false;
+};
+
+MockClass string_class("java/lang/String");
+MockClass thread_class("java/lang/Thread");
+MockClass buffer_class("java/nio/Buffer");
+MockClass *const known_classes[] = {&string_class, &thread_class, &buffer_class};
+
+_jmethodID known_methods[] = {{"currentThread"}, {"getName"}, {"position"}, {"limit"}};
+
+std::map<jobject, int> global_refs;
+int local_refs = 0;
+bool pending_exception = false;
+int buffers_before_failure = -1;
+std::vector<std::unique_ptr<MockBuffer>> created_buffers;
+
+std::atomic<int> get_env_calls{0};
+std::atomic<int> attaches{0};
+std::atomic<int> detaches{0};
+
+int globalRefs() {
+    int total = 0;
+    for (auto &ref : global_refs) {
+        total += ref.second;
+    }
+    return total;
+}
+
+jclass findClass(JNIEnv *, const char *name) {
+    for (auto cls : known_classes) {
+        if (std::strcmp(cls->name, name) == 0) {
+            ++local_refs;
+            return cls;
+        }
+    }
+    pending_exception = true;
+    return nullptr;
+}
+
+jobject newGlobalRef(JNIEnv *, jobject obj) {
+    ++global_refs[obj];
+    return obj;
+}
+
+void deleteGlobalRef(JNIEnv *, jobject obj) {
+    auto it = global_refs.find(obj);
+    if (it == global_refs.end() || it->second == 0) {
+        throw std::logic_error("Deleting a global reference that does not exist");
+    }
+    --it->second;
+}
+
+void deleteLocalRef(JNIEnv *, jobject) {
+    --local_refs;
+}
+
+jboolean exceptionCheck(JNIEnv *) {
+    return pending_exception ? JNI_TRUE : JNI_FALSE;
+}
+
+void exceptionClear(JNIEnv *) {
+    pending_exception = false;
+}
+
+jmethodID getMethodID(JNIEnv *, jclass, const char *name, const char *) {
+    for (auto &method : known_methods) {
+        if (std::strcmp(method.name, name) == 0) {
+            return &method;
+        }
+    }
+    pending_exception = true;
+    return nullptr;
+}
+
+jfieldID getFieldID(JNIEnv *, jclass, const char *, const char *) {
+    pending_exception = true;
+    return nullptr;
+}
+
+jint callIntMethodV(JNIEnv *, jobject obj, jmethodID method, va_list) {
+    auto buffer = static_cast<MockBuffer *>(obj);
+    if (buffer->throws) {
+        pending_exception = true;
+        return 0;
+    }
+    return std::strcmp(method->name, "position") == 0 ? buffer->position : buffer->limit;
+}
+
+jobject newDirectByteBuffer(JNIEnv *, void *address, jlong capacity) {
+    if (buffers_before_failure == 0) {
+        pending_exception = true;
+        return nullptr;
+    }
+    if (buffers_before_failure > 0) {
+        --buffers_before_failure;
+    }
+
+    created_buffers.emplace_back(new MockBuffer);
+    auto buffer = created_buffers.back().get();
+    buffer->address = static_cast<char *>(address);
+    buffer->limit = static_cast<jint>(capacity);
+    ++local_refs;
+    return buffer;
+}
+
+void *getDirectBufferAddress(JNIEnv *, jobject buf) {
+    return static_cast<MockBuffer *>(buf)->address;
+}
+
+const JNINativeInterface_ env_functions = {
+        findClass,
+        newGlobalRef,
+        deleteGlobalRef,
+        deleteLocalRef,
+        exceptionCheck,
+        exceptionClear,
+        getMethodID,
+        getMethodID,
+        getFieldID,
+        getFieldID,
+        callIntMethodV,
+        newDirectByteBuffer,
+        getDirectBufferAddress
+};
+
+JNIEnv mock_env{&env_functions};
+
+// Whether the VM considers the calling thread attached, by anyone
+thread_local bool thread_attached = false;
+
+jint detachCurrentThread(JavaVM *) {
+    ++detaches;
+    thread_attached = false;
+    return JNI_OK;
+}
+
+jint getEnv(JavaVM *, void **penv, jint) {
+    ++get_env_calls;
+    if (!thread_attached) {
+        *penv = nullptr;
+        return JNI_EDETACHED;
+    }
+    *penv = &mock_env;
+    return JNI_OK;
+}
+
+jint attachCurrentThreadAsDaemon(JavaVM *, JNIEnv **penv, void *) {
+    ++attaches;
+    thread_attached = true;
+    *penv = &mock_env;
+    return JNI_OK;
+}
+
+const JNIInvokeInterface_ vm_functions = {
+        detachCurrentThread,
+        getEnv,
+        attachCurrentThreadAsDaemon
+};
+
+JavaVM mock_vm{&vm_functions};
+
+void resetCounters() {
+    get_env_calls = 0;
+    attaches = 0;
+    detaches = 0;
+}
+
+// Classes missing on this VM resolve to nullptr with the exception cleared
+void testResolveRelease() {
+    CHECK(JNI_OnLoad(&mock_vm, nullptr) == JNI_VERSION_1_6);
+
+    CHECK(getJniClass(JniClass::STRING) == &string_class);
+    CHECK(getJniClass(JniClass::THREAD) == &thread_class);
+    CHECK(getJniClass(JniClass::BUFFER) == &buffer_class);
+    CHECK(getJniClass(JniClass::BUILD_VERSION) == nullptr);
+    CHECK(getJniMethod(JniMethod::THREAD_CURRENT_THREAD) == &known_methods[0]);
+    CHECK(getJniMethod(JniMethod::BUFFER_LIMIT) == &known_methods[3]);
+    CHECK(getJniField(JniField::BUILD_VERSION_SDK_INT) == nullptr);
+    CHECK(!pending_exception);
+    CHECK(local_refs == 0);
+    CHECK(globalRefs() == 3);
+
+    JNI_OnUnload(&mock_vm, nullptr);
+
+    CHECK(getJniClass(JniClass::STRING) == nullptr);
+    CHECK(getJniMethod(JniMethod::BUFFER_POSITION) == nullptr);
+    CHECK(globalRefs() == 0);
+    CHECK(getJniEnv() == nullptr);
+}
+
+// Threads attached by the library are cached and detached when they exit
+void testOwnAttach() {
+    resetCounters();
+    std::thread([]() {
+        CHECK(getJniEnv() == &mock_env);
+        CHECK(getJniEnv() == &mock_env);
+        CHECK(get_env_calls == 1);
+        CHECK(attaches == 1);
+    }).join();
+    CHECK(detaches == 1);
+}
+
+// Threads attached by someone else are neither cached nor detached
+void testForeignAttach() {
+    resetCounters();
+    std::thread([]() {
+        thread_attached = true;
+        CHECK(getJniEnv() == &mock_env);
+        CHECK(getJniEnv() == &mock_env);
+        CHECK(get_env_calls == 2);
+        CHECK(attaches == 0);
+
+        // The owner detaches, so the library attaches the thread itself
+        thread_attached = false;
+        CHECK(getJniEnv() == &mock_env);
+        CHECK(attaches == 1);
+    }).join();
+    CHECK(detaches == 1);
+}
+
+void testDirectBuffer() {
+    char data[] = "hello world";
+    MockBuffer buffer;
+    buffer.address = data;
+    buffer.position = 6;
+    buffer.limit = 11;
+
+    auto blob = getDirectBuffer(&mock_env, &buffer);
+    CHECK(std::string(blob.data(), blob.size()) == "world");
+    CHECK(blob.data() == data + 6);
+
+    buffer.throws = true;
+    CHECK(getDirectBuffer(&mock_env, &buffer).size() == 0);
+    CHECK(!pending_exception);
+
+    MockBuffer heap;
+    CHECK(getDirectBuffer(&mock_env, &heap).size() == 0);
+}
+
+void testBufferRing() {
+    auto refs = globalRefs();
+
+    {
+        JniBufferRing ring(2, 16);
+        CHECK(globalRefs() == refs + 2);
+        CHECK(local_refs == 0);
+
+        auto first = ring.acquire();
+        auto second = ring.acquire();
+        CHECK(first != second && first >= 0 && second >= 0);
+        CHECK(ring.acquire() == -1);
+        CHECK(ring.contents(&mock_env, first).size() == 16);
+
+        ring.release(first);
+        CHECK(ring.acquire() == first);
+    }
+    CHECK(globalRefs() == refs);
+
+    // Buffers created before the failure are released
+    buffers_before_failure = 2;
+    bool thrown = false;
+    try {
+        JniBufferRing ring(4, 16);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    buffers_before_failure = -1;
+    CHECK(thrown);
+    CHECK(!pending_exception);
+    CHECK(globalRefs() == refs);
+    CHECK(local_refs == 0);
+}
+
+}
+
+int main() {
+    thread_attached = true; // JNI_OnLoad runs on a Java thread
+
+    testResolveRelease();
+
+    CHECK(JNI_OnLoad(&mock_vm, nullptr) == JNI_VERSION_1_6);
+    testOwnAttach();
+    testForeignAttach();
+    testDirectBuffer();
+    testBufferRing();
+    JNI_OnUnload(&mock_vm, nullptr);
+
+    if (failures) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ *  Modern Native AddIn
+ *  Copyright (C) 2018  Infactum
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+// Subset of the JNI header used by jnienv.cpp, so it builds against mock
+// function tables without a JDK. Names and call shapes follow jni.h, the
+// table layout does not, nothing here is passed to a real VM.
+
+#ifndef JNI_H
+#define JNI_H
+
+#include <cstdarg>
+#include <cstdint>
+
+typedef int32_t jint;
+typedef int64_t jlong;
+typedef uint8_t jboolean;
+
+class _jobject {};
+class _jclass : public _jobject {};
+
+typedef _jobject *jobject;
+typedef _jclass *jclass;
+
+struct _jmethodID;
+struct _jfieldID;
+typedef _jmethodID *jmethodID;
+typedef _jfieldID *jfieldID;
+
+#define JNI_FALSE 0
+#define JNI_TRUE 1
+
+#define JNI_OK 0
+#define JNI_ERR (-1)
+#define JNI_EDETACHED (-2)
+
+#define JNI_VERSION_1_6 0x00010006
+
+#define JNIEXPORT
+#define JNICALL
+
+struct JNIEnv_;
+struct JavaVM_;
+typedef JNIEnv_ JNIEnv;
+typedef JavaVM_ JavaVM;
+
+struct JNINativeInterface_ {
+    jclass (*FindClass)(JNIEnv *env, const char *name);
+    jobject (*NewGlobalRef)(JNIEnv *env, jobject obj);
+    void (*DeleteGlobalRef)(JNIEnv *env, jobject obj);
+    void (*DeleteLocalRef)(JNIEnv *env, jobject obj);
+    jboolean (*ExceptionCheck)(JNIEnv *env);
+    void (*ExceptionClear)(JNIEnv *env);
+    jmethodID (*GetMethodID)(JNIEnv *env, jclass cls, const char *name, const char *sig);
+    jmethodID (*GetStaticMethodID)(JNIEnv *env, jclass cls, const char *name, const char *sig);
+    jfieldID (*GetFieldID)(JNIEnv *env, jclass cls, const char *name, const char *sig);
+    jfieldID (*GetStaticFieldID)(JNIEnv *env, jclass cls, const char *name, const char *sig);
+    jint (*CallIntMethodV)(JNIEnv *env, jobject obj, jmethodID methodID, va_list args);
+    jobject (*NewDirectByteBuffer)(JNIEnv *env, void *address, jlong capacity);
+    void *(*GetDirectBufferAddress)(JNIEnv *env, jobject buf);
+};
+
+struct JNIEnv_ {
+    const JNINativeInterface_ *functions;
+
+    jclass FindClass(const char *name) { return functions->FindClass(this, name); }
+
+    jobject NewGlobalRef(jobject obj) { return functions->NewGlobalRef(this, obj); }
+
+    void DeleteGlobalRef(jobject obj) { functions->DeleteGlobalRef(this, obj); }
+
+    void DeleteLocalRef(jobject obj) { functions->DeleteLocalRef(this, obj); }
+
+    jboolean ExceptionCheck() { return functions->ExceptionCheck(this); }
+
+    void ExceptionClear() { functions->ExceptionClear(this); }
+
+    jmethodID GetMethodID(jclass cls, const char *name, const char *sig) {
+        return functions->GetMethodID(this, cls, name, sig);
+    }
+
+    jmethodID GetStaticMethodID(jclass cls, const char *name, const char *sig) {
+        return functions->GetStaticMethodID(this, cls, name, sig);
+    }
+
+    jfieldID GetFieldID(jclass cls, const char *name, const char *sig) {
+        return functions->GetFieldID(this, cls, name, sig);
+    }
+
+    jfieldID GetStaticFieldID(jclass cls, const char *name, const char *sig) {
+        return functions->GetStaticFieldID(this, cls, name, sig);
+    }
+
+    jint CallIntMethod(jobject obj, jmethodID methodID, ...) {
+        va_list args;
+        va_start(args, methodID);
+        jint result = functions->CallIntMethodV(this, obj, methodID, args);
+        va_end(args);
+        return result;
+    }
+
+    jobject NewDirectByteBuffer(void *address, jlong capacity) {
+        return functions->NewDirectByteBuffer(this, address, capacity);
+    }
+
+    void *GetDirectBufferAddress(jobject buf) { return functions->GetDirectBufferAddress(this, buf); }
+};
+
+struct JavaVMAttachArgs {
+    jint version;
+    char *name;
+    jobject group;
+};
+
+struct JNIInvokeInterface_ {
+    jint (*DetachCurrentThread)(JavaVM *vm);
+    jint (*GetEnv)(JavaVM *vm, void **penv, jint version);
+    jint (*AttachCurrentThreadAsDaemon)(JavaVM *vm, JNIEnv **penv, void *args);
+};
+
+struct JavaVM_ {
+    const JNIInvokeInterface_ *functions;
+
+    jint DetachCurrentThread() { return functions->DetachCurrentThread(this); }
+
+    jint GetEnv(void **penv, jint version) { return functions->GetEnv(this, penv, version); }
+
+    jint AttachCurrentThreadAsDaemon(JNIEnv **penv, void *args) {
+        return functions->AttachCurrentThreadAsDaemon(this, penv, args);
+    }
+};
+
+#endif //JNI_H